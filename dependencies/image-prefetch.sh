@@ -0,0 +1,44 @@
+#!/bin/bash
+# Sashimono image prefetch script.
+# This is intended to be called by Sashimono agent to warm its image store before any instance needs the image.
+# Downloads the image from the registry into an archive in the docker save format without a docker daemon.
+
+image=$1
+tar_path=$2
+
+if [ -z "$image" ] || [ -z "$tar_path" ]; then
+    echo "INVALID_PARAMS,PREFETCH_ERR" && exit 1
+fi
+
+script_dir=$(dirname "$(realpath "$0")")
+docker_bin=$script_dir/dockerbin
+docker_img_dir=$docker_bin/images
+tmp_dir=$(mktemp -d)
+
+DOCKER_AUTH_URL="https://auth.docker.io/token?service=registry.docker.io&scope=repository:"
+DOCKER_REGISTRY_URL="https://registry-1.docker.io/v2/"
+
+function prefetch_error() {
+    rm -rf "$tmp_dir" "$tar_path"
+    echo "$1,PREFETCH_ERR"
+    exit 1
+}
+
+echo "Downloading image $image."
+"$docker_bin"/download-frozen-image-v2.sh "$tmp_dir" "$image" >/dev/null || prefetch_error "DOWNLOAD_ERR"
+tar -cf "$tar_path" -C "$tmp_dir" . || prefetch_error "ARCHIVE_ERR"
+rm -rf "$tmp_dir"
+
+# Record the image digest the same way user-assign.sh does, so the assignment uses the image loaded from the store
+# instead of pulling it again. The assignment pulls the image if the digest could not be recorded.
+image_repo=$(echo "$image" | cut -d':' -f1)
+image_version=$(echo "$image" | cut -s -d':' -f2)
+img_local_path=$docker_img_dir/$(echo "$image" | tr : -)
+TOKEN=$(curl -s "${DOCKER_AUTH_URL}${image_repo}:pull" | jq -r '.token') &&
+    IMAGE_DIGEST=$(curl -s --head -H "Authorization: Bearer $TOKEN" "${DOCKER_REGISTRY_URL}${image_repo}/manifests/${image_version:-latest}" | sed -n 's/.*[Dd]ocker-[Cc]ontent-[Dd]igest: \(sha256:[a-f0-9]*\).*/\1/p')
+if [ -n "$IMAGE_DIGEST" ]; then
+    mkdir -p "$img_local_path" && echo "$IMAGE_DIGEST" >"$img_local_path.tar.image_digest"
+fi
+
+echo "PREFETCH_SUC"
+exit 0
@@ -15,6 +15,12 @@ if [ ! -f "$saconfig" ]; then
     exit 1
 fi
 
+# On cgroup v2 the agent applies the limits to the user slices when it starts.
+if [ -f /sys/fs/cgroup/cgroup.controllers ]; then
+    echo "Cgroup v2 detected. Limits are applied by the agent."
+    exit 0
+fi
+
 # Calculate resources
 
 # Read config values
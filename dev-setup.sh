@@ -75,6 +75,7 @@ rm v2.0.0.tar.gz && sudo rm -r CLI11-2.0.0
 sudo apt-get install -y \
     libsodium-dev \
     sqlite3 libsqlite3-dev \
+    libsystemd-dev \
     libboost-stacktrace-dev \
     fuse3 \
     jq \
@@ -490,7 +490,7 @@ rm -r "$tmp"
         -out $SASHIMONO_DATA/contract_template/cfg/tlscert.pem -subj "/C=HP/CN=$(jq -r '.hp.host_address' $SASHIMONO_DATA/sa.cfg)"
 
 # Install Sashimono agent binaries into sashimono bin dir.
-cp "$script_dir"/{sagent,hpfs,user-cgcreate.sh,user-install.sh,dns_evernode.sh,user-uninstall.sh,docker-registry-uninstall.sh} $SASHIMONO_BIN
+cp "$script_dir"/{sagent,hpfs,user-cgcreate.sh,user-install.sh,user-assign.sh,image-prefetch.sh,dns_evernode.sh,user-uninstall.sh,docker-registry-uninstall.sh} $SASHIMONO_BIN
 chmod -R +x $SASHIMONO_BIN
 
 # Setup tls certs used for contract instance websockets.
@@ -578,17 +578,21 @@ fi
 
 stage "Configuring Sashimono services"
 
-cgrulesengd_service=$(cgrulesengd_servicename)
-[ -z "$cgrulesengd_service" ] && echo "cgroups rules engine service does not exist." && abort
-
-# Setting up cgroup rules with sashiusers group (if not already setup).
-echo "Creating cgroup rules..."
 ! grep -q $SASHIUSER_GROUP /etc/group && ! groupadd $SASHIUSER_GROUP && echo "$SASHIUSER_GROUP group creation failed." && abort
-if ! grep -q $SASHIUSER_GROUP /etc/cgrules.conf; then
-    ! echo "@$SASHIUSER_GROUP       cpu,memory              %u$CG_SUFFIX" >>/etc/cgrules.conf && echo "Cgroup rule creation failed." && abort
-    # Restart the service to apply the cgrules config.
-    echo "Restarting the '$cgrulesengd_service' service."
-    systemctl restart $cgrulesengd_service || abort
+
+# On cgroup v2 the agent applies the limits to the user slices itself, so the rules engine is only needed on v1.
+if [ ! -f /sys/fs/cgroup/cgroup.controllers ]; then
+    cgrulesengd_service=$(cgrulesengd_servicename)
+    [ -z "$cgrulesengd_service" ] && echo "cgroups rules engine service does not exist." && abort
+
+    # Setting up cgroup rules with sashiusers group (if not already setup).
+    echo "Creating cgroup rules..."
+    if ! grep -q $SASHIUSER_GROUP /etc/cgrules.conf; then
+        ! echo "@$SASHIUSER_GROUP       cpu,memory              %u$CG_SUFFIX" >>/etc/cgrules.conf && echo "Cgroup rule creation failed." && abort
+        # Restart the service to apply the cgrules config.
+        echo "Restarting the '$cgrulesengd_service' service."
+        systemctl restart $cgrulesengd_service || abort
+    fi
 fi
 
 # Install Sashimono Agent cgcreate service.
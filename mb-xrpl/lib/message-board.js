@@ -9,6 +9,9 @@ const path = require('path');
 const { UtilHelper } = require('./util-helper');
 
 const LEASE_ID_REG_EXP = /^[0-9A-F]{64}$/;
+const DESTROY_BATCH_SIZE = 16; // Well below the agent's batch limit (64) so other operations still fit in its queue.
+const DESTROY_BATCH_RETRIES = 3; // Items the agent was too busy to run are retried this many times.
+const DESTROY_BATCH_RETRY_DELAY = 10000; // In milliseconds.
 
 const LeaseStatus = {
     ACQUIRING: 'Acquiring',
@@ -299,6 +302,42 @@ class MessageBoard {
         this.#concurrencyQueue.processing = false;
     }
 
+    // Destroys the given instances in batches of DESTROY_BATCH_SIZE.
+    // Instances the agent was too busy to destroy are retried after a delay.
+    async #destroyOrphanInstances(containerNames) {
+        let pending = containerNames;
+        for (let attempt = 0; pending.length > 0; attempt++) {
+            const busy = [];
+            for (let i = 0; i < pending.length; i += DESTROY_BATCH_SIZE) {
+                const names = pending.slice(i, i + DESTROY_BATCH_SIZE);
+                try {
+                    const results = await this.sashiCli.destroyInstances(names);
+                    results.forEach((res, j) => {
+                        if (res.content === 'busy_error')
+                            busy.push(names[j]);
+                        else if (res.type === 'destroy_error')
+                            console.error(`Error pruning orphan instance ${names[j]}.`, res);
+                    });
+                }
+                catch (e) {
+                    console.error(e);
+                }
+            }
+
+            pending = busy;
+            if (pending.length === 0)
+                break;
+
+            if (attempt === DESTROY_BATCH_RETRIES) {
+                console.error(`Sashimono busy. Could not prune orphan instances ${pending.join(', ')}. They will be retried in the next prune.`);
+                break;
+            }
+
+            console.log(`Sashimono busy. Retrying to prune ${pending.length} orphan instances in ${DESTROY_BATCH_RETRY_DELAY} milliseconds.`);
+            await new Promise(resolve => setTimeout(resolve, DESTROY_BATCH_RETRY_DELAY));
+        }
+    }
+
     async #queueAction(action, maxAttempts = 5, delay = 0) {
         await this.#acquireConcurrencyQueue();
 
@@ -867,6 +906,7 @@ class MessageBoard {
 
         // Remove the instances which are orphan.
         // Only consider the older ones.
+        const orphanInstanceNames = [];
         for (const instance of instances.filter(i => (isStartup || i.time < timeMargin))) {
             try {
                 const leaseIndex = leases.findIndex(l => l.container_name === instance.name);
@@ -920,9 +960,9 @@ class MessageBoard {
                 }
                 else if (LEASE_ID_REG_EXP.test(instance.name)) {
                     // If the instance does not have lease record, This should be already pruned by lease prune job.
-                    // So we destroy the instance.
+                    // So we destroy the instance. These are destroyed together in batches below.
                     console.log(`Pruning orphan instance without lease ${instance.name}...`);
-                    await this.sashiCli.destroyInstance(instance.name);
+                    orphanInstanceNames.push(instance.name);
                 }
             }
             catch (e) {
@@ -930,6 +970,9 @@ class MessageBoard {
             }
         }
 
+        if (orphanInstanceNames.length > 0)
+            await this.#destroyOrphanInstances(orphanInstanceNames);
+
         // Remove the leases which are orphan (Does not have an instance).
         // Only consider the older ones.
         // If this is prune call at the startup and there are acquiring records, they won't be handled since there's no data for them in the memory.
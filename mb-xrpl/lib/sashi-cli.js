@@ -35,6 +35,20 @@ class SashiCLI {
         return res;
     }
 
+    // Destroys the given instances in parallel.
+    // Returns the destroy responses of the items in the same order.
+    async destroyInstances(containerNames) {
+        const msg = {
+            type: 'destroy_batch',
+            container_names: containerNames
+        };
+        const res = await this.execSashiCli(msg);
+        if (res.type === 'destroy_batch_error')
+            throw res;
+
+        return res.content;
+    }
+
     wait() {
         return new Promise(resolve => {
             // Wait until incompleted sashi cli requests are completed..
@@ -0,0 +1,250 @@
+#include "cgroup_manager.hpp"
+#include "util/util.hpp"
+
+namespace cgroup
+{
+    constexpr const char *CGROUP_ROOT = "/sys/fs/cgroup";
+    constexpr const char *CGROUP_V2_CHECK_FILE = "/sys/fs/cgroup/cgroup.controllers";
+    constexpr const char *USER_SLICE_DIR = "/sys/fs/cgroup/user.slice";
+    constexpr const char *CONTROLLERS = "+cpu +memory +io";
+    constexpr const char *UNLIMITED = "max";
+    constexpr size_t CPU_PERIOD_US = 1000000;
+
+    cgroup_ctx ctx;
+
+    /**
+     * Detects the cgroup version and enables the controllers the limits need down to the user slices. Systemd only
+     * enables the controllers its units ask for, so they are enabled here instead of relying on the slice settings.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        ctx.is_v2 = access(CGROUP_V2_CHECK_FILE, F_OK) == 0;
+        if (!ctx.is_v2)
+        {
+            LOG_INFO << "Cgroup v1 detected. Instance limits are left to the cgroup rules engine.";
+            return 0;
+        }
+
+        if (enable_controllers(CGROUP_ROOT) == -1 || enable_controllers(USER_SLICE_DIR) == -1)
+            return -1;
+
+        // Io limits are skipped if the disk is not found. Cpu and memory limits still apply.
+        if (get_io_device(ctx.io_device) == -1)
+        {
+            LOG_WARNING << "Root disk not found. Instance io limits are disabled.";
+            ctx.io_device.clear();
+        }
+
+        LOG_INFO << "Cgroup v2 manager initialized. Io device: " << (ctx.io_device.empty() ? "none" : ctx.io_device);
+        return 0;
+    }
+
+    bool is_v2()
+    {
+        return ctx.is_v2;
+    }
+
+    /**
+     * Checks whether the cpu and memory controllers are available to the user slices.
+     * @return true if both are enabled otherwise false.
+     */
+    bool is_ready()
+    {
+        const int fd = open((std::string(USER_SLICE_DIR) + "/cgroup.subtree_control").data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening the subtree controllers of " << USER_SLICE_DIR;
+            return false;
+        }
+
+        std::string buf;
+        const int ret = util::read_from_fd(fd, buf, 0);
+        close(fd);
+        if (ret == -1)
+        {
+            LOG_ERROR << errno << ": Error reading the subtree controllers of " << USER_SLICE_DIR;
+            return false;
+        }
+
+        std::istringstream stream(buf);
+        std::string controller;
+        bool has_cpu = false, has_memory = false;
+        while (stream >> controller)
+        {
+            has_cpu = has_cpu || controller == "cpu";
+            has_memory = has_memory || controller == "memory";
+        }
+        return has_cpu && has_memory;
+    }
+
+    /**
+     * Get the cgroup of an instance user. It's the slice systemd creates for the user, which holds the user manager
+     * and all the services it starts.
+     * @param uid Uid of the user.
+     * @return Directory of the cgroup.
+     */
+    const std::string get_user_dir(const uid_t uid)
+    {
+        return std::string(USER_SLICE_DIR) + "/user-" + std::to_string(uid) + ".slice";
+    }
+
+    /**
+     * Writes the limits to the cgroup of a user. The limits take effect on the running processes straight away.
+     * Memory + swap is converted to the swap only limit of v2.
+     * @param uid Uid of the user.
+     * @param lim Limits to be applied.
+     * @return 0 on success and -1 on error.
+     */
+    int apply_limits(const uid_t uid, const limits &lim)
+    {
+        const std::string dir = get_user_dir(uid);
+        if (!util::is_dir_exists(dir))
+        {
+            LOG_ERROR << "Cgroup " << dir << " does not exist.";
+            return -1;
+        }
+
+        const long cores = sysconf(_SC_NPROCESSORS_CONF);
+        const std::string cpu_max = lim.cpu_us == 0 ? std::string(UNLIMITED) : std::to_string(cores * lim.cpu_us);
+        const std::string mem_max = lim.mem_kbytes == 0 ? std::string(UNLIMITED) : std::to_string(lim.mem_kbytes * 1024);
+        const std::string swap_max = lim.swap_kbytes == 0 ? std::string(UNLIMITED) : std::to_string((lim.swap_kbytes > lim.mem_kbytes ? lim.swap_kbytes - lim.mem_kbytes : 0) * 1024);
+
+        // Swap is limited before memory so a lowered memory limit does not push pages into unlimited swap.
+        if (write_value(dir + "/memory.swap.max", swap_max) == -1 ||
+            write_value(dir + "/memory.max", mem_max) == -1 ||
+            write_value(dir + "/cpu.max", cpu_max + " " + std::to_string(CPU_PERIOD_US)) == -1)
+            return -1;
+
+        if (!ctx.io_device.empty())
+        {
+            const std::string io_max = ctx.io_device +
+                                       " rbps=" + (lim.io_read_bps == 0 ? std::string(UNLIMITED) : std::to_string(lim.io_read_bps)) +
+                                       " wbps=" + (lim.io_write_bps == 0 ? std::string(UNLIMITED) : std::to_string(lim.io_write_bps));
+            if (write_value(dir + "/io.max", io_max) == -1)
+                return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Get the current memory and swap usage of the cgroup of a user.
+     * @param uid Uid of the user.
+     * @param mem_bytes Memory usage.
+     * @param swap_bytes Swap usage. 0 if swap is not accounted.
+     * @return 0 on success and -1 on error.
+     */
+    int get_memory_usage(const uid_t uid, uint64_t &mem_bytes, uint64_t &swap_bytes)
+    {
+        const std::string dir = get_user_dir(uid);
+        swap_bytes = 0;
+        if (read_value(dir + "/memory.current", mem_bytes) == -1)
+            return -1;
+
+        if (util::is_file_exists(dir + "/memory.swap.current") && read_value(dir + "/memory.swap.current", swap_bytes) == -1)
+            return -1;
+
+        return 0;
+    }
+
+    /**
+     * Enables the controllers for the children of a cgroup. Controllers which are already enabled are left as is.
+     * @param dir Directory of the cgroup.
+     * @return 0 on success and -1 on error.
+     */
+    int enable_controllers(std::string_view dir)
+    {
+        return write_value(std::string(dir) + "/cgroup.subtree_control", CONTROLLERS);
+    }
+
+    /**
+     * Writes a value to a cgroup interface file. The value is written in a single write as the kernel expects.
+     * @param path Path of the interface file.
+     * @param value Value to be written.
+     * @return 0 on success and -1 on error.
+     */
+    int write_value(std::string_view path, std::string_view value)
+    {
+        const int fd = open(path.data(), O_WRONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening " << path;
+            return -1;
+        }
+
+        const ssize_t written = write(fd, value.data(), value.size());
+        close(fd);
+        if (written != (ssize_t)value.size())
+        {
+            LOG_ERROR << errno << ": Error writing '" << value << "' to " << path;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Reads a single number cgroup interface file.
+     * @param path Path of the interface file.
+     * @param value Read value.
+     * @return 0 on success and -1 on error.
+     */
+    int read_value(std::string_view path, uint64_t &value)
+    {
+        const int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening " << path;
+            return -1;
+        }
+
+        std::string buf;
+        const int ret = util::read_from_fd(fd, buf, 0);
+        close(fd);
+        if (ret == -1 || buf.empty())
+        {
+            LOG_ERROR << errno << ": Error reading " << path;
+            return -1;
+        }
+
+        value = strtoull(buf.data(), NULL, 10);
+        return 0;
+    }
+
+    /**
+     * Get the disk which backs the root filesystem. Io limits are only accepted on whole disks, so the parent disk
+     * is taken if the filesystem is on a partition.
+     * @param device Device number of the disk in major:minor form.
+     * @return 0 on success and -1 on error.
+     */
+    int get_io_device(std::string &device)
+    {
+        struct stat st;
+        if (stat("/", &st) == -1)
+            return -1;
+
+        const std::string sys_dir = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+        if (!util::is_dir_exists(sys_dir))
+            return -1;
+
+        if (!util::is_file_exists(sys_dir + "/partition"))
+        {
+            device = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+            return 0;
+        }
+
+        const int fd = open((sys_dir + "/../dev").data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        std::string buf;
+        const int ret = util::read_from_fd(fd, buf, 0);
+        close(fd);
+        if (ret == -1)
+            return -1;
+
+        device = buf.substr(0, buf.find_first_of("\n"));
+        return device.empty() ? -1 : 0;
+    }
+
+} // namespace cgroup
@@ -0,0 +1,51 @@
+#ifndef _SA_CGROUP_MANAGER_
+#define _SA_CGROUP_MANAGER_
+
+#include "pchheader.hpp"
+
+/**
+ * Applies the resource limits of the instance users on the cgroup v2 unified hierarchy. Each user gets the
+ * user-<uid>.slice subtree which systemd creates for its lingering user manager, so the dockerd and hpfs services of
+ * the user are forked straight into the limited group. On cgroup v1 hosts the limits are left to cgrulesengd.
+ */
+namespace cgroup
+{
+    // Limits of an instance user.
+    struct limits
+    {
+        size_t cpu_us = 0;       // CPU time out of a 1000000 microsec period per core.
+        size_t mem_kbytes = 0;   // Memory limit. 0 means unlimited.
+        size_t swap_kbytes = 0;  // Memory + swap limit, in line with the v1 memsw limit. 0 means unlimited.
+        size_t io_read_bps = 0;  // Read bandwidth on the root disk. 0 means unlimited.
+        size_t io_write_bps = 0; // Write bandwidth on the root disk. 0 means unlimited.
+    };
+
+    struct cgroup_ctx
+    {
+        bool is_v2 = false;
+        std::string io_device; // major:minor of the disk backing the root filesystem. Empty if not found.
+    };
+
+    int init();
+
+    bool is_v2();
+
+    bool is_ready();
+
+    const std::string get_user_dir(const uid_t uid);
+
+    int apply_limits(const uid_t uid, const limits &lim);
+
+    int get_memory_usage(const uid_t uid, uint64_t &mem_bytes, uint64_t &swap_bytes);
+
+    int enable_controllers(std::string_view dir);
+
+    int write_value(std::string_view path, std::string_view value);
+
+    int read_value(std::string_view path, uint64_t &value);
+
+    int get_io_device(std::string &device);
+
+} // namespace cgroup
+
+#endif
@@ -1,30 +1,57 @@
 #include "comm_handler.hpp"
 #include "../util/util.hpp"
 #include "../conf.hpp"
+#include "../crypto.hpp"
+#include "dispatcher.hpp"
+#include "../image_store.hpp"
+#include "../trace.hpp"
+#include "../metrics.hpp"
+#include "../stats_collector.hpp"
+
+#define __HANDLE_RESPONSE(type, content, ret)    \
+    {                                            \
+        std::string res;                         \
+        build_response(res, type, content, ret); \
+        record_error(type, content, ret);        \
+        send(session.fd, res);                   \
+        return ret;                              \
+    }
 
-#define __HANDLE_RESPONSE(type, content, ret)                                                                                                                                                                                                                                       \
-    {                                                                                                                                                                                                                                                                               \
-        std::string res;                                                                                                                                                                                                                                                            \
-        msg_parser.build_response(res, type, content, (((void *)type == (void *)msg::MSGTYPE_CREATE_RES || (void *)type == (void *)msg::MSGTYPE_LIST_RES || (void *)type == (void *)msg::MSGTYPE_INSPECT_RES) && ret == 0) || (void *)type == (void *)msg::MSGTYPE_INITIATE_ERROR); \
-        send(res);                                                                                                                                                                                                                                                                  \
-        return ret;                                                                                                                                                                                                                                                                 \
+// Populates the response of an operation executed by a dispatcher worker.
+#define __OPERATION_RESPONSE(type, content, ret) \
+    {                                            \
+        build_response(res, type, content, ret); \
+        record_error(type, content, ret);        \
+        return ret;                              \
     }
 
 namespace comm
 {
     constexpr uint32_t DEFAULT_MAX_MSG_SIZE = 1 * 1024 * 1024; // 1MB;
     bool init_success;
-    constexpr const int POLL_TIMEOUT = 10;
     constexpr const int BUFFER_SIZE = 4096;
-    constexpr const int EMPTY_READ_TRESHOLD = 5;
+    constexpr const int MAX_EPOLL_EVENTS = 32;
+    constexpr const int SEND_TIMEOUT_SECS = 5; // Max time a response write can block on a slow client.
+    constexpr const char *ADMIN_GROUP = "sashiadmin";
     msg::msg_parser msg_parser;
-    std::vector<uint8_t> read_buffer(BUFFER_SIZE, 0); // Global buffer storing the current message.
 
     constexpr const char *FORMAT_ERROR = "format_error";
     constexpr const char *TYPE_ERROR = "type_error";
     constexpr const char *INIT_ERROR = "init_error";
     constexpr const char *START_ERROR = "start_error";
     constexpr const char *STOP_ERROR = "stop_error";
+    constexpr const char *BUSY_ERROR = "busy_error";
+    constexpr const char *INTERNAL_ERROR = "internal_error";
+    constexpr const char *OPERATION_NOT_FOUND = "operation_not_found";
+    constexpr const char *PREFETCH_ERROR = "prefetch_error";
+    constexpr const char *UNKNOWN_TYPE = "unknown"; // Latency label of the messages with an unsupported type.
+
+    // Message types the latencies are recorded against. Any other type falls under UNKNOWN_TYPE so clients can't
+    // grow the metrics without bound.
+    constexpr const char *LATENCY_TYPES[] = {msg::MSGTYPE_CREATE, msg::MSGTYPE_DESTROY, msg::MSGTYPE_START, msg::MSGTYPE_STOP, msg::MSGTYPE_LIST,
+                                             msg::MSGTYPE_INSPECT, msg::MSGTYPE_OPERATION, msg::MSGTYPE_CREATE_BATCH, msg::MSGTYPE_DESTROY_BATCH,
+                                             msg::MSGTYPE_PREFETCH, msg::MSGTYPE_TRACE, msg::MSGTYPE_METRICS, msg::MSGTYPE_STATS,
+                                             msg::MSGTYPE_RESIZE};
 
     struct Callback
     {
@@ -51,13 +78,16 @@ namespace comm
         // Remove the socket if it already exists.
         unlink(conf::ctx.socket_path.c_str());
 
-        const std::string command = "chown :sashiadmin " + conf::ctx.socket_path;
+        // Members of the admin group are allowed to connect to the socket.
+        const struct group *admin_group = getgrnam(ADMIN_GROUP);
+        if (admin_group == NULL)
+            LOG_WARNING << "Group " << ADMIN_GROUP << " not found. Socket is accessible only to root.";
 
         const mode_t permission_mode = 0660; // rw-rw----
 
         if (bind(ctx.connection_socket, (const struct sockaddr *)&sock_name, sizeof(struct sockaddr_un)) == -1 ||
             chmod(conf::ctx.socket_path.c_str(), permission_mode) == -1 ||
-            system(command.data()) == -1 ||
+            (admin_group != NULL && chown(conf::ctx.socket_path.c_str(), -1, admin_group->gr_gid) == -1) ||
             listen(ctx.connection_socket, 20) == -1)
         {
             LOG_ERROR << errno << ": Error binding the socket for " << conf::ctx.socket_path;
@@ -65,7 +95,41 @@ namespace comm
             return -1;
         }
 
+        // Listen socket is non-blocking so we can drain all pending connections on a single readiness event.
+        // Event fd is used to wake up the event loop when shutting down.
+        ctx.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ctx.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event listen_event = {};
+        listen_event.events = EPOLLIN;
+        listen_event.data.fd = ctx.connection_socket;
+        struct epoll_event wakeup_event = {};
+        wakeup_event.events = EPOLLIN;
+        wakeup_event.data.fd = ctx.event_fd;
+
+        if (ctx.epoll_fd == -1 || ctx.event_fd == -1 ||
+            fcntl(ctx.connection_socket, F_SETFL, fcntl(ctx.connection_socket, F_GETFL) | O_NONBLOCK) == -1 ||
+            epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.connection_socket, &listen_event) == -1 ||
+            epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.event_fd, &wakeup_event) == -1)
+        {
+            LOG_ERROR << errno << ": Error setting up the socket event loop.";
+            if (ctx.epoll_fd != -1)
+                close(ctx.epoll_fd);
+            if (ctx.event_fd != -1)
+                close(ctx.event_fd);
+            close(ctx.connection_socket);
+            return -1;
+        }
+
         msg_parser = msg::msg_parser();
+
+        if (init_dispatcher() == -1)
+        {
+            close(ctx.epoll_fd);
+            close(ctx.event_fd);
+            close(ctx.connection_socket);
+            return -1;
+        }
+
         ctx.comm_handler_thread = std::thread(comm_handler_loop);
         init_success = true;
 
@@ -78,38 +142,81 @@ namespace comm
         {
             ctx.is_shutting_down = true;
 
+            // Wake up the event loop so it notices the shutdown.
+            const uint64_t wakeup = 1;
+            if (write(ctx.event_fd, &wakeup, sizeof(wakeup)) == -1)
+                LOG_ERROR << errno << ": Error waking up the message processor.";
+
             if (ctx.comm_handler_thread.joinable())
                 ctx.comm_handler_thread.join();
 
+            // Let the in-progress operations finish before the hp subsystem goes down.
+            deinit_dispatcher();
+
+            close(ctx.epoll_fd);
+            close(ctx.event_fd);
             close(ctx.connection_socket);
             unlink(conf::ctx.socket_path.c_str());
         }
     }
 
     /**
-     * This accepts connections to the socket.
+     * Accepts all pending connections to the socket and registers them with the event loop.
      * This only gets called whithin the comm handler thread.
      * @return 0 on success -1 on error.
      */
     int connect()
     {
-        ctx.data_socket = accept(ctx.connection_socket, NULL, NULL);
-        if (ctx.data_socket == -1)
+        while (true)
         {
-            LOG_ERROR << errno << ": Error accepting the new connection.";
-            return -1;
+            const int fd = accept4(ctx.connection_socket, NULL, NULL, SOCK_CLOEXEC);
+            if (fd == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;
+
+                LOG_ERROR << errno << ": Error accepting the new connection.";
+                return -1;
+            }
+
+            // Session sockets are kept blocking since we only read them on readiness.
+            // A send timeout prevents a stuck client from stalling the event loop.
+            const struct timeval send_timeout = {SEND_TIMEOUT_SECS, 0};
+            struct epoll_event event = {};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) == -1 ||
+                epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+            {
+                LOG_ERROR << errno << ": Error registering the new connection.";
+                close(fd);
+                continue;
+            }
+
+            comm_session &session = ctx.sessions[fd];
+            session.fd = fd;
+            session.read_buffer.resize(BUFFER_SIZE);
         }
-        return 0;
     }
 
     /**
-     * Disconnect the session.
+     * Disconnect the session of the given socket.
      * This only gets called whithin the comm handler thread.
+     * @param fd Socket fd of the session.
      */
-    void disconnect()
+    void disconnect(const int fd)
     {
-        close(ctx.data_socket);
-        ctx.data_socket = -1;
+        const auto itr = ctx.sessions.find(fd);
+        if (itr == ctx.sessions.end())
+            return;
+
+        // Detached sockets are owned by a dispatcher worker, which closes them after responding.
+        if (!itr->second.is_detached)
+        {
+            epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+        }
+        ctx.sessions.erase(itr);
     }
 
     void comm_handler_loop()
@@ -117,50 +224,64 @@ namespace comm
         LOG_INFO << "Message processor started.";
 
         util::mask_signal();
-        struct pollfd pfd;
-        int empty_read_count = 0; // Helps to detect when the client is disconnected.
+        struct epoll_event events[MAX_EPOLL_EVENTS];
 
         while (!ctx.is_shutting_down)
         {
-            // Process queued messaged only if there's a socket connection.
-            if (ctx.data_socket != -1)
+            // Block until a new connection, a client message or a shutdown wakeup arrives.
+            const int event_count = epoll_wait(ctx.epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+            if (event_count == -1)
             {
-                const int message_size = read_socket();
-                if (message_size == -1)
-                    disconnect();
-                else if (message_size > 0)
-                    handle_message(message_size);
-                else
-                {
-                    empty_read_count++;
-                    // Empty reads happens when client closed the connection.
-                    // Disconnect connection after 5 consecutive empty reads.
-                    if (empty_read_count == EMPTY_READ_TRESHOLD)
-                    {
-                        disconnect();
-                        empty_read_count = 0;
-                    }
-                    util::sleep(1000);
-                }
+                if (errno == EINTR)
+                    continue;
+
+                LOG_ERROR << errno << ": Error waiting for socket events.";
+                break;
             }
-            else
+
+            for (int i = 0; i < event_count && !ctx.is_shutting_down; i++)
             {
-                pfd.fd = ctx.connection_socket;
-                pfd.events = POLLIN;
+                const int fd = events[i].data.fd;
+
+                if (fd == ctx.event_fd)
+                    continue;
 
-                // Wait for some time if no connections are available.
-                if (poll(&pfd, 1, POLL_TIMEOUT) > 0)
+                if (fd == ctx.connection_socket)
                 {
                     connect();
-                    empty_read_count = 0;
+                    continue;
+                }
+
+                const auto itr = ctx.sessions.find(fd);
+                if (itr == ctx.sessions.end())
+                    continue;
+
+                if (!(events[i].events & EPOLLIN))
+                {
+                    // Client closed the connection or the socket errored without any pending data.
+                    disconnect(fd);
+                    continue;
                 }
-                else
-                    util::sleep(1000);
+
+                // Empty reads happens when client closed the connection.
+                const int message_size = read_socket(itr->second);
+                if (message_size > 0)
+                {
+                    handle_message(itr->second, message_size);
+
+                    // Detached sessions are recorded by the dispatcher worker once it responds.
+                    if (!itr->second.is_detached && itr->second.latency != NULL)
+                        itr->second.latency->observe(trace::get_epoch_microseconds() - itr->second.received_us);
+                }
+
+                // Close connection after serving a single message.
+                disconnect(fd);
             }
         }
 
-        // Disconnect the host at the termination.
-        disconnect();
+        // Disconnect all the clients at the termination.
+        while (!ctx.sessions.empty())
+            disconnect(ctx.sessions.begin()->first);
 
         LOG_INFO << "Message processor stopped.";
     }
@@ -174,22 +295,31 @@ namespace comm
     }
 
     /**
-     * Handles the received message.
+     * Handles the received message. Read only messages are answered right away while the operations which
+     * modify instances are handed over to the dispatcher workers.
+     * @param session Session which received the message.
      * @param message_size Message size.
      * @return 0 on success -1 on error.
      */
-    int handle_message(const int message_size)
+    int handle_message(comm_session &session, const int message_size)
     {
-        std::string_view msg((char *)read_buffer.data(), message_size);
+        session.received_us = trace::get_epoch_microseconds();
+        session.latency = &metrics::get(metrics::MESSAGE_DURATION, UNKNOWN_TYPE);
+
+        std::string_view msg((char *)session.read_buffer.data(), message_size);
         std::string type;
-        if (msg_parser.parse(msg) == -1 || msg_parser.extract_type(type) == -1)
-        {
-            read_buffer.clear();
+        bool is_async;
+        if (msg_parser.parse(msg) == -1 || msg_parser.extract_type(type) == -1 || msg_parser.extract_async_flag(is_async) == -1)
             __HANDLE_RESPONSE(msg::MSGTYPE_ERROR, FORMAT_ERROR, -1);
-        }
 
-        // Clear the buffer after the message is parsed.
-        read_buffer.clear();
+        for (const char *latency_type : LATENCY_TYPES)
+        {
+            if (type == latency_type)
+            {
+                session.latency = &metrics::get(metrics::MESSAGE_DURATION, type);
+                break;
+            }
+        }
 
         if (type == msg::MSGTYPE_LIST)
         {
@@ -209,21 +339,9 @@ namespace comm
                 msg_parser.extract_initiate_message(init_msg) == -1)
                 __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_ERROR, FORMAT_ERROR, -1);
 
-            hp::instance_info info;
-            std::string error_msg;
-            if (hp::create_new_instance(error_msg, info, msg.container_name, msg.pubkey, msg.contract_id, msg.image, msg.outbound_ipv6, msg.outbound_net_interface) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_ERROR, error_msg, -1);
-
-            if (hp::initiate_instance(error_msg, info.container_name, init_msg) == -1)
-            {
-                std::string content;
-                msg_parser.build_error_response(content, info.container_name, error_msg);
-                __HANDLE_RESPONSE(msg::MSGTYPE_INITIATE_ERROR, content, -1);
-            }
-
-            std::string create_res;
-            msg_parser.build_create_response(create_res, info);
-            __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_RES, create_res, 0);
+            return dispatch_operation(session, is_async, msg.container_name, msg::MSGTYPE_CREATE_ERROR,
+                                      [msg, init_msg](std::string &res)
+                                      { execute_create(res, msg, init_msg); });
         }
         // else if (type == msg::MSGTYPE_INITIATE)
         // {
@@ -242,11 +360,9 @@ namespace comm
             if (msg_parser.extract_destroy_message(msg))
                 __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_ERROR, FORMAT_ERROR, -1);
 
-            std::string error_msg;
-            if (hp::destroy_container(error_msg, msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_ERROR, error_msg, -1);
-
-            __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_RES, "destroyed", 0);
+            return dispatch_operation(session, is_async, msg.container_name, msg::MSGTYPE_DESTROY_ERROR,
+                                      [msg](std::string &res)
+                                      { execute_destroy(res, msg); });
         }
         else if (type == msg::MSGTYPE_START)
         {
@@ -254,10 +370,9 @@ namespace comm
             if (msg_parser.extract_start_message(msg))
                 __HANDLE_RESPONSE(msg::MSGTYPE_START_ERROR, FORMAT_ERROR, -1);
 
-            if (hp::start_container(msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_START_ERROR, START_ERROR, -1);
-
-            __HANDLE_RESPONSE(msg::MSGTYPE_START_RES, "started", 0);
+            return dispatch_operation(session, is_async, msg.container_name, msg::MSGTYPE_START_ERROR,
+                                      [msg](std::string &res)
+                                      { execute_start(res, msg); });
         }
         else if (type == msg::MSGTYPE_STOP)
         {
@@ -265,10 +380,19 @@ namespace comm
             if (msg_parser.extract_stop_message(msg))
                 __HANDLE_RESPONSE(msg::MSGTYPE_STOP_ERROR, FORMAT_ERROR, -1);
 
-            if (hp::stop_container(msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_STOP_ERROR, STOP_ERROR, -1);
+            return dispatch_operation(session, is_async, msg.container_name, msg::MSGTYPE_STOP_ERROR,
+                                      [msg](std::string &res)
+                                      { execute_stop(res, msg); });
+        }
+        else if (type == msg::MSGTYPE_RESIZE)
+        {
+            msg::resize_msg msg;
+            if (msg_parser.extract_resize_message(msg))
+                __HANDLE_RESPONSE(msg::MSGTYPE_RESIZE_ERROR, FORMAT_ERROR, -1);
 
-            __HANDLE_RESPONSE(msg::MSGTYPE_STOP_RES, "stopped", 0);
+            return dispatch_operation(session, is_async, msg.container_name, msg::MSGTYPE_RESIZE_ERROR,
+                                      [msg](std::string &res)
+                                      { execute_resize(res, msg); });
         }
         else if (type == msg::MSGTYPE_INSPECT)
         {
@@ -281,10 +405,125 @@ namespace comm
             if (hp::get_instance(error_msg, msg.container_name, instance) == -1)
                 __HANDLE_RESPONSE(msg::MSGTYPE_INSPECT_ERROR, error_msg, -1);
 
+            // Usage is left out until the instance has been sampled.
+            stats::sample usage;
+            stats::get_latest(msg.container_name, usage);
+
             std::string inspect_res;
-            msg_parser.build_inspect_response(inspect_res, instance);
+            msg_parser.build_inspect_response(inspect_res, instance, usage);
             __HANDLE_RESPONSE(msg::MSGTYPE_INSPECT_RES, inspect_res, 0);
         }
+        else if (type == msg::MSGTYPE_CREATE_BATCH)
+        {
+            msg::create_batch_msg msg;
+            if (msg_parser.extract_create_batch_message(msg) == -1)
+                __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_BATCH_ERROR, FORMAT_ERROR, -1);
+
+            std::vector<batch_item> items;
+            for (const msg::create_batch_item &item : msg.instances)
+            {
+                items.push_back({item.create.container_name, msg::MSGTYPE_CREATE_ERROR,
+                                 [item](std::string &res)
+                                 { execute_create(res, item.create, item.initiate); }});
+            }
+            return dispatch_batch(session, is_async, msg::MSGTYPE_CREATE_BATCH_RES, items);
+        }
+        else if (type == msg::MSGTYPE_DESTROY_BATCH)
+        {
+            msg::destroy_batch_msg msg;
+            if (msg_parser.extract_destroy_batch_message(msg) == -1)
+                __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_BATCH_ERROR, FORMAT_ERROR, -1);
+
+            std::vector<batch_item> items;
+            for (const std::string &container_name : msg.container_names)
+            {
+                const msg::destroy_msg destroy_msg{msg::MSGTYPE_DESTROY, container_name};
+                items.push_back({container_name, msg::MSGTYPE_DESTROY_ERROR,
+                                 [destroy_msg](std::string &res)
+                                 { execute_destroy(res, destroy_msg); }});
+            }
+            return dispatch_batch(session, is_async, msg::MSGTYPE_DESTROY_BATCH_RES, items);
+        }
+        else if (type == msg::MSGTYPE_OPERATION)
+        {
+            msg::operation_msg msg;
+            if (msg_parser.extract_operation_message(msg))
+                __HANDLE_RESPONSE(msg::MSGTYPE_OPERATION_ERROR, FORMAT_ERROR, -1);
+
+            operation op;
+            if (get_operation(msg.operation_id, op) == -1)
+                __HANDLE_RESPONSE(msg::MSGTYPE_OPERATION_ERROR, OPERATION_NOT_FOUND, -1);
+
+            // Completed operations are answered with the response of the operation itself.
+            if (op.state == OPERATION_STATE::COMPLETED)
+                return send(session.fd, op.response);
+
+            std::string operation_res;
+            msg_parser.build_operation_response(operation_res, op.id, OPERATION_STATES[op.state]);
+            __HANDLE_RESPONSE(msg::MSGTYPE_OPERATION_RES, operation_res, 0);
+        }
+        else if (type == msg::MSGTYPE_PREFETCH)
+        {
+            msg::prefetch_msg msg;
+            if (msg_parser.extract_prefetch_message(msg))
+                __HANDLE_RESPONSE(msg::MSGTYPE_PREFETCH_ERROR, FORMAT_ERROR, -1);
+
+            // The image is fetched in the background by the image store.
+            if (image_store::prefetch(msg.image) == -1)
+                __HANDLE_RESPONSE(msg::MSGTYPE_PREFETCH_ERROR, PREFETCH_ERROR, -1);
+
+            __HANDLE_RESPONSE(msg::MSGTYPE_PREFETCH_RES, "queued", 0);
+        }
+        else if (type == msg::MSGTYPE_TRACE)
+        {
+            msg::trace_msg msg;
+            if (msg_parser.extract_trace_message(msg))
+                __HANDLE_RESPONSE(msg::MSGTYPE_TRACE_ERROR, FORMAT_ERROR, -1);
+
+            std::vector<trace::span_record> spans;
+            trace::get_spans(spans, msg.operation_id, msg.container_name);
+
+            std::string trace_res;
+            if (msg.format == msg::TRACE_FORMAT_CHROME)
+                msg_parser.build_chrome_trace_response(trace_res, spans);
+            else
+                msg_parser.build_trace_response(trace_res, spans);
+            __HANDLE_RESPONSE(msg::MSGTYPE_TRACE_RES, trace_res, 0);
+        }
+        else if (type == msg::MSGTYPE_METRICS)
+        {
+            std::string text, metrics_res;
+            metrics::build_prometheus_text(text);
+            msg_parser.build_metrics_response(metrics_res, text);
+            __HANDLE_RESPONSE(msg::MSGTYPE_METRICS_RES, metrics_res, 0);
+        }
+        else if (type == msg::MSGTYPE_STATS)
+        {
+            msg::stats_msg msg;
+            if (msg_parser.extract_stats_message(msg))
+                __HANDLE_RESPONSE(msg::MSGTYPE_STATS_ERROR, FORMAT_ERROR, -1);
+
+            std::vector<stats::instance_samples> instance_stats;
+            if (msg.container_name.empty())
+            {
+                stats::get_all_latest(instance_stats);
+            }
+            else
+            {
+                hp::instance_info instance;
+                std::string error_msg;
+                if (hp::get_instance(error_msg, msg.container_name, instance) == -1)
+                    __HANDLE_RESPONSE(msg::MSGTYPE_STATS_ERROR, error_msg, -1);
+
+                stats::instance_samples &samples = instance_stats.emplace_back();
+                samples.container_name = msg.container_name;
+                stats::get_samples(msg.container_name, samples.samples);
+            }
+
+            std::string stats_res;
+            msg_parser.build_stats_response(stats_res, instance_stats);
+            __HANDLE_RESPONSE(msg::MSGTYPE_STATS_RES, stats_res, 0);
+        }
         else
             __HANDLE_RESPONSE("error", TYPE_ERROR, -1);
 
@@ -292,31 +531,289 @@ namespace comm
     }
 
     /**
-     * Sends the given message to the connected client.
+     * Hands over an instance operation to the dispatcher. In sync mode the worker responds on the session socket
+     * once the operation completes. In async mode the client gets the operation id right away and the result has
+     * to be collected later with an operation message.
+     * @param session Session which requested the operation.
+     * @param is_async Whether to respond with the operation id without waiting for the result.
+     * @param container_name Name of the container the operation is performed on.
+     * @param error_type Error response type of the operation.
+     * @param func Function which executes the operation and populates the response.
+     * @return 0 on success -1 on error.
+     */
+    int dispatch_operation(comm_session &session, const bool is_async, std::string_view container_name, const char *error_type, std::function<void(std::string &)> func)
+    {
+        dispatch_job job;
+        job.container_name = container_name;
+        job.func = std::move(func);
+        build_response(job.busy_response, error_type, BUSY_ERROR, -1);
+        build_response(job.failure_response, error_type, INTERNAL_ERROR, -1);
+        if (is_async)
+        {
+            job.operation_id = crypto::generate_uuid();
+        }
+        else
+        {
+            job.fd = session.fd;
+            job.latency = session.latency;
+            job.received_us = session.received_us;
+        }
+
+        const std::string operation_id = job.operation_id;
+
+        // Stop watching the socket before a worker gets hold of it.
+        if (!is_async)
+            epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, session.fd, NULL);
+
+        if (dispatch(std::move(job)) == -1)
+        {
+            LOG_ERROR << "Operation queue is full. Rejected the operation for " << container_name;
+            __HANDLE_RESPONSE(error_type, BUSY_ERROR, -1);
+        }
+
+        if (!is_async)
+        {
+            session.is_detached = true;
+            return 0;
+        }
+
+        std::string operation_res;
+        msg_parser.build_operation_response(operation_res, operation_id, OPERATION_STATES[OPERATION_STATE::PENDING]);
+        __HANDLE_RESPONSE(msg::MSGTYPE_OPERATION_RES, operation_res, 0);
+    }
+
+    /**
+     * Hands over the items of a batch message to the dispatcher. Items are executed in parallel by the dispatcher
+     * workers and a single response holding the item responses in the request order is delivered once all of them
+     * are completed. Response delivery follows the sync/async modes of dispatch_operation.
+     * @param session Session which requested the batch.
+     * @param is_async Whether to respond with the operation id without waiting for the result.
+     * @param res_type Response type of the batch.
+     * @param items Operations of the batch.
+     * @return 0 on success -1 on error.
+     */
+    int dispatch_batch(comm_session &session, const bool is_async, const char *res_type, std::vector<batch_item> &items)
+    {
+        struct batch_state
+        {
+            std::mutex mutex;
+            std::vector<std::string> responses;
+            size_t remaining = 0;
+            dispatch_job batch_job; // Carries the response destination of the batch. Never dispatched itself.
+        };
+
+        const std::shared_ptr<batch_state> state = std::make_shared<batch_state>();
+        state->responses.resize(items.size());
+        state->remaining = items.size();
+        if (is_async)
+        {
+            state->batch_job.operation_id = crypto::generate_uuid();
+            register_operation(state->batch_job.operation_id, {});
+        }
+        else
+        {
+            // Stop watching the socket before a worker gets hold of it.
+            state->batch_job.fd = session.fd;
+            state->batch_job.latency = session.latency;
+            state->batch_job.received_us = session.received_us;
+            epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, session.fd, NULL);
+            session.is_detached = true;
+        }
+        const std::string operation_id = state->batch_job.operation_id;
+
+        // Records an item response and delivers the batch response after the last item.
+        const auto on_item_complete = [state, res_type](const size_t index, std::string_view response)
+        {
+            std::scoped_lock lock(state->mutex);
+            state->responses[index] = response;
+            if (--state->remaining > 0)
+                return;
+
+            std::string content, batch_res;
+            msg_parser.build_batch_response(content, state->responses);
+            build_response(batch_res, res_type, content, 0);
+            complete_job(state->batch_job, batch_res);
+        };
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            dispatch_job job;
+            job.container_name = items[i].container_name;
+            job.func = std::move(items[i].func);
+            build_response(job.busy_response, items[i].error_type, BUSY_ERROR, -1);
+            build_response(job.failure_response, items[i].error_type, INTERNAL_ERROR, -1);
+            job.on_complete = [on_item_complete, i](std::string_view response)
+            { on_item_complete(i, response); };
+            job.trace_id = operation_id;
+
+            const std::string busy_response = job.busy_response;
+            if (dispatch(std::move(job)) == -1)
+            {
+                LOG_ERROR << "Operation queue is full. Rejected the operation for " << items[i].container_name;
+                metrics::add(metrics::ERRORS, BUSY_ERROR);
+                on_item_complete(i, busy_response);
+            }
+        }
+
+        if (!is_async)
+            return 0;
+
+        std::string operation_res;
+        msg_parser.build_operation_response(operation_res, operation_id, OPERATION_STATES[OPERATION_STATE::PENDING]);
+        __HANDLE_RESPONSE(msg::MSGTYPE_OPERATION_RES, operation_res, 0);
+    }
+
+    /**
+     * Creates and initiates a new instance.
+     * @param res Response message to be populated.
+     * @param msg Create message.
+     * @param init_msg Initiate message of the instance.
+     * @return 0 on success -1 on error.
+     */
+    int execute_create(std::string &res, const msg::create_msg &msg, const msg::initiate_msg &init_msg)
+    {
+        const trace::span span("create");
+        hp::instance_info info;
+        std::string error_msg;
+        if (hp::create_new_instance(error_msg, info, msg.container_name, msg.pubkey, msg.contract_id, msg.image, msg.outbound_ipv6, msg.outbound_net_interface, msg.resources) == -1)
+            __OPERATION_RESPONSE(msg::MSGTYPE_CREATE_ERROR, error_msg, -1);
+
+        if (hp::initiate_instance(error_msg, info.container_name, init_msg) == -1)
+        {
+            std::string content;
+            msg_parser.build_error_response(content, info.container_name, error_msg);
+            __OPERATION_RESPONSE(msg::MSGTYPE_INITIATE_ERROR, content, -1);
+        }
+
+        std::string create_res;
+        msg_parser.build_create_response(create_res, info);
+        __OPERATION_RESPONSE(msg::MSGTYPE_CREATE_RES, create_res, 0);
+    }
+
+    /**
+     * Destroys an instance.
+     * @param res Response message to be populated.
+     * @param msg Destroy message.
+     * @return 0 on success -1 on error.
+     */
+    int execute_destroy(std::string &res, const msg::destroy_msg &msg)
+    {
+        const trace::span span("destroy");
+        std::string error_msg;
+        if (hp::destroy_container(error_msg, msg.container_name) == -1)
+            __OPERATION_RESPONSE(msg::MSGTYPE_DESTROY_ERROR, error_msg, -1);
+
+        __OPERATION_RESPONSE(msg::MSGTYPE_DESTROY_RES, "destroyed", 0);
+    }
+
+    /**
+     * Starts a stopped instance.
+     * @param res Response message to be populated.
+     * @param msg Start message.
+     * @return 0 on success -1 on error.
+     */
+    int execute_start(std::string &res, const msg::start_msg &msg)
+    {
+        const trace::span span("start");
+        if (hp::start_container(msg.container_name) == -1)
+            __OPERATION_RESPONSE(msg::MSGTYPE_START_ERROR, START_ERROR, -1);
+
+        __OPERATION_RESPONSE(msg::MSGTYPE_START_RES, "started", 0);
+    }
+
+    /**
+     * Stops a running instance.
+     * @param res Response message to be populated.
+     * @param msg Stop message.
+     * @return 0 on success -1 on error.
+     */
+    int execute_stop(std::string &res, const msg::stop_msg &msg)
+    {
+        const trace::span span("stop");
+        if (hp::stop_container(msg.container_name) == -1)
+            __OPERATION_RESPONSE(msg::MSGTYPE_STOP_ERROR, STOP_ERROR, -1);
+
+        __OPERATION_RESPONSE(msg::MSGTYPE_STOP_RES, "stopped", 0);
+    }
+
+    /**
+     * Changes the size of an instance without restarting it.
+     * @param res Response message to be populated.
+     * @param msg Resize message.
+     * @return 0 on success -1 on error.
+     */
+    int execute_resize(std::string &res, const msg::resize_msg &msg)
+    {
+        const trace::span span("resize");
+        hp::resources allocation;
+        std::string error_msg;
+        if (hp::resize_instance(error_msg, allocation, msg.container_name, msg.resources) == -1)
+            __OPERATION_RESPONSE(msg::MSGTYPE_RESIZE_ERROR, error_msg, -1);
+
+        std::string resize_res;
+        msg_parser.build_resize_response(resize_res, msg.container_name, allocation);
+        __OPERATION_RESPONSE(msg::MSGTYPE_RESIZE_RES, resize_res, 0);
+    }
+
+    /**
+     * Builds the response message of the given type. Content of the successful create, list, inspect, operation,
+     * batch, trace, metrics, stats and resize responses and the initiate errors are json.
+     * @param res Response message to be populated.
+     * @param type Response type.
+     * @param content Response content.
+     * @param ret Return code of the operation.
+     */
+    void build_response(std::string &res, const char *type, std::string_view content, const int ret)
+    {
+        const bool json_content = ((type == msg::MSGTYPE_CREATE_RES || type == msg::MSGTYPE_LIST_RES || type == msg::MSGTYPE_INSPECT_RES || type == msg::MSGTYPE_OPERATION_RES ||
+                                    type == msg::MSGTYPE_CREATE_BATCH_RES || type == msg::MSGTYPE_DESTROY_BATCH_RES || type == msg::MSGTYPE_TRACE_RES ||
+                                    type == msg::MSGTYPE_METRICS_RES || type == msg::MSGTYPE_STATS_RES || type == msg::MSGTYPE_RESIZE_RES) &&
+                                   ret == 0) ||
+                                  type == msg::MSGTYPE_INITIATE_ERROR;
+        msg_parser.build_response(res, type, content, json_content);
+    }
+
+    /**
+     * Counts an error response against its error code. Initiate errors carry json content, so they are counted
+     * against the response type instead.
+     * @param type Response type.
+     * @param content Response content.
+     * @param ret Return code of the operation. Nothing is counted unless -1.
+     */
+    void record_error(const char *type, std::string_view content, const int ret)
+    {
+        if (ret != -1)
+            return;
+
+        if (type == msg::MSGTYPE_INITIATE_ERROR || content.empty())
+            metrics::add(metrics::ERRORS, type);
+        else
+            metrics::add(metrics::ERRORS, content);
+    }
+
+    /**
+     * Sends the given message to the client connected on the given socket.
+     * @param fd Socket fd of the client session.
      * @param message Message to send.
      * @return 0 on success -1 on error.
      **/
-    int send(std::string_view message)
+    int send(const int fd, std::string_view message)
     {
-        if (ctx.data_socket == -1)
+        if (fd == -1)
             return -1;
 
         uint8_t length_buffer[8];
         // Convert message length to a byte array
         uint32_to_bytes(length_buffer, message.length());
 
-        int res = write(ctx.data_socket, length_buffer, 8);
-        if (res == -1)
+        if (write(fd, length_buffer, 8) == -1 ||
+            write(fd, message.data(), message.length()) == -1)
         {
-            disconnect();
+            LOG_ERROR << errno << ": Error sending the response.";
             return -1;
         }
 
-        res = write(ctx.data_socket, message.data(), message.length());
-        // Close connection after sending the response to the client.
-        disconnect();
-
-        return res == -1 ? -1 : 0;
+        return 0;
     }
 
     /**
@@ -333,12 +830,18 @@ namespace comm
     }
 
     /**
-     * Reads the message from the connected client to the global buffer.
+     * Reads the next message from the client into the session buffer.
+     * @param session Session to read from.
      * @return Number of bytes read on success -1 on error.
      **/
-    int read_socket()
+    int read_socket(comm_session &session)
     {
-        const int ret = read(ctx.data_socket, read_buffer.data(), BUFFER_SIZE);
+        // Peek the size of the pending packet so messages larger than the default buffer can be read at once.
+        const int pending_size = recv(session.fd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+        if (pending_size > 0 && (size_t)pending_size > session.read_buffer.size())
+            session.read_buffer.resize(std::min<uint32_t>(pending_size, DEFAULT_MAX_MSG_SIZE));
+
+        const int ret = read(session.fd, session.read_buffer.data(), session.read_buffer.size());
         if (ret == -1)
         {
             LOG_ERROR << errno << ": Error receiving data.";
@@ -3,15 +3,36 @@
 
 #include "../pchheader.hpp"
 #include "../msg/msg_parser.hpp"
+#include "../metrics.hpp"
 
 namespace comm
 {
+    // Per-connection state of an accepted client.
+    struct comm_session
+    {
+        int fd = -1;
+        std::vector<uint8_t> read_buffer; // Buffer storing the current message of this session.
+        bool is_detached = false;         // Whether the socket is handed over to a dispatcher worker to respond.
+        metrics::metric *latency = NULL;  // Latency histogram of the current message type.
+        uint64_t received_us = 0;         // Epoch microseconds at which the current message was received.
+    };
+
+    // An operation of a batch message.
+    struct batch_item
+    {
+        std::string container_name;
+        const char *error_type;                 // Error response type of the operation.
+        std::function<void(std::string &)> func; // Executes the operation and populates the response.
+    };
+
     struct comm_ctx
     {
-        bool is_shutting_down = false;
+        std::atomic<bool> is_shutting_down = false;
         std::thread comm_handler_thread; // Incoming message processor thread.
         int connection_socket = -1;
-        int data_socket = -1;
+        int epoll_fd = -1;                                // Epoll instance watching the listen socket and all sessions.
+        int event_fd = -1;                                // Used to wake up the event loop on shutdown.
+        std::unordered_map<int, comm_session> sessions; // Active client sessions keyed by socket fd.
     };
 
     extern comm_ctx ctx;
@@ -22,17 +43,35 @@ namespace comm
 
     int connect();
 
-    void disconnect();
+    void disconnect(const int fd);
 
     void comm_handler_loop();
 
-    int handle_message(const int message_size);
+    int handle_message(comm_session &session, const int message_size);
+
+    int dispatch_operation(comm_session &session, const bool is_async, std::string_view container_name, const char *error_type, std::function<void(std::string &)> func);
+
+    int dispatch_batch(comm_session &session, const bool is_async, const char *res_type, std::vector<batch_item> &items);
+
+    int execute_create(std::string &res, const msg::create_msg &msg, const msg::initiate_msg &init_msg);
+
+    int execute_destroy(std::string &res, const msg::destroy_msg &msg);
+
+    int execute_start(std::string &res, const msg::start_msg &msg);
+
+    int execute_stop(std::string &res, const msg::stop_msg &msg);
+
+    int execute_resize(std::string &res, const msg::resize_msg &msg);
+
+    void build_response(std::string &res, const char *type, std::string_view content, const int ret);
+
+    void record_error(const char *type, std::string_view content, const int ret);
 
-    int send(std::string_view message);
+    int send(const int fd, std::string_view message);
 
     void wait();
 
-    int read_socket();
+    int read_socket(comm_session &session);
 
     void uint32_to_bytes(uint8_t *dest, const uint32_t x);
 
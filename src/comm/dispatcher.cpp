@@ -0,0 +1,266 @@
+#include "dispatcher.hpp"
+#include "comm_handler.hpp"
+#include "../util/util.hpp"
+#include "../crypto.hpp"
+#include "../trace.hpp"
+#include "../metrics.hpp"
+
+namespace comm
+{
+    constexpr size_t WORKER_COUNT = 4;                          // No. of operations which can be executed in parallel.
+    constexpr size_t MAX_PENDING_JOBS = 64;                     // Max no. of operations waiting for a worker.
+    constexpr uint64_t OPERATION_RETENTION_MS = 60 * 60 * 1000; // Completed async operations are kept for 1 hour.
+
+    dispatcher_ctx dispatcher;
+
+    /**
+     * Starts the worker pool.
+     * @return 0 on success -1 on error.
+     */
+    int init_dispatcher()
+    {
+        try
+        {
+            for (size_t i = 0; i < WORKER_COUNT; i++)
+                dispatcher.workers.push_back(std::thread(worker_loop));
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the dispatcher workers. " << e.what();
+            deinit_dispatcher();
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Waits for the running operations to finish and stops the worker pool.
+     * Clients of the operations which were not started are given their busy response.
+     */
+    void deinit_dispatcher()
+    {
+        {
+            std::scoped_lock lock(dispatcher.jobs_mutex);
+            dispatcher.is_shutting_down = true;
+        }
+        dispatcher.jobs_cv.notify_all();
+
+        for (std::thread &worker : dispatcher.workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+        dispatcher.workers.clear();
+
+        for (const dispatch_job &job : dispatcher.ready_jobs)
+            complete_job(job, job.busy_response);
+        for (const auto &[container_name, jobs] : dispatcher.blocked_jobs)
+        {
+            for (const dispatch_job &job : jobs)
+                complete_job(job, job.busy_response);
+        }
+        dispatcher.ready_jobs.clear();
+        dispatcher.blocked_jobs.clear();
+        metrics::get(metrics::QUEUE_DEPTH).add(-(int64_t)dispatcher.pending_count);
+        dispatcher.pending_count = 0;
+    }
+
+    /**
+     * Queues the given job to be executed by a worker. If another job of the same container is
+     * already in progress, this job is held back until that one completes.
+     * In sync mode the ownership of the job socket is transferred to the dispatcher on success.
+     * @param job Job to be executed.
+     * @return 0 on success. -1 if the queue is full or the dispatcher is shutting down.
+     */
+    int dispatch(dispatch_job &&job)
+    {
+        {
+            std::scoped_lock lock(dispatcher.jobs_mutex);
+            if (dispatcher.is_shutting_down || dispatcher.pending_count >= MAX_PENDING_JOBS)
+                return -1;
+
+            if (!job.operation_id.empty())
+                register_operation(job.operation_id, job.container_name);
+
+            // Sync jobs have no operation id, so their spans are recorded against an id of their own.
+            if (job.trace_id.empty())
+                job.trace_id = job.operation_id.empty() ? crypto::generate_uuid() : job.operation_id;
+            job.dispatched_us = trace::get_epoch_microseconds();
+
+            dispatcher.pending_count++;
+            metrics::get(metrics::QUEUE_DEPTH).add(1);
+            if (dispatcher.busy_containers.count(job.container_name) == 1)
+            {
+                dispatcher.blocked_jobs[job.container_name].push_back(std::move(job));
+                return 0;
+            }
+
+            dispatcher.busy_containers.emplace(job.container_name);
+            dispatcher.ready_jobs.push_back(std::move(job));
+        }
+        dispatcher.jobs_cv.notify_one();
+        return 0;
+    }
+
+    /**
+     * Starts tracking an async operation in pending state.
+     * @param operation_id Id of the operation.
+     * @param container_name Name of the container the operation is performed on.
+     */
+    void register_operation(std::string_view operation_id, std::string_view container_name)
+    {
+        std::scoped_lock lock(dispatcher.operations_mutex);
+        operation &op = dispatcher.operations[std::string(operation_id)];
+        op.id = operation_id;
+        op.container_name = container_name;
+    }
+
+    /**
+     * Get a copy of the async operation with the given id.
+     * @param operation_id Id of the operation.
+     * @param op Operation to be populated.
+     * @return 0 if found. -1 if the operation is not found or it has expired.
+     */
+    int get_operation(std::string_view operation_id, operation &op)
+    {
+        std::scoped_lock lock(dispatcher.operations_mutex);
+        const auto itr = dispatcher.operations.find(std::string(operation_id));
+        if (itr == dispatcher.operations.end())
+            return -1;
+
+        op = itr->second;
+        return 0;
+    }
+
+    void worker_loop()
+    {
+        util::mask_signal();
+
+        while (true)
+        {
+            dispatch_job job;
+            {
+                std::unique_lock lock(dispatcher.jobs_mutex);
+                dispatcher.jobs_cv.wait(lock, []
+                                        { return dispatcher.is_shutting_down || !dispatcher.ready_jobs.empty(); });
+                if (dispatcher.is_shutting_down)
+                    break;
+
+                job = std::move(dispatcher.ready_jobs.front());
+                dispatcher.ready_jobs.pop_front();
+                dispatcher.pending_count--;
+            }
+            metrics::get(metrics::QUEUE_DEPTH).add(-1);
+
+            set_operation_state(job.operation_id, OPERATION_STATE::RUNNING);
+
+            metrics::metric &in_flight = metrics::get(metrics::OPERATIONS_IN_FLIGHT);
+            in_flight.add(1);
+            std::string response;
+            {
+                const trace::operation_scope scope({job.trace_id, job.container_name});
+                trace::record_span("queue_wait", job.dispatched_us);
+                try
+                {
+                    job.func(response);
+                }
+                catch (const std::exception &e)
+                {
+                    // A failing operation must not take the agent down with it. The client still gets its response
+                    // and the container is released below.
+                    LOG_ERROR << "Operation for " << job.container_name << " failed with an exception. " << e.what();
+                    response = job.failure_response;
+                }
+                catch (...)
+                {
+                    LOG_ERROR << "Operation for " << job.container_name << " failed with an unknown exception.";
+                    response = job.failure_response;
+                }
+            }
+            in_flight.add(-1);
+            complete_job(job, response);
+
+            // Release the container and schedule its next job if there's any.
+            bool has_next = false;
+            {
+                std::scoped_lock lock(dispatcher.jobs_mutex);
+                const auto itr = dispatcher.blocked_jobs.find(job.container_name);
+                if (itr == dispatcher.blocked_jobs.end())
+                {
+                    dispatcher.busy_containers.erase(job.container_name);
+                }
+                else
+                {
+                    dispatcher.ready_jobs.push_back(std::move(itr->second.front()));
+                    itr->second.pop_front();
+                    if (itr->second.empty())
+                        dispatcher.blocked_jobs.erase(itr);
+                    has_next = true;
+                }
+            }
+            if (has_next)
+                dispatcher.jobs_cv.notify_one();
+        }
+    }
+
+    /**
+     * Delivers the response of a job. Sync mode responses are sent to the waiting client and its
+     * connection is closed. Async mode responses are recorded against the operation. Batch item
+     * responses are handed over to the batch.
+     * @param job The completed job.
+     * @param response Response message of the job.
+     */
+    void complete_job(const dispatch_job &job, std::string_view response)
+    {
+        if (job.on_complete)
+        {
+            job.on_complete(response);
+        }
+        else if (job.operation_id.empty())
+        {
+            send(job.fd, response);
+            close(job.fd);
+            if (job.latency != NULL)
+                job.latency->observe(trace::get_epoch_microseconds() - job.received_us);
+        }
+        else
+        {
+            set_operation_state(job.operation_id, OPERATION_STATE::COMPLETED, response);
+        }
+    }
+
+    /**
+     * Updates the state of an async operation. Expired completed operations are removed when an operation completes.
+     * @param operation_id Id of the operation. Nothing is done if empty.
+     * @param state New state of the operation.
+     * @param response Final response of the operation if completed.
+     */
+    void set_operation_state(std::string_view operation_id, const OPERATION_STATE state, std::string_view response)
+    {
+        if (operation_id.empty())
+            return;
+
+        std::scoped_lock lock(dispatcher.operations_mutex);
+        const auto itr = dispatcher.operations.find(std::string(operation_id));
+        if (itr == dispatcher.operations.end())
+            return;
+
+        itr->second.state = state;
+        if (state != OPERATION_STATE::COMPLETED)
+            return;
+
+        const uint64_t now = util::get_epoch_milliseconds();
+        itr->second.response = response;
+        itr->second.completed_on = now;
+
+        for (auto op_itr = dispatcher.operations.begin(); op_itr != dispatcher.operations.end();)
+        {
+            if (op_itr->second.state == OPERATION_STATE::COMPLETED && (now - op_itr->second.completed_on) > OPERATION_RETENTION_MS)
+                op_itr = dispatcher.operations.erase(op_itr);
+            else
+                op_itr++;
+        }
+    }
+
+} // namespace comm
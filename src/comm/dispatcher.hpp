@@ -0,0 +1,77 @@
+#ifndef _SA_COMM_DISPATCHER_
+#define _SA_COMM_DISPATCHER_
+
+#include "../pchheader.hpp"
+#include "../metrics.hpp"
+
+namespace comm
+{
+    constexpr const char *OPERATION_STATES[]{"pending", "running", "completed"};
+
+    enum OPERATION_STATE
+    {
+        PENDING,
+        RUNNING,
+        COMPLETED
+    };
+
+    // Tracks an operation which was submitted in async mode.
+    struct operation
+    {
+        std::string id;
+        std::string container_name;
+        OPERATION_STATE state = OPERATION_STATE::PENDING;
+        std::string response;       // Final response message, populated once completed.
+        uint64_t completed_on = 0; // Epoch milliseconds of the completion.
+    };
+
+    // A long running operation to be executed by a worker.
+    struct dispatch_job
+    {
+        std::string container_name;                            // Jobs of the same container are executed one after the other.
+        int fd = -1;                                           // Client socket waiting for the response. -1 in async mode.
+        std::string operation_id;                              // Operation id to record the response against. Empty in sync mode.
+        std::function<void(std::string &res)> func;            // Executes the operation and populates the response message.
+        std::string busy_response;                             // Response to send if the job couldn't be executed.
+        std::string failure_response;                          // Response to send if the job threw while executing.
+        std::function<void(std::string_view res)> on_complete; // Receives the response instead of the client if set. Used by batch items.
+        std::string trace_id;                                  // Operation id the trace spans of the job are recorded against.
+        uint64_t dispatched_us = 0;                            // Epoch microseconds at which the job was queued.
+        metrics::metric *latency = NULL;                       // Message latency histogram to record the sync response against.
+        uint64_t received_us = 0;                              // Epoch microseconds at which the client message was received.
+    };
+
+    struct dispatcher_ctx
+    {
+        std::mutex jobs_mutex;
+        std::condition_variable jobs_cv;
+        std::deque<dispatch_job> ready_jobs;                                    // Jobs which can be picked up by any worker.
+        std::unordered_map<std::string, std::deque<dispatch_job>> blocked_jobs; // Jobs waiting for a busy container, keyed by container name.
+        std::unordered_set<std::string> busy_containers;                        // Containers which currently have a job in a worker.
+        size_t pending_count = 0;                                               // No. of jobs which are not yet picked up by a worker.
+        std::vector<std::thread> workers;
+        bool is_shutting_down = false;
+
+        std::mutex operations_mutex;
+        std::unordered_map<std::string, operation> operations; // Async operations keyed by operation id.
+    };
+
+    int init_dispatcher();
+
+    void deinit_dispatcher();
+
+    int dispatch(dispatch_job &&job);
+
+    void register_operation(std::string_view operation_id, std::string_view container_name);
+
+    int get_operation(std::string_view operation_id, operation &op);
+
+    void worker_loop();
+
+    void complete_job(const dispatch_job &job, std::string_view response);
+
+    void set_operation_state(std::string_view operation_id, const OPERATION_STATE state, std::string_view response = {});
+
+} // namespace comm
+
+#endif
@@ -70,9 +70,12 @@ namespace conf
             cfg.system.max_swap_kbytes = !swap_kbytes ? 3145728 : swap_kbytes;
             cfg.system.max_cpu_us = !cpu_us ? 900000 : cpu_us; // Total CPU allocation out of 1000000 microsec (1 sec).
             cfg.system.max_storage_kbytes = !disk_kbytes ? 5242880 : disk_kbytes;
+            cfg.system.template_mode = "copy";
+            cfg.system.provisioner = "native";
 
             cfg.docker.image_prefix = "evernode/sashimono:";
             cfg.docker.registry_port = docker_registry_port;
+            cfg.docker.image_cache_max_kbytes = 5242880;
 
             cfg.log.max_file_count = 50;
             cfg.log.max_mbytes_per_file = 10;
@@ -116,6 +119,8 @@ namespace conf
 
         ctx.hpfs_exe_path = ctx.exe_dir + "/hpfs";
         ctx.user_install_sh = ctx.exe_dir + "/user-install.sh";
+        ctx.user_assign_sh = ctx.exe_dir + "/user-assign.sh";
+        ctx.image_prefetch_sh = ctx.exe_dir + "/image-prefetch.sh";
         ctx.dns_evernode_sh = ctx.exe_dir + "/dns_evernode.sh";
         ctx.user_uninstall_sh = ctx.exe_dir + "/user-uninstall.sh";
 
@@ -132,12 +137,14 @@ namespace conf
      */
     int validate_dir_paths()
     {
-        const std::string paths[6] = {
+        const std::string paths[8] = {
             ctx.config_file,
             ctx.log_dir,
             ctx.data_dir,
             ctx.contract_template_path,
             ctx.user_install_sh,
+            ctx.user_assign_sh,
+            ctx.image_prefetch_sh,
             ctx.user_uninstall_sh};
 
         for (const std::string &path : paths)
@@ -267,6 +274,14 @@ namespace conf
                 cfg.system.max_cpu_us = system["max_cpu_us"].as<size_t>();
                 cfg.system.max_storage_kbytes = system["max_storage_kbytes"].as<size_t>();
                 cfg.system.max_instance_count = system["max_instance_count"].as<size_t>();
+                if (system.contains("max_io_read_bps"))
+                    cfg.system.max_io_read_bps = system["max_io_read_bps"].as<size_t>();
+                if (system.contains("max_io_write_bps"))
+                    cfg.system.max_io_write_bps = system["max_io_write_bps"].as<size_t>();
+                if (system.contains("warm_pool_size"))
+                    cfg.system.warm_pool_size = system["warm_pool_size"].as<size_t>();
+                cfg.system.template_mode = system.contains("template_mode") ? system["template_mode"].as<std::string>() : "copy";
+                cfg.system.provisioner = system.contains("provisioner") ? system["provisioner"].as<std::string>() : "native";
             }
             catch (const std::exception &e)
             {
@@ -285,6 +300,9 @@ namespace conf
 
                 if (docker.contains("registry_port"))
                     cfg.docker.registry_port = docker["registry_port"].as<uint16_t>();
+
+                if (docker.contains("image_cache_max_kbytes"))
+                    cfg.docker.image_cache_max_kbytes = docker["image_cache_max_kbytes"].as<size_t>();
             }
             catch (const std::exception &e)
             {
@@ -356,6 +374,11 @@ namespace conf
             system_config.insert_or_assign("max_cpu_us", cfg.system.max_cpu_us);
             system_config.insert_or_assign("max_storage_kbytes", cfg.system.max_storage_kbytes);
             system_config.insert_or_assign("max_instance_count", cfg.system.max_instance_count);
+            system_config.insert_or_assign("max_io_read_bps", cfg.system.max_io_read_bps);
+            system_config.insert_or_assign("max_io_write_bps", cfg.system.max_io_write_bps);
+            system_config.insert_or_assign("warm_pool_size", cfg.system.warm_pool_size);
+            system_config.insert_or_assign("template_mode", cfg.system.template_mode);
+            system_config.insert_or_assign("provisioner", cfg.system.provisioner);
 
             d.insert_or_assign("system", system_config);
         }
@@ -364,6 +387,7 @@ namespace conf
         {
             jsoncons::ojson docker_config;
             docker_config.insert_or_assign("registry_port", cfg.docker.registry_port);
+            docker_config.insert_or_assign("image_cache_max_kbytes", cfg.docker.image_cache_max_kbytes);
             d.insert_or_assign("docker", docker_config);
         }
 
@@ -478,6 +502,18 @@ namespace conf
             return -1;
         }
 
+        if (cfg.system.template_mode != "copy" && cfg.system.template_mode != "overlay")
+        {
+            std::cerr << "Invalid template_mode configured. Valid values: copy|overlay\n";
+            return -1;
+        }
+
+        if (cfg.system.provisioner != "native" && cfg.system.provisioner != "script")
+        {
+            std::cerr << "Invalid provisioner configured. Valid values: native|script\n";
+            return -1;
+        }
+
         return 0;
     }
 
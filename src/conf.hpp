@@ -82,13 +82,19 @@ namespace conf
         size_t max_swap_kbytes = 0;    // Max swap memory allocated to all instances in KB.
         size_t max_storage_kbytes = 0; // Max physical storage  allocated to all instances in KB.
         size_t max_instance_count = 0; // Max number of instances that can be created.
+        size_t max_io_read_bps = 0;    // Max disk read bandwidth shared by all instances in bytes per sec. 0 means unlimited (cgroup v2 only).
+        size_t max_io_write_bps = 0;   // Max disk write bandwidth shared by all instances in bytes per sec. 0 means unlimited (cgroup v2 only).
+        size_t warm_pool_size = 0;     // No. of pre-provisioned instance users kept ready for new instances. 0 disables the pool.
+        std::string template_mode;     // How instances get the contract template (copy | overlay).
+        std::string provisioner;       // How instance users are provisioned (native | script).
     };
 
     struct docker_config
     {
-        std::string image_prefix;     // Docker image prefixes allowed to be used for contracts.
-        uint16_t registry_port = 0;   // 0 means bypass private docker registry.
-        std::string registry_address; // This is dynamically constructed at load time.
+        std::string image_prefix;          // Docker image prefixes allowed to be used for contracts.
+        uint16_t registry_port = 0;        // 0 means bypass private docker registry.
+        std::string registry_address;      // This is dynamically constructed at load time.
+        size_t image_cache_max_kbytes = 0; // Disk budget of the image store. 0 means unbounded.
     };
 
     struct sa_config
@@ -110,7 +116,10 @@ namespace conf
         std::string socket_path; // Path to the unix socket file.
 
         std::string user_install_sh;
+        std::string user_assign_sh;
+        std::string image_prefetch_sh;
         std::string user_uninstall_sh;
+        std::string dns_evernode_sh;
 
         std::string config_file; // Full path to the config file.
         std::string log_dir;     // Log directory full path.
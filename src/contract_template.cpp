@@ -0,0 +1,636 @@
+#include "contract_template.hpp"
+#include "conf.hpp"
+
+namespace contract_template
+{
+    constexpr const char *STAGING_DIR_TEMPLATE = ".sashiXXXXXX";
+    constexpr const char *TEMPLATE_STORE_DIR = "/template_store";
+    constexpr mode_t CONTRACT_DIR_PERMS = 0775;
+    constexpr mode_t TEMPLATE_STORE_PERMS = 0700; // The template is only reached through the overlays.
+    constexpr mode_t OVERLAY_DIR_PERMS = 0700;
+    constexpr size_t VERSION_BYTES = 16; // Length of the template version hash.
+    constexpr uid_t PROBE_UGID = 65534;  // Owner the probe mount maps the template to.
+
+    // Read-only lower directory of the current template version. Only populated in overlay mode.
+    std::string lower_dir;
+
+    /**
+     * Prepares the shared template when running in overlay mode. The template is unpacked once into a
+     * directory named after the hash of its contents, so instances created from an older template keep
+     * their own lower directory. Falls back to copy mode if the kernel cannot mount an overlay over an
+     * idmapped lower dir.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        if (conf::cfg.system.template_mode != MODE_OVERLAY)
+            return 0;
+
+        std::string version;
+        if (get_template_version(version) == -1)
+            return -1;
+
+        const std::string store_dir = conf::ctx.data_dir + TEMPLATE_STORE_DIR;
+        if (util::create_dir_tree_recursive(store_dir) == -1 || chmod(store_dir.data(), TEMPLATE_STORE_PERMS) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating contract template store " << store_dir;
+            return -1;
+        }
+
+        if (!is_idmapped_overlay_supported(store_dir))
+        {
+            LOG_WARNING << "Overlays over idmapped mounts are not supported by the kernel (needs Linux 5.19). Using copy mode for the contract template.";
+            return 0;
+        }
+
+        lower_dir = store_dir + "/" + version;
+        if (util::is_dir_exists(lower_dir))
+        {
+            // Templates unpacked by older versions had other permissions.
+            const int dir_fd = open(lower_dir.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd == -1 || set_tree_owner(dir_fd, 0, 0, CONTRACT_DIR_PERMS, CONTRACT_DIR_PERMS) == -1)
+            {
+                LOG_ERROR << errno << ": Error setting the permissions of contract template " << lower_dir;
+                return -1;
+            }
+            return 0;
+        }
+
+        // The template is owned by root with the permissions of a copied contract. Each overlay maps root to its
+        // instance user (see mount_overlay), so the instance sees the template owned the same way as a copy.
+        std::string staging_dir = store_dir + "/" + STAGING_DIR_TEMPLATE;
+        if (mkdtemp(staging_dir.data()) == NULL)
+        {
+            LOG_ERROR << errno << ": Error creating template staging directory in " << store_dir;
+            return -1;
+        }
+
+        if (chmod(staging_dir.data(), CONTRACT_DIR_PERMS) == -1 ||
+            util::copy_dir_tree(conf::ctx.contract_template_path, staging_dir, 0, 0, CONTRACT_DIR_PERMS) == -1 ||
+            rename(staging_dir.data(), lower_dir.data()) == -1)
+        {
+            LOG_ERROR << errno << ": Error unpacking contract template to " << lower_dir;
+            util::remove_directory_recursively(staging_dir);
+            return -1;
+        }
+
+        LOG_INFO << "Unpacked contract template version " << version;
+        return 0;
+    }
+
+    /**
+     * Checks whether an overlay can be mounted over an idmapped lower dir by mounting one over an empty directory.
+     * Idmapped mounts need Linux 5.12 and overlays accept them as layers from Linux 5.19.
+     * @param store_dir Template store directory to create the probe in.
+     * @return true if supported otherwise false.
+     */
+    bool is_idmapped_overlay_supported(std::string_view store_dir)
+    {
+        std::string probe_dir = std::string(store_dir) + "/" + STAGING_DIR_TEMPLATE;
+        if (mkdtemp(probe_dir.data()) == NULL)
+        {
+            LOG_ERROR << errno << ": Error creating overlay probe directory in " << store_dir;
+            return false;
+        }
+
+        const std::string empty_dir = probe_dir + "/empty";
+        const std::string merged_dir = probe_dir + "/merged";
+        const bool supported = mkdir(empty_dir.data(), OVERLAY_DIR_PERMS) == 0 &&
+                               mkdir((probe_dir + "/upper").data(), OVERLAY_DIR_PERMS) == 0 &&
+                               mkdir((probe_dir + "/work").data(), OVERLAY_DIR_PERMS) == 0 &&
+                               mkdir(merged_dir.data(), OVERLAY_DIR_PERMS) == 0 &&
+                               mount_layers(empty_dir, probe_dir, merged_dir, PROBE_UGID, PROBE_UGID) == 0;
+        if (supported)
+            umount2(merged_dir.data(), MNT_DETACH);
+
+        util::remove_directory_recursively(probe_dir);
+        return supported;
+    }
+
+    /**
+     * Removes the unpacked template versions which are neither the current one nor the lower dir of an overlay
+     * instance, along with the staging dirs left by an interrupted unpack. Nothing is removed if the lower dir of
+     * an instance cannot be read.
+     * @param contract_dirs Contract directories of all the instances.
+     */
+    void remove_unused_templates(const std::vector<std::string> &contract_dirs)
+    {
+        const std::string store_dir = conf::ctx.data_dir + TEMPLATE_STORE_DIR;
+        if (!util::is_dir_exists(store_dir))
+            return;
+
+        std::set<std::string> used_dirs;
+        if (!lower_dir.empty())
+            used_dirs.emplace(lower_dir);
+
+        for (const std::string &contract_dir : contract_dirs)
+        {
+            char lower[PATH_MAX];
+            const ssize_t len = readlink((get_overlay_dir(contract_dir) + "/lower").data(), lower, sizeof(lower) - 1);
+            if (len != -1)
+            {
+                used_dirs.emplace(lower, len);
+            }
+            else if (errno != ENOENT) // Copied contracts have no overlay dir.
+            {
+                LOG_ERROR << errno << ": Error reading overlay lower dir of " << contract_dir << ". Skipping template cleanup.";
+                return;
+            }
+        }
+
+        DIR *dir = opendir(store_dir.data());
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error opening contract template store " << store_dir;
+            return;
+        }
+
+        std::vector<std::string> unused_dirs;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            const std::string path = store_dir + "/" + entry->d_name;
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && used_dirs.count(path) == 0)
+                unused_dirs.push_back(path);
+        }
+        closedir(dir);
+
+        for (const std::string &path : unused_dirs)
+        {
+            if (util::remove_directory_recursively(path) == -1)
+                LOG_ERROR << errno << ": Error removing unused contract template " << path;
+            else
+                LOG_INFO << "Removed unused contract template " << path;
+        }
+    }
+
+    /**
+     * Creates the directory in which the contract config should be modified before calling commit.
+     * In copy mode this is a staging copy of the template next to the contract dir, so the final rename is atomic.
+     * In overlay mode the shared template is mounted at the contract dir and writes go to a per instance upper layer.
+     * @param work_dir The directory to modify the contract in.
+     * @param contract_dir Contract directory of the instance.
+     * @param user Instance user.
+     * @return 0 on success and -1 on error.
+     */
+    int prepare(std::string &work_dir, std::string_view contract_dir, const util::user_info &user)
+    {
+        if (lower_dir.empty())
+        {
+            work_dir = util::get_user_contract_dir(user.username, STAGING_DIR_TEMPLATE);
+            if (mkdtemp(work_dir.data()) == NULL)
+            {
+                LOG_ERROR << errno << ": Error creating staging directory to create contract folder.";
+                return -1;
+            }
+
+            // Give group write access to the contract directory, So contract user can write into it.
+            if (chown(work_dir.data(), user.user_id, user.group_id) == -1 || chmod(work_dir.data(), CONTRACT_DIR_PERMS) == -1 ||
+                util::copy_dir_tree(conf::ctx.contract_template_path, work_dir, user.user_id, user.group_id, CONTRACT_DIR_PERMS) == -1)
+            {
+                LOG_ERROR << errno << ": Default contract copying failed to " << work_dir;
+                util::remove_directory_recursively(work_dir);
+                return -1;
+            }
+
+            return 0;
+        }
+
+        // Root of the upper layer becomes the root of the merged contract dir.
+        const std::string overlay_dir = get_overlay_dir(contract_dir);
+        const std::string upper_dir = overlay_dir + "/upper";
+        const std::string work_overlay_dir = overlay_dir + "/work";
+        if (mkdir(overlay_dir.data(), OVERLAY_DIR_PERMS) == -1 ||
+            mkdir(upper_dir.data(), CONTRACT_DIR_PERMS) == -1 ||
+            mkdir(work_overlay_dir.data(), OVERLAY_DIR_PERMS) == -1 ||
+            chown(upper_dir.data(), user.user_id, user.group_id) == -1 || chmod(upper_dir.data(), CONTRACT_DIR_PERMS) == -1 ||
+            symlink(lower_dir.data(), (overlay_dir + "/lower").data()) == -1 ||
+            mkdir(contract_dir.data(), CONTRACT_DIR_PERMS) == -1 ||
+            mount_overlay(contract_dir, user) == -1)
+        {
+            LOG_ERROR << errno << ": Error preparing contract overlay in " << contract_dir;
+            discard(contract_dir, contract_dir);
+            return -1;
+        }
+
+        work_dir = contract_dir;
+        return 0;
+    }
+
+    /**
+     * Makes the prepared contract available in the contract dir.
+     * @param work_dir The directory returned by prepare.
+     * @param contract_dir Contract directory of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int commit(std::string_view work_dir, std::string_view contract_dir)
+    {
+        if (work_dir == contract_dir)
+            return 0;
+
+        if (rename(work_dir.data(), contract_dir.data()) == -1)
+        {
+            LOG_ERROR << errno << ": Default contract moving failed to " << contract_dir;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Removes a contract which was prepared but not committed.
+     * @param work_dir The directory returned by prepare.
+     * @param contract_dir Contract directory of the instance.
+     */
+    void discard(std::string_view work_dir, std::string_view contract_dir)
+    {
+        if (work_dir == contract_dir)
+        {
+            const std::string overlay_dir = get_overlay_dir(contract_dir);
+            umount2(contract_dir.data(), MNT_DETACH);
+            umount2((overlay_dir + "/lower_mnt").data(), MNT_DETACH);
+            util::remove_directory_recursively(overlay_dir);
+            rmdir(contract_dir.data());
+        }
+        else
+        {
+            util::remove_directory_recursively(work_dir);
+        }
+    }
+
+    /**
+     * Mounts the overlay of an instance at its contract dir unless it's already mounted.
+     * Mounts do not survive a reboot, so this is done for existing overlay instances at startup.
+     * @param contract_dir Contract directory of the instance.
+     * @param user Instance user. The template is mapped to be owned by this user.
+     * @return 0 on success and -1 on error.
+     */
+    int mount_overlay(std::string_view contract_dir, const util::user_info &user)
+    {
+        const std::string overlay_dir = get_overlay_dir(contract_dir);
+
+        char lower[PATH_MAX];
+        const ssize_t len = readlink((overlay_dir + "/lower").data(), lower, sizeof(lower) - 1);
+        if (len == -1)
+        {
+            LOG_ERROR << errno << ": Error reading overlay lower dir of " << contract_dir;
+            return -1;
+        }
+        lower[len] = '\0';
+
+        // A mount point is on a different device than its parent.
+        struct stat contract_st, parent_st;
+        if (stat(contract_dir.data(), &contract_st) == -1 || stat(overlay_dir.data(), &parent_st) == -1)
+        {
+            LOG_ERROR << errno << ": Error in stat of contract dir " << contract_dir;
+            return -1;
+        }
+        if (contract_st.st_dev != parent_st.st_dev)
+            return 0;
+
+        if (mount_layers(lower, overlay_dir, contract_dir, user.user_id, user.group_id) == -1)
+        {
+            LOG_ERROR << errno << ": Error mounting contract overlay at " << contract_dir;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Mounts an overlay whose lower dir is seen through an idmapped mount which maps root to the given user. The
+     * template files then appear owned by the instance user without changing them, so no file is copied up until
+     * the instance writes to it. The idmapped mount is only needed while the overlay is mounted, since the overlay
+     * keeps its own private copy of the layer mounts.
+     * @param lower Lower directory.
+     * @param overlay_dir Directory holding the upper, work and lower_mnt dirs.
+     * @param target Mount point of the overlay.
+     * @param uid User id root is mapped to.
+     * @param gid Group id root is mapped to.
+     * @return 0 on success and -1 on error.
+     */
+    int mount_layers(std::string_view lower, std::string_view overlay_dir, std::string_view target, const uid_t uid, const gid_t gid)
+    {
+        const std::string lower_mnt = std::string(overlay_dir) + "/lower_mnt";
+        if ((mkdir(lower_mnt.data(), OVERLAY_DIR_PERMS) == -1 && errno != EEXIST) ||
+            mount_idmapped(lower, lower_mnt, uid, gid) == -1)
+            return -1;
+
+        const std::string options = "lowerdir=" + lower_mnt + ",upperdir=" + std::string(overlay_dir) + "/upper,workdir=" + std::string(overlay_dir) + "/work";
+        const int ret = mount("overlay", target.data(), "overlay", 0, options.data());
+
+        const int mount_errno = errno;
+        umount2(lower_mnt.data(), MNT_DETACH);
+        errno = mount_errno;
+        return ret;
+    }
+
+    /**
+     * Attaches a read-only clone of a directory at the target with root mapped to the given user and group.
+     * @param src Directory to clone.
+     * @param target Mount point of the clone.
+     * @param uid User id root is mapped to.
+     * @param gid Group id root is mapped to.
+     * @return 0 on success and -1 on error.
+     */
+    int mount_idmapped(std::string_view src, std::string_view target, const uid_t uid, const gid_t gid)
+    {
+        // A previous mount may have been left behind if the agent stopped in between.
+        umount2(target.data(), MNT_DETACH | UMOUNT_NOFOLLOW);
+
+        const int userns_fd = create_user_ns(uid, gid);
+        if (userns_fd == -1)
+            return -1;
+
+        const int tree_fd = syscall(SYS_open_tree, AT_FDCWD, src.data(), OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+        if (tree_fd == -1)
+        {
+            close(userns_fd);
+            return -1;
+        }
+
+        struct mount_attr attr = {};
+        attr.attr_set = MOUNT_ATTR_IDMAP | MOUNT_ATTR_RDONLY;
+        attr.userns_fd = userns_fd;
+        const int ret = (syscall(SYS_mount_setattr, tree_fd, "", AT_EMPTY_PATH, &attr, sizeof(attr)) == -1 ||
+                         syscall(SYS_move_mount, tree_fd, "", AT_FDCWD, target.data(), MOVE_MOUNT_F_EMPTY_PATH) == -1)
+                            ? -1
+                            : 0;
+
+        const int mount_errno = errno;
+        close(tree_fd);
+        close(userns_fd);
+        errno = mount_errno;
+        return ret;
+    }
+
+    /**
+     * Creates a user namespace in which root is the given user and group. The namespace is held by a child which
+     * waits until the namespace fd has been opened and then exits.
+     * @param uid User id root is mapped to.
+     * @param gid Group id root is mapped to.
+     * @return The user namespace fd on success and -1 on error.
+     */
+    int create_user_ns(const uid_t uid, const gid_t gid)
+    {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+            return -1;
+
+        // Cloned like fork but straight into a new user namespace. The child waits for the write end to be closed.
+        const pid_t pid = syscall(SYS_clone, CLONE_NEWUSER | SIGCHLD, 0, NULL, NULL, 0);
+        if (pid == 0)
+        {
+            char c;
+            close(pipe_fds[1]);
+            while (read(pipe_fds[0], &c, 1) == -1 && errno == EINTR)
+                ;
+            _exit(0);
+        }
+
+        close(pipe_fds[0]);
+        if (pid == -1)
+        {
+            close(pipe_fds[1]);
+            return -1;
+        }
+
+        const std::string proc_dir = "/proc/" + std::to_string(pid);
+        const auto write_map = [](const std::string &path, const std::string &map) {
+            const int fd = open(path.data(), O_WRONLY | O_CLOEXEC);
+            const bool written = fd != -1 && write(fd, map.data(), map.size()) == (ssize_t)map.size();
+            if (fd != -1)
+                close(fd);
+            return written;
+        };
+
+        int userns_fd = -1;
+        if (write_map(proc_dir + "/uid_map", "0 " + std::to_string(uid) + " 1\n") &&
+            write_map(proc_dir + "/gid_map", "0 " + std::to_string(gid) + " 1\n"))
+            userns_fd = open((proc_dir + "/ns/user").data(), O_RDONLY | O_CLOEXEC);
+
+        const int ns_errno = errno;
+        close(pipe_fds[1]);
+        waitpid(pid, NULL, 0);
+        errno = ns_errno;
+        return userns_fd;
+    }
+
+    /**
+     * Sets the owner and permissions of a directory tree including the directory itself. Entries which already have
+     * them are left untouched. Symlinks only get the owner.
+     * @param dir_fd Directory fd. Ownership is taken over and it's closed before returning.
+     * @param uid Owner user id.
+     * @param gid Owner group id.
+     * @param dir_mode Permissions of the directories.
+     * @param file_mode Permissions of the other entries.
+     * @return 0 on success and -1 on error.
+     */
+    int set_tree_owner(const int dir_fd, const uid_t uid, const gid_t gid, const mode_t dir_mode, const mode_t file_mode)
+    {
+        struct stat dir_st;
+        if (fstat(dir_fd, &dir_st) == -1 ||
+            ((dir_st.st_uid != uid || dir_st.st_gid != gid) && fchown(dir_fd, uid, gid) == -1) ||
+            ((dir_st.st_mode & 07777) != dir_mode && fchmod(dir_fd, dir_mode) == -1))
+        {
+            close(dir_fd);
+            return -1;
+        }
+
+        DIR *dir = fdopendir(dir_fd);
+        if (dir == NULL)
+        {
+            close(dir_fd);
+            return -1;
+        }
+
+        int ret = 0;
+        struct dirent *entry;
+        while (ret == 0 && (entry = readdir(dir)) != NULL)
+        {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            struct stat st;
+            if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                ret = -1;
+            }
+            else if (S_ISDIR(st.st_mode))
+            {
+                const int child_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                ret = child_fd == -1 ? -1 : set_tree_owner(child_fd, uid, gid, dir_mode, file_mode);
+            }
+            else
+            {
+                if ((st.st_uid != uid || st.st_gid != gid) && fchownat(dir_fd, name, uid, gid, AT_SYMLINK_NOFOLLOW) == -1)
+                    ret = -1;
+                else if (!S_ISLNK(st.st_mode) && (st.st_mode & 07777) != file_mode && fchmodat(dir_fd, name, file_mode, 0) == -1)
+                    ret = -1;
+            }
+        }
+
+        closedir(dir);
+        return ret;
+    }
+
+    /**
+     * Unmounts the overlay of an instance and removes its upper layer. Does nothing for copied contracts.
+     * @param contract_dir Contract directory of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int unmount_overlay(std::string_view contract_dir)
+    {
+        if (!is_overlay(contract_dir))
+            return 0;
+
+        // Lazy unmount since the container may still be holding the contract dir.
+        if (umount2(contract_dir.data(), MNT_DETACH) == -1 && errno != EINVAL)
+        {
+            LOG_ERROR << errno << ": Error unmounting contract overlay at " << contract_dir;
+            return -1;
+        }
+
+        // The lower_mnt dir is only a mount point while an overlay is being mounted, but an interrupted mount could
+        // leave the template attached there and the removal below would then delete the template files.
+        const std::string overlay_dir = get_overlay_dir(contract_dir);
+        umount2((overlay_dir + "/lower_mnt").data(), MNT_DETACH);
+
+        if (util::remove_directory_recursively(overlay_dir) == -1)
+        {
+            LOG_ERROR << errno << ": Error removing contract overlay of " << contract_dir;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Checks whether the contract of an instance was created as an overlay.
+     * @param contract_dir Contract directory of the instance.
+     * @return true if the instance has an overlay.
+     */
+    bool is_overlay(std::string_view contract_dir)
+    {
+        struct stat st;
+        return lstat((get_overlay_dir(contract_dir) + "/lower").data(), &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    /**
+     * Get the directory holding the upper and work dirs of the overlay. This is a hidden sibling of the contract dir.
+     * @param contract_dir Contract directory of the instance.
+     * @return Overlay directory path.
+     */
+    const std::string get_overlay_dir(std::string_view contract_dir)
+    {
+        const size_t pos = contract_dir.find_last_of('/');
+        return std::string(contract_dir.substr(0, pos + 1)) + "." + std::string(contract_dir.substr(pos + 1)) + ".overlay";
+    }
+
+    /**
+     * Calculates the version of the contract template as the hash of its contents.
+     * @param version Hex encoded template version.
+     * @return 0 on success and -1 on error.
+     */
+    int get_template_version(std::string &version)
+    {
+        const int dir_fd = open(conf::ctx.contract_template_path.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening contract template " << conf::ctx.contract_template_path;
+            return -1;
+        }
+
+        crypto_generichash_state state;
+        crypto_generichash_init(&state, NULL, 0, VERSION_BYTES);
+        if (hash_dir_tree(state, dir_fd, "") == -1)
+            return -1;
+
+        std::string hash(VERSION_BYTES, '\0');
+        crypto_generichash_final(&state, reinterpret_cast<unsigned char *>(hash.data()), hash.size());
+        version = util::to_hex(hash);
+        return 0;
+    }
+
+    /**
+     * Adds the paths, modes and contents of the entries under the given directory to the hash in a stable order.
+     * @param state Hash state.
+     * @param dir_fd Directory fd. Ownership is taken over and it's closed before returning.
+     * @param rel_path Path of the directory relative to the template root.
+     * @return 0 on success and -1 on error.
+     */
+    int hash_dir_tree(crypto_generichash_state &state, const int dir_fd, std::string_view rel_path)
+    {
+        DIR *dir = fdopendir(dir_fd);
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error opening template directory " << rel_path;
+            close(dir_fd);
+            return -1;
+        }
+
+        std::set<std::string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                names.emplace(entry->d_name);
+        }
+
+        int ret = 0;
+        for (auto itr = names.begin(); ret == 0 && itr != names.end(); itr++)
+        {
+            const std::string entry_path = std::string(rel_path) + "/" + *itr;
+            struct stat st;
+            if (fstatat(dir_fd, itr->data(), &st, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                LOG_ERROR << errno << ": Error in stat of template entry " << entry_path;
+                ret = -1;
+                break;
+            }
+
+            const std::string header = entry_path + ":" + std::to_string(st.st_mode) + ":" + std::to_string(st.st_size) + "\n";
+            crypto_generichash_update(&state, reinterpret_cast<const unsigned char *>(header.data()), header.size());
+
+            if (S_ISDIR(st.st_mode))
+            {
+                const int child_fd = openat(dir_fd, itr->data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                ret = child_fd == -1 ? -1 : hash_dir_tree(state, child_fd, entry_path);
+            }
+            else if (S_ISLNK(st.st_mode))
+            {
+                char target[PATH_MAX];
+                const ssize_t len = readlinkat(dir_fd, itr->data(), target, sizeof(target));
+                if (len == -1)
+                    ret = -1;
+                else
+                    crypto_generichash_update(&state, reinterpret_cast<const unsigned char *>(target), len);
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                const int fd = openat(dir_fd, itr->data(), O_RDONLY | O_CLOEXEC);
+                if (fd == -1)
+                {
+                    ret = -1;
+                    break;
+                }
+
+                unsigned char buf[65536];
+                ssize_t read_bytes;
+                while ((read_bytes = read(fd, buf, sizeof(buf))) > 0)
+                    crypto_generichash_update(&state, buf, read_bytes);
+                if (read_bytes == -1)
+                    ret = -1;
+                close(fd);
+            }
+        }
+
+        if (ret == -1)
+            LOG_ERROR << errno << ": Error hashing contract template at " << rel_path;
+
+        closedir(dir);
+        return ret;
+    }
+
+} // namespace contract_template
@@ -0,0 +1,46 @@
+#ifndef _SA_CONTRACT_TEMPLATE_
+#define _SA_CONTRACT_TEMPLATE_
+
+#include "pchheader.hpp"
+#include "util/util.hpp"
+
+namespace contract_template
+{
+    constexpr const char *MODE_COPY = "copy";       // Each instance gets a full copy of the template.
+    constexpr const char *MODE_OVERLAY = "overlay"; // Each instance gets an overlay on top of a shared read-only template.
+
+    int init();
+
+    bool is_idmapped_overlay_supported(std::string_view store_dir);
+
+    void remove_unused_templates(const std::vector<std::string> &contract_dirs);
+
+    int prepare(std::string &work_dir, std::string_view contract_dir, const util::user_info &user);
+
+    int commit(std::string_view work_dir, std::string_view contract_dir);
+
+    void discard(std::string_view work_dir, std::string_view contract_dir);
+
+    int mount_overlay(std::string_view contract_dir, const util::user_info &user);
+
+    int mount_layers(std::string_view lower, std::string_view overlay_dir, std::string_view target, const uid_t uid, const gid_t gid);
+
+    int mount_idmapped(std::string_view src, std::string_view target, const uid_t uid, const gid_t gid);
+
+    int create_user_ns(const uid_t uid, const gid_t gid);
+
+    int set_tree_owner(const int dir_fd, const uid_t uid, const gid_t gid, const mode_t dir_mode, const mode_t file_mode);
+
+    int unmount_overlay(std::string_view contract_dir);
+
+    bool is_overlay(std::string_view contract_dir);
+
+    const std::string get_overlay_dir(std::string_view contract_dir);
+
+    int get_template_version(std::string &version);
+
+    int hash_dir_tree(crypto_generichash_state &state, const int dir_fd, std::string_view rel_path);
+
+} // namespace contract_template
+
+#endif
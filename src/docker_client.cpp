@@ -0,0 +1,427 @@
+#include "docker_client.hpp"
+#include "util/util.hpp"
+
+namespace docker
+{
+    constexpr int DEFAULT_TIMEOUT_SECS = 30; // Container stop waits 10 seconds for the container before killing it.
+    constexpr const char *HTTP_HEADER_END = "\r\n\r\n";
+    constexpr const char *HTTP_CRLF = "\r\n";
+    constexpr const char *CHUNKED_ENCODING = "transfer-encoding: chunked";
+    constexpr int HTTP_NOT_MODIFIED = 304; // Returned by start/stop if the container is already in the requested state.
+    constexpr int HTTP_NOT_FOUND = 404;
+
+    /**
+     * Get the path of the rootless docker daemon socket of the given user.
+     * @param socket_path Socket path to be populated.
+     * @param username Username of the instance user.
+     * @return 0 on success and -1 on error.
+     */
+    int get_user_socket_path(std::string &socket_path, std::string_view username)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+
+        socket_path = "/run/user/" + std::to_string(user.user_id) + "/docker.sock";
+        return 0;
+    }
+
+    /**
+     * Creates a container. The image must already be available to the daemon.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param spec Settings of the container.
+     * @param timeout_secs Max time to wait for the daemon.
+     * @return 0 on success and -1 on error.
+     */
+    int create_container(api_error &error, std::string_view socket_path, const container_spec &spec, const int timeout_secs)
+    {
+        jsoncons::ojson d;
+        d.insert_or_assign("Image", spec.image);
+
+        jsoncons::ojson cmd(jsoncons::json_array_arg);
+        for (const std::string &arg : spec.cmd)
+            cmd.push_back(arg);
+        d.insert_or_assign("Cmd", cmd);
+
+        d.insert_or_assign("Tty", true);
+        d.insert_or_assign("OpenStdin", true);
+        d.insert_or_assign("StopSignal", spec.stop_signal);
+
+        jsoncons::ojson exposed_ports;
+        jsoncons::ojson port_bindings;
+        for (const port_mapping &mapping : spec.ports)
+        {
+            const std::string host_port = std::to_string(mapping.port);
+            const std::string key = host_port + (mapping.is_udp ? "/udp" : "/tcp");
+            exposed_ports.insert_or_assign(key, jsoncons::ojson());
+
+            jsoncons::ojson binding;
+            binding.insert_or_assign("HostPort", host_port);
+            jsoncons::ojson bindings(jsoncons::json_array_arg);
+            bindings.push_back(binding);
+            port_bindings.insert_or_assign(key, bindings);
+        }
+        d.insert_or_assign("ExposedPorts", exposed_ports);
+
+        jsoncons::ojson host_config;
+        host_config.insert_or_assign("PortBindings", port_bindings);
+
+        jsoncons::ojson mount;
+        mount.insert_or_assign("Type", "bind");
+        mount.insert_or_assign("Source", spec.bind_source);
+        mount.insert_or_assign("Target", spec.bind_target);
+        jsoncons::ojson mounts(jsoncons::json_array_arg);
+        mounts.push_back(mount);
+        host_config.insert_or_assign("Mounts", mounts);
+
+        jsoncons::ojson restart_policy;
+        restart_policy.insert_or_assign("Name", spec.restart_policy);
+        host_config.insert_or_assign("RestartPolicy", restart_policy);
+
+        jsoncons::ojson log_opts;
+        for (const auto &[key, value] : spec.log_opts)
+            log_opts.insert_or_assign(key, value);
+        jsoncons::ojson log_config;
+        log_config.insert_or_assign("Type", spec.log_driver);
+        log_config.insert_or_assign("Config", log_opts);
+        host_config.insert_or_assign("LogConfig", log_config);
+
+        d.insert_or_assign("HostConfig", host_config);
+
+        std::string response_body;
+        return send_request(error, socket_path, "POST", "/containers/create?name=" + spec.name, d.to_string(), timeout_secs, response_body);
+    }
+
+    /**
+     * Starts a container. Starting an already running container is not an error.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param container_name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int start_container(api_error &error, std::string_view socket_path, std::string_view container_name)
+    {
+        std::string response_body;
+        return send_request(error, socket_path, "POST", "/containers/" + std::string(container_name) + "/start", {}, DEFAULT_TIMEOUT_SECS, response_body);
+    }
+
+    /**
+     * Stops a container using its stop signal. Stopping an already stopped container is not an error.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param container_name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int stop_container(api_error &error, std::string_view socket_path, std::string_view container_name)
+    {
+        std::string response_body;
+        return send_request(error, socket_path, "POST", "/containers/" + std::string(container_name) + "/stop", {}, DEFAULT_TIMEOUT_SECS, response_body);
+    }
+
+    /**
+     * Removes a container. Running containers are killed before removing.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param container_name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_container(api_error &error, std::string_view socket_path, std::string_view container_name)
+    {
+        std::string response_body;
+        return send_request(error, socket_path, "DELETE", "/containers/" + std::string(container_name) + "?force=true", {}, DEFAULT_TIMEOUT_SECS, response_body);
+    }
+
+    /**
+     * Get the state of a container (created, running, exited etc.).
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param container_name Name of the container.
+     * @param status Container state to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int inspect_container_status(api_error &error, std::string_view socket_path, std::string_view container_name, std::string &status)
+    {
+        std::string response_body;
+        if (send_request(error, socket_path, "GET", "/containers/" + std::string(container_name) + "/json", {}, DEFAULT_TIMEOUT_SECS, response_body) == -1)
+            return -1;
+
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(response_body);
+            status = d["State"]["Status"].as<std::string>();
+        }
+        catch (const std::exception &e)
+        {
+            error.message = std::string("Invalid inspect response. ") + e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Waits until a container exits.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param container_name Name of the container.
+     * @param timeout_secs Max time to wait. 0 to wait without a timeout.
+     * @param exit_code Exit code of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int wait_container(api_error &error, std::string_view socket_path, std::string_view container_name, const int timeout_secs, int &exit_code)
+    {
+        std::string response_body;
+        if (send_request(error, socket_path, "POST", "/containers/" + std::string(container_name) + "/wait", {}, timeout_secs, response_body) == -1)
+            return -1;
+
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(response_body);
+            exit_code = d["StatusCode"].as<int>();
+        }
+        catch (const std::exception &e)
+        {
+            error.message = std::string("Invalid wait response. ") + e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Checks whether an image is available to the daemon.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param image Image name with the tag.
+     * @param exists Whether the image exists.
+     * @return 0 on success and -1 on error.
+     */
+    int image_exists(api_error &error, std::string_view socket_path, std::string_view image, bool &exists)
+    {
+        std::string response_body;
+        exists = send_request(error, socket_path, "GET", "/images/" + std::string(image) + "/json", {}, DEFAULT_TIMEOUT_SECS, response_body) == 0;
+        if (!exists && error.status != HTTP_NOT_FOUND)
+            return -1;
+
+        error = {};
+        return 0;
+    }
+
+    /**
+     * Loads an image from a tar archive in the docker save format.
+     * @param error Error of the call if any.
+     * @param socket_path Docker daemon socket path.
+     * @param content_length Size of the archive.
+     * @param body_writer Function which writes the archive to the given socket fd.
+     * @param timeout_secs Max time to wait for the daemon. 0 to wait without a timeout.
+     * @return 0 on success and -1 on error.
+     */
+    int load_image(api_error &error, std::string_view socket_path, const size_t content_length, const body_writer &writer, const int timeout_secs)
+    {
+        std::string response_body;
+        if (send_stream_request(error, socket_path, "POST", "/images/load?quiet=1", "application/x-tar", content_length, writer, timeout_secs, response_body) == -1)
+            return -1;
+
+        // Load failures are reported within the progress messages of a successful response.
+        const size_t pos = response_body.find("\"errorDetail\"");
+        if (pos != std::string::npos)
+        {
+            error.message = response_body.substr(pos);
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Sends a HTTP request with a json body to the docker daemon and reads the response.
+     * @param error Error of the call if any. The status is populated with the HTTP status of the response.
+     * @param socket_path Docker daemon socket path.
+     * @param method HTTP method.
+     * @param path Request path including the query string.
+     * @param body Json request body. Empty if there's no body.
+     * @param timeout_secs Max time to wait for the daemon. 0 to wait without a timeout.
+     * @param response_body Body of the response.
+     * @return 0 on success and -1 on error.
+     */
+    int send_request(api_error &error, std::string_view socket_path, std::string_view method, std::string_view path, std::string_view body,
+                     const int timeout_secs, std::string &response_body)
+    {
+        return send_stream_request(
+            error, socket_path, method, path, body.empty() ? "" : "application/json", body.length(),
+            [&](const int fd)
+            { return write_all(fd, body); },
+            timeout_secs, response_body);
+    }
+
+    /**
+     * Sends a HTTP request to the docker daemon over its unix socket and reads the response. The body is written
+     * directly to the socket by the given writer, so large bodies do not need to be buffered.
+     * A new connection is used for each request and the daemon closes it after responding.
+     * @param error Error of the call if any. The status is populated with the HTTP status of the response.
+     * @param socket_path Docker daemon socket path.
+     * @param method HTTP method.
+     * @param path Request path including the query string.
+     * @param content_type Content type of the body. Empty if there's no body.
+     * @param content_length Length of the body.
+     * @param writer Function which writes the body to the given socket fd.
+     * @param timeout_secs Max time to wait for the daemon. 0 to wait without a timeout.
+     * @param response_body Body of the response.
+     * @return 0 on success and -1 on error.
+     */
+    int send_stream_request(api_error &error, std::string_view socket_path, std::string_view method, std::string_view path, std::string_view content_type,
+                            const size_t content_length, const body_writer &writer, const int timeout_secs, std::string &response_body)
+    {
+        error = {};
+
+        sockaddr_un addr = {};
+        if (socket_path.length() >= sizeof(addr.sun_path))
+        {
+            error.message = "Socket path too long.";
+            return -1;
+        }
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path.data(), socket_path.length());
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            error.message = "Error creating socket. errno: " + std::to_string(errno);
+            return -1;
+        }
+
+        const timeval timeout = {timeout_secs, 0};
+        if ((timeout_secs > 0 && (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+                                  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)) ||
+            connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            error.message = "Error connecting to " + std::string(socket_path) + ". errno: " + std::to_string(errno);
+            close(fd);
+            return -1;
+        }
+
+        std::string request;
+        request.append(method).append(" ").append(path).append(" HTTP/1.1\r\n");
+        request.append("Host: docker\r\nConnection: close\r\n");
+        if (!content_type.empty())
+            request.append("Content-Type: ").append(content_type).append(HTTP_CRLF);
+        request.append("Content-Length: ").append(std::to_string(content_length)).append(HTTP_HEADER_END);
+
+        if (write_all(fd, request) == -1 || writer(fd) == -1)
+        {
+            error.message = "Error sending request. errno: " + std::to_string(errno);
+            close(fd);
+            return -1;
+        }
+
+        std::string response;
+        char buffer[4096];
+        while (true)
+        {
+            const ssize_t res = read(fd, buffer, sizeof(buffer));
+            if (res == 0)
+                break;
+            if (res == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                error.message = (errno == EAGAIN || errno == EWOULDBLOCK) ? "Timed out waiting for the docker daemon." : "Error reading response. errno: " + std::to_string(errno);
+                close(fd);
+                return -1;
+            }
+            response.append(buffer, res);
+        }
+        close(fd);
+
+        return parse_response(error, response, response_body);
+    }
+
+    /**
+     * Writes the whole buffer to the given fd.
+     * @param fd File descriptor to write to.
+     * @param buf Data to be written.
+     * @return 0 on success and -1 on error.
+     */
+    int write_all(const int fd, std::string_view buf)
+    {
+        size_t sent = 0;
+        while (sent < buf.length())
+        {
+            const ssize_t res = write(fd, buf.data() + sent, buf.length() - sent);
+            if (res == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            sent += res;
+        }
+        return 0;
+    }
+
+    /**
+     * Parses a HTTP response of the docker daemon. Error responses are converted to an api error using the
+     * message returned by the daemon.
+     * @param error Error of the call if any. The status is populated with the HTTP status of the response.
+     * @param response Raw HTTP response.
+     * @param response_body Decoded body of the response.
+     * @return 0 for successful responses and -1 for error responses or malformed responses.
+     */
+    int parse_response(api_error &error, std::string_view response, std::string &response_body)
+    {
+        // Status line format: HTTP/1.1 <status> <reason>
+        const size_t header_end = response.find(HTTP_HEADER_END);
+        const size_t status_pos = response.find(' ');
+        if (header_end == std::string_view::npos || status_pos == std::string_view::npos || status_pos > header_end ||
+            util::stoi(std::string(response.substr(status_pos + 1, 3)), error.status) == -1)
+        {
+            error.status = 0;
+            error.message = "Malformed response from the docker daemon.";
+            return -1;
+        }
+
+        std::string headers(response.substr(0, header_end));
+        std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+        const std::string_view body = response.substr(header_end + 4);
+
+        response_body.clear();
+        if (headers.find(CHUNKED_ENCODING) == std::string::npos)
+        {
+            response_body = body;
+        }
+        else
+        {
+            // Each chunk is the hex size of the chunk followed by the chunk data. A zero size chunk ends the body.
+            size_t pos = 0;
+            while (true)
+            {
+                const size_t line_end = body.find(HTTP_CRLF, pos);
+                const size_t chunk_size = line_end == std::string_view::npos ? 0 : strtoul(std::string(body.substr(pos, line_end - pos)).data(), NULL, 16);
+                if (line_end == std::string_view::npos || (line_end + 2 + chunk_size) > body.length())
+                {
+                    error.message = "Malformed chunked response from the docker daemon.";
+                    return -1;
+                }
+                if (chunk_size == 0)
+                    break;
+
+                response_body.append(body.substr(line_end + 2, chunk_size));
+                pos = line_end + 2 + chunk_size + 2;
+            }
+        }
+
+        if (error.status < 300 || error.status == HTTP_NOT_MODIFIED)
+            return 0;
+
+        // Error responses contain a json object with the error message.
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(response_body);
+            error.message = d["message"].as<std::string>();
+        }
+        catch (const std::exception &)
+        {
+            error.message = response_body;
+        }
+        return -1;
+    }
+
+} // namespace docker
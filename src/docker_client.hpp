@@ -0,0 +1,70 @@
+#ifndef _SA_DOCKER_CLIENT_
+#define _SA_DOCKER_CLIENT_
+
+#include "pchheader.hpp"
+
+namespace docker
+{
+    // Error of a failed Docker Engine API call.
+    struct api_error
+    {
+        int status = 0;      // HTTP status code returned by the daemon. 0 if the daemon could not be reached.
+        std::string message; // Error message returned by the daemon or the reason for the failure.
+    };
+
+    // A container port which is published on the same host port.
+    struct port_mapping
+    {
+        uint16_t port = 0;
+        bool is_udp = false;
+    };
+
+    // Settings of a container to be created.
+    struct container_spec
+    {
+        std::string name;
+        std::string image;
+        std::vector<std::string> cmd;
+        std::string stop_signal;
+        std::string bind_source; // Host directory to be bind mounted into the container.
+        std::string bind_target; // Mount point of the bind mount inside the container.
+        std::vector<port_mapping> ports;
+        std::string restart_policy;
+        std::string log_driver;
+        std::unordered_map<std::string, std::string> log_opts;
+    };
+
+    // Writes a request body directly to the socket fd. Returns 0 on success and -1 on error.
+    typedef std::function<int(const int fd)> body_writer;
+
+    int get_user_socket_path(std::string &socket_path, std::string_view username);
+
+    int create_container(api_error &error, std::string_view socket_path, const container_spec &spec, const int timeout_secs);
+
+    int start_container(api_error &error, std::string_view socket_path, std::string_view container_name);
+
+    int stop_container(api_error &error, std::string_view socket_path, std::string_view container_name);
+
+    int remove_container(api_error &error, std::string_view socket_path, std::string_view container_name);
+
+    int inspect_container_status(api_error &error, std::string_view socket_path, std::string_view container_name, std::string &status);
+
+    int wait_container(api_error &error, std::string_view socket_path, std::string_view container_name, const int timeout_secs, int &exit_code);
+
+    int image_exists(api_error &error, std::string_view socket_path, std::string_view image, bool &exists);
+
+    int load_image(api_error &error, std::string_view socket_path, const size_t content_length, const body_writer &writer, const int timeout_secs);
+
+    int send_request(api_error &error, std::string_view socket_path, std::string_view method, std::string_view path, std::string_view body,
+                     const int timeout_secs, std::string &response_body);
+
+    int send_stream_request(api_error &error, std::string_view socket_path, std::string_view method, std::string_view path, std::string_view content_type,
+                            const size_t content_length, const body_writer &writer, const int timeout_secs, std::string &response_body);
+
+    int write_all(const int fd, std::string_view buf);
+
+    int parse_response(api_error &error, std::string_view response, std::string &response_body);
+
+} // namespace docker
+
+#endif
@@ -2,25 +2,44 @@
 #include "crypto.hpp"
 #include "util/util.hpp"
 #include "sqlite.hpp"
+#include "docker_client.hpp"
+#include "instance_registry.hpp"
+#include "contract_template.hpp"
+#include "image_store.hpp"
+#include "provisioner.hpp"
+#include "subprocess.hpp"
+#include "trace.hpp"
+#include "stats_collector.hpp"
+#include "cgroup_manager.hpp"
+#include "scheduler.hpp"
 
 namespace hp
 {
-    // Keep track of the ports of the most recent hp instance.
-    ports last_assigned_ports;
-
     resources instance_resources;
 
-    // This is defaults to true because it initialize last assigned ports when a new instance is created if there is no vacant ports available.
-    bool last_port_assign_from_vacant = true;
+    // Guards the instance count since instance operations are executed in parallel.
+    std::mutex allocation_mutex;
+    size_t reserved_instance_count = 0; // No. of instances being created which are not yet in the registry.
 
     constexpr int FILE_PERMS = 0644;
-    constexpr int DOCKER_CREATE_TIMEOUT_SECS = 120; // Max timeout for docker create command to execute.
+    constexpr int DOCKER_CREATE_TIMEOUT_SECS = 120; // Max time to wait for the docker daemon to create a container.
 
     sqlite3 *db = NULL;    // Database connection for hp related sqlite stuff.
-    sqlite3 *db_mb = NULL; // Database connection for messageboard related sqlite stuff.
-
-    // Vector keeping vacant ports from destroyed instances.
-    std::vector<ports> vacant_ports;
+    sqlite3 *db_mb = NULL; // Read-only database connection for messageboard related sqlite stuff. Opened on first use.
+    std::mutex db_mb_mutex;
+    ino_t db_mb_inode = 0; // Inode of the opened messageboard database. Used to detect a replaced database file.
+    dev_t db_mb_dev = 0;
+
+    // Pre-provisioned users waiting to be assigned to new instances. Guarded by allocation_mutex.
+    std::deque<warm_user> warm_users;
+    std::thread warm_pool_thread;
+    std::condition_variable warm_pool_cv; // Wakes up the warm pool thread when a warm user is taken or on shutdown.
+    constexpr int WARM_POOL_CHECK_INTERVAL_SECS = 60;
+
+    // Status reconciler which catches up the instance status with the containers stopped or restarted by docker.
+    std::thread reconciler_thread;
+    std::condition_variable reconciler_cv; // Wakes up the reconciler on shutdown.
+    constexpr int STATUS_CHECK_INTERVAL_SECS = 30;
 
     bool is_shutting_down = false;
 
@@ -28,24 +47,11 @@ namespace hp
     constexpr int CONTRACT_USER_ID = 10000;
     constexpr int CONTRACT_GROUP_ID = 0;
 
-    // We instruct the demon to restart the container automatically once the container exits except manually stopping.
-    // We keep docker logs at size limit of 10mb, We only need these logs for docker instance failure debugging since all other logs are kept in files.
-    // For the local log driver compression, minimum max-file should be 2. So we keep two logs each max-size is 5mb
-    constexpr const char *DOCKER_CREATE = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock timeout --foreground -v -s SIGINT %ss %s/dockerbin/docker create -t -i --stop-signal=SIGINT --log-driver local \
-     --log-opt max-size=5m --log-opt max-file=2 --name=%s -p %s:%s -p %s:%s -p %s:%s/udp -p %s:%s -p %s:%s -p %s:%s/udp -p %s:%s/udp --restart unless-stopped --mount type=bind,source=%s,target=/contract %s run /contract";
-    constexpr const char *DOCKER_START = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker start %s";
-    constexpr const char *DOCKER_STOP = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker stop %s";
-    constexpr const char *DOCKER_REMOVE = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker rm -f %s";
-    constexpr const char *DOCKER_STATUS = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker inspect --format='{{json .State.Status}}' %s";
-    constexpr const char *COPY_DIR = "cp -r %s %s";
-    constexpr const char *MOVE_DIR = "mv %s %s";
-    constexpr const char *CHOWN_DIR = "chown -R %s:%s %s";
-    constexpr const char *CHMOD_DIR = "chmod -R %s %s";
 
     // Error codes used in create and initiate instance.
-    constexpr const char *DB_READ_ERROR = "db_read_error";
     constexpr const char *DB_WRITE_ERROR = "db_write_error";
     constexpr const char *USER_INSTALL_ERROR = "user_install_error";
+    constexpr const char *USER_ASSIGN_ERROR = "user_assign_error";
     constexpr const char *USER_UNINSTALL_ERROR = "user_uninstall_error";
     constexpr const char *INSTANCE_ERROR = "instance_error";
     constexpr const char *CONF_READ_ERROR = "conf_read_error";
@@ -60,6 +66,9 @@ namespace hp
     constexpr const char *DOCKER_IMAGE_INVALID = "docker_image_invalid";
     constexpr const char *DOCKER_CONTAINER_NOT_FOUND = "container_not_found";
     constexpr const char *INSTANCE_ALREADY_EXISTS = "instance_already_exists";
+    constexpr const char *INSTANCE_RESIZE_ERROR = "instance_resize_error";
+    constexpr const char *STORAGE_IN_USE = "storage_in_use";
+    constexpr const char *MEMORY_IN_USE = "memory_in_use";
 
     // Cgrules check related constants.
     constexpr const char *CGRULE_ACTIVE = "service=$(grep \"ExecStart.*=.*/cgrulesengd$\" /etc/systemd/system/*.service | head -1 | awk -F : ' { print $1 } ') && [ ! -z $service ] && systemctl is-active $(basename $service)";
@@ -69,6 +78,12 @@ namespace hp
     constexpr const char *CGRULE_REGEXP = "(^|\n)(\\s*)@sashiuser(\\s+)cpu,memory(\\s+)\%u-cg(\\s*)($|\n)";
     constexpr const char *REBOOT_FILE = "/run/reboot-required.pkgs";
     constexpr const char *REBOOT_REGEXP = "(^|\n)(\\s*)sashimono(\\s*)($|\n)";
+    constexpr uint64_t CGRULE_CHECK_TIMEOUT_MS = 10000;
+
+    // Max time the user scripts may run before they are stopped.
+    constexpr uint64_t INSTALL_TIMEOUT_MS = 15 * 60 * 1000;
+    constexpr uint64_t ASSIGN_TIMEOUT_MS = 30 * 60 * 1000; // Includes pulling the image.
+    constexpr uint64_t UNINSTALL_TIMEOUT_MS = 5 * 60 * 1000;
 
     /**
      * Initialize hp related environment.
@@ -76,24 +91,68 @@ namespace hp
     int init()
     {
         // First, check whether system is ready to start.
-        if (!system_ready())
+        if (cgroup::init() == -1 || !system_ready())
             return -1;
 
         const std::string db_path = conf::ctx.data_dir + "/sa.sqlite";
         if (sqlite::open_db(db_path, &db, true) == -1 ||
-            sqlite::initialize_hp_db(db) == -1)
+            sqlite::set_wal_mode(db) == -1 ||
+            sqlite::initialize_hp_db(db) == -1 ||
+            registry::init(db) == -1)
         {
             LOG_ERROR << "Error preparing database in " << db_path;
             return -1;
         }
 
-        // Populate the vacant ports vector with vacant ports of destroyed containers.
-        get_vacant_ports_list(vacant_ports);
-        // Calculate the resources per instance.
+        if (contract_template::init() == -1 || image_store::init() == -1 || stats::init() == -1)
+            return -1;
+
+        // Mounts do not survive a reboot, so overlays of the existing instances are mounted again. Template versions
+        // which are no longer the lower dir of any of them are removed afterwards.
+        std::vector<instance_info> instances;
+        registry::get_instance_list(instances);
+        std::vector<std::string> contract_dirs;
+        for (const instance_info &info : instances)
+        {
+            const std::string contract_dir = util::get_user_contract_dir(info.username, info.container_name);
+            util::user_info user;
+            if (contract_template::is_overlay(contract_dir) && util::get_system_user_info(info.username, user) == 0)
+                contract_template::mount_overlay(contract_dir, user);
+            contract_dirs.push_back(contract_dir);
+        }
+        contract_template::remove_unused_templates(contract_dirs);
+
+        // Calculate the resources of the standard instance slot.
         instance_resources.cpu_us = conf::cfg.system.max_cpu_us / conf::cfg.system.max_instance_count;
         instance_resources.mem_kbytes = conf::cfg.system.max_mem_kbytes / conf::cfg.system.max_instance_count;
         instance_resources.swap_kbytes = instance_resources.mem_kbytes + (conf::cfg.system.max_swap_kbytes / conf::cfg.system.max_instance_count);
         instance_resources.storage_kbytes = conf::cfg.system.max_storage_kbytes / conf::cfg.system.max_instance_count;
+        instance_resources.io_read_bps = conf::cfg.system.max_io_read_bps / conf::cfg.system.max_instance_count;
+        instance_resources.io_write_bps = conf::cfg.system.max_io_write_bps / conf::cfg.system.max_instance_count;
+
+        if (scheduler::init(instance_resources, instances) == -1)
+            return -1;
+
+        // Cgroup v2 limits are written again on startup in place of the cgcreate service of v1, so limits of users
+        // provisioned by an older agent or by the script catch up with the config.
+        if (cgroup::is_v2())
+        {
+            for (const instance_info &info : instances)
+            {
+                const resources res = scheduler::get_allocation(info);
+                cgroup::limits lim;
+                lim.cpu_us = res.cpu_us;
+                lim.mem_kbytes = res.mem_kbytes;
+                lim.swap_kbytes = res.swap_kbytes;
+                lim.io_read_bps = res.io_read_bps;
+                lim.io_write_bps = res.io_write_bps;
+
+                util::user_info user;
+                if (util::get_system_user_info(info.username, user) == -1 || cgroup::apply_limits(user.user_id, lim) == -1)
+                    LOG_WARNING << "Cgroup limits of " << info.container_name << " could not be applied.";
+            }
+        }
+
         // Set run as group id 0 (sashimono user group id, root user inside docker container).
         // Because contract user is in sashimono user's group, so the contract user will get the group permissions.
         contract_ugid = {CONTRACT_USER_ID, CONTRACT_GROUP_ID};
@@ -106,10 +165,226 @@ namespace hp
      */
     void deinit()
     {
-        is_shutting_down = true;
+        {
+            std::scoped_lock lock(allocation_mutex);
+            is_shutting_down = true;
+        }
+        warm_pool_cv.notify_all();
+        reconciler_cv.notify_all();
 
+        // Wait for any in progress warm user installation.
+        if (warm_pool_thread.joinable())
+            warm_pool_thread.join();
+
+        if (reconciler_thread.joinable())
+            reconciler_thread.join();
+
+        stats::deinit();
+        image_store::deinit();
+        registry::deinit();
         if (db != NULL)
             sqlite::close_db(&db);
+
+        {
+            std::scoped_lock lock(db_mb_mutex);
+            if (db_mb != NULL)
+                sqlite::close_db(&db_mb);
+        }
+
+        // All the external commands are run on behalf of the instances.
+        subprocess::deinit();
+    }
+
+    /**
+     * Loads the warm users from the db and starts the thread which keeps the warm pool filled. The warm users were
+     * provisioned with the standard size of the config they were installed with, so the current standard size is
+     * applied to them again. A claimed warm user then only needs a resize if the instance is not of the standard size.
+     * @return 0 on success and -1 on error.
+     */
+    int init_warm_pool()
+    {
+        std::deque<warm_user> loaded_users;
+        registry::get_warm_users(loaded_users);
+
+        std::deque<warm_user> users;
+        for (warm_user &user : loaded_users)
+        {
+            if (provisioner::update_resources(user.user_id, user.username, to_provision_params(instance_resources)) == -1)
+            {
+                // Not kept in the pool since it would be handed out with stale limits.
+                LOG_WARNING << "Error applying the standard size to warm user " << user.username << ". Removing it.";
+                uninstall_user(user.username, {}, {});
+                registry::remove_warm_user(user.username);
+                continue;
+            }
+            users.push_back(std::move(user));
+        }
+
+        {
+            std::scoped_lock lock(allocation_mutex);
+            warm_users = std::move(users);
+        }
+
+        // The thread is also needed to clean up the remaining warm users if the pool has been disabled.
+        if (conf::cfg.system.warm_pool_size == 0 && warm_users.empty())
+            return 0;
+
+        try
+        {
+            warm_pool_thread = std::thread(warm_pool_loop);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the warm pool thread. " << e.what();
+            return -1;
+        }
+
+        LOG_INFO << "Warm pool size: " << conf::cfg.system.warm_pool_size << ", available warm users: " << warm_users.size();
+        return 0;
+    }
+
+    /**
+     * Installs warm users until the configured pool size is reached. Warm users are provisioned with the standard size,
+     * so the pool is only filled while the free budget can hold a standard slot for each of them and the new one.
+     * Surplus users are uninstalled if the pool size has been reduced.
+     */
+    void warm_pool_loop()
+    {
+        util::mask_signal();
+
+        std::unique_lock lock(allocation_mutex);
+        while (!is_shutting_down)
+        {
+            if (warm_users.size() > conf::cfg.system.warm_pool_size)
+            {
+                const warm_user user = warm_users.back();
+                warm_users.pop_back();
+                lock.unlock();
+
+                LOG_INFO << "Removing surplus warm user " << user.username;
+                uninstall_user(user.username, {}, {});
+                registry::remove_warm_user(user.username);
+
+                lock.lock();
+                continue;
+            }
+
+            if (warm_users.size() < conf::cfg.system.warm_pool_size && scheduler::has_standard_slots(warm_users.size() + 1))
+            {
+                lock.unlock();
+
+                // Instance specific params are passed empty so only the user level setup is done. Ports are not
+                // reserved for warm users. Reserving a slot is an in-memory lookup at create time, while the port
+                // specific setup (firewall, hp.cfg, docker publish) is done by the assignment anyway.
+                warm_user user;
+                int ret = install_user(user.user_id, user.username, instance_resources, {}, {}, {}, {}, {});
+                if (ret == 0 && registry::add_warm_user(user) == -1)
+                {
+                    uninstall_user(user.username, {}, {});
+                    ret = -1;
+                }
+
+                lock.lock();
+                if (ret == 0)
+                {
+                    warm_users.push_back(std::move(user));
+                    continue;
+                }
+                LOG_ERROR << "Error installing a warm user. Retrying in " << WARM_POOL_CHECK_INTERVAL_SECS << "s.";
+            }
+
+            warm_pool_cv.wait_for(lock, std::chrono::seconds(WARM_POOL_CHECK_INTERVAL_SECS));
+        }
+    }
+
+    /**
+     * Starts the thread which keeps the instance status in line with the state of the containers.
+     * @return 0 on success and -1 on error.
+     */
+    int init_reconciler()
+    {
+        try
+        {
+            reconciler_thread = std::thread(reconciler_loop);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the status reconciler thread. " << e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    void reconciler_loop()
+    {
+        util::mask_signal();
+
+        std::unique_lock lock(allocation_mutex);
+        while (!is_shutting_down)
+        {
+            lock.unlock();
+            reconcile_status();
+            lock.lock();
+
+            reconciler_cv.wait_for(lock, std::chrono::seconds(STATUS_CHECK_INTERVAL_SECS), []
+                                   { return is_shutting_down; });
+        }
+    }
+
+    /**
+     * Polls the state of the containers which are supposed to be running and records the containers which have
+     * exited or have been restarted by docker. The status is only replaced if no operation has changed it since it
+     * was read, so the status set by the instance operations always wins.
+     */
+    void reconcile_status()
+    {
+        std::vector<instance_info> instances;
+        registry::get_instance_list(instances);
+        for (const instance_info &info : instances)
+        {
+            if (info.status != CONTAINER_STATES[STATES::RUNNING] && info.status != CONTAINER_STATES[STATES::EXITED])
+                continue;
+
+            std::string docker_status;
+            if (check_instance_status(info.username, info.container_name, docker_status) == -1)
+                continue;
+
+            // Transient docker states such as restarting and paused are left until they settle.
+            const char *status = NULL;
+            if (docker_status == "running")
+                status = CONTAINER_STATES[STATES::RUNNING];
+            else if (docker_status == "exited" || docker_status == "dead")
+                status = CONTAINER_STATES[STATES::EXITED];
+            if (status == NULL || info.status == status)
+                continue;
+
+            bool replaced = false;
+            if (registry::replace_status(info.container_name, info.status, status, replaced) == -1)
+                LOG_ERROR << "Error recording the status of " << info.container_name << " as " << status;
+            else if (replaced)
+                LOG_WARNING << "Container " << info.container_name << " is " << docker_status << ". Status changed from " << info.status << " to " << status;
+        }
+    }
+
+    /**
+     * Takes the oldest user from the warm pool.
+     * @param user The taken warm user.
+     * @return true if a warm user was available, otherwise false.
+     */
+    bool take_warm_user(warm_user &user)
+    {
+        {
+            std::scoped_lock lock(allocation_mutex);
+            if (warm_users.empty())
+                return false;
+
+            user = std::move(warm_users.front());
+            warm_users.pop_front();
+        }
+
+        registry::remove_warm_user(user.username);
+        warm_pool_cv.notify_one();
+        return true;
     }
 
     /**
@@ -119,35 +394,28 @@ namespace hp
      * @param owner_pubkey Public key of the instance owner.
      * @param contract_id Contract id to be configured.
      * @param image Docker image name to use (image prefix name must exists).
+     * @param request Requested tier and sizes of the instance.
      * @return 0 on success and -1 on error.
      */
-    int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image, std::string_view outbound_ipv6, std::string_view outbound_net_interface)
+    int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image, std::string_view outbound_ipv6, std::string_view outbound_net_interface,
+                            const msg::resource_request &request)
     {
+        trace::span checks_span("checks");
+
         // Creating an instance with same name is not allowed.
         hp::instance_info existing_instance;
-        if (sqlite::get_instance(db, container_name, existing_instance) == 0)
+        if (registry::get_instance(container_name, existing_instance) == 0)
         {
             error_msg = INSTANCE_ALREADY_EXISTS;
             LOG_ERROR << "Found another instance with name: " << container_name << ".";
             return -1;
         }
 
-        // If the max allowed instance count is already allocated. We won't allow more.
-        const int allocated_count = sqlite::get_allocated_instance_count(db);
-        if (allocated_count == -1)
-        {
-            error_msg = DB_READ_ERROR;
-            LOG_ERROR << "Error getting allocated instance count from db.";
+        resources res;
+        if (scheduler::resolve(error_msg, res, request) == -1)
             return -1;
-        }
-        else if ((size_t)allocated_count >= conf::cfg.system.max_instance_count)
-        {
-            error_msg = MAX_ALLOCATION_REACHED;
-            LOG_ERROR << "Max instance count is reached.";
-            return -1;
-        }
 
-        LOG_INFO << "Resources for instance - CPU: " << instance_resources.cpu_us << " MicroS, RAM: " << instance_resources.mem_kbytes << " KB, Storage: " << instance_resources.storage_kbytes << " KB.";
+        LOG_INFO << "Resources for instance - CPU: " << res.cpu_us << " MicroS, RAM: " << res.mem_kbytes << " KB, Storage: " << res.storage_kbytes << " KB.";
 
         // First check whether contract_id is valid uuid.
         if (!crypto::verify_uuid(contract_id))
@@ -165,70 +433,167 @@ namespace hp
         //     return -1;
         // }
 
-        const std::string image_name = image;
+        std::string image_name = image;
 
         ports instance_ports;
-        if (!vacant_ports.empty())
-        {
-            // Assign a port pair from one of destroyed instances.
-            instance_ports = vacant_ports.back();
-            last_port_assign_from_vacant = true;
-        }
-        else
+        if (reserve_allocation(error_msg, res, instance_ports) == -1)
+            return -1;
+        checks_span.end();
+
+        // Creation runs as a graph of stages. The image download and the node keys only depend on the request, so they
+        // start right away. The contract is staged once the user exists while the download goes on, and the download is
+        // joined only before the assignment, which would otherwise pull the image itself.
+        create_timings timings;
+        const uint64_t start_time = util::get_epoch_milliseconds();
+        std::future<int> image_fetch;
+        if (image_store::fetch_image_async(image_name, image_fetch) == -1)
+            LOG_WARNING << "Image " << image_name << " will be pulled by the assignment.";
+
+        staged_contract contract;
+        crypto::generate_signing_keys(contract.pubkey, contract.seckey);
+
+        // Warm users are prepared without an outbound ipv6 address, so they can only be used if the instance does not need one.
+        const bool is_outbound_ipv6 = !outbound_ipv6.empty() && outbound_ipv6 != "-" && !outbound_net_interface.empty() && outbound_net_interface != "-";
+
+        int user_id;
+        std::string username;
+        warm_user user;
+        if (!is_outbound_ipv6 && take_warm_user(user))
         {
-            if (last_port_assign_from_vacant)
+            username = user.username;
+            LOG_INFO << "Assigning warm user " << username << " to " << container_name;
+
+            // Warm users are prepared with the standard size.
+            if (!scheduler::is_standard(res) && provisioner::update_resources(user.user_id, username, to_provision_params(res)) == -1)
             {
-                sqlite::get_max_ports(db, last_assigned_ports);
-                last_port_assign_from_vacant = false;
+                error_msg = USER_INSTALL_ERROR;
+                LOG_ERROR << "Error resizing warm user " << username;
+                uninstall_user(username, {}, {});
+                release_allocation(res, instance_ports);
+                return -1;
             }
-            instance_ports = {(uint16_t)(last_assigned_ports.peer_port + 1), (uint16_t)(last_assigned_ports.user_port + 1), (uint16_t)(last_assigned_ports.gp_tcp_port_start + 2), (uint16_t)(last_assigned_ports.gp_udp_port_start + 2)};
         }
-
-        int user_id;
-        std::string username;
-        if (install_user(
-                user_id, username, instance_resources.cpu_us, instance_resources.mem_kbytes, instance_resources.swap_kbytes,
-                instance_resources.storage_kbytes, container_name, instance_ports, image_name, outbound_ipv6, outbound_net_interface) == -1)
+        else if (install_user(user_id, username, res, {}, {}, {}, outbound_ipv6, outbound_net_interface) == -1)
         {
             error_msg = USER_INSTALL_ERROR;
+            release_allocation(res, instance_ports);
             return -1;
         }
+        timings.user_ms = util::get_epoch_milliseconds() - start_time;
 
         const std::string contract_dir = util::get_user_contract_dir(username, container_name);
+        if (stage_contract(contract, username, owner_pubkey, contract_id, contract_dir, instance_ports) == -1)
+        {
+            error_msg = INSTANCE_ERROR;
+            LOG_ERROR << "Error staging the contract of " << container_name;
+            // The user is not bound to the instance yet.
+            uninstall_user(username, {}, {});
+            release_allocation(res, instance_ports);
+            return -1;
+        }
+        timings.contract_ms = util::get_epoch_milliseconds() - start_time - timings.user_ms;
 
-        auto pos = image_name.find("--");
-        if (pos != std::string::npos) {
-        image_name = image_name.substr(0, pos);
+        // Images already in the image store are streamed to the user's docker daemon, so the assignment does not pull them.
+        // The assignment pulls the image itself if this fails.
+        if (image_fetch.valid())
+        {
+            const trace::span span("image_wait");
+            image_fetch.wait();
         }
+        timings.image_wait_ms = util::get_epoch_milliseconds() - start_time - timings.user_ms - timings.contract_ms;
+        image_store::load_image(username, image_name);
 
-        if (create_contract(username, owner_pubkey, contract_id, contract_dir, instance_ports, info) == -1 ||
+        if (assign_user(username, container_name, instance_ports, image_name, res.mem_kbytes, res.storage_kbytes) == -1)
+        {
+            error_msg = USER_ASSIGN_ERROR;
+            contract_template::discard(contract.work_dir, contract_dir);
+            // The user is partially bound to the instance, so it's removed along with the instance rules.
+            uninstall_user(username, instance_ports, container_name);
+            release_allocation(res, instance_ports);
+            return -1;
+        }
+
+        // An image pulled by the assignment is moved to the image store for the next instances.
+        image_store::import_saved_image(image_name);
+
+        const size_t pos = image_name.find("--");
+        if (pos != std::string::npos)
+            image_name = image_name.substr(0, pos);
+
+        const uint64_t container_start_time = util::get_epoch_milliseconds();
+        if (commit_contract(contract, username, owner_pubkey, contract_id, instance_ports, info) == -1 ||
             create_container(username, image_name, container_name, contract_dir, instance_ports, info) == -1)
         {
             error_msg = INSTANCE_ERROR;
             LOG_ERROR << "Error creating hp instance for " << owner_pubkey;
             // Remove user if instance creation failed.
             uninstall_user(username, instance_ports, container_name);
+            release_allocation(res, instance_ports);
             return -1;
         }
+        timings.container_ms = util::get_epoch_milliseconds() - container_start_time;
 
-        if (sqlite::insert_hp_instance_row(db, info) == -1)
+        info.allocation = res;
+        if (registry::add_instance(info) == -1)
         {
             error_msg = DB_WRITE_ERROR;
             LOG_ERROR << "Error inserting instance data into db for " << owner_pubkey;
             // Remove container and uninstall user if database update failed.
             docker_remove(username, container_name);
             uninstall_user(username, instance_ports, container_name);
+            release_allocation(res, instance_ports);
             return -1;
         }
 
-        if (last_port_assign_from_vacant)
-            vacant_ports.pop_back();
-        else
-            last_assigned_ports = instance_ports;
+        // The instance holds its resources from now on, so only the slot reservation is released.
+        release_allocation({}, instance_ports);
+        LOG_INFO << "Created instance " << container_name << " in " << (util::get_epoch_milliseconds() - start_time) << "ms. User: " << timings.user_ms
+                 << "ms, contract: " << timings.contract_ms << "ms, image wait: " << timings.image_wait_ms << "ms, container: " << timings.container_ms << "ms.";
+        return 0;
+    }
+
+    /**
+     * Reserves the resources and a port set for an instance being created. Instance operations run in parallel, so
+     * the reservation keeps concurrent creates from exceeding the resource budget or taking the same ports. The
+     * instance count is no longer a limit of its own since instances smaller than the standard slot leave room for
+     * more of them. With standard instances alone the budget runs out at the configured instance count.
+     * @param error_msg Error message if any.
+     * @param res Size of the instance.
+     * @param instance_ports Reserved ports.
+     * @return 0 on success and -1 on error.
+     */
+    int reserve_allocation(std::string &error_msg, const resources &res, ports &instance_ports)
+    {
+        std::scoped_lock lock(allocation_mutex);
 
+        if (scheduler::reserve(error_msg, res) == -1)
+            return -1;
+
+        if (registry::reserve_ports(instance_ports) == -1)
+        {
+            error_msg = MAX_ALLOCATION_REACHED;
+            scheduler::release(res);
+            return -1;
+        }
+
+        reserved_instance_count++;
         return 0;
     }
 
+    /**
+     * Releases the reservation made by reserve_allocation. By this time the instance either owns the ports
+     * in the registry or has failed, in which case the ports become free again.
+     * @param res Resources to give back. Empty if the instance has been created and holds them.
+     * @param instance_ports Reserved ports.
+     */
+    void release_allocation(const resources &res, const ports &instance_ports)
+    {
+        std::scoped_lock lock(allocation_mutex);
+        reserved_instance_count--;
+        scheduler::release(res);
+        registry::release_ports(instance_ports);
+    }
+
     /**
      * Initiate the instance. The config will be updated and container will be started.
      * @param error_msg Error message if any.
@@ -239,8 +604,7 @@ namespace hp
     int initiate_instance(std::string &error_msg, std::string_view container_name, const msg::initiate_msg &config_msg)
     {
         instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        if (registry::get_instance(container_name, info) == -1)
         {
             error_msg = NO_CONTAINER;
             LOG_ERROR << "Given container not found. name: " << container_name;
@@ -265,6 +629,7 @@ namespace hp
             return -1;
         }
 
+        trace::span config_span("config_update");
         jsoncons::ojson d;
         std::string hpfs_log_level;
         bool is_full_history;
@@ -272,8 +637,7 @@ namespace hp
             write_json_values(d, config_msg.config) == -1 ||
             read_json_values(d, hpfs_log_level, is_full_history) == -1 ||
             util::write_json_file(config_fd, d) == -1 ||
-            hpfs::update_service_conf(info.username, hpfs_log_level, is_full_history) == -1 ||
-            hpfs::start_hpfs_systemd(info.username) == -1)
+            hpfs::update_service_conf(info.username, hpfs_log_level, is_full_history) == -1)
         {
             error_msg = CONTAINER_CONF_ERROR;
             LOG_ERROR << "Error when setting up container. name: " << container_name;
@@ -281,6 +645,14 @@ namespace hp
             return -1;
         }
         close(config_fd);
+        config_span.end();
+
+        if (hpfs::start_hpfs_systemd(info.username) == -1)
+        {
+            error_msg = CONTAINER_CONF_ERROR;
+            LOG_ERROR << "Error when setting up container. name: " << container_name;
+            return -1;
+        }
 
         if (docker_start(info.username, container_name) == -1)
         {
@@ -291,7 +663,7 @@ namespace hp
             return -1;
         }
 
-        if (sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
+        if (registry::update_status(container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
         {
             error_msg = CONTAINER_UPDATE_ERROR;
             LOG_ERROR << "Error when updating container status. name: " << container_name;
@@ -315,29 +687,38 @@ namespace hp
      */
     int create_container(std::string_view username, std::string_view image_name, std::string_view container_name, std::string_view contract_dir, const ports &assigned_ports, instance_info &info)
     {
-        const std::string user_port = std::to_string(assigned_ports.user_port);
-        const std::string peer_port = std::to_string(assigned_ports.peer_port);
-        const std::string gp_tcp_port_1 = std::to_string(assigned_ports.gp_tcp_port_start);
-        const std::string gp_tcp_port_2 = std::to_string(assigned_ports.gp_tcp_port_start + 1);
-        const std::string gp_udp_port_1 = std::to_string(assigned_ports.gp_udp_port_start);
-        const std::string gp_udp_port_2 = std::to_string(assigned_ports.gp_udp_port_start + 1);
-        const std::string timeout = std::to_string(DOCKER_CREATE_TIMEOUT_SECS);
-        const int len = 376 + username.length() + timeout.length() + conf::ctx.exe_dir.length() + container_name.length() + (user_port.length() * 2) + (peer_port.length() * 4) + (gp_tcp_port_1.length() * 2) + (gp_tcp_port_2.length() * 2) + (gp_udp_port_1.length() * 2) + (gp_udp_port_2.length() * 2) + contract_dir.length() + image_name.length();
-        char command[len];
-        sprintf(command, DOCKER_CREATE, username.data(), timeout.data(), conf::ctx.exe_dir.data(), container_name.data(),
-                user_port.data(), user_port.data(),
-                peer_port.data(), peer_port.data(),
-                peer_port.data(), peer_port.data(),
-                gp_tcp_port_1.data(), gp_tcp_port_1.data(),
-                gp_tcp_port_2.data(), gp_tcp_port_2.data(),
-                gp_udp_port_1.data(), gp_udp_port_1.data(),
-                gp_udp_port_2.data(), gp_udp_port_2.data(),
-                contract_dir.data(), image_name.data());
+        const trace::span span("docker_create");
+        std::string socket_path;
+        if (docker::get_user_socket_path(socket_path, username) == -1)
+            return -1;
+
+        // We instruct the demon to restart the container automatically once the container exits except manually stopping.
+        // We keep docker logs at size limit of 10mb, We only need these logs for docker instance failure debugging since all other logs are kept in files.
+        // For the local log driver compression, minimum max-file should be 2. So we keep two logs each max-size is 5mb
+        docker::container_spec spec;
+        spec.name = container_name;
+        spec.image = image_name;
+        spec.cmd = {"run", "/contract"};
+        spec.stop_signal = "SIGINT";
+        spec.bind_source = contract_dir;
+        spec.bind_target = "/contract";
+        spec.ports = {
+            {assigned_ports.user_port, false},
+            {assigned_ports.peer_port, false},
+            {assigned_ports.peer_port, true},
+            {assigned_ports.gp_tcp_port_start, false},
+            {(uint16_t)(assigned_ports.gp_tcp_port_start + 1), false},
+            {assigned_ports.gp_udp_port_start, true},
+            {(uint16_t)(assigned_ports.gp_udp_port_start + 1), true}};
+        spec.restart_policy = "unless-stopped";
+        spec.log_driver = "local";
+        spec.log_opts = {{"max-size", "5m"}, {"max-file", "2"}};
 
         LOG_INFO << "Creating the docker container. name: " << container_name;
-        if (system(command) != 0)
+        docker::api_error error;
+        if (docker::create_container(error, socket_path, spec, DOCKER_CREATE_TIMEOUT_SECS) == -1)
         {
-            LOG_ERROR << "Error when running container. name: " << container_name;
+            LOG_ERROR << "Error when running container. name: " << container_name << " status: " << error.status << " " << error.message;
             return -1;
         }
 
@@ -348,27 +729,26 @@ namespace hp
     }
 
     /**
-     * Stops the container with given name if exists.
+     * Stops the container with given name if it is running or has exited on its own.
      * @param container_name Name of the container.
      * @return 0 on success execution or relavent error code on error.
      */
     int stop_container(std::string_view container_name)
     {
         instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        if (registry::get_instance(container_name, info) == -1)
         {
             LOG_ERROR << "Given container not found. name: " << container_name;
             return -1;
         }
-        else if (info.status != CONTAINER_STATES[STATES::RUNNING])
+        else if (info.status != CONTAINER_STATES[STATES::RUNNING] && info.status != CONTAINER_STATES[STATES::EXITED])
         {
             LOG_ERROR << "Given container is not running. name: " << container_name;
             return -1;
         }
 
         if (docker_stop(info.username, container_name) == -1 ||
-            sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::STOPPED]) == -1 ||
+            registry::update_status(container_name, CONTAINER_STATES[STATES::STOPPED]) == -1 ||
             hpfs::stop_hpfs_systemd(info.username) == -1)
         {
             LOG_ERROR << "Error when stopping container. name: " << container_name;
@@ -379,20 +759,19 @@ namespace hp
     }
 
     /**
-     * Starts the container with given name if exists.
+     * Starts the container with given name if it is stopped or has exited on its own.
      * @param container_name Name of the container.
      * @return 0 on success execution or relavent error code on error.
      */
     int start_container(std::string_view container_name)
     {
         instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        if (registry::get_instance(container_name, info) == -1)
         {
             LOG_ERROR << "Given container not found. name: " << container_name;
             return -1;
         }
-        else if (info.status != CONTAINER_STATES[STATES::STOPPED])
+        else if (info.status != CONTAINER_STATES[STATES::STOPPED] && info.status != CONTAINER_STATES[STATES::EXITED])
         {
             LOG_ERROR << "Given container is not stopped. name: " << container_name;
             return -1;
@@ -423,7 +802,7 @@ namespace hp
         }
         close(config_fd);
 
-        if (sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
+        if (registry::update_status(container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
         {
             LOG_ERROR << "Error when starting container. name: " << container_name;
             // Stop started docker and hpfs processes if database update fails.
@@ -436,45 +815,63 @@ namespace hp
     }
 
     /**
-     * Execute docker start <container_name> command.
+     * Starts the given container through the docker daemon of the instance user.
      * @param username Username of the instance user.
      * @param container_name Name of the container.
      * @return 0 on successful execution and -1 on error.
      */
     int docker_start(std::string_view username, std::string_view container_name)
     {
-        const int len = 100 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_START, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
+        const trace::span span("docker_start");
+        std::string socket_path;
+        docker::api_error error;
+        if (docker::get_user_socket_path(socket_path, username) == -1 ||
+            docker::start_container(error, socket_path, container_name) == -1)
+        {
+            LOG_ERROR << "Docker start error. name: " << container_name << " status: " << error.status << " " << error.message;
+            return -1;
+        }
+        return 0;
     }
 
     /**
-     * Execute docker stop <container_name> command.
+     * Stops the given container through the docker daemon of the instance user.
      * @param username Username of the instance user.
      * @param container_name Name of the container.
      * @return 0 on successful execution and -1 on error.
      */
     int docker_stop(std::string_view username, std::string_view container_name)
     {
-        const int len = 99 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_STOP, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
+        const trace::span span("docker_stop");
+        std::string socket_path;
+        docker::api_error error;
+        if (docker::get_user_socket_path(socket_path, username) == -1 ||
+            docker::stop_container(error, socket_path, container_name) == -1)
+        {
+            LOG_ERROR << "Docker stop error. name: " << container_name << " status: " << error.status << " " << error.message;
+            return -1;
+        }
+        return 0;
     }
 
     /**
-     * Execute docker rm <container_name> command.
+     * Force removes the given container through the docker daemon of the instance user.
      * @param username Username of the instance user.
      * @param container_name Name of the container.
      * @return 0 on successful execution and -1 on error.
      */
     int docker_remove(std::string_view username, std::string_view container_name)
     {
-        const int len = 100 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_REMOVE, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
+        const trace::span span("docker_remove");
+        std::string socket_path;
+        docker::api_error error;
+        if (docker::get_user_socket_path(socket_path, username) == -1 ||
+            docker::remove_container(error, socket_path, container_name) == -1)
+        {
+            LOG_ERROR << "Docker remove error. name: " << container_name << " status: " << error.status << " " << error.message;
+            return -1;
+        }
+        return 0;
     }
 
     /**
@@ -486,8 +883,7 @@ namespace hp
     int destroy_container(std::string &error_msg, std::string_view container_name)
     {
         instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        if (registry::get_instance(container_name, info) == -1)
         {
             error_msg = NO_CONTAINER;
             LOG_ERROR << "Given container not found. name: " << container_name;
@@ -496,66 +892,134 @@ namespace hp
 
         LOG_INFO << "Deleting instance " << container_name;
         if (uninstall_user(info.username, info.assigned_ports, container_name) == -1 ||
-            // sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::DESTROYED]) == -1) // Soft Deletion.
-            sqlite::delete_hp_instance(db, container_name) == -1) // Permanent Deletion.
+            registry::remove_instance(container_name) == -1)
         {
             error_msg = USER_UNINSTALL_ERROR;
             return -1;
         }
-        // Add the port pair of the destroyed container to the vacant port vector.
-        if (std::find(vacant_ports.begin(), vacant_ports.end(), info.assigned_ports) == vacant_ports.end())
+        scheduler::release(scheduler::get_allocation(info));
+
+        // The freed instance slot can be used to refill the warm pool.
+        warm_pool_cv.notify_one();
+        return 0;
+    }
+
+    /**
+     * Changes the size of an instance in place. The new size is taken out of the budget first, then the disk quota
+     * and the cgroup limits of the instance user are rewritten while the container and hpfs keep running, and the
+     * size is persisted last. Any failure puts the previous size back. Shrinking below the memory or disk in use is
+     * refused so the instance is not killed or left over its quota.
+     * @param error_msg Error message if any.
+     * @param res The new size of the instance.
+     * @param container_name Name of the instance.
+     * @param request Requested tier and sizes. Sizes which are 0 keep their current values unless a tier is given.
+     * @return 0 on success and -1 on error.
+     */
+    int resize_instance(std::string &error_msg, resources &res, std::string_view container_name, const msg::resource_request &request)
+    {
+        instance_info info;
+        if (registry::get_instance(container_name, info) == -1)
         {
-            if (info.assigned_ports.gp_tcp_port_start == 0)
-            {
-                const uint16_t increment = ((info.assigned_ports.peer_port - conf::cfg.hp.init_peer_port) * 2);
-                const uint16_t gp_tcp_port_start = conf::cfg.hp.init_gp_tcp_port + increment;
-                const uint16_t gp_udp_port_start = conf::cfg.hp.init_gp_udp_port + increment;
-                vacant_ports.push_back({info.assigned_ports.user_port, info.assigned_ports.peer_port, gp_tcp_port_start, gp_udp_port_start});
-            }
-            else
-            {
-                vacant_ports.push_back(info.assigned_ports);
-            }
+            error_msg = NO_CONTAINER;
+            LOG_ERROR << "Given container not found. name: " << container_name;
+            return -1;
+        }
+
+        const resources current = scheduler::get_allocation(info);
+        msg::resource_request full_request = request;
+        if (request.tier.empty())
+        {
+            full_request.cpu_us = request.cpu_us != 0 ? request.cpu_us : current.cpu_us;
+            full_request.mem_kbytes = request.mem_kbytes != 0 ? request.mem_kbytes : current.mem_kbytes;
+            full_request.swap_kbytes = request.swap_kbytes != 0 ? request.swap_kbytes : current.swap_kbytes - std::min(current.swap_kbytes, current.mem_kbytes);
+            full_request.storage_kbytes = request.storage_kbytes != 0 ? request.storage_kbytes : current.storage_kbytes;
         }
 
+        if (scheduler::resolve(error_msg, res, full_request) == -1)
+            return -1;
+
+        // Io limits follow the tier, so they are kept if only the sizes are changed.
+        if (request.tier.empty())
+        {
+            res.io_read_bps = current.io_read_bps;
+            res.io_write_bps = current.io_write_bps;
+        }
+
+        util::user_info user;
+        if (util::get_system_user_info(info.username, user) == -1)
+        {
+            error_msg = INSTANCE_RESIZE_ERROR;
+            LOG_ERROR << "Error getting the user of " << container_name;
+            return -1;
+        }
+
+        // The quota would not stop the files already written, so shrinking the disk below them is refused.
+        size_t used_kbytes = 0;
+        if (res.storage_kbytes < current.storage_kbytes && provisioner::get_disk_usage(user.user_id, used_kbytes) == 0 &&
+            res.storage_kbytes < used_kbytes)
+        {
+            error_msg = STORAGE_IN_USE;
+            LOG_ERROR << "Instance " << container_name << " uses " << used_kbytes << " KB which is more than the requested storage.";
+            return -1;
+        }
+
+        // Limits below the memory in use would force reclaim or an oom kill of the running instance, so shrinking
+        // below it is refused as well. Sizes other than the standard slot need cgroup v2, so v1 never shrinks.
+        uint64_t mem_bytes = 0, swap_bytes = 0;
+        if (cgroup::is_v2() && (res.mem_kbytes < current.mem_kbytes || res.swap_kbytes < current.swap_kbytes) &&
+            cgroup::get_memory_usage(user.user_id, mem_bytes, swap_bytes) == 0 &&
+            (res.mem_kbytes * 1024 < mem_bytes || res.swap_kbytes * 1024 < mem_bytes + swap_bytes))
+        {
+            error_msg = MEMORY_IN_USE;
+            LOG_ERROR << "Instance " << container_name << " uses " << (mem_bytes / 1024) << " KB memory and " << (swap_bytes / 1024)
+                      << " KB swap which is more than the requested memory.";
+            return -1;
+        }
+
+        if (scheduler::resize(error_msg, current, res) == -1)
+            return -1;
+
+        if (provisioner::update_resources(user.user_id, info.username, to_provision_params(res)) == -1 ||
+            registry::update_allocation(container_name, res) == -1)
+        {
+            error_msg = INSTANCE_RESIZE_ERROR;
+            LOG_ERROR << "Error resizing instance " << container_name << ". Restoring the previous size.";
+            if (provisioner::update_resources(user.user_id, info.username, to_provision_params(current)) == -1)
+                LOG_ERROR << "Error restoring the limits of " << container_name;
+
+            scheduler::revert(res, current);
+            return -1;
+        }
+
+        LOG_INFO << "Resized instance " << container_name << ". CPU: " << current.cpu_us << " -> " << res.cpu_us << " MicroS, RAM: "
+                 << current.mem_kbytes << " -> " << res.mem_kbytes << " KB, Storage: " << current.storage_kbytes << " -> " << res.storage_kbytes << " KB.";
         return 0;
     }
 
     /**
-     * Creates a copy of default contract with the given name and the ports in the instance folder given in the config file.
+     * Prepares a copy of the default contract for an instance and writes the instance config into it. The contract
+     * becomes visible in the contract dir only when it's committed.
+     * @param contract Contract with the node keys to use. Receives the work dir of the contract.
      * @param username Name of the instance user.
      * @param owner_pubkey Public key of the owner of the instance.
      * @param contract_id Contract id to be configured.
      * @param contract_dir Directory of the contract.
      * @param assigned_ports Assigned ports to the instance.
-     * @param info Information of the created contract instance.
      * @return -1 on error and 0 on success.
-     *
      */
-    int create_contract(std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
-                        std::string_view contract_dir, const ports &assigned_ports, instance_info &info)
+    int stage_contract(staged_contract &contract, std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
+                       std::string_view contract_dir, const ports &assigned_ports)
     {
-        // Creating a temporary directory to do the config manipulations before moved to the contract dir.
-        // Folders inside /tmp directory will be cleaned after a reboot. So this will self cleanup folders
-        // that might be remaining due to another error in the workflow.
-        char templ[17] = "/tmp/sashiXXXXXX";
-        const char *temp_dirpath = mkdtemp(templ);
-        if (temp_dirpath == NULL)
-        {
-            LOG_ERROR << errno << ": Error creating temporary directory to create contract folder.";
+        const trace::span span("stage_contract");
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
             return -1;
-        }
-        const std::string source_path = conf::ctx.contract_template_path + "/*";
-        int len = 25 + source_path.length();
-        char cp_command[len];
-        sprintf(cp_command, COPY_DIR, source_path.data(), temp_dirpath);
-        if (system(cp_command) != 0)
-        {
-            LOG_ERROR << errno << ": Default contract copying failed to " << temp_dirpath;
+
+        std::string work_dir;
+        if (contract_template::prepare(work_dir, contract_dir, user) == -1)
             return -1;
-        }
 
-        const std::string config_dir = std::string(temp_dirpath) + "/cfg";
+        const std::string config_dir = work_dir + "/cfg";
 
         // Read the config file into json document object.
         const std::string config_file_path = config_dir + "/hp.cfg";
@@ -564,6 +1028,7 @@ namespace hp
         if (config_fd == -1)
         {
             LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
+            contract_template::discard(work_dir, contract_dir);
             return -1;
         }
 
@@ -571,20 +1036,18 @@ namespace hp
         if (util::read_json_file(config_fd, d) == -1)
         {
             close(config_fd);
+            contract_template::discard(work_dir, contract_dir);
             return -1;
         }
 
-        std::string pubkey, seckey;
-        crypto::generate_signing_keys(pubkey, seckey);
-
-        const std::string pubkey_hex = util::to_hex(pubkey);
+        const std::string pubkey_hex = util::to_hex(contract.pubkey);
 
         d["node"]["public_key"] = pubkey_hex;
-        d["node"]["private_key"] = util::to_hex(seckey);
+        d["node"]["private_key"] = util::to_hex(contract.seckey);
         d["contract"]["id"] = contract_id;
         d["contract"]["run_as"] = contract_ugid.to_string();
         jsoncons::ojson unl(jsoncons::json_array_arg);
-        unl.push_back(util::to_hex(pubkey));
+        unl.push_back(pubkey_hex);
         d["contract"]["unl"] = unl;
         d["contract"]["bin_path"] = "bootstrap_contract";
         d["contract"]["bin_args"] = owner_pubkey;
@@ -596,47 +1059,50 @@ namespace hp
         {
             LOG_ERROR << "Writing modified hp config failed.";
             close(config_fd);
+            contract_template::discard(work_dir, contract_dir);
             return -1;
         }
         close(config_fd);
 
-        // Move the contract to contract dir
-        len = 22 + contract_dir.length();
-        char mv_command[len];
-        sprintf(mv_command, MOVE_DIR, temp_dirpath, contract_dir.data());
-        if (system(mv_command) != 0)
-        {
-            LOG_ERROR << "Default contract moving failed to " << contract_dir;
-            return -1;
-        }
+        contract.work_dir = work_dir;
+        contract.contract_dir = contract_dir;
+        return 0;
+    }
 
-        // Transfer ownership to the instance user.
-        len = 12 + (username.length() * 2) + contract_dir.length();
-        char own_command[len];
-        sprintf(own_command, CHOWN_DIR, username.data(), username.data(), contract_dir.data());
-        len = 11 + 4 + contract_dir.length();
-        // Give group write access to the contract directory, So contract user can write into it.
-        char perm_command[len];
-        sprintf(perm_command, CHMOD_DIR, "0775", contract_dir.data());
-        if (system(own_command) != 0 || system(perm_command) != 0)
+    /**
+     * Moves a staged contract to its contract dir. The staged contract is discarded on error.
+     * @param contract The staged contract.
+     * @param username Name of the instance user.
+     * @param owner_pubkey Public key of the owner of the instance.
+     * @param contract_id Contract id to be configured.
+     * @param assigned_ports Assigned ports to the instance.
+     * @param info Information of the created contract instance.
+     * @return -1 on error and 0 on success.
+     */
+    int commit_contract(const staged_contract &contract, std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
+                        const ports &assigned_ports, instance_info &info)
+    {
+        const trace::span span("commit_contract");
+        if (contract_template::commit(contract.work_dir, contract.contract_dir) == -1)
         {
-            LOG_ERROR << "Changing contract ownership and permissions failed " << contract_dir;
+            contract_template::discard(contract.work_dir, contract.contract_dir);
             return -1;
         }
 
         info.owner_pubkey = owner_pubkey;
         info.username = username;
-        info.contract_dir = contract_dir;
+        info.contract_dir = contract.contract_dir;
         info.ip = conf::cfg.hp.host_address;
         info.contract_id = contract_id;
-        info.pubkey = pubkey_hex;
+        info.pubkey = util::to_hex(contract.pubkey);
         info.assigned_ports = assigned_ports;
         info.status = CONTAINER_STATES[STATES::CREATED];
+        info.status_changed_on = util::get_epoch_milliseconds();
         return 0;
     }
 
     /**
-     * Check the status of the given container using docker inspect command.
+     * Check the status of the given container using the docker inspect api.
      * @param username Username of the instance user.
      * @param container_name Name of the container.
      * @param status The variable that holds the status of the container.
@@ -644,18 +1110,14 @@ namespace hp
      */
     int check_instance_status(std::string_view username, std::string_view container_name, std::string &status)
     {
-        const int len = 136 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_STATUS, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-
-        char buffer[20];
-
-        if (util::execute_bash_cmd(command, buffer, 20) == -1)
+        std::string socket_path;
+        docker::api_error error;
+        if (docker::get_user_socket_path(socket_path, username) == -1 ||
+            docker::inspect_container_status(error, socket_path, container_name, status) == -1)
+        {
+            LOG_ERROR << "Docker inspect error. name: " << container_name << " status: " << error.status << " " << error.message;
             return -1;
-
-        status = buffer;
-        status = status.substr(1, status.length() - 3);
-
+        }
         return 0;
     }
 
@@ -910,25 +1372,56 @@ namespace hp
         return 0;
     }
 
+    /**
+     * Get the provisioning params of a user with the given resources.
+     * @param res Resources of the user.
+     * @return Provisioning params.
+     */
+    const provisioner::provision_params to_provision_params(const resources &res)
+    {
+        provisioner::provision_params params;
+        params.cpu_us = res.cpu_us;
+        params.mem_kbytes = res.mem_kbytes;
+        params.swap_kbytes = res.swap_kbytes;
+        params.storage_kbytes = res.storage_kbytes;
+        params.io_read_bps = res.io_read_bps;
+        params.io_write_bps = res.io_write_bps;
+        params.contract_ugid = contract_ugid;
+        return params;
+    }
+
     /**
      * Create new user and install dependencies and populate id and username.
      * @param user_id Uid of the created user to be populated.
      * @param username Username of the created user to be populated.
-     * @param max_cpu_us CPU quota allowed for this user.
-     * @param max_mem_kbytes Memory quota allowed for this user.
-     * @param max_swap_kbytes Swap memory quota allowed for this user.
-     * @param storage_kbytes Disk quota allowed for this user.
+     * @param res Resources allowed for this user.
      * @param instance_ports Ports assigned to the instance.
      */
-    int install_user(
-        int &user_id, std::string &username, const size_t max_cpu_us, const size_t max_mem_kbytes, const size_t max_swap_kbytes, const size_t storage_kbytes,
-        std::string_view container_name, const ports instance_ports, std::string_view docker_image, std::string_view outbound_ipv6, std::string_view outbound_net_interface)
+    int install_user(int &user_id, std::string &username, const resources &res, std::string_view container_name, const ports instance_ports,
+                     std::string_view docker_image, std::string_view outbound_ipv6, std::string_view outbound_net_interface)
     {
+        const trace::span span("install_user");
+        // The instance specific setup is left to the assignment, so user-only installations are provisioned natively.
+        // user-install.sh takes over if the native provisioning fails (eg: user quotas are not enabled yet).
+        if (container_name.empty() && conf::cfg.system.provisioner == provisioner::MODE_NATIVE)
+        {
+            provisioner::provision_params params = to_provision_params(res);
+            if (outbound_ipv6 != "-" && outbound_net_interface != "-")
+            {
+                params.outbound_ipv6 = outbound_ipv6;
+                params.outbound_net_interface = outbound_net_interface;
+            }
+            if (provisioner::provision_user(user_id, username, params) == 0)
+                return 0;
+
+            LOG_WARNING << "Native user provisioning failed. Falling back to " << conf::ctx.user_install_sh;
+        }
+
         const std::vector<std::string_view> input_params = {
-            std::to_string(max_cpu_us),
-            std::to_string(max_mem_kbytes),
-            std::to_string(max_swap_kbytes),
-            std::to_string(storage_kbytes),
+            std::to_string(res.cpu_us),
+            std::to_string(res.mem_kbytes),
+            std::to_string(res.swap_kbytes),
+            std::to_string(res.storage_kbytes),
             container_name,
             std::to_string(contract_ugid.uid),
             std::to_string(contract_ugid.gid),
@@ -941,7 +1434,7 @@ namespace hp
             outbound_ipv6,
             outbound_net_interface};
         std::vector<std::string> output_params;
-        if (util::execute_bash_file(conf::ctx.user_install_sh, output_params, input_params) == -1)
+        if (util::execute_bash_file(conf::ctx.user_install_sh, output_params, input_params, INSTALL_TIMEOUT_MS) == -1)
             return -1;
 
         if (strncmp(output_params.at(output_params.size() - 1).data(), "INST_SUC", 8) == 0) // If success.
@@ -952,6 +1445,25 @@ namespace hp
                 return -1;
             }
             username = output_params.at(1);
+
+            // The script limits the slice through systemd, which has no io limits. On cgroup v2 the complete set of
+            // limits is written natively.
+            if (cgroup::is_v2())
+            {
+                cgroup::limits lim;
+                lim.cpu_us = res.cpu_us;
+                lim.mem_kbytes = res.mem_kbytes;
+                lim.swap_kbytes = res.swap_kbytes;
+                lim.io_read_bps = res.io_read_bps;
+                lim.io_write_bps = res.io_write_bps;
+                if (cgroup::apply_limits(user_id, lim) == -1)
+                {
+                    LOG_ERROR << "Error applying the cgroup limits of " << username;
+                    uninstall_user(username, {}, {});
+                    return -1;
+                }
+            }
+
             LOG_INFO << "Created new user : " << username << ", uid : " << user_id;
             return 0;
         }
@@ -969,6 +1481,59 @@ namespace hp
         }
     }
 
+    /**
+     * Performs the instance specific setup on a warm user.
+     * @param username Username of the warm user.
+     * @param container_name Name of the instance.
+     * @param instance_ports Ports assigned to the instance.
+     * @param docker_image Docker image of the instance.
+     * @param max_mem_kbytes Memory allocated to the instance.
+     * @param storage_kbytes Storage allocated to the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int assign_user(std::string_view username, std::string_view container_name, const ports &instance_ports, std::string_view docker_image,
+                    const size_t max_mem_kbytes, const size_t storage_kbytes)
+    {
+        const trace::span span("assign_user");
+        const std::string peer_port = std::to_string(instance_ports.peer_port);
+        const std::string user_port = std::to_string(instance_ports.user_port);
+        const std::string gp_tcp_port_start = std::to_string(instance_ports.gp_tcp_port_start);
+        const std::string gp_udp_port_start = std::to_string(instance_ports.gp_udp_port_start);
+        const std::string mem_kbytes = std::to_string(max_mem_kbytes);
+        const std::string disk_kbytes = std::to_string(storage_kbytes);
+        const std::vector<std::string_view> input_params = {
+            username,
+            container_name,
+            peer_port,
+            user_port,
+            gp_tcp_port_start,
+            gp_udp_port_start,
+            docker_image,
+            mem_kbytes,
+            disk_kbytes};
+        std::vector<std::string> output_params;
+        if (util::execute_bash_file(conf::ctx.user_assign_sh, output_params, input_params, ASSIGN_TIMEOUT_MS) == -1)
+            return -1;
+
+        if (strncmp(output_params.at(output_params.size() - 1).data(), "ASSIGN_SUC", 10) == 0) // If success.
+        {
+            LOG_INFO << "Assigned user " << username << " to " << container_name;
+            return 0;
+        }
+        else if (strncmp(output_params.at(output_params.size() - 1).data(), "ASSIGN_ERR", 10) == 0) // If error.
+        {
+            const std::string error = output_params.at(0);
+            LOG_ERROR << "User assignment error : " << error;
+            return -1;
+        }
+        else
+        {
+            const std::string error = output_params.at(0);
+            LOG_ERROR << "Unknown user assignment error : " << error;
+            return -1;
+        }
+    }
+
     /**
      * Delete the given user and remove dependencies.
      * @param username Username of the user to be deleted.
@@ -977,6 +1542,12 @@ namespace hp
      */
     int uninstall_user(std::string_view username, const ports assigned_ports, std::string_view instance_name)
     {
+        const trace::span span("uninstall_user");
+        // Contract overlay has to be unmounted before the user's home directory can be removed.
+        if (!instance_name.empty() &&
+            contract_template::unmount_overlay(util::get_user_contract_dir(std::string(username), instance_name)) == -1)
+            return -1;
+
         const std::vector<std::string_view> input_params = {
             username,
             std::to_string(assigned_ports.peer_port),
@@ -985,7 +1556,7 @@ namespace hp
             std::to_string(assigned_ports.gp_udp_port_start),
             instance_name};
         std::vector<std::string> output_params;
-        if (util::execute_bash_file(conf::ctx.user_uninstall_sh, output_params, input_params) == -1)
+        if (util::execute_bash_file(conf::ctx.user_uninstall_sh, output_params, input_params, UNINSTALL_TIMEOUT_MS) == -1)
             return -1;
 
         // const std::string contract_dir = util::get_user_contract_dir(info.username, container_name);
@@ -1009,12 +1580,12 @@ namespace hp
     }
 
     /**
-     * Get the instance list except destroyed instances from the database.
+     * Get the instance list from the registry.
      * @param instances List of instances to be populated.
      */
     void get_instance_list(std::vector<hp::instance_info> &instances)
     {
-        sqlite::get_instance_list(db, instances);
+        registry::get_instance_list(instances);
     }
 
     /**
@@ -1024,17 +1595,34 @@ namespace hp
     void get_lease_list(std::vector<hp::lease_info> &leases)
     {
         const std::string db_mb_path = conf::ctx.data_dir + "/mb-xrpl/mb-xrpl.sqlite";
-        if (sqlite::open_db(db_mb_path, &db_mb, true) == -1)
+        std::scoped_lock lock(db_mb_mutex);
+
+        // The connection is kept open across calls. It's only reopened if the database file has been replaced.
+        struct stat st;
+        if (stat(db_mb_path.data(), &st) == -1)
         {
-            LOG_ERROR << "Error preparing messageboard database in " << db_mb_path;
+            LOG_ERROR << errno << ": Error reading messageboard database stat " << db_mb_path;
+            sqlite::close_db(&db_mb);
             return;
         }
+
+        if (db_mb == NULL || st.st_ino != db_mb_inode || st.st_dev != db_mb_dev)
+        {
+            sqlite::close_db(&db_mb);
+            if (sqlite::open_db(db_mb_path, &db_mb) == -1)
+            {
+                LOG_ERROR << "Error preparing messageboard database in " << db_mb_path;
+                return;
+            }
+            db_mb_inode = st.st_ino;
+            db_mb_dev = st.st_dev;
+        }
+
         sqlite::get_lease_list(db_mb, leases);
-        sqlite::close_db(&db_mb);
     }
 
     /**
-     * Get the instance with given name from the database, skip if destroyed.
+     * Get the instance with given name from the registry.
      * @param error_msg Error message if any.
      * @param container_name Name of the instance
      * @param instance Instance info ref to be populated.
@@ -1042,75 +1630,78 @@ namespace hp
      */
     int get_instance(std::string &error_msg, std::string_view container_name, hp::instance_info &instance)
     {
-        if (sqlite::get_instance(db, container_name, instance) == -1)
+        if (registry::get_instance(container_name, instance) == -1)
         {
             error_msg = DOCKER_CONTAINER_NOT_FOUND;
             LOG_ERROR << "No instace with name: " << container_name << ".";
             return -1;
         }
 
+        instance.allocation = scheduler::get_allocation(instance);
         return 0;
     }
     /**
-     * Populate the given vector with vacant ports which are not already assigned.
-     * @param vacant_ports Ports vector to hold port pairs from database.
+     * Check whether there's a pending reboot and the cgroup limits can be applied. On cgroup v2 the agent applies the
+     * limits itself, otherwise the cgrules service must be running and configured.
+     * @return true if ready otherwise false.
      */
-    void get_vacant_ports_list(std::vector<hp::ports> &vacant_ports)
+    bool system_ready()
     {
-        const int gp_tcp_port_count = 2;
-        const int gp_udp_port_count = 2;
-
-        // get all instances
-        std::vector<hp::instance_info> instances;
-        get_instance_list(instances);
-
-        // no instances
-        if (instances.empty())
+        if (cgroup::is_v2())
         {
-            return;
+            if (!cgroup::is_ready())
+            {
+                LOG_ERROR << "Cgroup cpu and memory controllers are not enabled for the user slices.";
+                return false;
+            }
         }
-
-        // Get the max instance
-        const std::vector<hp::instance_info>::iterator element_max_peer_port = std::max_element(instances.begin(), instances.end(),
-                                                                                                [](const hp::instance_info &a, const hp::instance_info &b)
-                                                                                                {
-                                                                                                    return (uint16_t)(a.assigned_ports.user_port) < (uint16_t)(b.assigned_ports.user_port);
-                                                                                                });
-
-        ports init_ports = {(uint16_t)(conf::cfg.hp.init_peer_port), (uint16_t)(conf::cfg.hp.init_user_port), (uint16_t)(conf::cfg.hp.init_gp_tcp_port), (uint16_t)(conf::cfg.hp.init_gp_udp_port)};
-
-        // Keep increasing init port (peer port) until it reaches max port
-        // If init port values did not match with an item in the instances list, add init port values to vacant ports list.
-        while (init_ports.peer_port < element_max_peer_port->assigned_ports.peer_port)
+        else if (!is_cgrules_ready())
         {
+            return false;
+        }
 
-            bool is_item_available = std::find_if(instances.begin(), instances.end(), [init_ports](const instance_info &instance)
-                                                  { return instance.assigned_ports.peer_port == init_ports.peer_port; }) != instances.end();
+        // Check there's a pending reboot.
+        if (util::is_file_exists(REBOOT_FILE))
+        {
+            const int fd = open(REBOOT_FILE, O_RDONLY);
+            if (fd == -1)
+            {
+                LOG_ERROR << errno << ": Error opening the reboot file.";
+                return false;
+            }
 
-            if (!is_item_available)
+            std::string buf;
+            if (util::read_from_fd(fd, buf, 0) == -1)
             {
-                vacant_ports.push_back(init_ports);
+                LOG_ERROR << errno << ": Error reading the reboot file.";
+                close(fd);
+                return false;
             }
 
-            init_ports.peer_port++;
-            init_ports.user_port++;
-            init_ports.gp_tcp_port_start += gp_tcp_port_count;
-            init_ports.gp_udp_port_start += gp_udp_port_count;
+            close(fd);
+
+            if (std::regex_search(buf, std::regex(REBOOT_REGEXP)))
+            {
+                LOG_ERROR << "There's a pending reboot.";
+                return false;
+            }
         }
+
+        return true;
     }
+
     /**
-     * Check whether there's a pending reboot and cgrules service is running and configured.
+     * Check whether the cgrules service is running and configured.
      * @return true if active and configured otherwise false.
      */
-    bool system_ready()
+    bool is_cgrules_ready()
     {
-        char buffer[20];
-
-        if (util::execute_bash_cmd(CGRULE_ACTIVE, buffer, 20) == -1)
+        std::string output;
+        if (util::execute_bash_cmd(CGRULE_ACTIVE, output, CGRULE_CHECK_TIMEOUT_MS) == -1)
             return false;
 
         // Check cgrules service status is active.
-        if (strncmp(buffer, "active", 6) != 0)
+        if (strncmp(output.data(), "active", 6) != 0)
         {
             LOG_ERROR << "Cgrules service is inactive.";
             return false;
@@ -1124,7 +1715,7 @@ namespace hp
         }
 
         // Check cgrules config exist and configured.
-        int fd = open(CGRULE_CONF, O_RDONLY);
+        const int fd = open(CGRULE_CONF, O_RDONLY);
         if (fd == -1)
         {
             LOG_ERROR << errno << ": Error opening the cgrules config file.";
@@ -1147,32 +1738,6 @@ namespace hp
             return false;
         }
 
-        // Check there's a pending reboot.
-        if (util::is_file_exists(REBOOT_FILE))
-        {
-            fd = open(REBOOT_FILE, O_RDONLY);
-            if (fd == -1)
-            {
-                LOG_ERROR << errno << ": Error opening the reboot file.";
-                return false;
-            }
-
-            if (util::read_from_fd(fd, buf, 0) == -1)
-            {
-                LOG_ERROR << errno << ": Error reading the reboot file.";
-                close(fd);
-                return false;
-            }
-
-            close(fd);
-
-            if (std::regex_search(buf, std::regex(REBOOT_REGEXP)))
-            {
-                LOG_ERROR << "There's a pending reboot.";
-                return false;
-            }
-        }
-
         return true;
     }
 } // namespace hp
@@ -6,6 +6,7 @@
 #include "conf.hpp"
 #include "conf.hpp"
 #include "msg/msg_common.hpp"
+#include "provisioner.hpp"
 
 namespace hp
 {
@@ -35,6 +36,16 @@ namespace hp
         }
     };
 
+    struct resources
+    {
+        size_t cpu_us = 0;         // CPU time an instance can consume.
+        size_t mem_kbytes = 0;     // Memory an instance can allocate.
+        size_t swap_kbytes = 0;    // Swap memory an instance can allocate.
+        size_t storage_kbytes = 0; // Physical storage an instance can allocate.
+        size_t io_read_bps = 0;    // Disk read bandwidth of an instance. 0 means unlimited.
+        size_t io_write_bps = 0;   // Disk write bandwidth of an instance. 0 means unlimited.
+    };
+
     struct instance_info
     {
         std::string owner_pubkey;
@@ -45,8 +56,10 @@ namespace hp
         std::string contract_id;
         ports assigned_ports;
         std::string status;
+        uint64_t status_changed_on = 0; // Epoch milliseconds of the last status change. 0 if not known.
         std::string username;
         std::string image_name;
+        resources allocation; // Size of the instance. Empty for instances created before the sizes were recorded.
     };
 
     // Represents a lease data retured from message board database.
@@ -59,19 +72,53 @@ namespace hp
         uint64_t life_moments;
     };
 
-    struct resources
+    // A pre-provisioned instance user which is not yet assigned to an instance.
+    struct warm_user
     {
-        size_t cpu_us = 0;         // CPU time an instance can consume.
-        size_t mem_kbytes = 0;     // Memory an instance can allocate.
-        size_t swap_kbytes = 0;    // Swap memory an instance can allocate.
-        size_t storage_kbytes = 0; // Physical storage an instance can allocate.
+        std::string username;
+        int user_id = 0;
+    };
+
+    // A contract prepared in its work dir while the other stages of the instance creation run.
+    struct staged_contract
+    {
+        std::string pubkey; // Node signing keys.
+        std::string seckey;
+        std::string work_dir;
+        std::string contract_dir;
+    };
+
+    // Time taken by the stages of an instance creation in milliseconds.
+    struct create_timings
+    {
+        uint64_t user_ms = 0;       // User installation or warm user assignment.
+        uint64_t contract_ms = 0;   // Contract staging.
+        uint64_t image_wait_ms = 0; // Wait for the image download which was not overlapped by the earlier stages.
+        uint64_t container_ms = 0;  // Contract commit and container creation.
     };
 
     int init();
 
     void deinit();
 
-    int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image_key, std::string_view outbound_ipv6, std::string_view outbound_net_interface);
+    int init_warm_pool();
+
+    void warm_pool_loop();
+
+    int init_reconciler();
+
+    void reconciler_loop();
+
+    void reconcile_status();
+
+    bool take_warm_user(warm_user &user);
+
+    int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image_key, std::string_view outbound_ipv6, std::string_view outbound_net_interface,
+                            const msg::resource_request &request);
+
+    int reserve_allocation(std::string &error_msg, const resources &res, ports &instance_ports);
+
+    void release_allocation(const resources &res, const ports &instance_ports);
 
     int initiate_instance(std::string &error_msg, std::string_view container_name, const msg::initiate_msg &config_msg);
 
@@ -89,8 +136,13 @@ namespace hp
 
     int destroy_container(std::string &error_msg, std::string_view container_name);
 
-    int create_contract(std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
-                        std::string_view contract_dir, const ports &assigned_ports, instance_info &info);
+    int resize_instance(std::string &error_msg, resources &res, std::string_view container_name, const msg::resource_request &request);
+
+    int stage_contract(staged_contract &contract, std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
+                       std::string_view contract_dir, const ports &assigned_ports);
+
+    int commit_contract(const staged_contract &contract, std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
+                        const ports &assigned_ports, instance_info &info);
 
     int check_instance_status(std::string_view username, std::string_view container_name, std::string &status);
 
@@ -98,9 +150,13 @@ namespace hp
 
     int write_json_values(jsoncons::ojson &d, const msg::config_struct &config);
 
-    int install_user(int &user_id, std::string &username, const size_t max_cpu_us, const size_t max_mem_kbytes, const size_t max_swap_kbytes,
-                     const size_t storage_kbytes, std::string_view container_name, const ports instance_ports, std::string_view docker_image,
-                     std::string_view outbound_ipv6, std::string_view outbound_net_interface);
+    const provisioner::provision_params to_provision_params(const resources &res);
+
+    int install_user(int &user_id, std::string &username, const resources &res, std::string_view container_name, const ports instance_ports,
+                     std::string_view docker_image, std::string_view outbound_ipv6, std::string_view outbound_net_interface);
+
+    int assign_user(std::string_view username, std::string_view container_name, const ports &instance_ports, std::string_view docker_image,
+                    const size_t max_mem_kbytes, const size_t storage_kbytes);
 
     int uninstall_user(std::string_view username, const ports assigned_ports, std::string_view instance_name);
 
@@ -112,7 +168,7 @@ namespace hp
 
     bool system_ready();
 
-    void get_vacant_ports_list(std::vector<hp::ports> &vacant_ports);
+    bool is_cgrules_ready();
 
 } // namespace hp
 #endif
\ No newline at end of file
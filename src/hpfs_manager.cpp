@@ -1,29 +1,28 @@
 #include "hpfs_manager.hpp"
 #include "util/util.hpp"
 #include "conf.hpp"
+#include "trace.hpp"
 
 namespace hpfs
 {
     constexpr int FILE_PERMS = 0644;
+    constexpr const char *CONTRACT_FS_UNIT = "contract_fs.service";
+    constexpr const char *LEDGER_FS_UNIT = "ledger_fs.service";
+    constexpr const char *JOB_RESULT_DONE = "done";
+    constexpr uint64_t UNIT_JOB_TIMEOUT_MS = 30000; // Max time to wait for the units to get started or stopped.
+
     /**
      * Start hpfs systemd services of the instance.
      * @param username Username of the instance user.
      * @return -1 on error and 0 on success.
-     * 
+     *
     */
     int start_hpfs_systemd(const std::string &username)
     {
-        const std::string contract_fs_start = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user start contract_fs";
-        const std::string contract_fs_enable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user enable contract_fs";
-        const std::string ledger_fs_start = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user start ledger_fs";
-        const std::string ledger_fs_enable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user enable ledger_fs";
-
-        if (system(contract_fs_start.c_str()) == -1 ||
-            system(ledger_fs_start.c_str()) == -1 ||
-            system(contract_fs_enable.c_str()) == -1 ||
-            system(ledger_fs_enable.c_str()) == -1)
+        const trace::span span("hpfs_start");
+        if (control_units(username, true) == -1)
         {
-            LOG_ERROR << "Error stopping and disabling hpfs systemd services for user: " << username;
+            LOG_ERROR << "Error starting and enabling hpfs systemd services for user: " << username;
             return -1;
         }
 
@@ -34,19 +33,12 @@ namespace hpfs
      * Stop hpfs systemd services of the instance.
      * @param username Username of the instance user.
      * @return -1 on error and 0 on success.
-     * 
+     *
     */
     int stop_hpfs_systemd(const std::string &username)
     {
-        const std::string contract_fs_stop = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user stop contract_fs";
-        const std::string contract_fs_disable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user disable contract_fs";
-        const std::string ledger_fs_stop = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user stop ledger_fs";
-        const std::string ledger_fs_disable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user disable ledger_fs";
-
-        if (system(contract_fs_stop.c_str()) == -1 ||
-            system(ledger_fs_stop.c_str()) == -1 ||
-            system(contract_fs_disable.c_str()) == -1 ||
-            system(ledger_fs_disable.c_str()) == -1)
+        const trace::span span("hpfs_stop");
+        if (control_units(username, false) == -1)
         {
             LOG_ERROR << "Error stopping and disabling hpfs systemd services for user: " << username;
             return -1;
@@ -55,6 +47,190 @@ namespace hpfs
         return 0;
     }
 
+    /**
+     * Starts and enables or stops and disables the hpfs units through the systemd user manager of the instance user.
+     * All the method calls are sent at once and then the job completion signals are awaited.
+     * @param username Username of the instance user.
+     * @param start Whether to start or stop the units.
+     * @return -1 on error and 0 on success.
+     */
+    int control_units(const std::string &username, const bool start)
+    {
+        util::user_info user;
+        sd_bus *bus = NULL;
+        if (util::get_system_user_info(username, user) == -1 || connect_user_manager(user.user_id, &bus) == -1)
+            return -1;
+
+        std::unordered_map<std::string, std::string> finished_jobs;
+        std::vector<unit_call> calls(4);
+        calls[0] = {"", "Subscribe", false};
+        calls[1] = {"unit files", start ? "EnableUnitFiles" : "DisableUnitFiles", false};
+        calls[2] = {CONTRACT_FS_UNIT, start ? "StartUnit" : "StopUnit", true};
+        calls[3] = {LEDGER_FS_UNIT, start ? "StartUnit" : "StopUnit", true};
+
+        const uint64_t timeout_us = UNIT_JOB_TIMEOUT_MS * 1000;
+        int ret = sd_bus_add_match(bus, NULL, JOB_REMOVED_MATCH, on_job_removed, &finished_jobs);
+        if (ret >= 0)
+            ret = call_method(bus, calls[0], timeout_us, "");
+        if (ret >= 0)
+            ret = start ? call_method(bus, calls[1], timeout_us, "asbb", 2, CONTRACT_FS_UNIT, LEDGER_FS_UNIT, 0, 1)
+                        : call_method(bus, calls[1], timeout_us, "asb", 2, CONTRACT_FS_UNIT, LEDGER_FS_UNIT, 0);
+        for (size_t i = 2; ret >= 0 && i < calls.size(); i++)
+            ret = call_method(bus, calls[i], timeout_us, "ss", calls[i].unit.data(), "replace");
+
+        if (ret < 0)
+        {
+            LOG_ERROR << -ret << ": Error sending requests to the systemd user manager of " << username;
+            sd_bus_flush_close_unref(bus);
+            return -1;
+        }
+
+        return wait_unit_calls(bus, calls, finished_jobs, UNIT_JOB_TIMEOUT_MS);
+    }
+
+    /**
+     * Connects to the systemd user manager of a user. The private socket of the user manager accepts root connections
+     * directly without a bus daemon.
+     * @param user_id Uid of the user.
+     * @param bus Bus connection to be populated. Caller must close it.
+     * @return -1 on error and 0 on success.
+     */
+    int connect_user_manager(const int user_id, sd_bus **bus)
+    {
+        const std::string address = "unix:path=/run/user/" + std::to_string(user_id) + "/systemd/private";
+        int ret = sd_bus_new(bus);
+        if (ret >= 0)
+            ret = sd_bus_set_address(*bus, address.data());
+        if (ret >= 0)
+            ret = sd_bus_start(*bus);
+        if (ret < 0)
+        {
+            LOG_ERROR << -ret << ": Error connecting to the systemd user manager at " << address;
+            *bus = sd_bus_close_unref(*bus);
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Waits for the replies of the sent calls and their queued jobs, closes the bus and reports the result of each call.
+     * @param bus Bus connection the calls were sent on. It is closed once done.
+     * @param calls Sent calls.
+     * @param finished_jobs Results of the finished jobs, populated by on_job_removed.
+     * @param timeout_ms Max time to wait.
+     * @return -1 if any call failed and 0 on success.
+     */
+    int wait_unit_calls(sd_bus *bus, const std::vector<unit_call> &calls, const std::unordered_map<std::string, std::string> &finished_jobs, const uint64_t timeout_ms)
+    {
+        const uint64_t deadline = util::get_epoch_milliseconds() + timeout_ms;
+        while (!is_completed(calls, finished_jobs))
+        {
+            int ret = sd_bus_process(bus, NULL);
+            if (ret > 0)
+                continue;
+
+            const uint64_t now = util::get_epoch_milliseconds();
+            if (ret < 0 || now >= deadline || (ret = sd_bus_wait(bus, (deadline - now) * 1000)) < 0)
+                break;
+        }
+        sd_bus_flush_close_unref(bus);
+
+        // Report the result of each unit.
+        int status = 0;
+        for (const unit_call &call : calls)
+        {
+            const auto itr = finished_jobs.find(call.job_path);
+            if (!call.error.empty())
+                LOG_ERROR << call.method << " " << call.unit << " failed: " << call.error;
+            else if (!call.replied)
+                LOG_ERROR << call.method << " " << call.unit << " timed out.";
+            else if (call.has_job && itr == finished_jobs.end())
+                LOG_ERROR << call.method << " " << call.unit << " job did not complete.";
+            else if (call.has_job && itr->second != JOB_RESULT_DONE)
+                LOG_ERROR << call.method << " " << call.unit << " job result: " << itr->second;
+            else
+                continue;
+
+            status = -1;
+        }
+
+        return status;
+    }
+
+    /**
+     * Sends a method call to the systemd manager without waiting for the reply.
+     * @param bus Bus connection.
+     * @param call The call whose reply should be recorded.
+     * @param timeout_us Timeout of the reply in microseconds.
+     * @param types Signature of the arguments.
+     * @return Negative errno on error.
+     */
+    int call_method(sd_bus *bus, unit_call &call, const uint64_t timeout_us, const char *types, ...)
+    {
+        sd_bus_message *msg = NULL;
+        int ret = sd_bus_message_new_method_call(bus, &msg, SYSTEMD_SERVICE, SYSTEMD_PATH, SYSTEMD_MANAGER_INTERFACE, call.method.data());
+        if (ret >= 0)
+        {
+            va_list args;
+            va_start(args, types);
+            ret = sd_bus_message_appendv(msg, types, args);
+            va_end(args);
+        }
+        if (ret >= 0)
+            ret = sd_bus_call_async(bus, NULL, msg, on_method_reply, &call, timeout_us);
+
+        sd_bus_message_unref(msg);
+        return ret;
+    }
+
+    /**
+     * Records the reply of a method call. Replies of unit start and stop calls carry the path of the queued job.
+     */
+    int on_method_reply(sd_bus_message *msg, void *userdata, sd_bus_error *ret_error)
+    {
+        unit_call &call = *static_cast<unit_call *>(userdata);
+        call.replied = true;
+
+        const sd_bus_error *error = sd_bus_message_get_error(msg);
+        if (error != NULL)
+        {
+            call.error = error->message != NULL ? error->message : error->name;
+            return 0;
+        }
+
+        const char *job_path;
+        if (call.has_job)
+        {
+            if (sd_bus_message_read(msg, "o", &job_path) < 0)
+                call.error = "Invalid reply.";
+            else
+                call.job_path = job_path;
+        }
+        return 0;
+    }
+
+    /**
+     * Records the result of a finished job.
+     */
+    int on_job_removed(sd_bus_message *msg, void *userdata, sd_bus_error *ret_error)
+    {
+        auto &finished_jobs = *static_cast<std::unordered_map<std::string, std::string> *>(userdata);
+        uint32_t id;
+        const char *job_path, *unit, *result;
+        if (sd_bus_message_read(msg, "uoss", &id, &job_path, &unit, &result) >= 0)
+            finished_jobs.emplace(job_path, result);
+        return 0;
+    }
+
+    /**
+     * Checks whether all the calls are replied and all the queued jobs are finished.
+     */
+    bool is_completed(const std::vector<unit_call> &calls, const std::unordered_map<std::string, std::string> &finished_jobs)
+    {
+        return std::all_of(calls.begin(), calls.end(), [&](const unit_call &call)
+                           { return call.replied && (!call.has_job || !call.error.empty() || finished_jobs.count(call.job_path) == 1); });
+    }
+
     /**
      * Update service configuration file for the instance with hpfs related config values.
      * @param username Username of the instance user.
@@ -5,8 +5,31 @@
 
 namespace hpfs
 {
+    constexpr const char *SYSTEMD_SERVICE = "org.freedesktop.systemd1";
+    constexpr const char *SYSTEMD_PATH = "/org/freedesktop/systemd1";
+    constexpr const char *SYSTEMD_MANAGER_INTERFACE = "org.freedesktop.systemd1.Manager";
+    constexpr const char *JOB_REMOVED_MATCH = "type='signal',interface='org.freedesktop.systemd1.Manager',member='JobRemoved'";
+
+    // A method call to the systemd user manager of an instance user.
+    struct unit_call
+    {
+        std::string unit;      // Unit the call is made for.
+        std::string method;    // Systemd manager method.
+        bool has_job = false;  // Whether the call queues a job for the unit.
+        bool replied = false;
+        std::string error;     // Error of the call if it failed.
+        std::string job_path;  // Object path of the queued job.
+    };
+
     int start_hpfs_systemd(const std::string &username);
     int stop_hpfs_systemd(const std::string &username);
+    int control_units(const std::string &username, const bool start);
+    int connect_user_manager(const int user_id, sd_bus **bus);
+    int wait_unit_calls(sd_bus *bus, const std::vector<unit_call> &calls, const std::unordered_map<std::string, std::string> &finished_jobs, const uint64_t timeout_ms);
+    int call_method(sd_bus *bus, unit_call &call, const uint64_t timeout_us, const char *types, ...);
+    int on_method_reply(sd_bus_message *msg, void *userdata, sd_bus_error *ret_error);
+    int on_job_removed(sd_bus_message *msg, void *userdata, sd_bus_error *ret_error);
+    bool is_completed(const std::vector<unit_call> &calls, const std::unordered_map<std::string, std::string> &finished_jobs);
     int update_service_conf(const std::string &username, const std::string &log_level, const bool is_full_history);
 } // namespace hpfs
 #endif
\ No newline at end of file
@@ -0,0 +1,991 @@
+#include "image_store.hpp"
+#include "conf.hpp"
+#include "docker_client.hpp"
+#include "instance_registry.hpp"
+#include "trace.hpp"
+#include "util/util.hpp"
+
+namespace image_store
+{
+    constexpr const char *STORE_DIR = "/image_store";
+    constexpr const char *BLOBS_DIR = "/blobs/sha256";
+    constexpr const char *REFS_DIR = "/refs";
+    constexpr const char *TEMP_FILE_PREFIX = "tmp.";
+    constexpr const char *DOWNLOADS_DIR = "/downloads"; // Archives being downloaded by the prefetch script.
+    constexpr const char *IMAGES_DIR = "/dockerbin/images"; // Where user-assign.sh saves the pulled images.
+    constexpr const char *IMAGE_NAME_CHARS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-:/@";
+    constexpr size_t TAR_BLOCK_SIZE = 512;
+    constexpr size_t TAR_SIZE_OFFSET = 124;
+    constexpr size_t TAR_SIZE_LEN = 12;
+    constexpr size_t TAR_TYPE_OFFSET = 156;
+    constexpr size_t MAX_PREFETCH_QUEUE_SIZE = 32;
+    constexpr int IMAGE_LOAD_TIMEOUT_SECS = 600;
+    constexpr uint64_t PREFETCH_TIMEOUT_MS = 30 * 60 * 1000;
+    constexpr int FILE_PERMS = 0644;
+
+    // Each live instance of an image counts as this much more recent use when picking images to evict.
+    constexpr uint64_t LIVE_INSTANCE_WEIGHT_MS = 24 * 60 * 60 * 1000;
+
+    std::string store_dir;
+    std::mutex import_mutex; // Imports of the same image by parallel instance creations are done once.
+
+    // Images and blobs in the store. Streams pin the blobs of the image under the shared lock (see pin_blobs).
+    std::shared_mutex store_mutex;
+    std::unordered_map<std::string, std::vector<std::string>> images; // Image name -> digests of its blobs.
+    std::unordered_map<std::string, blob_info> blobs;                 // Digest -> blob.
+    size_t total_bytes = 0;
+
+    // Images waiting to be prefetched by the prefetch thread. Guarded by prefetch_mutex.
+    std::deque<std::string> prefetch_queue;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cv;
+    std::thread prefetch_thread;
+    bool is_shutting_down = false;
+
+    // Images being downloaded. Fetches of an image already being downloaded wait for it. Guarded by prefetch_mutex.
+    std::unordered_set<std::string> downloading;
+    std::condition_variable download_cv;
+    size_t active_fetches = 0; // Background fetches started by instance creations.
+
+    /**
+     * Prepares the image store, loads the images in the store and starts the prefetch thread.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        store_dir = conf::ctx.data_dir + STORE_DIR;
+        // Downloads interrupted by a restart are discarded.
+        util::remove_directory_recursively(store_dir + DOWNLOADS_DIR);
+        if (util::create_dir_tree_recursive(store_dir + BLOBS_DIR) == -1 ||
+            util::create_dir_tree_recursive(store_dir + REFS_DIR) == -1 ||
+            util::create_dir_tree_recursive(store_dir + DOWNLOADS_DIR) == -1)
+        {
+            LOG_ERROR << "Error creating image store in " << store_dir;
+            return -1;
+        }
+
+        if (load_index() == -1)
+            return -1;
+
+        try
+        {
+            prefetch_thread = std::thread(prefetch_loop);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the image prefetch thread. " << e.what();
+            return -1;
+        }
+
+        LOG_INFO << "Image store has " << images.size() << " images in " << (total_bytes / 1024) << " KB. Budget: "
+                 << conf::cfg.docker.image_cache_max_kbytes << " KB";
+        return 0;
+    }
+
+    /**
+     * Stops the prefetch thread after the prefetch in progress, if any.
+     */
+    void deinit()
+    {
+        {
+            std::scoped_lock lock(prefetch_mutex);
+            is_shutting_down = true;
+            prefetch_queue.clear();
+        }
+        prefetch_cv.notify_all();
+
+        if (prefetch_thread.joinable())
+            prefetch_thread.join();
+
+        std::unique_lock lock(prefetch_mutex);
+        download_cv.wait(lock, []
+                         { return active_fetches == 0; });
+    }
+
+    /**
+     * Get the name of the image which is actually pulled for the given instance image. Instance images may carry
+     * additional settings after a "--" separator in the tag.
+     * @param image Instance image.
+     * @return Image name with the tag.
+     */
+    const std::string get_pull_image(std::string_view image)
+    {
+        const size_t pos = image.find("--");
+        if (pos == std::string_view::npos)
+            return std::string(image);
+
+        std::string pull_image(image.substr(0, pos));
+        if (pull_image.back() == ':')
+            pull_image.append("latest");
+        return pull_image;
+    }
+
+    /**
+     * Streams an image from the store to the docker daemon of the instance user unless the daemon already has it.
+     * Blobs are sent straight from the store files, so the image archive is never materialized. The image is marked as
+     * recently used either way. The daemon extracts the layers itself, since the layer files of a rootless daemon are
+     * owned by the subordinate ids of its user and cannot be shared with the daemons of other users.
+     * @param username Username of the instance user.
+     * @param image Instance image.
+     * @return 0 if the daemon has the image and -1 if the image is not in the store or on error.
+     */
+    int load_image(std::string_view username, std::string_view image)
+    {
+        const trace::span span("image_load");
+        const std::string pull_image = get_pull_image(image);
+        {
+            std::shared_lock lock(store_mutex);
+            if (images.count(pull_image) == 0)
+                return -1;
+
+            touch_ref(pull_image);
+        }
+
+        std::string socket_path;
+        docker::api_error error;
+        bool exists = false;
+        if (docker::get_user_socket_path(socket_path, username) == -1 ||
+            docker::image_exists(error, socket_path, pull_image, exists) == -1)
+        {
+            LOG_ERROR << "Error checking image " << pull_image << " of " << username << ". status: " << error.status << " " << error.message;
+            return -1;
+        }
+
+        if (exists)
+            return 0;
+
+        // The stream can take minutes, so it runs without the store lock on the pinned blobs.
+        std::vector<archive_entry> entries;
+        std::vector<int> blob_fds;
+        if (pin_blobs(pull_image, entries, blob_fds) == -1)
+            return -1;
+
+        // Archive ends with two zero blocks.
+        size_t content_length = TAR_BLOCK_SIZE * 2;
+        for (const archive_entry &entry : entries)
+            content_length += TAR_BLOCK_SIZE + padded_size(entry.size);
+
+        const std::string zeros(TAR_BLOCK_SIZE * 2, '\0');
+        const auto writer = [&](const int fd)
+        {
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                const archive_entry &entry = entries[i];
+                if (docker::write_all(fd, entry.header) == -1)
+                    return -1;
+
+                if (entry.digest.empty())
+                {
+                    if (docker::write_all(fd, entry.data) == -1)
+                        return -1;
+                }
+                else
+                {
+                    off_t offset = 0;
+                    while ((size_t)offset < entry.size)
+                    {
+                        if (sendfile(fd, blob_fds[i], &offset, entry.size - offset) <= 0 && errno != EINTR)
+                            return -1;
+                    }
+                }
+
+                if (docker::write_all(fd, std::string_view(zeros.data(), padded_size(entry.size) - entry.size)) == -1)
+                    return -1;
+            }
+            return docker::write_all(fd, zeros);
+        };
+
+        const int ret = docker::load_image(error, socket_path, content_length, writer, IMAGE_LOAD_TIMEOUT_SECS);
+        unpin_blobs(blob_fds);
+        if (ret == -1)
+        {
+            LOG_ERROR << "Error loading image " << pull_image << " to " << username << ". status: " << error.status << " " << error.message;
+            return -1;
+        }
+
+        LOG_INFO << "Loaded image " << pull_image << " to " << username << " from the image store.";
+        return 0;
+    }
+
+    /**
+     * Opens the blobs of an image under the store lock. An open blob stays readable even if the image is evicted and
+     * the blob file is removed meanwhile, so the image can be streamed without holding the lock.
+     * @param image Image name with the tag.
+     * @param entries Archive entries of the image.
+     * @param blob_fds Fd of the blob of each entry. -1 for the entries without a blob.
+     * @return 0 on success and -1 if the image is not in the store or on error.
+     */
+    int pin_blobs(std::string_view image, std::vector<archive_entry> &entries, std::vector<int> &blob_fds)
+    {
+        std::shared_lock lock(store_mutex);
+        if (images.count(std::string(image)) == 0 || read_ref(image, entries) == -1)
+            return -1;
+
+        blob_fds.assign(entries.size(), -1);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].digest.empty())
+                continue;
+
+            const std::string blob_path = store_dir + BLOBS_DIR + "/" + entries[i].digest;
+            blob_fds[i] = open(blob_path.data(), O_RDONLY | O_CLOEXEC);
+            if (blob_fds[i] == -1)
+            {
+                LOG_ERROR << errno << ": Error opening image blob " << blob_path;
+                unpin_blobs(blob_fds);
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Closes the blobs opened by pin_blobs.
+     * @param blob_fds Fds of the blobs.
+     */
+    void unpin_blobs(std::vector<int> &blob_fds)
+    {
+        for (const int fd : blob_fds)
+        {
+            if (fd != -1)
+                close(fd);
+        }
+        blob_fds.clear();
+    }
+
+    /**
+     * Moves the image archive saved by the user assignment into the store. The archive is removed once imported
+     * since the store can reproduce it.
+     * @param image Instance image.
+     * @return 0 on success or if there's nothing to import and -1 on error.
+     */
+    int import_saved_image(std::string_view image)
+    {
+        const std::string pull_image = get_pull_image(image);
+        std::string tar_name = pull_image;
+        std::replace(tar_name.begin(), tar_name.end(), ':', '-');
+        const std::string tar_path = conf::ctx.exe_dir + IMAGES_DIR + "/" + tar_name + ".tar";
+
+        std::scoped_lock lock(import_mutex);
+        if (!util::is_file_exists(tar_path))
+            return 0;
+
+        if (import_tarball(tar_path, pull_image) == -1)
+            return -1;
+
+        unlink(tar_path.data());
+        LOG_INFO << "Imported image " << pull_image << " to the image store.";
+        return 0;
+    }
+
+    /**
+     * Queues an image to be prefetched into the store in the background.
+     * @param image Instance image.
+     * @return 0 if queued or already queued and -1 if the image name is invalid or the queue is full.
+     */
+    int prefetch(std::string_view image)
+    {
+        if (!is_valid_image_name(image))
+        {
+            LOG_ERROR << "Invalid image name to prefetch.";
+            return -1;
+        }
+
+        const std::string pull_image = get_pull_image(image);
+        {
+            std::scoped_lock lock(prefetch_mutex);
+            if (std::find(prefetch_queue.begin(), prefetch_queue.end(), pull_image) != prefetch_queue.end())
+                return 0;
+
+            if (prefetch_queue.size() >= MAX_PREFETCH_QUEUE_SIZE)
+            {
+                LOG_ERROR << "Image prefetch queue is full. Dropped " << pull_image;
+                return -1;
+            }
+            prefetch_queue.push_back(pull_image);
+        }
+        prefetch_cv.notify_one();
+        return 0;
+    }
+
+    /**
+     * Prefetches the queued images one at a time until shutdown.
+     */
+    void prefetch_loop()
+    {
+        util::mask_signal();
+
+        std::unique_lock lock(prefetch_mutex);
+        while (!is_shutting_down)
+        {
+            if (prefetch_queue.empty())
+            {
+                prefetch_cv.wait(lock);
+                continue;
+            }
+
+            const std::string image = prefetch_queue.front();
+            prefetch_queue.pop_front();
+            lock.unlock();
+
+            prefetch_image(image);
+
+            lock.lock();
+        }
+    }
+
+    /**
+     * Downloads an image from the registry and imports it to the store. Images already in the store are only
+     * marked as recently used.
+     * @param image Image name with the tag.
+     * @return 0 on success and -1 on error.
+     */
+    int prefetch_image(std::string_view image)
+    {
+        const std::string image_name(image);
+        {
+            std::unique_lock lock(prefetch_mutex);
+            download_cv.wait(lock, [&]
+                             { return downloading.count(image_name) == 0; });
+
+            std::shared_lock store_lock(store_mutex);
+            if (images.count(image_name) == 1)
+            {
+                touch_ref(image);
+                return 0;
+            }
+            downloading.insert(image_name);
+        }
+
+        const int ret = download_image(image);
+        {
+            std::scoped_lock lock(prefetch_mutex);
+            downloading.erase(image_name);
+        }
+        download_cv.notify_all();
+        return ret;
+    }
+
+    /**
+     * Downloads an instance image to the store ahead of the assignment of its user, so the assignment does not
+     * pull it. Fetches of an image already being downloaded by the prefetch thread or another creation wait for
+     * that download instead of starting another.
+     * @param image Instance image.
+     * @return 0 if the image is in the store and -1 on error.
+     */
+    int fetch_image(std::string_view image)
+    {
+        const trace::span span("image_fetch");
+        if (!is_valid_image_name(image))
+        {
+            LOG_ERROR << "Invalid image name to fetch.";
+            return -1;
+        }
+
+        return prefetch_image(get_pull_image(image));
+    }
+
+    /**
+     * Fetches an instance image to the store on a background thread, so the download overlaps with the other
+     * stages of the instance creation.
+     * @param image Instance image.
+     * @param result Becomes ready with the result of fetch_image once the fetch completes.
+     * @return 0 if the fetch was started and -1 on error.
+     */
+    int fetch_image_async(std::string_view image, std::future<int> &result)
+    {
+        std::packaged_task<int()> task([image = std::string(image)]
+                                       { return fetch_image(image); });
+        {
+            std::scoped_lock lock(prefetch_mutex);
+            if (is_shutting_down)
+                return -1;
+            active_fetches++;
+        }
+        result = task.get_future();
+
+        // The thread is detached, so a failed creation does not wait for the download. deinit waits for it instead.
+        const auto fetch = [trace_ctx = trace::get_context()](std::packaged_task<int()> task)
+        {
+            util::mask_signal();
+            {
+                const trace::operation_scope scope(trace_ctx);
+                task();
+            }
+            std::scoped_lock lock(prefetch_mutex);
+            active_fetches--;
+            download_cv.notify_all();
+        };
+
+        try
+        {
+            std::thread(fetch, std::move(task)).detach();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the image fetch thread. " << e.what();
+            std::scoped_lock lock(prefetch_mutex);
+            active_fetches--;
+            result = std::future<int>();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Runs the prefetch script for an image and imports the downloaded archive. Each download gets its own archive,
+     * so different images can be downloaded at once.
+     * @param image Image name with the tag.
+     * @return 0 on success and -1 on error.
+     */
+    int download_image(std::string_view image)
+    {
+        std::string tar_path = store_dir + DOWNLOADS_DIR + "/" + TEMP_FILE_PREFIX + "XXXXXX";
+        const int fd = mkstemp(tar_path.data());
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating download archive for " << image;
+            return -1;
+        }
+        close(fd);
+
+        LOG_INFO << "Downloading image " << image;
+        std::vector<std::string> output_params;
+        if (util::execute_bash_file(conf::ctx.image_prefetch_sh, output_params, {image, tar_path}, PREFETCH_TIMEOUT_MS) == -1 ||
+            output_params.empty())
+        {
+            unlink(tar_path.data());
+            return -1;
+        }
+
+        if (strncmp(output_params.at(output_params.size() - 1).data(), "PREFETCH_SUC", 12) != 0)
+        {
+            LOG_ERROR << "Image prefetch error : " << output_params.at(0);
+            unlink(tar_path.data());
+            return -1;
+        }
+
+        const int ret = import_tarball(tar_path, image);
+        unlink(tar_path.data());
+        if (ret == -1)
+            return -1;
+
+        LOG_INFO << "Downloaded image " << image << " to the image store.";
+        return 0;
+    }
+
+    /**
+     * Checks whether an image name is safe to pass to the prefetch script. Only the characters of image references
+     * are allowed.
+     * @param image Image name.
+     * @return true if the name is valid, otherwise false.
+     */
+    bool is_valid_image_name(std::string_view image)
+    {
+        return !image.empty() && image.find_first_not_of(IMAGE_NAME_CHARS) == std::string_view::npos;
+    }
+
+    /**
+     * Imports an image archive in the docker save format. Contents of the regular files are stored as blobs keyed
+     * by their digest, so the layers shared between images and image versions are kept once. Blobs are written
+     * without the store lock and the image is added to the store afterwards.
+     * @param tar_path Path of the image archive.
+     * @param image Image name with the tag.
+     * @return 0 on success and -1 on error.
+     */
+    int import_tarball(std::string_view tar_path, std::string_view image)
+    {
+        const int fd = open(tar_path.data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening image archive " << tar_path;
+            return -1;
+        }
+
+        std::vector<archive_entry> entries;
+        char header[TAR_BLOCK_SIZE];
+        int ret = 0;
+        while (true)
+        {
+            if (read_exact(fd, header, TAR_BLOCK_SIZE) == -1)
+            {
+                ret = -1;
+                break;
+            }
+
+            // End of the archive is marked by a zero block.
+            if (std::all_of(header, header + TAR_BLOCK_SIZE, [](const char c)
+                            { return c == '\0'; }))
+                break;
+
+            archive_entry entry;
+            entry.header.assign(header, TAR_BLOCK_SIZE);
+            if (parse_size(header, entry.size) == -1)
+            {
+                ret = -1;
+                break;
+            }
+
+            const char type = header[TAR_TYPE_OFFSET];
+            if (type == '0' || type == '\0' || type == '7')
+            {
+                ret = store_blob(fd, entry.size, entry.digest);
+            }
+            else
+            {
+                entry.data.resize(entry.size);
+                ret = read_exact(fd, entry.data.data(), entry.size);
+            }
+
+            // Skip the padding of the contents.
+            if (ret == -1 || lseek(fd, padded_size(entry.size) - entry.size, SEEK_CUR) == -1)
+            {
+                ret = -1;
+                break;
+            }
+
+            entries.push_back(std::move(entry));
+        }
+        close(fd);
+
+        if (ret == -1)
+        {
+            LOG_ERROR << "Error reading image archive " << tar_path;
+            return -1;
+        }
+
+        return add_image(image, entries);
+    }
+
+    /**
+     * Stores the next given no. of bytes of the fd as a blob.
+     * @param fd File descriptor to read the contents from.
+     * @param size Size of the contents.
+     * @param digest Hex encoded sha256 digest of the contents.
+     * @return 0 on success and -1 on error.
+     */
+    int store_blob(const int fd, const size_t size, std::string &digest)
+    {
+        std::string temp_path = store_dir + BLOBS_DIR + "/" + TEMP_FILE_PREFIX + "XXXXXX";
+        const int blob_fd = mkstemp(temp_path.data());
+        if (blob_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating image blob in " << store_dir;
+            return -1;
+        }
+
+        crypto_hash_sha256_state state;
+        crypto_hash_sha256_init(&state);
+
+        char buf[65536];
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            const size_t len = std::min(remaining, sizeof(buf));
+            if (read_exact(fd, buf, len) == -1 || docker::write_all(blob_fd, std::string_view(buf, len)) == -1)
+            {
+                LOG_ERROR << errno << ": Error writing image blob " << temp_path;
+                close(blob_fd);
+                unlink(temp_path.data());
+                return -1;
+            }
+            crypto_hash_sha256_update(&state, reinterpret_cast<unsigned char *>(buf), len);
+            remaining -= len;
+        }
+        close(blob_fd);
+
+        std::string hash(crypto_hash_sha256_BYTES, '\0');
+        crypto_hash_sha256_final(&state, reinterpret_cast<unsigned char *>(hash.data()));
+        digest = util::to_hex(hash);
+
+        // An existing blob with the same digest has the same contents.
+        const std::string blob_path = store_dir + BLOBS_DIR + "/" + digest;
+        if (util::is_file_exists(blob_path))
+            unlink(temp_path.data());
+        else if (chmod(temp_path.data(), FILE_PERMS) == -1 || rename(temp_path.data(), blob_path.data()) == -1)
+        {
+            LOG_ERROR << errno << ": Error storing image blob " << blob_path;
+            unlink(temp_path.data());
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Reads the archive entries of an image in the store.
+     * @param image Image name with the tag.
+     * @param entries Entries of the image archive.
+     * @return 0 on success and -1 if the image is not in the store or on error.
+     */
+    int read_ref(std::string_view image, std::vector<archive_entry> &entries)
+    {
+        const int fd = open(get_ref_path(image).data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        jsoncons::ojson d;
+        const int ret = util::read_json_file(fd, d);
+        close(fd);
+        if (ret == -1)
+            return -1;
+
+        try
+        {
+            for (const auto &item : d["entries"].array_range())
+            {
+                archive_entry entry;
+                entry.header = util::to_bin(item["header"].as<std::string_view>());
+                entry.size = item["size"].as<size_t>();
+                if (item.contains("digest"))
+                    entry.digest = item["digest"].as<std::string>();
+                else
+                    entry.data = util::to_bin(item["data"].as<std::string_view>());
+                entries.push_back(std::move(entry));
+            }
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Invalid image store entry of " << image << ". " << e.what();
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Records the archive entries of an image in the store. The record is replaced atomically.
+     * @param image Image name with the tag.
+     * @param entries Entries of the image archive.
+     * @return 0 on success and -1 on error.
+     */
+    int write_ref(std::string_view image, const std::vector<archive_entry> &entries)
+    {
+        jsoncons::ojson d;
+        d.insert_or_assign("image", image);
+        jsoncons::ojson items(jsoncons::json_array_arg);
+        for (const archive_entry &entry : entries)
+        {
+            jsoncons::ojson item;
+            item.insert_or_assign("header", util::to_hex(entry.header));
+            item.insert_or_assign("size", entry.size);
+            if (entry.digest.empty())
+                item.insert_or_assign("data", util::to_hex(entry.data));
+            else
+                item.insert_or_assign("digest", entry.digest);
+            items.push_back(std::move(item));
+        }
+        d.insert_or_assign("entries", std::move(items));
+
+        const std::string ref_path = get_ref_path(image);
+        std::string temp_path = store_dir + REFS_DIR + "/" + TEMP_FILE_PREFIX + "XXXXXX";
+        const int fd = mkstemp(temp_path.data());
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating image store entry for " << image;
+            return -1;
+        }
+
+        if (util::write_json_file(fd, d) == -1 || fchmod(fd, FILE_PERMS) == -1 || rename(temp_path.data(), ref_path.data()) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing image store entry " << ref_path;
+            close(fd);
+            unlink(temp_path.data());
+            return -1;
+        }
+
+        close(fd);
+        return 0;
+    }
+
+    /**
+     * Adds an image to the store and evicts the least valuable images if the store exceeds its budget.
+     * @param image Image name with the tag.
+     * @param entries Entries of the image archive. Blobs must be already stored.
+     * @return 0 on success and -1 on error.
+     */
+    int add_image(std::string_view image, const std::vector<archive_entry> &entries)
+    {
+        // Instances are listed beforehand to keep the registry lock out of the store lock.
+        std::vector<hp::instance_info> instances;
+        registry::get_instance_list(instances);
+
+        std::unique_lock lock(store_mutex);
+
+        // A deduplicated blob may have been evicted since it was found in the store.
+        std::vector<std::string> digests;
+        for (const archive_entry &entry : entries)
+        {
+            if (entry.digest.empty())
+                continue;
+
+            if (blobs.count(entry.digest) == 0 && !util::is_file_exists(store_dir + BLOBS_DIR + "/" + entry.digest))
+            {
+                LOG_ERROR << "Image blob " << entry.digest << " of " << image << " has been evicted during the import.";
+                return -1;
+            }
+            digests.push_back(entry.digest);
+        }
+
+        if (write_ref(image, entries) == -1)
+            return -1;
+
+        // Blobs of the new version are referenced before the previous version is released, so the shared ones stay.
+        for (const archive_entry &entry : entries)
+        {
+            if (entry.digest.empty())
+                continue;
+
+            const auto [itr, inserted] = blobs.try_emplace(entry.digest, blob_info{entry.size, 0});
+            if (inserted)
+                total_bytes += entry.size;
+            itr->second.ref_count++;
+        }
+
+        const auto [itr, inserted] = images.try_emplace(std::string(image));
+        if (!inserted)
+            release_blobs(itr->second);
+        itr->second = std::move(digests);
+
+        evict(image, instances);
+        return 0;
+    }
+
+    /**
+     * Removes images in the least valuable first order until the store is within its budget. An image is valued by
+     * its last use, with each live instance of the image counting as LIVE_INSTANCE_WEIGHT_MS more recent use.
+     * Caller must hold the unique lock.
+     * @param protected_image Image which is never evicted (eg: the image just added).
+     * @param instances Live instances.
+     */
+    void evict(std::string_view protected_image, const std::vector<hp::instance_info> &instances)
+    {
+        const size_t budget = conf::cfg.docker.image_cache_max_kbytes * 1024;
+        if (budget == 0 || total_bytes <= budget)
+            return;
+
+        std::unordered_map<std::string, uint64_t> live_counts;
+        for (const hp::instance_info &info : instances)
+            live_counts[get_pull_image(info.image_name)]++;
+
+        std::vector<std::pair<uint64_t, std::string>> candidates;
+        for (const auto &[image, digests] : images)
+        {
+            if (image == protected_image)
+                continue;
+
+            struct stat st;
+            const uint64_t last_used_ms = stat(get_ref_path(image).data(), &st) == 0 ? (st.st_mtim.tv_sec * 1000ULL + st.st_mtim.tv_nsec / 1000000) : 0;
+            const auto live_itr = live_counts.find(image);
+            const uint64_t live_count = live_itr == live_counts.end() ? 0 : live_itr->second;
+            candidates.emplace_back(last_used_ms + live_count * LIVE_INSTANCE_WEIGHT_MS, image);
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (const auto &[score, image] : candidates)
+        {
+            if (total_bytes <= budget)
+                break;
+
+            remove_image(image);
+        }
+
+        if (total_bytes > budget)
+            LOG_WARNING << "Image store uses " << (total_bytes / 1024) << " KB which exceeds the budget of "
+                        << conf::cfg.docker.image_cache_max_kbytes << " KB.";
+    }
+
+    /**
+     * Removes an image and its blobs which are not used by other images. Caller must hold the unique lock.
+     * @param image Image name with the tag.
+     */
+    void remove_image(std::string_view image)
+    {
+        const auto itr = images.find(std::string(image));
+        if (itr == images.end())
+            return;
+
+        unlink(get_ref_path(image).data());
+        const size_t prev_bytes = total_bytes;
+        release_blobs(itr->second);
+        images.erase(itr);
+        LOG_INFO << "Evicted image " << image << " from the image store. Freed " << ((prev_bytes - total_bytes) / 1024) << " KB";
+    }
+
+    /**
+     * Releases a reference to each given blob. Blobs with no remaining references are removed. Caller must hold the unique lock.
+     * @param digests Digests of the blobs.
+     */
+    void release_blobs(const std::vector<std::string> &digests)
+    {
+        for (const std::string &digest : digests)
+        {
+            const auto itr = blobs.find(digest);
+            if (itr == blobs.end() || --itr->second.ref_count > 0)
+                continue;
+
+            unlink((store_dir + BLOBS_DIR + "/" + digest).data());
+            total_bytes -= itr->second.size;
+            blobs.erase(itr);
+        }
+    }
+
+    /**
+     * Marks an image in the store as recently used. Last use is kept as the modification time of its record.
+     * @param image Image name with the tag.
+     */
+    void touch_ref(std::string_view image)
+    {
+        utimensat(AT_FDCWD, get_ref_path(image).data(), NULL, 0);
+    }
+
+    /**
+     * Loads the images in the store and removes the blobs which are not referenced by any image and the leftovers
+     * of interrupted imports.
+     * @return 0 on success and -1 on error.
+     */
+    int load_index()
+    {
+        const std::string refs_dir = store_dir + REFS_DIR;
+        DIR *dir = opendir(refs_dir.data());
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error opening image store " << refs_dir;
+            return -1;
+        }
+
+        std::unique_lock lock(store_mutex);
+        bool is_complete = true;
+        struct dirent *dir_entry;
+        while ((dir_entry = readdir(dir)) != NULL)
+        {
+            const std::string name = dir_entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            const std::string path = refs_dir + "/" + name;
+            jsoncons::ojson d;
+            const int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+            const bool is_valid = fd != -1 && name.rfind(TEMP_FILE_PREFIX, 0) != 0 && util::read_json_file(fd, d) == 0;
+            if (fd != -1)
+                close(fd);
+
+            if (!is_valid)
+            {
+                unlink(path.data());
+                continue;
+            }
+
+            // Keep all the blobs if an image record is unreadable.
+            try
+            {
+                std::vector<std::string> digests;
+                for (const auto &item : d["entries"].array_range())
+                {
+                    if (!item.contains("digest"))
+                        continue;
+
+                    const std::string digest = item["digest"].as<std::string>();
+                    const auto [itr, inserted] = blobs.try_emplace(digest, blob_info{item["size"].as<size_t>(), 0});
+                    if (inserted)
+                        total_bytes += itr->second.size;
+                    itr->second.ref_count++;
+                    digests.push_back(digest);
+                }
+                images.emplace(d["image"].as<std::string>(), std::move(digests));
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR << "Invalid image store entry " << path << ". " << e.what();
+                is_complete = false;
+            }
+        }
+        closedir(dir);
+
+        const std::string blobs_dir = store_dir + BLOBS_DIR;
+        if (!is_complete || (dir = opendir(blobs_dir.data())) == NULL)
+            return 0;
+
+        size_t removed = 0;
+        while ((dir_entry = readdir(dir)) != NULL)
+        {
+            const std::string name = dir_entry->d_name;
+            if (name != "." && name != ".." && blobs.count(name) == 0 && unlinkat(dirfd(dir), name.data(), 0) == 0)
+                removed++;
+        }
+        closedir(dir);
+
+        if (removed > 0)
+            LOG_INFO << "Removed " << removed << " unused blobs from the image store.";
+        return 0;
+    }
+
+    /**
+     * Get the path of the record of an image in the store.
+     * @param image Image name with the tag.
+     * @return Record file path.
+     */
+    const std::string get_ref_path(std::string_view image)
+    {
+        std::string hash(crypto_generichash_BYTES, '\0');
+        crypto_generichash(reinterpret_cast<unsigned char *>(hash.data()), hash.size(),
+                           reinterpret_cast<const unsigned char *>(image.data()), image.length(), NULL, 0);
+        return store_dir + REFS_DIR + "/" + util::to_hex(hash) + ".json";
+    }
+
+    /**
+     * Reads exactly the given no. of bytes.
+     * @return 0 on success and -1 on error or on a premature end of file.
+     */
+    int read_exact(const int fd, char *buf, const size_t len)
+    {
+        size_t total = 0;
+        while (total < len)
+        {
+            const ssize_t res = read(fd, buf + total, len - total);
+            if (res == -1 && errno == EINTR)
+                continue;
+            if (res <= 0)
+                return -1;
+            total += res;
+        }
+        return 0;
+    }
+
+    /**
+     * Parses the contents size of a tar header. Large sizes are encoded in base-256 with the high bit set.
+     * @param header Tar header block.
+     * @param size Parsed size.
+     * @return 0 on success and -1 on invalid size.
+     */
+    int parse_size(const char *header, size_t &size)
+    {
+        const unsigned char *field = reinterpret_cast<const unsigned char *>(header + TAR_SIZE_OFFSET);
+        size = 0;
+        if (field[0] & 0x80)
+        {
+            for (size_t i = 1; i < TAR_SIZE_LEN; i++)
+                size = (size << 8) | field[i];
+            return 0;
+        }
+
+        size_t i = 0;
+        while (i < TAR_SIZE_LEN && field[i] == ' ')
+            i++;
+
+        for (; i < TAR_SIZE_LEN && field[i] != '\0' && field[i] != ' '; i++)
+        {
+            if (field[i] < '0' || field[i] > '7')
+                return -1;
+            size = (size << 3) | (field[i] - '0');
+        }
+        return 0;
+    }
+
+    size_t padded_size(const size_t size)
+    {
+        return ((size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
+    }
+
+} // namespace image_store
@@ -0,0 +1,83 @@
+#ifndef _SA_IMAGE_STORE_
+#define _SA_IMAGE_STORE_
+
+#include "pchheader.hpp"
+#include "hp_manager.hpp"
+
+namespace image_store
+{
+    // An entry of a saved image archive. Contents of regular files are kept in the store as blobs keyed by digest.
+    struct archive_entry
+    {
+        std::string header; // Raw tar header block.
+        std::string data;   // Inline contents of other entries with contents (eg: pax and long name headers).
+        std::string digest; // Hex encoded sha256 of the contents of a regular file.
+        size_t size = 0;    // Size of the contents.
+    };
+
+    // A blob in the store shared by the images which have the same contents.
+    struct blob_info
+    {
+        size_t size = 0;      // Size of the blob.
+        size_t ref_count = 0; // No. of images which reference the blob.
+    };
+
+    int init();
+
+    void deinit();
+
+    const std::string get_pull_image(std::string_view image);
+
+    int load_image(std::string_view username, std::string_view image);
+
+    int pin_blobs(std::string_view image, std::vector<archive_entry> &entries, std::vector<int> &blob_fds);
+
+    void unpin_blobs(std::vector<int> &blob_fds);
+
+    int import_saved_image(std::string_view image);
+
+    int prefetch(std::string_view image);
+
+    void prefetch_loop();
+
+    int prefetch_image(std::string_view image);
+
+    int fetch_image(std::string_view image);
+
+    int fetch_image_async(std::string_view image, std::future<int> &result);
+
+    int download_image(std::string_view image);
+
+    bool is_valid_image_name(std::string_view image);
+
+    int import_tarball(std::string_view tar_path, std::string_view image);
+
+    int store_blob(const int fd, const size_t size, std::string &digest);
+
+    int read_ref(std::string_view image, std::vector<archive_entry> &entries);
+
+    int write_ref(std::string_view image, const std::vector<archive_entry> &entries);
+
+    int add_image(std::string_view image, const std::vector<archive_entry> &entries);
+
+    void evict(std::string_view protected_image, const std::vector<hp::instance_info> &instances);
+
+    void remove_image(std::string_view image);
+
+    void release_blobs(const std::vector<std::string> &digests);
+
+    void touch_ref(std::string_view image);
+
+    int load_index();
+
+    const std::string get_ref_path(std::string_view image);
+
+    int read_exact(const int fd, char *buf, const size_t len);
+
+    int parse_size(const char *header, size_t &size);
+
+    size_t padded_size(const size_t size);
+
+} // namespace image_store
+
+#endif
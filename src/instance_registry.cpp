@@ -0,0 +1,461 @@
+#include "instance_registry.hpp"
+#include "sqlite.hpp"
+#include "trace.hpp"
+#include "conf.hpp"
+#include "util/util.hpp"
+
+namespace registry
+{
+    constexpr int GP_PORT_COUNT = 2; // No. of general purpose tcp and udp ports of an instance.
+
+    registry_ctx ctx;
+
+    /**
+     * Loads the instances from the database.
+     * @param db Database connection used for the write-through.
+     * @return 0 on success and -1 on error.
+     */
+    int init(sqlite3 *db)
+    {
+        std::vector<hp::instance_info> instances;
+        sqlite::get_instance_list(db, instances);
+
+        std::unique_lock lock(ctx.mutex);
+        ctx.db = db;
+        ctx.ports.init(conf::cfg.hp);
+        for (hp::instance_info &info : instances)
+        {
+            // Instances created before general purpose ports were introduced get them derived from the peer port.
+            if (info.assigned_ports.gp_tcp_port_start == 0 || info.assigned_ports.gp_udp_port_start == 0)
+            {
+                const uint16_t increment = ((info.assigned_ports.peer_port - conf::cfg.hp.init_peer_port) * GP_PORT_COUNT);
+                info.assigned_ports.gp_tcp_port_start = conf::cfg.hp.init_gp_tcp_port + increment;
+                info.assigned_ports.gp_udp_port_start = conf::cfg.hp.init_gp_udp_port + increment;
+            }
+
+            index_instance(info);
+            ctx.instances.emplace(info.container_name, std::move(info));
+        }
+
+        LOG_INFO << "Loaded " << ctx.instances.size() << " instances to the registry. Used port slots: " << ctx.ports.used_count;
+        lock.unlock();
+
+        // A mismatch is not fatal since the registry has been loaded from the database itself.
+        check_consistency();
+        return 0;
+    }
+
+    void deinit()
+    {
+        std::unique_lock lock(ctx.mutex);
+        ctx.instances.clear();
+        ctx.username_index.clear();
+        ctx.port_index.clear();
+        ctx.reserved_slot_count = 0;
+        ctx.db = NULL;
+    }
+
+    /**
+     * Get a copy of the instance with the given name.
+     * @param container_name Name of the instance.
+     * @param info Instance info to be populated.
+     * @return 0 if found and -1 if not found.
+     */
+    int get_instance(std::string_view container_name, hp::instance_info &info)
+    {
+        std::shared_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+            return -1;
+
+        info = itr->second;
+        return 0;
+    }
+
+    /**
+     * Get a copy of the instance which belongs to the given instance user.
+     * @param username Username of the instance user.
+     * @param info Instance info to be populated.
+     * @return 0 if found and -1 if not found.
+     */
+    int get_instance_by_username(std::string_view username, hp::instance_info &info)
+    {
+        std::shared_lock lock(ctx.mutex);
+        const auto itr = ctx.username_index.find(std::string(username));
+        if (itr == ctx.username_index.end())
+            return -1;
+
+        info = ctx.instances.at(itr->second);
+        return 0;
+    }
+
+    /**
+     * Populate the given vector with copies of all the instances.
+     * @param instances Vector to hold the instances.
+     */
+    void get_instance_list(std::vector<hp::instance_info> &instances)
+    {
+        std::shared_lock lock(ctx.mutex);
+        instances.reserve(instances.size() + ctx.instances.size());
+        for (const auto &[container_name, info] : ctx.instances)
+            instances.push_back(info);
+    }
+
+    size_t get_instance_count()
+    {
+        std::shared_lock lock(ctx.mutex);
+        return ctx.instances.size();
+    }
+
+    /**
+     * Adds a new instance. The instance is inserted to the database first.
+     * @param info Instance to be added.
+     * @return 0 on success and -1 on error.
+     */
+    int add_instance(const hp::instance_info &info)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        if (ctx.instances.count(info.container_name) == 1)
+        {
+            LOG_ERROR << "Instance " << info.container_name << " already exists in the registry.";
+            return -1;
+        }
+
+        if (sqlite::begin_transaction(ctx.db) == -1)
+            return -1;
+
+        if (sqlite::insert_hp_instance_row(ctx.db, info) == -1 ||
+            sqlite::commit_transaction(ctx.db) == -1)
+        {
+            sqlite::rollback_transaction(ctx.db);
+            return -1;
+        }
+
+        index_instance(info);
+        ctx.instances.emplace(info.container_name, info);
+        return 0;
+    }
+
+    /**
+     * Updates the status of an instance. The status is updated in the database first.
+     * @param container_name Name of the instance.
+     * @param status New status of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int update_status(std::string_view container_name, std::string_view status)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+        {
+            LOG_ERROR << "Instance " << container_name << " not found in the registry.";
+            return -1;
+        }
+
+        return write_status(itr->second, status);
+    }
+
+    /**
+     * Updates the status of an instance only if it still has the expected status. Used to apply the status observed
+     * outside of the instance operations without overwriting a status set by an operation meanwhile.
+     * @param container_name Name of the instance.
+     * @param expected_status Status the instance must have.
+     * @param status New status of the instance.
+     * @param replaced Whether the status was updated.
+     * @return 0 on success and -1 on error. A missing instance or a different status is not an error.
+     */
+    int replace_status(std::string_view container_name, std::string_view expected_status, std::string_view status, bool &replaced)
+    {
+        replaced = false;
+        std::unique_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end() || itr->second.status != expected_status)
+            return 0;
+
+        if (write_status(itr->second, status) == -1)
+            return -1;
+
+        replaced = true;
+        return 0;
+    }
+
+    /**
+     * Writes the status of an instance through to the database along with the time of the change.
+     * Caller must hold the registry lock exclusively.
+     * @param info Registry entry of the instance.
+     * @param status New status of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int write_status(hp::instance_info &info, std::string_view status)
+    {
+        const uint64_t changed_on = util::get_epoch_milliseconds();
+        if (sqlite::begin_transaction(ctx.db) == -1)
+            return -1;
+
+        if (sqlite::update_status_in_container(ctx.db, info.container_name, status, changed_on) == -1 ||
+            sqlite::commit_transaction(ctx.db) == -1)
+        {
+            sqlite::rollback_transaction(ctx.db);
+            return -1;
+        }
+
+        info.status = status;
+        info.status_changed_on = changed_on;
+        return 0;
+    }
+
+    /**
+     * Updates the allocation of a resized instance. The allocation is updated in the database first.
+     * @param container_name Name of the instance.
+     * @param allocation New size of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int update_allocation(std::string_view container_name, const hp::resources &allocation)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+        {
+            LOG_ERROR << "Instance " << container_name << " not found in the registry.";
+            return -1;
+        }
+
+        if (sqlite::begin_transaction(ctx.db) == -1)
+            return -1;
+
+        if (sqlite::update_allocation_in_container(ctx.db, container_name, allocation) == -1 ||
+            sqlite::commit_transaction(ctx.db) == -1)
+        {
+            sqlite::rollback_transaction(ctx.db);
+            return -1;
+        }
+
+        itr->second.allocation = allocation;
+        return 0;
+    }
+
+    /**
+     * Removes an instance. The instance is deleted from the database first.
+     * @param container_name Name of the instance.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_instance(std::string_view container_name)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+        {
+            LOG_ERROR << "Instance " << container_name << " not found in the registry.";
+            return -1;
+        }
+
+        if (sqlite::begin_transaction(ctx.db) == -1)
+            return -1;
+
+        if (sqlite::delete_hp_instance(ctx.db, container_name) == -1 ||
+            sqlite::commit_transaction(ctx.db) == -1)
+        {
+            sqlite::rollback_transaction(ctx.db);
+            return -1;
+        }
+
+        unindex_instance(itr->second);
+        ctx.instances.erase(itr);
+        return 0;
+    }
+
+    /**
+     * Records a warm user in the database. Warm users share the database connection with the instances, so the
+     * write is made under the registry lock to keep it out of the instance transactions.
+     * @param user The warm user.
+     * @return 0 on success and -1 on error.
+     */
+    int add_warm_user(const hp::warm_user &user)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        return sqlite::insert_warm_user(ctx.db, user);
+    }
+
+    /**
+     * Deletes a warm user from the database under the registry lock.
+     * @param username Username of the warm user.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_warm_user(std::string_view username)
+    {
+        const trace::span span("db_write");
+        std::unique_lock lock(ctx.mutex);
+        return sqlite::delete_warm_user(ctx.db, username);
+    }
+
+    /**
+     * Get the warm users recorded in the database.
+     * @param users List to populate.
+     */
+    void get_warm_users(std::deque<hp::warm_user> &users)
+    {
+        std::shared_lock lock(ctx.mutex);
+        sqlite::get_warm_users(ctx.db, users);
+    }
+
+    /**
+     * Reserves the lowest free port slot. The reservation is kept until release_ports is called, by which
+     * time the instance either owns the ports or has failed.
+     * @param instance_ports Reserved ports.
+     * @return 0 on success and -1 if all the port slots are used.
+     */
+    int reserve_ports(hp::ports &instance_ports)
+    {
+        std::unique_lock lock(ctx.mutex);
+        uint16_t slot;
+        if (ctx.ports.reserve(slot) == -1)
+        {
+            LOG_ERROR << "No free ports available for a new instance.";
+            return -1;
+        }
+
+        ctx.reserved_slot_count++;
+        instance_ports = ctx.ports.get_ports(slot);
+        return 0;
+    }
+
+    /**
+     * Releases a port reservation made with reserve_ports. The slot stays used if an instance has been added with the ports.
+     * @param instance_ports Reserved ports.
+     */
+    void release_ports(const hp::ports &instance_ports)
+    {
+        std::unique_lock lock(ctx.mutex);
+        uint16_t slot;
+        if (ctx.ports.get_slot(instance_ports, slot) == -1)
+            return;
+
+        ctx.reserved_slot_count--;
+        if (ctx.port_index.count(instance_ports.peer_port) == 0)
+            ctx.ports.release(slot);
+    }
+
+    /**
+     * Checks the registry and the used port slots against the instances in the database.
+     * @return 0 if consistent and -1 if there's a mismatch.
+     */
+    int check_consistency()
+    {
+        std::vector<hp::instance_info> db_instances;
+        std::shared_lock lock(ctx.mutex);
+        sqlite::get_instance_list(ctx.db, db_instances);
+
+        int ret = 0;
+        if (db_instances.size() != ctx.instances.size())
+        {
+            LOG_ERROR << "Registry has " << ctx.instances.size() << " instances while the database has " << db_instances.size();
+            ret = -1;
+        }
+
+        std::unordered_set<uint16_t> instance_slots;
+        for (const hp::instance_info &db_info : db_instances)
+        {
+            const auto itr = ctx.instances.find(db_info.container_name);
+            if (itr == ctx.instances.end() || itr->second.status != db_info.status)
+            {
+                LOG_ERROR << "Registry entry of " << db_info.container_name << " does not match the database.";
+                ret = -1;
+                continue;
+            }
+
+            std::vector<uint16_t> slots;
+            get_instance_slots(itr->second, slots);
+            for (const uint16_t slot : slots)
+            {
+                instance_slots.emplace(slot);
+                if (!ctx.ports.is_used(slot))
+                {
+                    LOG_ERROR << "Port slot " << slot << " of " << db_info.container_name << " is not marked as used.";
+                    ret = -1;
+                }
+            }
+        }
+
+        if (ctx.ports.used_count != instance_slots.size() + ctx.reserved_slot_count)
+        {
+            LOG_ERROR << "Used port slot count " << ctx.ports.used_count << " does not match the " << instance_slots.size()
+                      << " instance slots and " << ctx.reserved_slot_count << " reservations.";
+            ret = -1;
+        }
+
+        return ret;
+    }
+
+    /**
+     * Adds the username and the ports of the instance to the indexes. Caller must hold the unique lock.
+     * @param info Instance to be indexed.
+     */
+    void index_instance(const hp::instance_info &info)
+    {
+        std::vector<uint16_t> slots;
+        get_instance_slots(info, slots);
+        for (const uint16_t slot : slots)
+            ctx.ports.mark_used(slot);
+
+        const hp::ports &ports = info.assigned_ports;
+        ctx.username_index.emplace(info.username, info.container_name);
+        ctx.port_index.emplace(ports.peer_port, info.container_name);
+        ctx.port_index.emplace(ports.user_port, info.container_name);
+        for (int i = 0; i < GP_PORT_COUNT; i++)
+        {
+            ctx.port_index.emplace(ports.gp_tcp_port_start + i, info.container_name);
+            ctx.port_index.emplace(ports.gp_udp_port_start + i, info.container_name);
+        }
+    }
+
+    /**
+     * Removes the username and the ports of the instance from the indexes. Caller must hold the unique lock.
+     * @param info Instance to be removed from the indexes.
+     */
+    void unindex_instance(const hp::instance_info &info)
+    {
+        std::vector<uint16_t> slots;
+        get_instance_slots(info, slots);
+        for (const uint16_t slot : slots)
+            ctx.ports.release(slot);
+
+        const hp::ports &ports = info.assigned_ports;
+        ctx.username_index.erase(info.username);
+        ctx.port_index.erase(ports.peer_port);
+        ctx.port_index.erase(ports.user_port);
+        for (int i = 0; i < GP_PORT_COUNT; i++)
+        {
+            ctx.port_index.erase(ports.gp_tcp_port_start + i);
+            ctx.port_index.erase(ports.gp_udp_port_start + i);
+        }
+    }
+
+    /**
+     * Get the port slots occupied by the instance. Instances created with the current port config own exactly one slot.
+     * Instances with ports off the slot grid (eg: created with a different port config) block the slots their peer
+     * and user ports fall into, so those ports are never handed out again.
+     * @param info The instance.
+     * @param slots Slots of the instance.
+     */
+    void get_instance_slots(const hp::instance_info &info, std::vector<uint16_t> &slots)
+    {
+        uint16_t slot;
+        if (ctx.ports.get_slot(info.assigned_ports, slot) == 0)
+        {
+            slots.push_back(slot);
+            return;
+        }
+
+        const hp::ports &ports = info.assigned_ports;
+        if (ports.peer_port >= conf::cfg.hp.init_peer_port)
+            slots.push_back(ports.peer_port - conf::cfg.hp.init_peer_port);
+        if (ports.user_port >= conf::cfg.hp.init_user_port)
+            slots.push_back(ports.user_port - conf::cfg.hp.init_user_port);
+    }
+
+} // namespace registry
@@ -0,0 +1,67 @@
+#ifndef _SA_INSTANCE_REGISTRY_
+#define _SA_INSTANCE_REGISTRY_
+
+#include "pchheader.hpp"
+#include "hp_manager.hpp"
+#include "port_allocator.hpp"
+
+namespace registry
+{
+    // In-memory copy of the instances table. All the instance reads are served from here and every
+    // mutation is written through to the database before it becomes visible.
+    struct registry_ctx
+    {
+        sqlite3 *db = NULL;
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, hp::instance_info> instances; // Instances keyed by container name.
+        std::unordered_map<std::string, std::string> username_index;  // Container names keyed by instance username.
+        std::unordered_map<uint16_t, std::string> port_index;         // Container names keyed by every port assigned to them.
+        port_allocator ports;                                         // Port slots used by the instances and the instances being created.
+        size_t reserved_slot_count = 0;                               // No. of port slots reserved for instances being created.
+    };
+
+    int init(sqlite3 *db);
+
+    void deinit();
+
+    int get_instance(std::string_view container_name, hp::instance_info &info);
+
+    int get_instance_by_username(std::string_view username, hp::instance_info &info);
+
+    void get_instance_list(std::vector<hp::instance_info> &instances);
+
+    size_t get_instance_count();
+
+    int add_instance(const hp::instance_info &info);
+
+    int update_status(std::string_view container_name, std::string_view status);
+
+    int replace_status(std::string_view container_name, std::string_view expected_status, std::string_view status, bool &replaced);
+
+    int update_allocation(std::string_view container_name, const hp::resources &allocation);
+
+    int remove_instance(std::string_view container_name);
+
+    int add_warm_user(const hp::warm_user &user);
+
+    int remove_warm_user(std::string_view username);
+
+    void get_warm_users(std::deque<hp::warm_user> &users);
+
+    int reserve_ports(hp::ports &instance_ports);
+
+    void release_ports(const hp::ports &instance_ports);
+
+    int check_consistency();
+
+    int write_status(hp::instance_info &info, std::string_view status);
+
+    void index_instance(const hp::instance_info &info);
+
+    void unindex_instance(const hp::instance_info &info);
+
+    void get_instance_slots(const hp::instance_info &info, std::vector<uint16_t> &slots);
+
+} // namespace registry
+
+#endif
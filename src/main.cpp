@@ -199,7 +199,7 @@ int main(int argc, char **argv)
         LOG_INFO << "Log level: " << conf::cfg.log.log_level;
         LOG_INFO << "Data dir: " << conf::ctx.data_dir;
 
-        if (comm::init() == -1 || hp::init() == -1)
+        if (comm::init() == -1 || hp::init() == -1 || hp::init_warm_pool() == -1 || hp::init_reconciler() == -1)
         {
             deinit();
             return 1;
@@ -266,7 +266,10 @@ int main(int argc, char **argv)
         salog::init();
 
         if (hp::init() == -1)
+        {
+            hp::deinit();
             return 1;
+        }
 
         std::vector<hp::instance_info> instances;
         hp::get_instance_list(instances);
@@ -0,0 +1,180 @@
+#include "metrics.hpp"
+
+namespace metrics
+{
+    // Head of the metric list. New metrics are pushed to the front with a compare and swap, so lookups and
+    // inserts never block each other.
+    std::atomic<metric *> head = NULL;
+
+    void metric::add(const int64_t delta)
+    {
+        value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void metric::observe(const uint64_t duration_us)
+    {
+        const uint64_t *bucket = std::lower_bound(LATENCY_BUCKETS_US, LATENCY_BUCKETS_US + BUCKET_COUNT, duration_us);
+        if (bucket != LATENCY_BUCKETS_US + BUCKET_COUNT)
+            buckets[bucket - LATENCY_BUCKETS_US].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(duration_us, std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the metric of a family with the given label value. The metric is created on first use. Callers on hot
+     * paths with fixed labels can keep the returned reference since metrics are never removed.
+     * @param fam Family of the metric.
+     * @param label_value Value of the family label. Ignored for families without a label.
+     * @return The metric.
+     */
+    metric &get(const family &fam, std::string_view label_value)
+    {
+        if (fam.label == NULL)
+            label_value = {};
+
+        metric *first = head.load(std::memory_order_acquire);
+        for (metric *m = first; m != NULL; m = m->next)
+        {
+            if (m->fam == &fam && m->label_value == label_value)
+                return *m;
+        }
+
+        metric *created = new metric();
+        created->fam = &fam;
+        created->label_value = label_value;
+        created->next = first;
+        while (!head.compare_exchange_weak(created->next, created, std::memory_order_release, std::memory_order_acquire))
+        {
+            // Another thread may have created the same metric meanwhile.
+            for (metric *m = created->next; m != NULL && m != first; m = m->next)
+            {
+                if (m->fam == &fam && m->label_value == label_value)
+                {
+                    delete created;
+                    return *m;
+                }
+            }
+            first = created->next;
+        }
+        return *created;
+    }
+
+    void add(const family &fam, std::string_view label_value, const int64_t delta)
+    {
+        get(fam, label_value).add(delta);
+    }
+
+    void observe(const family &fam, std::string_view label_value, const uint64_t duration_us)
+    {
+        get(fam, label_value).observe(duration_us);
+    }
+
+    /**
+     * Renders all the metrics in the Prometheus text exposition format.
+     * @param text Buffer to render the metrics into.
+     */
+    void build_prometheus_text(std::string &text)
+    {
+        std::vector<const metric *> list;
+        for (const metric *m = head.load(std::memory_order_acquire); m != NULL; m = m->next)
+            list.push_back(m);
+
+        // The list holds the latest metrics first.
+        std::reverse(list.begin(), list.end());
+
+        for (const family *fam : FAMILIES)
+        {
+            text.append("# HELP ").append(fam->name).append(" ").append(fam->help).append("\n");
+            text.append("# TYPE ").append(fam->name).append(fam->type == COUNTER ? " counter\n" : (fam->type == GAUGE ? " gauge\n" : " histogram\n"));
+
+            for (const metric *m : list)
+            {
+                if (m->fam != fam)
+                    continue;
+
+                if (fam->type != HISTOGRAM)
+                {
+                    text.append(fam->name);
+                    append_labels(text, *m);
+                    text.append(" ").append(std::to_string(m->value.load(std::memory_order_relaxed))).append("\n");
+                    continue;
+                }
+
+                // Buckets are cumulative in the exposition format.
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < BUCKET_COUNT; i++)
+                {
+                    cumulative += m->buckets[i].load(std::memory_order_relaxed);
+                    std::string le;
+                    append_seconds(le, LATENCY_BUCKETS_US[i]);
+                    text.append(fam->name).append("_bucket");
+                    append_labels(text, *m, le);
+                    text.append(" ").append(std::to_string(cumulative)).append("\n");
+                }
+
+                const uint64_t count = m->count.load(std::memory_order_relaxed);
+                text.append(fam->name).append("_bucket");
+                append_labels(text, *m, "+Inf");
+                text.append(" ").append(std::to_string(std::max(count, cumulative))).append("\n");
+
+                text.append(fam->name).append("_sum");
+                append_labels(text, *m);
+                text.append(" ");
+                append_seconds(text, m->sum_us.load(std::memory_order_relaxed));
+                text.append("\n");
+
+                text.append(fam->name).append("_count");
+                append_labels(text, *m);
+                text.append(" ").append(std::to_string(count)).append("\n");
+            }
+        }
+    }
+
+    /**
+     * Appends the label set of a metric. Label values are escaped as required by the exposition format.
+     * @param text Buffer to append to.
+     * @param m The metric.
+     * @param le Upper bound label of a histogram bucket. Omitted if empty.
+     */
+    void append_labels(std::string &text, const metric &m, std::string_view le)
+    {
+        if (m.fam->label == NULL && le.empty())
+            return;
+
+        text.append("{");
+        if (m.fam->label != NULL)
+        {
+            text.append(m.fam->label).append("=\"");
+            for (const char c : m.label_value)
+            {
+                if (c == '\\' || c == '"')
+                    text.push_back('\\');
+                if (c == '\n')
+                    text.append("\\n");
+                else
+                    text.push_back(c);
+            }
+            text.append("\"");
+            if (!le.empty())
+                text.append(",");
+        }
+        if (!le.empty())
+            text.append("le=\"").append(le).append("\"");
+        text.append("}");
+    }
+
+    /**
+     * Appends a duration in seconds with microsecond precision.
+     * @param text Buffer to append to.
+     * @param duration_us Duration in microseconds.
+     */
+    void append_seconds(std::string &text, const uint64_t duration_us)
+    {
+        std::string fraction = std::to_string(duration_us % 1000000);
+        fraction.insert(0, 6 - fraction.size(), '0');
+        while (fraction.size() > 1 && fraction.back() == '0')
+            fraction.pop_back();
+        text.append(std::to_string(duration_us / 1000000)).append(".").append(fraction);
+    }
+
+} // namespace metrics
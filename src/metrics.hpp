@@ -0,0 +1,80 @@
+#ifndef _SA_METRICS_
+#define _SA_METRICS_
+
+#include "pchheader.hpp"
+
+/**
+ * Counters, gauges and latency histograms of the agent, rendered in the Prometheus text format. Metrics are kept in
+ * an append-only list and updated with atomics, so recording takes no locks.
+ */
+namespace metrics
+{
+    // Upper bounds of the latency histogram buckets in microseconds. Range from 1ms to 30min covers both the
+    // database queries and the slowest user installations.
+    constexpr uint64_t LATENCY_BUCKETS_US[] = {1000, 5000, 25000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+                                               10000000, 30000000, 60000000, 120000000, 300000000, 600000000, 1800000000};
+    constexpr size_t BUCKET_COUNT = sizeof(LATENCY_BUCKETS_US) / sizeof(LATENCY_BUCKETS_US[0]);
+
+    enum METRIC_TYPE
+    {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    // A named group of metrics which differ only by the value of their label.
+    struct family
+    {
+        const char *name;
+        METRIC_TYPE type;
+        const char *label; // Name of the label. NULL for metrics without a label.
+        const char *help;
+    };
+
+    constexpr family MESSAGE_DURATION{"sa_message_duration_seconds", HISTOGRAM, "type", "Time from receiving a message to sending its response."};
+    constexpr family PHASE_DURATION{"sa_phase_duration_seconds", HISTOGRAM, "phase", "Duration of the phases of instance operations."};
+    constexpr family OPERATIONS_IN_FLIGHT{"sa_operations_in_flight", GAUGE, NULL, "Instance operations being executed by the dispatcher workers."};
+    constexpr family QUEUE_DEPTH{"sa_dispatch_queue_depth", GAUGE, NULL, "Instance operations waiting for a dispatcher worker."};
+    constexpr family SUBPROCESS_SPAWNS{"sa_subprocess_spawns_total", COUNTER, "program", "Processes spawned for external commands."};
+    constexpr family SUBPROCESS_SPAWN_ERRORS{"sa_subprocess_spawn_errors_total", COUNTER, "program", "External commands which could not be spawned."};
+    constexpr family SUBPROCESS_TIMEOUTS{"sa_subprocess_timeouts_total", COUNTER, "program", "External commands stopped for exceeding their deadline."};
+    constexpr family SUBPROCESS_DURATION{"sa_subprocess_duration_seconds", HISTOGRAM, "program", "Run time of external commands."};
+    constexpr family SUBPROCESSES_RUNNING{"sa_subprocesses_running", GAUGE, NULL, "External commands currently running."};
+    constexpr family SQLITE_QUERY_DURATION{"sa_sqlite_query_duration_seconds", HISTOGRAM, "statement", "Execution time of the SQLite statements by statement kind."};
+    constexpr family ERRORS{"sa_errors_total", COUNTER, "code", "Error responses by error code."};
+
+    // Families in the order they are rendered.
+    constexpr const family *FAMILIES[] = {&MESSAGE_DURATION, &PHASE_DURATION, &OPERATIONS_IN_FLIGHT, &QUEUE_DEPTH, &SUBPROCESS_SPAWNS,
+                                          &SUBPROCESS_SPAWN_ERRORS, &SUBPROCESS_TIMEOUTS, &SUBPROCESS_DURATION, &SUBPROCESSES_RUNNING,
+                                          &SQLITE_QUERY_DURATION, &ERRORS};
+
+    // A metric of a family with a particular label value. Metrics are never removed once created.
+    struct metric
+    {
+        const family *fam = NULL;
+        std::string label_value;
+        std::atomic<int64_t> value = 0;                     // Value of counters and gauges.
+        std::atomic<uint64_t> buckets[BUCKET_COUNT] = {}; // Observations falling into each histogram bucket (non cumulative).
+        std::atomic<uint64_t> count = 0;                    // No. of histogram observations.
+        std::atomic<uint64_t> sum_us = 0;                   // Sum of the histogram observations.
+        metric *next = NULL;                                // Next metric in the list. Set before the metric is published.
+
+        void add(const int64_t delta);
+        void observe(const uint64_t duration_us);
+    };
+
+    metric &get(const family &fam, std::string_view label_value = {});
+
+    void add(const family &fam, std::string_view label_value, const int64_t delta = 1);
+
+    void observe(const family &fam, std::string_view label_value, const uint64_t duration_us);
+
+    void build_prometheus_text(std::string &text);
+
+    void append_labels(std::string &text, const metric &m, std::string_view le = {});
+
+    void append_seconds(std::string &text, const uint64_t duration_us);
+
+} // namespace metrics
+
+#endif
@@ -11,6 +11,7 @@ namespace msg::json
     constexpr const char *DOUBLE_QUOTE = "\"";
     constexpr uint16_t MOMENT_SIZE = 3600;       // Seconds per Moment.
     constexpr uint16_t INSTANCE_INFO_SIZE = 495; // Size of a single instance info
+    constexpr size_t MAX_BATCH_SIZE = 64;        // Max no. of instances allowed in a batch message.
     /**
      * Parses a json message sent by the message board.
      * @param d Jsoncons document to which the parsed json should be loaded.
@@ -74,7 +75,9 @@ namespace msg::json
      *            "type": "create",
      *            "owner_pubkey": "<pubkey of the owner>"
      *            "contract_id": "<contract id>",
-     *            "image": "<docker image key>"
+     *            "image": "<docker image key>",
+     *            "tier": "<optional resource tier>",
+     *            "resources": {<optional explicit sizes>}
      *          }
      * @return 0 on successful extraction. -1 for failure.
      */
@@ -137,6 +140,64 @@ namespace msg::json
         msg.image = d[msg::FLD_IMAGE].as<std::string>();
         msg.outbound_ipv6 = d[msg::FLD_OUTBOUND_IPV6].is<std::string>() ? d[msg::FLD_OUTBOUND_IPV6].as<std::string>() : "-";
         msg.outbound_net_interface = d[msg::FLD_OUTBOUND_NET_INTERFACE].is<std::string>() ? d[msg::FLD_OUTBOUND_NET_INTERFACE].as<std::string>() : "-";
+        return extract_resource_request(msg.resources, d);
+    }
+
+    /**
+     * Extracts the optional size of an instance from msg.
+     * @param request Populated request.
+     * @param d The json document holding the message.
+     *          Accepted fields:
+     *          {
+     *            "tier": "<micro | small | standard | large | xlarge>",
+     *            "resources": {
+     *              "cpu_us": <cpu time out of 1000000 microsec>,
+     *              "mem_kbytes": <memory in KB>,
+     *              "swap_kbytes": <swap on top of the memory in KB>,
+     *              "storage_kbytes": <disk in KB>
+     *            }
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_resource_request(resource_request &request, const jsoncons::json &d)
+    {
+        if (d.contains(msg::FLD_TIER))
+        {
+            if (!d[msg::FLD_TIER].is<std::string>())
+            {
+                LOG_ERROR << "Invalid tier value.";
+                return -1;
+            }
+            request.tier = d[msg::FLD_TIER].as<std::string>();
+        }
+
+        if (!d.contains(msg::FLD_RESOURCES))
+            return 0;
+
+        const jsoncons::json &resources = d[msg::FLD_RESOURCES];
+        if (!resources.is_object())
+        {
+            LOG_ERROR << "Invalid resources value.";
+            return -1;
+        }
+
+        const std::pair<const char *, size_t *> fields[] = {{msg::FLD_CPU_US, &request.cpu_us},
+                                                           {msg::FLD_MEM_KBYTES, &request.mem_kbytes},
+                                                           {msg::FLD_SWAP_KBYTES, &request.swap_kbytes},
+                                                           {msg::FLD_STORAGE_KBYTES, &request.storage_kbytes}};
+        for (const auto &[field, value] : fields)
+        {
+            if (!resources.contains(field))
+                continue;
+
+            if (!resources[field].is<uint64_t>())
+            {
+                LOG_ERROR << "Invalid " << field << " value.";
+                return -1;
+            }
+            *value = resources[field].as<uint64_t>();
+        }
+
         return 0;
     }
 
@@ -603,6 +664,46 @@ namespace msg::json
         return 0;
     }
 
+    /**
+     * Extracts resize message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the read request message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "resize",
+     *            "container_name": "<container_name>",
+     *            "tier": "<micro | small | standard | large | xlarge>",
+     *            "resources": {<sizes to be changed>}
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_resize_message(resize_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_CONTAINER_NAME))
+        {
+            LOG_ERROR << "Field container_name is missing.";
+            return -1;
+        }
+
+        if (!d[msg::FLD_CONTAINER_NAME].is<std::string>())
+        {
+            LOG_ERROR << "Invalid container_name value.";
+            return -1;
+        }
+
+        if (!d.contains(msg::FLD_TIER) && !d.contains(msg::FLD_RESOURCES))
+        {
+            LOG_ERROR << "Field tier or resources is required.";
+            return -1;
+        }
+
+        msg.container_name = d[msg::FLD_CONTAINER_NAME].as<std::string>();
+        return extract_resource_request(msg.resources, d);
+    }
+
     /**
      * Extracts inspect message from msg.
      * @param msg Populated msg object.
@@ -635,6 +736,296 @@ namespace msg::json
         return 0;
     }
 
+    /**
+     * Extracts operation message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "operation",
+     *            "operation_id": "<operation id>",
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_operation_message(operation_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_OPERATION_ID))
+        {
+            LOG_ERROR << "Field operation_id is missing.";
+            return -1;
+        }
+
+        if (!d[msg::FLD_OPERATION_ID].is<std::string>())
+        {
+            LOG_ERROR << "Invalid operation_id value.";
+            return -1;
+        }
+
+        msg.operation_id = d[msg::FLD_OPERATION_ID].as<std::string>();
+        return 0;
+    }
+
+    /**
+     * Extracts create batch message from msg. Each item is validated as a create message.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "create_batch",
+     *            "instances": [
+     *              {
+     *                "container_name": "<container_name>",
+     *                "owner_pubkey": "<pubkey of the owner>"
+     *                "contract_id": "<contract id>",
+     *                "image": "<docker image key>",
+     *                "config": {...}
+     *              },
+     *              ...
+     *            ]
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_create_batch_message(create_batch_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_INSTANCES))
+        {
+            LOG_ERROR << "Field instances is missing.";
+            return -1;
+        }
+
+        const jsoncons::json &instances = d[msg::FLD_INSTANCES];
+        if (!instances.is_array() || instances.empty() || instances.size() > MAX_BATCH_SIZE)
+        {
+            LOG_ERROR << "Invalid instances value. Expected an array of 1 to " << MAX_BATCH_SIZE << " items.";
+            return -1;
+        }
+
+        std::unordered_set<std::string> container_names;
+        for (const jsoncons::json &instance : instances.array_range())
+        {
+            if (!instance.is_object())
+            {
+                LOG_ERROR << "Invalid instance value.";
+                return -1;
+            }
+
+            // Items are regular create messages without the type field.
+            jsoncons::json item = instance;
+            item[msg::FLD_TYPE] = msg::MSGTYPE_CREATE;
+
+            create_batch_item batch_item;
+            if (extract_create_message(batch_item.create, item) == -1 ||
+                extract_initiate_message(batch_item.initiate, item) == -1)
+                return -1;
+
+            if (!container_names.emplace(batch_item.create.container_name).second)
+            {
+                LOG_ERROR << "Duplicate container_name in batch: " << batch_item.create.container_name;
+                return -1;
+            }
+
+            msg.instances.push_back(std::move(batch_item));
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts destroy batch message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "destroy_batch",
+     *            "container_names": ["<container_name>", ...]
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_destroy_batch_message(destroy_batch_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_CONTAINER_NAMES))
+        {
+            LOG_ERROR << "Field container_names is missing.";
+            return -1;
+        }
+
+        const jsoncons::json &container_names = d[msg::FLD_CONTAINER_NAMES];
+        if (!container_names.is_array() || container_names.empty() || container_names.size() > MAX_BATCH_SIZE)
+        {
+            LOG_ERROR << "Invalid container_names value. Expected an array of 1 to " << MAX_BATCH_SIZE << " items.";
+            return -1;
+        }
+
+        std::unordered_set<std::string> unique_names;
+        for (const jsoncons::json &container_name : container_names.array_range())
+        {
+            if (!container_name.is<std::string>())
+            {
+                LOG_ERROR << "Invalid container_name value.";
+                return -1;
+            }
+
+            const std::string name = container_name.as<std::string>();
+            if (!unique_names.emplace(name).second)
+            {
+                LOG_ERROR << "Duplicate container_name in batch: " << name;
+                return -1;
+            }
+
+            msg.container_names.push_back(name);
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts prefetch message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "prefetch",
+     *            "image": "<docker image>",
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_prefetch_message(prefetch_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_IMAGE))
+        {
+            LOG_ERROR << "Field image is missing.";
+            return -1;
+        }
+
+        if (!d[msg::FLD_IMAGE].is<std::string>())
+        {
+            LOG_ERROR << "Invalid image value.";
+            return -1;
+        }
+
+        msg.image = d[msg::FLD_IMAGE].as<std::string>();
+        return 0;
+    }
+
+    /**
+     * Extracts trace message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "trace",
+     *            "operation_id": "<operation id>", (optional)
+     *            "container_name": "<container name>", (optional)
+     *            "format": "spans" | "chrome", (optional, defaults to spans)
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_trace_message(trace_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (d.contains(msg::FLD_OPERATION_ID))
+        {
+            if (!d[msg::FLD_OPERATION_ID].is<std::string>())
+            {
+                LOG_ERROR << "Invalid operation_id value.";
+                return -1;
+            }
+            msg.operation_id = d[msg::FLD_OPERATION_ID].as<std::string>();
+        }
+
+        if (d.contains(msg::FLD_CONTAINER_NAME))
+        {
+            if (!d[msg::FLD_CONTAINER_NAME].is<std::string>())
+            {
+                LOG_ERROR << "Invalid container_name value.";
+                return -1;
+            }
+            msg.container_name = d[msg::FLD_CONTAINER_NAME].as<std::string>();
+        }
+
+        msg.format = msg::TRACE_FORMAT_SPANS;
+        if (d.contains(msg::FLD_FORMAT))
+        {
+            if (!d[msg::FLD_FORMAT].is<std::string>())
+            {
+                LOG_ERROR << "Invalid format value.";
+                return -1;
+            }
+            msg.format = d[msg::FLD_FORMAT].as<std::string>();
+            if (msg.format != msg::TRACE_FORMAT_SPANS && msg.format != msg::TRACE_FORMAT_CHROME)
+            {
+                LOG_ERROR << "Invalid trace format. Valid values: spans|chrome";
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts stats message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "stats",
+     *            "container_name": "<container name>", (optional)
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_stats_message(stats_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (d.contains(msg::FLD_CONTAINER_NAME))
+        {
+            if (!d[msg::FLD_CONTAINER_NAME].is<std::string>())
+            {
+                LOG_ERROR << "Invalid container_name value.";
+                return -1;
+            }
+            msg.container_name = d[msg::FLD_CONTAINER_NAME].as<std::string>();
+        }
+        return 0;
+    }
+
+    /**
+     * Extracts the optional 'async' flag from the json document. Defaults to false if not present.
+     * @param is_async Populated async flag.
+     * @param d The json document holding the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_async_flag(bool &is_async, const jsoncons::json &d)
+    {
+        is_async = false;
+        if (!d.contains(msg::FLD_ASYNC))
+            return 0;
+
+        if (!d[msg::FLD_ASYNC].is<bool>())
+        {
+            LOG_ERROR << "Invalid async value.";
+            return -1;
+        }
+
+        is_async = d[msg::FLD_ASYNC].as<bool>();
+        return 0;
+    }
+
     /**
      * Constructs a generic json response.
      * @param msg Buffer to construct the generated json message string into.
@@ -730,6 +1121,7 @@ namespace msg::json
      *              "user": "<instance user name>",
      *              "image": "<docker image name>",
      *              "status": "<status of the instance>",
+     *              "status_changed_on": <epoch milliseconds of the last status change>,
      *              "peer_port": "<peer port of the instance>",
      *              "user_port": "<user port of the instance>",
      *              "created_timestamp": <created on UNIX timestamp>,
@@ -748,6 +1140,13 @@ namespace msg::json
         const uint32_t message_size = (INSTANCE_INFO_SIZE * instances.size()) + 3;
         msg.reserve(message_size);
 
+        // Index the leases by container name so each instance is matched with a single lookup.
+        // The first lease of a container is used if there are many.
+        std::unordered_map<std::string_view, const hp::lease_info *> lease_index;
+        lease_index.reserve(leases.size());
+        for (const hp::lease_info &lease : leases)
+            lease_index.emplace(lease.container_name, &lease);
+
         msg += "[";
         for (size_t i = 0; i < instances.size(); i++)
         {
@@ -774,6 +1173,10 @@ namespace msg::json
             msg += SEP_COLON;
             msg += instance.status;
             msg += SEP_COMMA;
+            msg += "status_changed_on";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(instance.status_changed_on);
+            msg += SEP_COMMA_NOQUOTE;
             msg += "peer_port";
             msg += SEP_COLON_NOQUOTE;
             msg += std::to_string(instance.assigned_ports.peer_port);
@@ -791,10 +1194,10 @@ namespace msg::json
             msg += std::to_string(instance.assigned_ports.gp_udp_port_start);
 
             // Include matching lease information.
-            const auto lease = std::find_if(leases.begin(), leases.end(), [&](const hp::lease_info &l)
-                                            { return l.container_name == instance.container_name; });
-            if (lease != leases.end())
+            const auto lease_itr = lease_index.find(instance.container_name);
+            if (lease_itr != lease_index.end())
             {
+                const hp::lease_info *lease = lease_itr->second;
                 msg += SEP_COMMA_NOQUOTE;
                 msg += "created_timestamp";
                 msg += SEP_COLON_NOQUOTE;
@@ -819,8 +1222,6 @@ namespace msg::json
                 msg += ",";
         }
         msg += "]";
-
-        std::cout << msg << "\n";
     }
 
     /**
@@ -832,13 +1233,17 @@ namespace msg::json
      *              "user": "<instance user name>",
      *              "image": "<docker image name>",
      *              "status": "<status of the instance>",
+     *              "status_changed_on": <epoch milliseconds of the last status change>,
      *              "peer_port": "<peer port of the instance>",
-     *              "user_port": "<user port of the instance>"
+     *              "user_port": "<user port of the instance>",
+     *              "resources": {<size of the instance>},
+     *              "usage": {<latest resource usage sample>} (only if the instance has been sampled)
      *             }
      * @param instance Instance info.
+     * @param usage Latest resource usage sample of the instance. Its timestamp is 0 if not sampled yet.
      *
      */
-    void build_inspect_response(std::string &msg, const hp::instance_info &instance)
+    void build_inspect_response(std::string &msg, const hp::instance_info &instance, const stats::sample &usage)
     {
         msg.reserve(1024);
         msg += "{\"";
@@ -858,6 +1263,10 @@ namespace msg::json
         msg += SEP_COLON;
         msg += instance.status;
         msg += SEP_COMMA;
+        msg += "status_changed_on";
+        msg += SEP_COLON_NOQUOTE;
+        msg += std::to_string(instance.status_changed_on);
+        msg += SEP_COMMA_NOQUOTE;
         msg += "peer_port";
         msg += SEP_COLON_NOQUOTE;
         msg += std::to_string(instance.assigned_ports.peer_port);
@@ -865,6 +1274,17 @@ namespace msg::json
         msg += "user_port";
         msg += SEP_COLON_NOQUOTE;
         msg += std::to_string(instance.assigned_ports.user_port);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "resources";
+        msg += SEP_COLON_NOQUOTE;
+        build_resources(msg, instance.allocation);
+        if (usage.timestamp != 0)
+        {
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "usage";
+            msg += SEP_COLON_NOQUOTE;
+            build_sample(msg, usage);
+        }
         msg += "}";
     }
 
@@ -894,4 +1314,364 @@ namespace msg::json
         msg += DOUBLE_QUOTE;
         msg += "}";
     }
+
+    /**
+     * Constructs the response content for an operation which is not yet completed.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             {
+     *              "operation_id": "<operation id>",
+     *              "state": "<pending|running>"
+     *             }
+     * @param operation_id Id of the operation.
+     * @param state Current state of the operation.
+     */
+    void build_operation_response(std::string &msg, std::string_view operation_id, std::string_view state)
+    {
+        msg.reserve(32 + operation_id.size() + state.size());
+        msg += "{\"";
+        msg += msg::FLD_OPERATION_ID;
+        msg += SEP_COLON;
+        msg += operation_id;
+        msg += SEP_COMMA;
+        msg += "state";
+        msg += SEP_COLON;
+        msg += state;
+        msg += DOUBLE_QUOTE;
+        msg += "}";
+    }
+
+    /**
+     * Constructs the response content for a batch message out of the responses of the individual items.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             [
+     *              {"type": "<item response type>", "content": <item response content>},
+     *              ...
+     *             ]
+     * @param responses Responses of the batch items in the order of the request.
+     */
+    void build_batch_response(std::string &msg, const std::vector<std::string> &responses)
+    {
+        size_t message_size = 2 + responses.size();
+        for (const std::string &response : responses)
+            message_size += response.size();
+        msg.reserve(message_size);
+
+        msg += "[";
+        for (size_t i = 0; i < responses.size(); i++)
+        {
+            if (i > 0)
+                msg += ",";
+            msg += responses[i];
+        }
+        msg += "]";
+    }
+
+    /**
+     * Constructs the response content for a trace message.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             [
+     *              {
+     *                "operation_id": "<operation id>",
+     *                "container_name": "<container name>",
+     *                "name": "<phase name>",
+     *                "start_us": <epoch microseconds>,
+     *                "duration_us": <microseconds>,
+     *                "thread": <thread id>
+     *              },
+     *              ...
+     *             ]
+     * @param spans Spans in the order they were completed.
+     */
+    void build_trace_response(std::string &msg, const std::vector<trace::span_record> &spans)
+    {
+        msg.reserve(2 + (spans.size() * 192));
+        msg += "[";
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            const trace::span_record &span = spans[i];
+            if (i > 0)
+                msg += ",";
+            msg += "{\"";
+            msg += msg::FLD_OPERATION_ID;
+            msg += SEP_COLON;
+            msg += span.operation_id;
+            msg += SEP_COMMA;
+            msg += msg::FLD_CONTAINER_NAME;
+            msg += SEP_COLON;
+            msg += span.container_name;
+            msg += SEP_COMMA;
+            msg += "name";
+            msg += SEP_COLON;
+            msg += span.name;
+            msg += DOUBLE_QUOTE;
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "start_us";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.start_us);
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "duration_us";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.duration_us);
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "thread";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.thread_id);
+            msg += "}";
+        }
+        msg += "]";
+    }
+
+    /**
+     * Constructs the response content for a trace message in the Chrome trace event format. Each span becomes a
+     * complete event, so the content can be saved as a file and opened in chrome://tracing or Perfetto.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             {
+     *              "traceEvents": [
+     *                {
+     *                  "name": "<phase name>",
+     *                  "cat": "<container name>",
+     *                  "ph": "X",
+     *                  "ts": <epoch microseconds>,
+     *                  "dur": <microseconds>,
+     *                  "pid": <agent process id>,
+     *                  "tid": <thread id>,
+     *                  "args": {"operation_id": "<operation id>"}
+     *                },
+     *                ...
+     *              ],
+     *              "displayTimeUnit": "ms"
+     *             }
+     * @param spans Spans in the order they were completed.
+     */
+    void build_chrome_trace_response(std::string &msg, const std::vector<trace::span_record> &spans)
+    {
+        const std::string pid = std::to_string(getpid());
+        msg.reserve(64 + (spans.size() * 224));
+        msg += "{\"traceEvents\":[";
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            const trace::span_record &span = spans[i];
+            if (i > 0)
+                msg += ",";
+            msg += "{\"name";
+            msg += SEP_COLON;
+            msg += span.name;
+            msg += SEP_COMMA;
+            msg += "cat";
+            msg += SEP_COLON;
+            msg += span.container_name;
+            msg += SEP_COMMA;
+            msg += "ph";
+            msg += SEP_COLON;
+            msg += "X";
+            msg += DOUBLE_QUOTE;
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "ts";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.start_us);
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "dur";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.duration_us);
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "pid";
+            msg += SEP_COLON_NOQUOTE;
+            msg += pid;
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "tid";
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(span.thread_id);
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "args\":{\"";
+            msg += msg::FLD_OPERATION_ID;
+            msg += SEP_COLON;
+            msg += span.operation_id;
+            msg += "\"}}";
+        }
+        msg += "],\"displayTimeUnit\":\"ms\"}";
+    }
+
+    /**
+     * Constructs the response content for a metrics message. The metrics text is sent as a json string, so the
+     * client only has to unescape it to get the Prometheus exposition text.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             "<metrics in the Prometheus text format>"
+     * @param text Metrics in the Prometheus text format.
+     */
+    void build_metrics_response(std::string &msg, std::string_view text)
+    {
+        msg.reserve(text.size() + (text.size() / 16) + 2);
+        msg += DOUBLE_QUOTE;
+        for (const char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                msg += '\\';
+                msg += c;
+            }
+            else if (c == '\n')
+            {
+                msg += "\\n";
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                msg += escaped;
+            }
+            else
+            {
+                msg += c;
+            }
+        }
+        msg += DOUBLE_QUOTE;
+    }
+
+    /**
+     * Constructs the response content for a stats message.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             [
+     *              {
+     *                "name": "<instance name>",
+     *                "samples": [{<resource usage sample>}, ...]
+     *              },
+     *              ...
+     *             ]
+     * @param stats Samples of the instances in the order they were taken.
+     */
+    void build_stats_response(std::string &msg, const std::vector<stats::instance_samples> &stats)
+    {
+        msg.reserve(2 + (stats.size() * 64));
+        msg += "[";
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            if (i > 0)
+                msg += ",";
+            msg += "{\"";
+            msg += "name";
+            msg += SEP_COLON;
+            msg += stats[i].container_name;
+            msg += SEP_COMMA;
+            msg += "samples";
+            msg += SEP_COLON_NOQUOTE;
+            msg += "[";
+            for (size_t j = 0; j < stats[i].samples.size(); j++)
+            {
+                if (j > 0)
+                    msg += ",";
+                build_sample(msg, stats[i].samples[j]);
+            }
+            msg += "]}";
+        }
+        msg += "]";
+    }
+
+    /**
+     * Appends a resource usage sample as a json object.
+     * @param msg Buffer to append the generated json object into.
+     *           Object format:
+     *             {
+     *              "timestamp": <epoch milliseconds>,
+     *              "cpu_usage_us": <cumulative cpu time>,
+     *              "mem_bytes": <memory usage>,
+     *              "mem_peak_bytes": <peak memory usage>,
+     *              "swap_bytes": <swap usage>,
+     *              "io_read_bytes": <cumulative bytes read>,
+     *              "io_write_bytes": <cumulative bytes written>,
+     *              "io_read_ops": <cumulative read operations>,
+     *              "io_write_ops": <cumulative write operations>,
+     *              "disk_bytes": <disk usage of the instance user>
+     *             }
+     * @param s The sample.
+     */
+    void build_sample(std::string &msg, const stats::sample &s)
+    {
+        const std::pair<const char *, uint64_t> fields[] = {
+            {"timestamp", s.timestamp},
+            {"cpu_usage_us", s.cpu_usage_us},
+            {"mem_bytes", s.mem_bytes},
+            {"mem_peak_bytes", s.mem_peak_bytes},
+            {"swap_bytes", s.swap_bytes},
+            {"io_read_bytes", s.io_read_bytes},
+            {"io_write_bytes", s.io_write_bytes},
+            {"io_read_ops", s.io_read_ops},
+            {"io_write_ops", s.io_write_ops},
+            {"disk_bytes", s.disk_bytes}};
+
+        msg += "{";
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        {
+            if (i > 0)
+                msg += ",";
+            msg += DOUBLE_QUOTE;
+            msg += fields[i].first;
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(fields[i].second);
+        }
+        msg += "}";
+    }
+
+    /**
+     * Constructs the response of a resize.
+     * @param msg Buffer to populate.
+     *           Format:
+     *             {
+     *              "name": "<container name>",
+     *              "resources": {<new size of the instance>}
+     *             }
+     * @param container_name Name of the instance.
+     * @param res New size of the instance.
+     */
+    void build_resize_response(std::string &msg, std::string_view container_name, const hp::resources &res)
+    {
+        msg.reserve(256);
+        msg += "{\"";
+        msg += "name";
+        msg += SEP_COLON;
+        msg += container_name;
+        msg += SEP_COMMA;
+        msg += "resources";
+        msg += SEP_COLON_NOQUOTE;
+        build_resources(msg, res);
+        msg += "}";
+    }
+
+    /**
+     * Constructs the size of an instance. Swap is given on top of the memory, the same way it's requested.
+     * @param msg Buffer to append the generated json object to.
+     *           Format:
+     *             {
+     *              "cpu_us": <cpu time out of 1000000 microsec>,
+     *              "mem_kbytes": <memory in KB>,
+     *              "swap_kbytes": <swap in KB>,
+     *              "storage_kbytes": <disk in KB>
+     *             }
+     * @param res The size.
+     */
+    void build_resources(std::string &msg, const hp::resources &res)
+    {
+        const std::pair<const char *, uint64_t> fields[] = {
+            {msg::FLD_CPU_US, res.cpu_us},
+            {msg::FLD_MEM_KBYTES, res.mem_kbytes},
+            {msg::FLD_SWAP_KBYTES, res.swap_kbytes - std::min(res.swap_kbytes, res.mem_kbytes)},
+            {msg::FLD_STORAGE_KBYTES, res.storage_kbytes}};
+
+        msg += "{";
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        {
+            if (i > 0)
+                msg += ",";
+            msg += DOUBLE_QUOTE;
+            msg += fields[i].first;
+            msg += SEP_COLON_NOQUOTE;
+            msg += std::to_string(fields[i].second);
+        }
+        msg += "}";
+    }
 } // namespace msg::json
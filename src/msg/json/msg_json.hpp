@@ -4,6 +4,8 @@
 #include "../../pchheader.hpp"
 #include "../msg_common.hpp"
 #include "../../hp_manager.hpp"
+#include "../../trace.hpp"
+#include "../../stats_collector.hpp"
 
 /**
  * Parser helpers for json messages.
@@ -16,6 +18,8 @@ namespace msg::json
 
     int extract_create_message(create_msg &msg, const jsoncons::json &d);
 
+    int extract_resource_request(resource_request &request, const jsoncons::json &d);
+
     int extract_initiate_message(initiate_msg &msg, const jsoncons::json &d);
 
     int extract_destroy_message(destroy_msg &msg, const jsoncons::json &d);
@@ -24,18 +28,52 @@ namespace msg::json
 
     int extract_stop_message(stop_msg &msg, const jsoncons::json &d);
 
+    int extract_resize_message(resize_msg &msg, const jsoncons::json &d);
+
     int extract_inspect_message(inspect_msg &msg, const jsoncons::json &d);
 
+    int extract_operation_message(operation_msg &msg, const jsoncons::json &d);
+
+    int extract_create_batch_message(create_batch_msg &msg, const jsoncons::json &d);
+
+    int extract_destroy_batch_message(destroy_batch_msg &msg, const jsoncons::json &d);
+
+    int extract_prefetch_message(prefetch_msg &msg, const jsoncons::json &d);
+
+    int extract_trace_message(trace_msg &msg, const jsoncons::json &d);
+
+    int extract_stats_message(stats_msg &msg, const jsoncons::json &d);
+
+    int extract_async_flag(bool &is_async, const jsoncons::json &d);
+
     void build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content = false);
 
     void build_create_response(std::string &msg, const hp::instance_info &info);
 
     void build_list_response(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases);
 
-    void build_inspect_response(std::string &msg, const hp::instance_info &instance);
+    void build_inspect_response(std::string &msg, const hp::instance_info &instance, const stats::sample &usage);
+
+    void build_resize_response(std::string &msg, std::string_view container_name, const hp::resources &res);
 
     void build_error_response(std::string &msg, std::string_view container_name, std::string_view error);
 
+    void build_operation_response(std::string &msg, std::string_view operation_id, std::string_view state);
+
+    void build_batch_response(std::string &msg, const std::vector<std::string> &responses);
+
+    void build_trace_response(std::string &msg, const std::vector<trace::span_record> &spans);
+
+    void build_chrome_trace_response(std::string &msg, const std::vector<trace::span_record> &spans);
+
+    void build_metrics_response(std::string &msg, std::string_view text);
+
+    void build_stats_response(std::string &msg, const std::vector<stats::instance_samples> &stats);
+
+    void build_sample(std::string &msg, const stats::sample &s);
+
+    void build_resources(std::string &msg, const hp::resources &res);
+
 } // namespace msg::json
 
 #endif
\ No newline at end of file
@@ -6,6 +6,16 @@
 
 namespace msg
 {
+    // Size of an instance asked for on create. Sizes which are 0 are taken from the tier.
+    struct resource_request
+    {
+        std::string tier;
+        size_t cpu_us = 0;
+        size_t mem_kbytes = 0;
+        size_t swap_kbytes = 0; // Swap on top of the memory.
+        size_t storage_kbytes = 0;
+    };
+
     struct create_msg
     {
         std::string type;
@@ -15,6 +25,7 @@ namespace msg
         std::string image;
         std::string outbound_ipv6;
         std::string outbound_net_interface;
+        resource_request resources;
     };
 
     struct history_configuration
@@ -161,12 +172,66 @@ namespace msg
         std::string container_name;
     };
 
+    struct resize_msg
+    {
+        std::string type;
+        std::string container_name;
+        resource_request resources; // New size. Sizes which are 0 keep their current values unless a tier is given.
+    };
+
     struct inspect_msg
     {
         std::string type;
         std::string container_name;
     };
 
+    struct create_batch_item
+    {
+        create_msg create;
+        initiate_msg initiate;
+    };
+
+    struct create_batch_msg
+    {
+        std::string type;
+        std::vector<create_batch_item> instances;
+    };
+
+    struct destroy_batch_msg
+    {
+        std::string type;
+        std::vector<std::string> container_names;
+    };
+
+    struct operation_msg
+    {
+        std::string type;
+        std::string operation_id;
+    };
+
+    struct prefetch_msg
+    {
+        std::string type;
+        std::string image;
+    };
+
+    struct trace_msg
+    {
+        std::string type;
+        std::string operation_id;   // Only the spans of this operation are returned if set.
+        std::string container_name; // Only the spans of this instance are returned if set.
+        std::string format;         // One of the TRACE_FORMAT_* values.
+    };
+
+    struct stats_msg
+    {
+        std::string type;
+        std::string container_name; // All the samples of this instance are returned if set. Otherwise the latest sample of each instance.
+    };
+
+    constexpr const char *TRACE_FORMAT_SPANS = "spans";   // Plain list of the spans.
+    constexpr const char *TRACE_FORMAT_CHROME = "chrome"; // Chrome trace event format, loadable in chrome://tracing and Perfetto.
+
     // Message field names
     constexpr const char *FLD_TYPE = "type";
     constexpr const char *FLD_CONTENT = "content";
@@ -227,6 +292,17 @@ namespace msg
     constexpr const char *FLD_MAX_DUP_MSG_MIN = "max_dup_msgs_per_min";
     constexpr const char *FLD_PEER_DISCOVERY = "peer_discovery";
     constexpr const char *FLD_CON_READ_REQ = "concurrent_read_requests";
+    constexpr const char *FLD_ASYNC = "async";
+    constexpr const char *FLD_OPERATION_ID = "operation_id";
+    constexpr const char *FLD_INSTANCES = "instances";
+    constexpr const char *FLD_CONTAINER_NAMES = "container_names";
+    constexpr const char *FLD_FORMAT = "format";
+    constexpr const char *FLD_TIER = "tier";
+    constexpr const char *FLD_RESOURCES = "resources";
+    constexpr const char *FLD_CPU_US = "cpu_us";
+    constexpr const char *FLD_MEM_KBYTES = "mem_kbytes";
+    constexpr const char *FLD_SWAP_KBYTES = "swap_kbytes";
+    constexpr const char *FLD_STORAGE_KBYTES = "storage_kbytes";
 
     // Message types
     constexpr const char *MSGTYPE_INIT = "init";
@@ -237,6 +313,14 @@ namespace msg
     constexpr const char *MSGTYPE_STOP = "stop";
     constexpr const char *MSGTYPE_LIST = "list";
     constexpr const char *MSGTYPE_INSPECT = "inspect";
+    constexpr const char *MSGTYPE_OPERATION = "operation";
+    constexpr const char *MSGTYPE_CREATE_BATCH = "create_batch";
+    constexpr const char *MSGTYPE_DESTROY_BATCH = "destroy_batch";
+    constexpr const char *MSGTYPE_PREFETCH = "prefetch";
+    constexpr const char *MSGTYPE_TRACE = "trace";
+    constexpr const char *MSGTYPE_METRICS = "metrics";
+    constexpr const char *MSGTYPE_STATS = "stats";
+    constexpr const char *MSGTYPE_RESIZE = "resize";
 
     // Message res types
     constexpr const char *MSGTYPE_ERROR = "error";
@@ -253,6 +337,21 @@ namespace msg
     constexpr const char *MSGTYPE_LIST_RES = "list_res";
     constexpr const char *MSGTYPE_INSPECT_RES = "inspect_res";
     constexpr const char *MSGTYPE_INSPECT_ERROR = "inspect_error";
+    constexpr const char *MSGTYPE_OPERATION_RES = "operation_res";
+    constexpr const char *MSGTYPE_OPERATION_ERROR = "operation_error";
+    constexpr const char *MSGTYPE_CREATE_BATCH_RES = "create_batch_res";
+    constexpr const char *MSGTYPE_CREATE_BATCH_ERROR = "create_batch_error";
+    constexpr const char *MSGTYPE_DESTROY_BATCH_RES = "destroy_batch_res";
+    constexpr const char *MSGTYPE_DESTROY_BATCH_ERROR = "destroy_batch_error";
+    constexpr const char *MSGTYPE_PREFETCH_RES = "prefetch_res";
+    constexpr const char *MSGTYPE_PREFETCH_ERROR = "prefetch_error";
+    constexpr const char *MSGTYPE_TRACE_RES = "trace_res";
+    constexpr const char *MSGTYPE_TRACE_ERROR = "trace_error";
+    constexpr const char *MSGTYPE_METRICS_RES = "metrics_res";
+    constexpr const char *MSGTYPE_STATS_RES = "stats_res";
+    constexpr const char *MSGTYPE_STATS_ERROR = "stats_error";
+    constexpr const char *MSGTYPE_RESIZE_RES = "resize_res";
+    constexpr const char *MSGTYPE_RESIZE_ERROR = "resize_error";
 
 } // namespace msg
 
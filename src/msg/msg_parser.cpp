@@ -38,11 +38,51 @@ namespace msg
         return json::extract_stop_message(msg, jdoc);
     }
 
+    int msg_parser::extract_resize_message(resize_msg &msg) const
+    {
+        return json::extract_resize_message(msg, jdoc);
+    }
+
     int msg_parser::extract_inspect_message(inspect_msg &msg) const
     {
         return json::extract_inspect_message(msg, jdoc);
     }
 
+    int msg_parser::extract_operation_message(operation_msg &msg) const
+    {
+        return json::extract_operation_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_create_batch_message(create_batch_msg &msg) const
+    {
+        return json::extract_create_batch_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_destroy_batch_message(destroy_batch_msg &msg) const
+    {
+        return json::extract_destroy_batch_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_prefetch_message(prefetch_msg &msg) const
+    {
+        return json::extract_prefetch_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_trace_message(trace_msg &msg) const
+    {
+        return json::extract_trace_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_stats_message(stats_msg &msg) const
+    {
+        return json::extract_stats_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_async_flag(bool &is_async) const
+    {
+        return json::extract_async_flag(is_async, jdoc);
+    }
+
     void msg_parser::build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content) const
     {
         json::build_response(msg, response_type, content, json_content);
@@ -59,9 +99,14 @@ namespace msg
         json::build_list_response(msg, instances, leases);
     }
 
-    void msg_parser::build_inspect_response(std::string &msg, const hp::instance_info &instance) const
+    void msg_parser::build_inspect_response(std::string &msg, const hp::instance_info &instance, const stats::sample &usage) const
+    {
+        json::build_inspect_response(msg, instance, usage);
+    }
+
+    void msg_parser::build_resize_response(std::string &msg, std::string_view container_name, const hp::resources &res) const
     {
-        json::build_inspect_response(msg, instance);
+        json::build_resize_response(msg, container_name, res);
     }
 
     void msg_parser::build_error_response(std::string &msg,
@@ -70,4 +115,34 @@ namespace msg
         json::build_error_response(msg, container_name, error);
     }
 
+    void msg_parser::build_operation_response(std::string &msg, std::string_view operation_id, std::string_view state) const
+    {
+        json::build_operation_response(msg, operation_id, state);
+    }
+
+    void msg_parser::build_batch_response(std::string &msg, const std::vector<std::string> &responses) const
+    {
+        json::build_batch_response(msg, responses);
+    }
+
+    void msg_parser::build_trace_response(std::string &msg, const std::vector<trace::span_record> &spans) const
+    {
+        json::build_trace_response(msg, spans);
+    }
+
+    void msg_parser::build_chrome_trace_response(std::string &msg, const std::vector<trace::span_record> &spans) const
+    {
+        json::build_chrome_trace_response(msg, spans);
+    }
+
+    void msg_parser::build_metrics_response(std::string &msg, std::string_view text) const
+    {
+        json::build_metrics_response(msg, text);
+    }
+
+    void msg_parser::build_stats_response(std::string &msg, const std::vector<stats::instance_samples> &stats) const
+    {
+        json::build_stats_response(msg, stats);
+    }
+
 } // namespace msg
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "../pchheader.hpp"
 #include "msg_common.hpp"
 #include "../hp_manager.hpp"
+#include "../trace.hpp"
+#include "../stats_collector.hpp"
 
 namespace msg
 {
@@ -19,14 +21,29 @@ namespace msg
         int extract_destroy_message(destroy_msg &msg) const;
         int extract_start_message(start_msg &msg) const;
         int extract_stop_message(stop_msg &msg) const;
+        int extract_resize_message(resize_msg &msg) const;
         int extract_inspect_message(inspect_msg &msg) const;
+        int extract_operation_message(operation_msg &msg) const;
+        int extract_create_batch_message(create_batch_msg &msg) const;
+        int extract_destroy_batch_message(destroy_batch_msg &msg) const;
+        int extract_prefetch_message(prefetch_msg &msg) const;
+        int extract_trace_message(trace_msg &msg) const;
+        int extract_stats_message(stats_msg &msg) const;
+        int extract_async_flag(bool &is_async) const;
         void build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content = false) const;
         void build_create_response(std::string &msg, const hp::instance_info &info) const;
         void build_list_response(std::string &msg,
                                              const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases) const;
-        void build_inspect_response(std::string &msg, const hp::instance_info &instance) const;
+        void build_inspect_response(std::string &msg, const hp::instance_info &instance, const stats::sample &usage) const;
+        void build_resize_response(std::string &msg, std::string_view container_name, const hp::resources &res) const;
         void build_error_response(std::string &msg,
                                          std::string_view container_name, std::string_view error) const;
+        void build_operation_response(std::string &msg, std::string_view operation_id, std::string_view state) const;
+        void build_batch_response(std::string &msg, const std::vector<std::string> &responses) const;
+        void build_trace_response(std::string &msg, const std::vector<trace::span_record> &spans) const;
+        void build_chrome_trace_response(std::string &msg, const std::vector<trace::span_record> &spans) const;
+        void build_metrics_response(std::string &msg, std::string_view text) const;
+        void build_stats_response(std::string &msg, const std::vector<stats::instance_samples> &stats) const;
     };
 
 } // namespace msg
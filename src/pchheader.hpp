@@ -2,29 +2,59 @@
 #define _SA_PCHHEADER_
 
 #include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
 #include <boost/stacktrace.hpp>
 #include <chrono>
 #include <concurrentqueue.h>
+#include <condition_variable>
 #include <csignal>
+#include <cstdarg>
+#include <deque>
+#include <dirent.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <grp.h>
+#include <ifaddrs.h>
 #include <iostream>
 #include <jsoncons/json.hpp>
 #include <libgen.h>
+#include <linux/fs.h>
+#include <limits.h>
+#include <memory>
+#include <mntent.h>
+#include <mutex>
+#include <net/if.h>
+#include <netdb.h>
 #include <set>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <spawn.h>
 #include <sqlite3.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/quota.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <sodium.h>
 #include <stdlib.h>
+#include <systemd/sd-bus.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <thread>
@@ -0,0 +1,124 @@
+#include "port_allocator.hpp"
+
+namespace registry
+{
+    constexpr int GP_PORT_COUNT = 2; // No. of general purpose tcp and udp ports of a slot.
+    constexpr size_t WORD_BITS = 64;
+
+    /**
+     * Sizes the bitmap to the no. of slots whose ports fit in the port range with the given initial ports. Only whole
+     * slots are counted, so the last port of a slot never runs past 65535.
+     * @param hp_config Config holding the initial ports.
+     */
+    void port_allocator::init(const conf::hp_config &hp_config)
+    {
+        config = hp_config;
+
+        const auto slots_from = [](const uint16_t init_port, const size_t ports_per_slot)
+        {
+            return init_port == 0 ? 0 : (UINT16_MAX - init_port + 1) / ports_per_slot;
+        };
+        slot_count = std::min({slots_from(config.init_peer_port, 1),
+                               slots_from(config.init_user_port, 1),
+                               slots_from(config.init_gp_tcp_port, GP_PORT_COUNT),
+                               slots_from(config.init_gp_udp_port, GP_PORT_COUNT)});
+
+        bitmap.assign((slot_count + WORD_BITS - 1) / WORD_BITS, 0);
+        used_count = 0;
+        first_free_word = 0;
+    }
+
+    /**
+     * Reserves the lowest free slot.
+     * @param slot The reserved slot.
+     * @return 0 on success and -1 if all the slots are used.
+     */
+    int port_allocator::reserve(uint16_t &slot)
+    {
+        for (size_t word = first_free_word; word < bitmap.size(); word++)
+        {
+            if (bitmap[word] == UINT64_MAX)
+                continue;
+
+            const size_t candidate = (word * WORD_BITS) + __builtin_ctzll(~bitmap[word]);
+            first_free_word = word;
+            if (candidate >= slot_count)
+                break;
+
+            slot = candidate;
+            bitmap[word] |= (1ULL << (slot % WORD_BITS));
+            used_count++;
+            return 0;
+        }
+
+        first_free_word = bitmap.size();
+        return -1;
+    }
+
+    /**
+     * Marks the given slot as used.
+     * @param slot Slot to be marked.
+     * @return 0 on success. -1 if the slot is out of range or already used.
+     */
+    int port_allocator::mark_used(const uint16_t slot)
+    {
+        if (slot >= slot_count || is_used(slot))
+            return -1;
+
+        bitmap[slot / WORD_BITS] |= (1ULL << (slot % WORD_BITS));
+        used_count++;
+        return 0;
+    }
+
+    /**
+     * Makes the given slot free.
+     * @param slot Slot to be released.
+     */
+    void port_allocator::release(const uint16_t slot)
+    {
+        if (slot >= slot_count || !is_used(slot))
+            return;
+
+        bitmap[slot / WORD_BITS] &= ~(1ULL << (slot % WORD_BITS));
+        used_count--;
+        first_free_word = std::min(first_free_word, (size_t)(slot / WORD_BITS));
+    }
+
+    bool port_allocator::is_used(const uint16_t slot) const
+    {
+        return slot < slot_count && (bitmap[slot / WORD_BITS] & (1ULL << (slot % WORD_BITS))) != 0;
+    }
+
+    /**
+     * Get the slot which owns the given ports.
+     * @param ports Ports of an instance.
+     * @param slot Slot of the ports.
+     * @return 0 on success. -1 if the ports do not belong to a single slot.
+     */
+    int port_allocator::get_slot(const hp::ports &ports, uint16_t &slot) const
+    {
+        if (ports.peer_port < config.init_peer_port)
+            return -1;
+
+        const size_t candidate = ports.peer_port - config.init_peer_port;
+        if (candidate >= slot_count || !(get_ports(candidate) == ports))
+            return -1;
+
+        slot = candidate;
+        return 0;
+    }
+
+    /**
+     * Get the ports of the given slot.
+     * @param slot Index of the slot.
+     * @return Ports of the slot.
+     */
+    const hp::ports port_allocator::get_ports(const uint16_t slot) const
+    {
+        return {(uint16_t)(config.init_peer_port + slot),
+                (uint16_t)(config.init_user_port + slot),
+                (uint16_t)(config.init_gp_tcp_port + (slot * GP_PORT_COUNT)),
+                (uint16_t)(config.init_gp_udp_port + (slot * GP_PORT_COUNT))};
+    }
+
+} // namespace registry
@@ -0,0 +1,41 @@
+#ifndef _SA_PORT_ALLOCATOR_
+#define _SA_PORT_ALLOCATOR_
+
+#include "pchheader.hpp"
+#include "hp_manager.hpp"
+
+namespace registry
+{
+    /**
+     * Allocates port slots. Slot n owns the nth peer and user ports and the nth pair of general purpose tcp and udp
+     * ports counted from the configured initial ports. A bitmap keeps the slots which are either assigned to an
+     * instance or reserved for one being created.
+     */
+    struct port_allocator
+    {
+        std::vector<uint64_t> bitmap;
+        size_t slot_count = 0;
+        size_t used_count = 0;
+        size_t first_free_word = 0; // No free slots are below this word of the bitmap.
+
+        void init(const conf::hp_config &config);
+
+        int reserve(uint16_t &slot);
+
+        int mark_used(const uint16_t slot);
+
+        void release(const uint16_t slot);
+
+        bool is_used(const uint16_t slot) const;
+
+        int get_slot(const hp::ports &ports, uint16_t &slot) const;
+
+        const hp::ports get_ports(const uint16_t slot) const;
+
+    private:
+        conf::hp_config config;
+    };
+
+} // namespace registry
+
+#endif
@@ -0,0 +1,909 @@
+#include "provisioner.hpp"
+#include "hp_manager.hpp"
+#include "hpfs_manager.hpp"
+#include "docker_client.hpp"
+#include "trace.hpp"
+#include "cgroup_manager.hpp"
+#include "util/util.hpp"
+
+namespace provisioner
+{
+    constexpr const char *USER_PREFIX = "sashi";
+    constexpr const char *CONTRACT_USER_SUFFIX = "-secuser";
+    constexpr const char *SASHIMONO_USER_GROUP = "sashiuser"; // Group of all the instance users.
+    constexpr const char *NOLOGIN_SHELL = "/usr/sbin/nologin";
+    constexpr const char *LIMITS_CONF = "/etc/security/limits.conf";
+    constexpr const char *SUBUID_FILE = "/etc/subuid";
+    constexpr const char *SUBGID_FILE = "/etc/subgid";
+    constexpr const char *NFTABLES_CONF = "/etc/nftables.conf";
+    constexpr const char *NFTABLES_UNIT = "nftables.service";
+    constexpr const char *DOCKER_UNIT = "docker.service";
+    constexpr const char *MBXRPL_CONFIG = "/etc/sashimono/mb-xrpl/mb-xrpl.cfg";
+    constexpr const char *RESOLV_CONF = "/etc/resolv.conf";
+    constexpr const char *ROUTE_TABLE = "/proc/net/route";
+    constexpr const char *LOGIN_SERVICE = "org.freedesktop.login1";
+    constexpr const char *LOGIN_PATH = "/org/freedesktop/login1";
+    constexpr const char *LOGIN_MANAGER_INTERFACE = "org.freedesktop.login1.Manager";
+    constexpr const char *SYSTEM_STATE_RUNNING = "running";
+    constexpr rlim_t MIN_NOFILE_LIMIT = 250000;
+    constexpr int USER_SYSTEMD_WAIT_MS = 3000;    // Max time to wait for the systemd user manager.
+    constexpr int USER_SYSTEMD_POLL_MS = 100;
+    constexpr int DOCKERD_READY_ATTEMPTS = 5;     // Attempts to reach the restarted dockerd, a second apart.
+    constexpr uint64_t UNIT_JOB_TIMEOUT_MS = 30000;
+    constexpr uint64_t SYSTEM_CALL_TIMEOUT_US = 30000000;
+    constexpr int FILE_PERMS = 0644;
+    constexpr int CPU_PERIOD_US = 1000000;
+
+    // Host level files edited by the provisionings are guarded so parallel provisionings do not lose each other's edits.
+    std::mutex limits_mutex;
+    std::mutex firewall_mutex;
+    bool is_nftables_enabled = false; // Guarded by firewall_mutex.
+
+    /**
+     * Provisions a new instance user natively. The stages are run in order and the completed ones are rolled back
+     * if a stage fails, so a failed provisioning leaves nothing behind.
+     * @param user_id Uid of the created user to be populated.
+     * @param username Username of the created user to be populated.
+     * @param params Resources and settings of the user.
+     * @return 0 on success and -1 on error.
+     */
+    int provision_user(int &user_id, std::string &username, const provision_params &params)
+    {
+        provision_ctx ctx;
+        ctx.params = params;
+        const uint64_t epoch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        ctx.username = USER_PREFIX + std::to_string(epoch_ns);
+        ctx.contract_username = ctx.username + CONTRACT_USER_SUFFIX;
+
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+        {
+            if (run_stage(ctx, (STAGE)stage) == -1)
+            {
+                LOG_ERROR << "User provisioning failed at stage " << STAGE_NAMES[stage] << " for " << ctx.username;
+                rollback(ctx);
+                return -1;
+            }
+            ctx.completed_stages++;
+        }
+
+        std::string timings;
+        uint64_t total = 0;
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+        {
+            timings.append(timings.empty() ? "" : ", ").append(STAGE_NAMES[stage]).append(": ").append(std::to_string(ctx.stage_durations[stage])).append("ms");
+            total += ctx.stage_durations[stage];
+        }
+        LOG_INFO << "Provisioned user " << ctx.username << ", uid : " << ctx.user_id << " in " << total << "ms (" << timings << ")";
+
+        user_id = ctx.user_id;
+        username = ctx.username;
+        return 0;
+    }
+
+    /**
+     * Changes the resources of an existing user in place. The disk quota and the slice limits are rewritten while
+     * the processes of the user keep running.
+     * @param user_id Uid of the user.
+     * @param username Username of the user.
+     * @param params New resources of the user.
+     * @return 0 on success and -1 on error.
+     */
+    int update_resources(const int user_id, std::string_view username, const provision_params &params)
+    {
+        provision_ctx ctx;
+        ctx.params = params;
+        ctx.user_id = user_id;
+        ctx.username = username;
+        if (set_quota(ctx) == -1 || setup_slice(ctx) == -1)
+            return -1;
+
+        LOG_INFO << "Updated the resources of " << username << ". CPU: " << params.cpu_us << " MicroS, RAM: " << params.mem_kbytes
+                 << " KB, Storage: " << params.storage_kbytes << " KB.";
+        return 0;
+    }
+
+    /**
+     * Runs a stage and records the time taken.
+     * @param ctx Provisioning state.
+     * @param stage Stage to run.
+     * @return 0 on success and -1 on error.
+     */
+    int run_stage(provision_ctx &ctx, const STAGE stage)
+    {
+        const trace::span span(std::string("provision:") + STAGE_NAMES[stage]);
+        const uint64_t start = util::get_epoch_milliseconds();
+        int ret = -1;
+        switch (stage)
+        {
+        case LIMITS:
+            ret = setup_limits(ctx);
+            break;
+        case USER:
+            ret = create_user(ctx);
+            break;
+        case CONTRACT_USER:
+            ret = create_contract_user(ctx);
+            break;
+        case QUOTA:
+            ret = set_quota(ctx);
+            break;
+        case USER_SYSTEMD:
+            ret = wait_user_systemd(ctx);
+            break;
+        case SLICE:
+            ret = setup_slice(ctx);
+            break;
+        case DOCKERD:
+            ret = install_dockerd(ctx);
+            break;
+        case FIREWALL:
+            ret = setup_firewall(ctx);
+            break;
+        default:
+            break;
+        }
+        ctx.stage_durations[stage] = util::get_epoch_milliseconds() - start;
+        return ret;
+    }
+
+    /**
+     * Undoes the completed stages and the failed one in the reverse order. Once the user exists, user-uninstall.sh
+     * removes everything owned by the user (processes, dockerd, contract user, quota, home and limits), so only the
+     * host level artifacts it does not know about are undone individually.
+     * @param ctx Provisioning state.
+     */
+    void rollback(provision_ctx &ctx)
+    {
+        LOG_INFO << "Rolling back user provisioning of " << ctx.username;
+        for (int stage = std::min(ctx.completed_stages, STAGE_COUNT - 1); stage >= 0; stage--)
+        {
+            switch (stage)
+            {
+            case LIMITS:
+                remove_limits(ctx.username);
+                break;
+            case USER:
+                if (ctx.user_id != -1 || getpwnam(ctx.username.data()) != NULL)
+                    hp::uninstall_user(ctx.username, {}, {});
+                break;
+            case SLICE:
+                remove_slice(ctx);
+                break;
+            case FIREWALL:
+                remove_firewall(ctx);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    /**
+     * Adds the process and file descriptor limits of the user. The file descriptors are shared among the max no. of
+     * instances and the host.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int setup_limits(provision_ctx &ctx)
+    {
+        struct rlimit nofile, nproc;
+        if (getrlimit(RLIMIT_NOFILE, &nofile) == -1 || getrlimit(RLIMIT_NPROC, &nproc) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading the resource limits.";
+            return -1;
+        }
+
+        const rlim_t nofile_limit = std::max(nofile.rlim_cur, MIN_NOFILE_LIMIT) / (conf::cfg.system.max_instance_count + 1);
+        const std::string nproc_limit = nproc.rlim_cur == RLIM_INFINITY ? "unlimited" : std::to_string(nproc.rlim_cur);
+
+        std::stringstream lines;
+        lines << ctx.username << " hard nofile " << nofile_limit << "\n"
+              << ctx.username << " soft nofile " << nofile_limit << "\n"
+              << ctx.username << " hard nproc " << nproc_limit << "\n";
+
+        std::scoped_lock lock(limits_mutex);
+        return write_file(LIMITS_CONF, lines.str(), O_WRONLY | O_CREAT | O_APPEND, FILE_PERMS);
+    }
+
+    /**
+     * Removes the limits of the user. The file is replaced atomically.
+     * @param username Username of the user.
+     */
+    void remove_limits(std::string_view username)
+    {
+        std::scoped_lock lock(limits_mutex);
+        const int fd = open(LIMITS_CONF, O_RDONLY | O_CLOEXEC);
+        std::string content;
+        if (fd == -1 || util::read_from_fd(fd, content) == -1)
+        {
+            if (fd != -1)
+                close(fd);
+            return;
+        }
+        close(fd);
+
+        std::string filtered;
+        std::istringstream stream(content);
+        std::string line;
+        const std::string prefix = std::string(username) + " ";
+        while (std::getline(stream, line))
+        {
+            if (line.rfind(prefix, 0) != 0)
+                filtered.append(line).append("\n");
+        }
+
+        const std::string temp_path = std::string(LIMITS_CONF) + ".sashi";
+        if (write_file(temp_path, filtered, O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == -1 || rename(temp_path.data(), LIMITS_CONF) == -1)
+        {
+            LOG_ERROR << errno << ": Error removing the limits of " << username;
+            unlink(temp_path.data());
+        }
+    }
+
+    /**
+     * Creates the instance user with a locked password and enables lingering so its systemd user manager runs
+     * without a login session.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int create_user(provision_ctx &ctx)
+    {
+        // useradd locks the password of the new user by default.
+        if (run_command({"useradd", "--shell", NOLOGIN_SHELL, "-m", "-G", SASHIMONO_USER_GROUP, ctx.username}) != 0)
+            return -1;
+
+        util::user_info user;
+        if (util::get_system_user_info(ctx.username, user) == -1)
+            return -1;
+
+        ctx.user_id = user.user_id;
+        ctx.group_id = user.group_id;
+        ctx.home_dir = user.home_dir;
+
+        struct stat st;
+        if (stat(ctx.home_dir.data(), &st) == -1 || chmod(ctx.home_dir.data(), st.st_mode & ~S_IRWXO) == -1)
+        {
+            LOG_ERROR << errno << ": Error setting permissions of " << ctx.home_dir;
+            return -1;
+        }
+
+        sd_bus *bus = NULL;
+        if (sd_bus_open_system(&bus) < 0)
+        {
+            LOG_ERROR << "Error connecting to the system bus.";
+            return -1;
+        }
+
+        sd_bus_message *msg = NULL;
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        int ret = sd_bus_message_new_method_call(bus, &msg, LOGIN_SERVICE, LOGIN_PATH, LOGIN_MANAGER_INTERFACE, "SetUserLinger");
+        if (ret >= 0)
+            ret = sd_bus_message_append(msg, "ubb", (uint32_t)ctx.user_id, 1, 0);
+        if (ret >= 0)
+            ret = sd_bus_call(bus, msg, SYSTEM_CALL_TIMEOUT_US, &error, NULL);
+        if (ret < 0)
+            LOG_ERROR << -ret << ": Error enabling lingering of " << ctx.username << ". " << (error.message != NULL ? error.message : "");
+
+        sd_bus_error_free(&error);
+        sd_bus_message_unref(msg);
+        sd_bus_flush_close_unref(bus);
+        return ret < 0 ? -1 : 0;
+    }
+
+    /**
+     * Creates the host user which the contract user inside the container maps to. The uid is taken from the
+     * subordinate uid range of the instance user, which useradd has allocated along with the user.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int create_contract_user(provision_ctx &ctx)
+    {
+        int uid_offset;
+        if (get_subid_offset(SUBUID_FILE, ctx.username, uid_offset) == -1)
+            return -1;
+
+        const std::string host_uid = std::to_string(uid_offset + ctx.params.contract_ugid.uid - 1);
+
+        // Contract gid is always 0 since the hp config of the instances sets it so. The contract user is then
+        // in the group of the instance user. Otherwise it gets its own group from the subordinate gid range.
+        if (ctx.params.contract_ugid.gid == 0)
+            return run_command({"useradd", "--shell", NOLOGIN_SHELL, "-M", "-g", std::to_string(ctx.group_id), "-u", host_uid, ctx.contract_username}) == 0 ? 0 : -1;
+
+        int gid_offset;
+        if (get_subid_offset(SUBGID_FILE, ctx.username, gid_offset) == -1)
+            return -1;
+
+        const std::string host_gid = std::to_string(gid_offset + ctx.params.contract_ugid.gid - 1);
+        if (run_command({"groupadd", "-g", host_gid, ctx.contract_username}) != 0 ||
+            run_command({"useradd", "--shell", NOLOGIN_SHELL, "-M", "-g", host_gid, "-G", ctx.username, "-u", host_uid, ctx.contract_username}) != 0)
+            return -1;
+
+        return 0;
+    }
+
+    /**
+     * Sets the disk quota of the user on the root filesystem. Fails if user quotas are not enabled, in which case
+     * user-install.sh takes over since it enables them.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int set_quota(provision_ctx &ctx)
+    {
+        std::string device;
+        if (get_root_device(device) == -1)
+            return -1;
+
+        struct if_dqinfo info;
+        if (quotactl(QCMD(Q_GETINFO, USRQUOTA), device.data(), 0, reinterpret_cast<caddr_t>(&info)) == -1)
+        {
+            LOG_ERROR << errno << ": User quotas are not enabled on " << device;
+            return -1;
+        }
+
+        // Block limits are in 1KB units.
+        struct dqblk quota = {};
+        quota.dqb_bsoftlimit = ctx.params.storage_kbytes;
+        quota.dqb_bhardlimit = ctx.params.storage_kbytes;
+        quota.dqb_valid = QIF_BLIMITS | QIF_ILIMITS;
+        if (quotactl(QCMD(Q_SETQUOTA, USRQUOTA), device.data(), ctx.user_id, reinterpret_cast<caddr_t>(&quota)) == -1)
+        {
+            LOG_ERROR << errno << ": Error setting the disk quota of " << ctx.username;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Get the disk space used by a user on the root filesystem as accounted by the user quota.
+     * @param user_id Uid of the user.
+     * @param used_kbytes Used disk space in KB.
+     * @return 0 on success and -1 on error.
+     */
+    int get_disk_usage(const int user_id, size_t &used_kbytes)
+    {
+        std::string device;
+        if (get_root_device(device) == -1)
+            return -1;
+
+        struct dqblk quota = {};
+        if (quotactl(QCMD(Q_GETQUOTA, USRQUOTA), device.data(), user_id, reinterpret_cast<caddr_t>(&quota)) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading the disk quota of uid " << user_id;
+            return -1;
+        }
+
+        // Used space is in bytes unlike the block limits.
+        used_kbytes = quota.dqb_curspace / 1024;
+        return 0;
+    }
+
+    /**
+     * Waits until the systemd user manager started by lingering is running.
+     * @param ctx Provisioning state.
+     * @return 0 once running and -1 on timeout.
+     */
+    int wait_user_systemd(provision_ctx &ctx)
+    {
+        const std::string socket_path = "/run/user/" + std::to_string(ctx.user_id) + "/systemd/private";
+        std::string state;
+        for (int waited = 0; waited < USER_SYSTEMD_WAIT_MS; waited += USER_SYSTEMD_POLL_MS)
+        {
+            util::sleep(USER_SYSTEMD_POLL_MS);
+
+            // The socket appears once the user manager has started.
+            sd_bus *bus = NULL;
+            if (!util::is_file_exists(socket_path) || hpfs::connect_user_manager(ctx.user_id, &bus) == -1)
+                continue;
+
+            char *value = NULL;
+            sd_bus_error error = SD_BUS_ERROR_NULL;
+            if (sd_bus_get_property_string(bus, hpfs::SYSTEMD_SERVICE, hpfs::SYSTEMD_PATH, hpfs::SYSTEMD_MANAGER_INTERFACE, "SystemState", &error, &value) >= 0)
+            {
+                state = value;
+                free(value);
+            }
+            sd_bus_error_free(&error);
+            sd_bus_flush_close_unref(bus);
+
+            if (state == SYSTEM_STATE_RUNNING)
+                return 0;
+        }
+
+        LOG_ERROR << "Systemd user manager of " << ctx.username << " is not running. State: " << (state.empty() ? "unknown" : state);
+        return -1;
+    }
+
+    /**
+     * Installs rootless dockerd for the user and applies the sashimono specific settings to its service files.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int install_dockerd(provision_ctx &ctx)
+    {
+        const std::string docker_bin = conf::ctx.exe_dir + "/dockerbin";
+        const std::string runtime_dir = "/run/user/" + std::to_string(ctx.user_id);
+        const char *path = getenv("PATH");
+        if (run_command({"sudo", "-H", "-u", ctx.username, "PATH=" + docker_bin + ":" + (path == NULL ? "" : path), "XDG_RUNTIME_DIR=" + runtime_dir,
+                         docker_bin + "/dockerd-rootless-setuptool.sh", "install"}) != 0)
+            return -1;
+
+        const std::string units_dir = ctx.home_dir + "/.config/systemd/user";
+        const std::string override_dir = units_dir + "/" + DOCKER_UNIT + ".d";
+        std::string override_conf = "[Service]\nEnvironment=DOCKERD_ROOTLESS_ROOTLESSKIT_PORT_DRIVER=slirp4netns\n";
+
+        // Outbound ipv6 address is passed to slirp4netns through rootlesskit and the route is set up in the dockerd namespace.
+        const bool has_ipv6 = !ctx.params.outbound_ipv6.empty() && !ctx.params.outbound_net_interface.empty();
+        if (has_ipv6)
+        {
+            override_conf.append("Environment=\"DOCKERD_ROOTLESS_ROOTLESSKIT_FLAGS=--ipv6 --outbound-addr6=" + ctx.params.outbound_ipv6 + "\"\n")
+                .append("ExecStartPost=/bin/bash -c 'nsenter -U --preserve-credentials -n -t $(pgrep -u " + ctx.username +
+                        " dockerd) /bin/bash -c \"ip addr add fd00::100/64 dev tap0 && ip route add default via fd00::2 dev tap0\"'\n");
+
+            const std::string docker_config_dir = ctx.home_dir + "/.config/docker";
+            const std::string daemon_json = "{\n    \"experimental\": true,\n    \"ipv6\": true,\n    \"fixed-cidr-v6\": \"2001:db8:1::/64\",\n"
+                                            "    \"ip6tables\": true,\n    \"mtu\": 65520\n}\n";
+            if (util::create_dir_tree_recursive(docker_config_dir) == -1 ||
+                write_file(docker_config_dir + "/daemon.json", daemon_json, O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == -1 ||
+                run_command({"ip", "addr", "add", ctx.params.outbound_ipv6, "dev", ctx.params.outbound_net_interface}) != 0)
+                return -1;
+
+            // The address is removed by user-uninstall.sh through the cleanup script.
+            if (write_file(ctx.home_dir + "/uninstall_cleanup.sh", "ip addr del " + ctx.params.outbound_ipv6 + " dev " + ctx.params.outbound_net_interface + "\n",
+                           O_WRONLY | O_CREAT | O_APPEND, FILE_PERMS) == -1)
+                return -1;
+        }
+
+        if ((mkdir(override_dir.data(), util::DIR_PERMS) == -1 && errno != EEXIST) || chown(override_dir.data(), ctx.user_id, ctx.group_id) == -1 ||
+            write_file(override_dir + "/override.conf", override_conf, O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == -1 ||
+            chown((override_dir + "/override.conf").data(), ctx.user_id, ctx.group_id) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing the dockerd service overrides of " << ctx.username;
+            return -1;
+        }
+
+        // Command line args of dockerd can only be changed in the unit file itself since ExecStart cannot be overridden.
+        const std::string unit_path = units_dir + "/" + DOCKER_UNIT;
+        const int fd = open(unit_path.data(), O_RDONLY | O_CLOEXEC);
+        std::string unit;
+        if (fd == -1 || util::read_from_fd(fd, unit) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading " << unit_path;
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+
+        const std::string exec_original = "ExecStart=" + docker_bin + "/dockerd-rootless.sh";
+        std::string exec_replace = exec_original + " --max-concurrent-downloads 1";
+        if (!conf::cfg.docker.registry_address.empty())
+            exec_replace.append(" --registry-mirror http://" + conf::cfg.docker.registry_address + " --insecure-registry " + conf::cfg.docker.registry_address);
+        util::find_and_replace(unit, exec_original, exec_replace);
+        if (write_file(unit_path, unit, O_WRONLY | O_TRUNC, FILE_PERMS) == -1)
+            return -1;
+
+        return restart_dockerd(ctx);
+    }
+
+    /**
+     * Reloads the systemd user manager and restarts dockerd with the updated service files, then waits for the
+     * daemon to answer.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int restart_dockerd(provision_ctx &ctx)
+    {
+        sd_bus *bus = NULL;
+        if (hpfs::connect_user_manager(ctx.user_id, &bus) == -1)
+            return -1;
+
+        std::unordered_map<std::string, std::string> finished_jobs;
+        std::vector<hpfs::unit_call> calls(3);
+        calls[0] = {"", "Subscribe", false};
+        calls[1] = {"manager", "Reload", false};
+        calls[2] = {DOCKER_UNIT, "RestartUnit", true};
+
+        // The manager handles the calls in order, so the restart sees the reloaded unit files.
+        const uint64_t timeout_us = UNIT_JOB_TIMEOUT_MS * 1000;
+        int ret = sd_bus_add_match(bus, NULL, hpfs::JOB_REMOVED_MATCH, hpfs::on_job_removed, &finished_jobs);
+        if (ret >= 0)
+            ret = hpfs::call_method(bus, calls[0], timeout_us, "");
+        if (ret >= 0)
+            ret = hpfs::call_method(bus, calls[1], timeout_us, "");
+        if (ret >= 0)
+            ret = hpfs::call_method(bus, calls[2], timeout_us, "ss", DOCKER_UNIT, "replace");
+        if (ret < 0)
+        {
+            LOG_ERROR << -ret << ": Error sending requests to the systemd user manager of " << ctx.username;
+            sd_bus_flush_close_unref(bus);
+            return -1;
+        }
+
+        if (hpfs::wait_unit_calls(bus, calls, finished_jobs, UNIT_JOB_TIMEOUT_MS) == -1)
+            return -1;
+
+        const std::string socket_path = "/run/user/" + std::to_string(ctx.user_id) + "/docker.sock";
+        for (int i = 0; i < DOCKERD_READY_ATTEMPTS; i++)
+        {
+            docker::api_error error;
+            std::string response;
+            if (docker::send_request(error, socket_path, "GET", "/_ping", "", 5, response) == 0)
+                return 0;
+
+            LOG_INFO << "Docker daemon of " << ctx.username << " isn't available. Retrying " << (i + 1) << "...";
+            util::sleep(1000);
+        }
+
+        LOG_ERROR << "Docker daemon of " << ctx.username << " did not become available.";
+        return -1;
+    }
+
+    /**
+     * Blocks the outbound traffic of the user to the local network, except to the host itself, the gateway, the
+     * proxy and a local DNS server. Not needed on hosts which are directly reachable on their public address.
+     * The ruleset is applied in one transaction and persisted so it survives reboots.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int setup_firewall(provision_ctx &ctx)
+    {
+        // Local ipv4 address of the host.
+        std::string local_ip;
+        struct ifaddrs *ifaddr;
+        if (getifaddrs(&ifaddr) == 0)
+        {
+            for (struct ifaddrs *ifa = ifaddr; ifa != NULL && local_ip.empty(); ifa = ifa->ifa_next)
+            {
+                char addr[INET_ADDRSTRLEN];
+                if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET && !(ifa->ifa_flags & IFF_LOOPBACK) &&
+                    inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in *>(ifa->ifa_addr)->sin_addr, addr, sizeof(addr)) != NULL)
+                    local_ip = addr;
+            }
+            freeifaddrs(ifaddr);
+        }
+
+        // Address the public host name resolves to.
+        std::string public_ip;
+        struct addrinfo hints = {}, *res;
+        hints.ai_family = AF_INET;
+        if (getaddrinfo(conf::cfg.hp.host_address.data(), NULL, &hints, &res) == 0)
+        {
+            char addr[INET_ADDRSTRLEN];
+            if (inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in *>(res->ai_addr)->sin_addr, addr, sizeof(addr)) != NULL)
+                public_ip = addr;
+            freeaddrinfo(res);
+        }
+
+        if (local_ip == public_ip)
+        {
+            LOG_INFO << "Stand alone host with no local subnet. No firewall rules needed for " << ctx.username;
+            return 0;
+        }
+
+        // Default gateway and the first local subnet from the main routing table.
+        std::string gateway, lan_subnet;
+        std::ifstream routes(ROUTE_TABLE);
+        std::string line;
+        std::getline(routes, line); // Header line.
+        while (std::getline(routes, line) && (gateway.empty() || lan_subnet.empty()))
+        {
+            char iface[IF_NAMESIZE + 1];
+            unsigned int dest, gw, flags, refcnt, use, metric, mask;
+            if (sscanf(line.data(), "%16s %x %x %x %u %u %u %x", iface, &dest, &gw, &flags, &refcnt, &use, &metric, &mask) != 8)
+                continue;
+
+            char addr[INET_ADDRSTRLEN];
+            struct in_addr in;
+            in.s_addr = dest == 0 ? gw : dest;
+            if (inet_ntop(AF_INET, &in, addr, sizeof(addr)) == NULL)
+                continue;
+
+            if (dest == 0 && gateway.empty())
+                gateway = addr;
+            else if (dest != 0 && lan_subnet.empty())
+                lan_subnet = std::string(addr) + "/" + std::to_string(__builtin_popcount(mask));
+        }
+
+        // Proxy which forwards the public traffic to the instances.
+        std::string proxy_ip;
+        const int fd = open(MBXRPL_CONFIG, O_RDONLY | O_CLOEXEC);
+        jsoncons::ojson mb_config;
+        if (fd != -1 && util::read_json_file(fd, mb_config) == 0 && mb_config.contains("proxy"))
+        {
+            const jsoncons::ojson &proxy = mb_config["proxy"];
+            if (proxy.contains("ip") && proxy["ip"].is_string())
+                proxy_ip = proxy["ip"].as<std::string>();
+            else if (proxy.contains("npm_url") && proxy["npm_url"].is_string())
+            {
+                // Host of a url like http://<host>:<port>/
+                const std::string url = proxy["npm_url"].as<std::string>();
+                const size_t start = url.find("://");
+                if (start != std::string::npos)
+                    proxy_ip = url.substr(start + 3, url.find_first_of(":/", start + 3) - (start + 3));
+            }
+        }
+        if (fd != -1)
+            close(fd);
+
+        const std::string uid = std::to_string(ctx.user_id);
+        const std::string table = "docker_filter_" + uid;
+        const std::string rule = "        meta skuid " + uid + " ip daddr ";
+
+        // Declaring and deleting the table first makes the ruleset replace any leftover table of the same uid.
+        std::stringstream ruleset;
+        ruleset << "table ip " << table << "\n"
+                << "delete table ip " << table << "\n"
+                << "table ip " << table << " {\n"
+                << "    chain OUTPUT {\n"
+                << "        type filter hook output priority 0; policy accept;\n"
+                << rule << local_ip << " accept\n";
+        if (!gateway.empty())
+            ruleset << rule << gateway << " accept\n";
+        if (!proxy_ip.empty())
+            ruleset << rule << proxy_ip << " accept\n";
+        if (!lan_subnet.empty())
+        {
+            // A DNS server within the local subnet is allowed.
+            std::ifstream resolv_conf(RESOLV_CONF);
+            std::string local_dns;
+            while (std::getline(resolv_conf, line) && local_dns.empty())
+            {
+                if (line.rfind("nameserver", 0) == 0)
+                    local_dns = line.substr(line.find_first_not_of(" \t", 10));
+            }
+
+            const auto get_prefix = [](std::string_view ip)
+            { return ip.substr(0, ip.find('.', ip.find('.') + 1)); };
+            if (!local_dns.empty() && get_prefix(local_dns) == get_prefix(lan_subnet))
+                ruleset << rule << local_dns << " accept\n";
+
+            ruleset << rule << lan_subnet << " drop\n";
+        }
+        else
+        {
+            LOG_WARNING << "Could not detect the local subnet. Only the allowed addresses are set up for " << ctx.username;
+        }
+        ruleset << "    }\n}\n";
+
+        const std::string ruleset_path = ctx.home_dir + "/.nftables.sashi";
+        std::scoped_lock lock(firewall_mutex);
+        const int ret = write_file(ruleset_path, ruleset.str(), O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == 0 && run_command({"nft", "-f", ruleset_path}) == 0 ? 0 : -1;
+        unlink(ruleset_path.data());
+        if (ret == -1)
+            return -1;
+
+        std::string saved;
+        if (util::execute_command({"nft", "list", "ruleset"}, saved) != 0 ||
+            write_file(NFTABLES_CONF, saved, O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == -1)
+        {
+            LOG_ERROR << "Error persisting the nftables ruleset.";
+            return -1;
+        }
+
+        if (!is_nftables_enabled && system_manager_call("EnableUnitFiles", "asbb", 1, NFTABLES_UNIT, 0, 1) == 0)
+            is_nftables_enabled = true;
+
+        return 0;
+    }
+
+    /**
+     * Removes the firewall table of the user and persists the ruleset.
+     * @param ctx Provisioning state.
+     */
+    void remove_firewall(provision_ctx &ctx)
+    {
+        if (ctx.user_id == -1)
+            return;
+
+        std::scoped_lock lock(firewall_mutex);
+        std::string saved;
+        if (run_command({"nft", "delete", "table", "ip", "docker_filter_" + std::to_string(ctx.user_id)}) == 0 &&
+            util::execute_command({"nft", "list", "ruleset"}, saved) == 0)
+            write_file(NFTABLES_CONF, saved, O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS);
+    }
+
+    /**
+     * Limits the cpu, memory, swap and io of the user slice. The sashimono cpu share out of 1000000us is spread across
+     * all the cores, so the quota is given as a percentage of a single core. The swap param includes the memory while
+     * the slice swap limit does not.
+     * @param ctx Provisioning state.
+     * @return 0 on success and -1 on error.
+     */
+    int setup_slice(provision_ctx &ctx)
+    {
+        const long cores = sysconf(_SC_NPROCESSORS_CONF);
+        const size_t cpu_quota = (cores * ctx.params.cpu_us * 100) / CPU_PERIOD_US;
+        const std::string slice_dir = "/etc/systemd/system/user-" + std::to_string(ctx.user_id) + ".slice.d";
+
+        // Systemd maps MemorySwapMax to memory.swap.max of v2, which is the swap only limit. On v1 the memory + swap
+        // limit is set by user-cgcreate.sh through memory.memsw, so the override keeps the same value it always had.
+        const size_t swap_max = cgroup::is_v2() ? (ctx.params.swap_kbytes > ctx.params.mem_kbytes ? ctx.params.swap_kbytes - ctx.params.mem_kbytes : 0)
+                                                : ctx.params.swap_kbytes;
+
+        std::stringstream conf;
+        conf << "[Slice]\n"
+             << "MemoryAccounting=true\n"
+             << "CPUAccounting=true\n"
+             << "MemoryMax=" << ctx.params.mem_kbytes << "K\n"
+             << "CPUQuota=" << cpu_quota << "%\n"
+             << "MemorySwapMax=" << swap_max << "K\n";
+
+        // Io limits are only supported on cgroup v2.
+        std::string io_device;
+        if (cgroup::is_v2() && (ctx.params.io_read_bps > 0 || ctx.params.io_write_bps > 0) && cgroup::get_io_device(io_device) == 0)
+        {
+            if (ctx.params.io_read_bps > 0)
+                conf << "IOReadBandwidthMax=/dev/block/" << io_device << " " << ctx.params.io_read_bps << "\n";
+            if (ctx.params.io_write_bps > 0)
+                conf << "IOWriteBandwidthMax=/dev/block/" << io_device << " " << ctx.params.io_write_bps << "\n";
+        }
+
+        if ((mkdir(slice_dir.data(), util::DIR_PERMS) == -1 && errno != EEXIST) ||
+            write_file(slice_dir + "/override.conf", conf.str(), O_WRONLY | O_CREAT | O_TRUNC, FILE_PERMS) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing the slice limits of " << ctx.username;
+            return -1;
+        }
+
+        // The override keeps the limits across reboots. The slice already exists since the user manager is running,
+        // so on cgroup v2 the limits are written to it directly instead of waiting on systemd to pick up the override.
+        if (system_manager_call("Reload", "") == -1)
+            return -1;
+
+        if (!cgroup::is_v2())
+            return 0;
+
+        cgroup::limits lim;
+        lim.cpu_us = ctx.params.cpu_us;
+        lim.mem_kbytes = ctx.params.mem_kbytes;
+        lim.swap_kbytes = ctx.params.swap_kbytes;
+        lim.io_read_bps = ctx.params.io_read_bps;
+        lim.io_write_bps = ctx.params.io_write_bps;
+        return cgroup::apply_limits(ctx.user_id, lim);
+    }
+
+    /**
+     * Removes the slice limits of the user.
+     * @param ctx Provisioning state.
+     */
+    void remove_slice(provision_ctx &ctx)
+    {
+        if (ctx.user_id == -1)
+            return;
+
+        const std::string slice_dir = "/etc/systemd/system/user-" + std::to_string(ctx.user_id) + ".slice.d";
+        unlink((slice_dir + "/override.conf").data());
+        rmdir(slice_dir.data());
+        system_manager_call("Reload", "");
+    }
+
+    /**
+     * Runs a program and logs its output if it fails.
+     * @param args Program followed by its arguments.
+     * @return Exit code of the program. -1 if it could not be run.
+     */
+    int run_command(const std::vector<std::string> &args)
+    {
+        std::string output;
+        const int ret = util::execute_command(args, output);
+        if (ret != 0)
+            LOG_ERROR << args[0] << " exited with " << ret << ". " << output;
+        return ret;
+    }
+
+    /**
+     * Get the start of the subordinate id range of a user.
+     * @param file Subordinate id file (/etc/subuid or /etc/subgid).
+     * @param username Username of the user.
+     * @param offset First id of the range.
+     * @return 0 on success and -1 if the user has no range.
+     */
+    int get_subid_offset(std::string_view file, std::string_view username, int &offset)
+    {
+        std::ifstream stream(file.data());
+        std::string line;
+        const std::string prefix = std::string(username) + ":";
+        while (std::getline(stream, line))
+        {
+            if (line.rfind(prefix, 0) != 0)
+                continue;
+
+            const size_t end = line.find(':', prefix.length());
+            if (end != std::string::npos && util::stoi(line.substr(prefix.length(), end - prefix.length()), offset) == 0)
+                return 0;
+        }
+
+        LOG_ERROR << "No subordinate id range for " << username << " in " << file;
+        return -1;
+    }
+
+    /**
+     * Get the device of the root filesystem.
+     * @param device Device path.
+     * @return 0 on success and -1 on error.
+     */
+    int get_root_device(std::string &device)
+    {
+        FILE *mounts = setmntent("/proc/self/mounts", "r");
+        if (mounts == NULL)
+            return -1;
+
+        struct mntent *entry;
+        while ((entry = getmntent(mounts)) != NULL)
+        {
+            // The last mount on / is the visible one.
+            if (strcmp(entry->mnt_dir, "/") == 0)
+                device = entry->mnt_fsname;
+        }
+        endmntent(mounts);
+
+        if (device.empty())
+        {
+            LOG_ERROR << "Root filesystem not found in the mount table.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Calls a method of the systemd system manager and waits for the reply.
+     * @param member Manager method.
+     * @param types Signature of the arguments.
+     * @return 0 on success and -1 on error.
+     */
+    int system_manager_call(const char *member, const char *types, ...)
+    {
+        sd_bus *bus = NULL;
+        if (sd_bus_open_system(&bus) < 0)
+        {
+            LOG_ERROR << "Error connecting to the system bus.";
+            return -1;
+        }
+
+        sd_bus_message *msg = NULL;
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        int ret = sd_bus_message_new_method_call(bus, &msg, hpfs::SYSTEMD_SERVICE, hpfs::SYSTEMD_PATH, hpfs::SYSTEMD_MANAGER_INTERFACE, member);
+        if (ret >= 0)
+        {
+            va_list args;
+            va_start(args, types);
+            ret = sd_bus_message_appendv(msg, types, args);
+            va_end(args);
+        }
+        if (ret >= 0)
+            ret = sd_bus_call(bus, msg, SYSTEM_CALL_TIMEOUT_US, &error, NULL);
+        if (ret < 0)
+            LOG_ERROR << -ret << ": System manager " << member << " failed. " << (error.message != NULL ? error.message : "");
+
+        sd_bus_error_free(&error);
+        sd_bus_message_unref(msg);
+        sd_bus_flush_close_unref(bus);
+        return ret < 0 ? -1 : 0;
+    }
+
+    /**
+     * Writes the given content to a file.
+     * @param path File path.
+     * @param content Content to be written.
+     * @param flags Open flags.
+     * @param mode Permissions of a created file.
+     * @return 0 on success and -1 on error.
+     */
+    int write_file(std::string_view path, std::string_view content, const int flags, const mode_t mode)
+    {
+        const int fd = open(path.data(), flags | O_CLOEXEC, mode);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening " << path;
+            return -1;
+        }
+
+        const int ret = docker::write_all(fd, content);
+        close(fd);
+        if (ret == -1)
+            LOG_ERROR << errno << ": Error writing " << path;
+        return ret;
+    }
+
+} // namespace provisioner
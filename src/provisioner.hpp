@@ -0,0 +1,101 @@
+#ifndef _SA_PROVISIONER_
+#define _SA_PROVISIONER_
+
+#include "pchheader.hpp"
+#include "conf.hpp"
+
+namespace provisioner
+{
+    constexpr const char *MODE_NATIVE = "native"; // Users are provisioned in-process and user-install.sh is only a fallback.
+    constexpr const char *MODE_SCRIPT = "script"; // Users are always provisioned by user-install.sh.
+
+    // Stages of a user provisioning in the order they are run. Failed provisionings are rolled back in the reverse order.
+    enum STAGE
+    {
+        LIMITS,        // Process and file descriptor limits of the user.
+        USER,          // Instance user with its home directory and lingering systemd user manager.
+        CONTRACT_USER, // Host user of the contract user inside the container, taken from the subordinate id range.
+        QUOTA,         // Disk quota of the user.
+        USER_SYSTEMD,  // Wait for the systemd user manager.
+        SLICE,         // cgroup limits of the user slice. Applied before dockerd so no service of the user runs unlimited.
+        DOCKERD,       // Rootless dockerd and its service files.
+        FIREWALL,      // nftables filter which keeps the user off the local network.
+        STAGE_COUNT
+    };
+
+    constexpr const char *STAGE_NAMES[STAGE_COUNT] = {"limits", "user", "contract_user", "quota", "user_systemd", "slice", "dockerd", "firewall"};
+
+    // Resources and settings of the user to be provisioned.
+    struct provision_params
+    {
+        size_t cpu_us = 0;
+        size_t mem_kbytes = 0;
+        size_t swap_kbytes = 0;
+        size_t storage_kbytes = 0;
+        size_t io_read_bps = 0;
+        size_t io_write_bps = 0;
+        conf::ugid contract_ugid;
+        std::string outbound_ipv6;
+        std::string outbound_net_interface;
+    };
+
+    // State of a provisioning shared by the stages.
+    struct provision_ctx
+    {
+        provision_params params;
+        std::string username;
+        std::string contract_username;
+        std::string home_dir;
+        int user_id = -1;
+        int group_id = -1;
+        int completed_stages = 0;                     // No. of stages completed so far.
+        uint64_t stage_durations[STAGE_COUNT] = {}; // Time taken by each stage in milliseconds.
+    };
+
+    int provision_user(int &user_id, std::string &username, const provision_params &params);
+
+    int update_resources(const int user_id, std::string_view username, const provision_params &params);
+
+    int run_stage(provision_ctx &ctx, const STAGE stage);
+
+    void rollback(provision_ctx &ctx);
+
+    int setup_limits(provision_ctx &ctx);
+
+    void remove_limits(std::string_view username);
+
+    int create_user(provision_ctx &ctx);
+
+    int create_contract_user(provision_ctx &ctx);
+
+    int set_quota(provision_ctx &ctx);
+
+    int get_disk_usage(const int user_id, size_t &used_kbytes);
+
+    int wait_user_systemd(provision_ctx &ctx);
+
+    int install_dockerd(provision_ctx &ctx);
+
+    int restart_dockerd(provision_ctx &ctx);
+
+    int setup_firewall(provision_ctx &ctx);
+
+    void remove_firewall(provision_ctx &ctx);
+
+    int setup_slice(provision_ctx &ctx);
+
+    void remove_slice(provision_ctx &ctx);
+
+    int run_command(const std::vector<std::string> &args);
+
+    int get_subid_offset(std::string_view file, std::string_view username, int &offset);
+
+    int get_root_device(std::string &device);
+
+    int system_manager_call(const char *member, const char *types, ...);
+
+    int write_file(std::string_view path, std::string_view content, const int flags, const mode_t mode);
+
+} // namespace provisioner
+
+#endif
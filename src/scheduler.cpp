@@ -0,0 +1,258 @@
+#include "scheduler.hpp"
+#include "cgroup_manager.hpp"
+
+namespace scheduler
+{
+    constexpr const char *MAX_ALLOCATION_REACHED = "max_alloc_reached";
+    constexpr const char *TIER_INVALID = "tier_invalid";
+    constexpr const char *RESOURCES_INVALID = "resources_invalid";
+    constexpr const char *RESOURCES_UNSUPPORTED = "resources_unsupported";
+
+    scheduler_ctx ctx;
+
+    /**
+     * Sets up the budget and accounts the allocations of the existing instances.
+     * @param standard Size of the standard slot.
+     * @param instances Existing instances.
+     * @return 0 on success and -1 on error.
+     */
+    int init(const hp::resources &standard, const std::vector<hp::instance_info> &instances)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        ctx.standard = standard;
+        ctx.capacity.cpu_us = conf::cfg.system.max_cpu_us;
+        ctx.capacity.mem_kbytes = conf::cfg.system.max_mem_kbytes;
+        ctx.capacity.swap_kbytes = conf::cfg.system.max_swap_kbytes;
+        ctx.capacity.storage_kbytes = conf::cfg.system.max_storage_kbytes;
+        ctx.used = {};
+
+        for (const hp::instance_info &info : instances)
+            add(ctx.used, get_allocation(info));
+
+        // The budget may have been reduced by a reconfig. Existing instances keep their allocations but no new
+        // instance is admitted until enough of them are destroyed.
+        if (ctx.used.cpu_us > ctx.capacity.cpu_us || ctx.used.mem_kbytes > ctx.capacity.mem_kbytes ||
+            ctx.used.swap_kbytes > ctx.capacity.swap_kbytes || ctx.used.storage_kbytes > ctx.capacity.storage_kbytes)
+            LOG_WARNING << "Existing instances exceed the configured resource budget.";
+
+        LOG_INFO << "Scheduler budget - CPU: " << ctx.used.cpu_us << "/" << ctx.capacity.cpu_us << " MicroS, RAM: " << ctx.used.mem_kbytes << "/"
+                 << ctx.capacity.mem_kbytes << " KB, Swap: " << ctx.used.swap_kbytes << "/" << ctx.capacity.swap_kbytes << " KB, Storage: "
+                 << ctx.used.storage_kbytes << "/" << ctx.capacity.storage_kbytes << " KB.";
+        return 0;
+    }
+
+    /**
+     * Resolves the size of a new instance. Sizes which are not given explicitly are taken from the tier, which is
+     * the standard slot if not given. Io limits are always scaled from the tier since they cap the instance rather
+     * than reserve bandwidth for it.
+     * @param error_msg Error message if any.
+     * @param res Resolved size. Swap includes the memory as the limits expect.
+     * @param request Requested tier and sizes.
+     * @return 0 on success and -1 on error.
+     */
+    int resolve(std::string &error_msg, hp::resources &res, const msg::resource_request &request)
+    {
+        const std::string_view tier_name = request.tier.empty() ? DEFAULT_TIER : request.tier;
+        const tier *selected = NULL;
+        for (const tier &t : TIERS)
+        {
+            if (tier_name == t.name)
+                selected = &t;
+        }
+
+        if (selected == NULL)
+        {
+            error_msg = TIER_INVALID;
+            LOG_ERROR << "Invalid resource tier: " << tier_name;
+            return -1;
+        }
+
+        const auto scale = [selected](const size_t value) { return value * selected->numerator / selected->denominator; };
+        const size_t standard_swap = ctx.standard.swap_kbytes - ctx.standard.mem_kbytes;
+
+        res.cpu_us = request.cpu_us != 0 ? request.cpu_us : scale(ctx.standard.cpu_us);
+        res.mem_kbytes = request.mem_kbytes != 0 ? request.mem_kbytes : scale(ctx.standard.mem_kbytes);
+        res.swap_kbytes = res.mem_kbytes + (request.swap_kbytes != 0 ? request.swap_kbytes : scale(standard_swap));
+        res.storage_kbytes = request.storage_kbytes != 0 ? request.storage_kbytes : scale(ctx.standard.storage_kbytes);
+        res.io_read_bps = scale(ctx.standard.io_read_bps);
+        res.io_write_bps = scale(ctx.standard.io_write_bps);
+
+        if (res.cpu_us == 0 || res.mem_kbytes == 0 || res.storage_kbytes == 0)
+        {
+            error_msg = RESOURCES_INVALID;
+            LOG_ERROR << "Instance cpu, memory and storage cannot be zero.";
+            return -1;
+        }
+
+        // Cgroup v1 limits are applied per user at boot with the standard size, so other sizes cannot be enforced.
+        if (!cgroup::is_v2() && !is_standard(res))
+        {
+            error_msg = RESOURCES_UNSUPPORTED;
+            LOG_ERROR << "Instance sizes other than the standard slot need cgroup v2.";
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Admits an instance if the remaining budget can hold it in every resource, and holds its allocation.
+     * @param error_msg Error message if any.
+     * @param res Size of the instance.
+     * @return 0 if admitted and -1 if the budget is not enough.
+     */
+    int reserve(std::string &error_msg, const hp::resources &res)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        hp::resources free;
+        get_free(free);
+        if (!fits(res, free))
+        {
+            error_msg = MAX_ALLOCATION_REACHED;
+            LOG_ERROR << "Not enough resources for the instance. Free CPU: " << free.cpu_us << " MicroS, RAM: " << free.mem_kbytes
+                      << " KB, Swap: " << free.swap_kbytes << " KB, Storage: " << free.storage_kbytes << " KB.";
+            return -1;
+        }
+
+        add(ctx.used, res);
+        return 0;
+    }
+
+    /**
+     * Swaps the allocation of an existing instance for a new size. The current allocation counts as free while
+     * checking the new size, and both the check and the swap happen under the lock so concurrent admissions cannot
+     * take the budget in between.
+     * @param error_msg Error message if any.
+     * @param current Current size of the instance.
+     * @param res New size of the instance.
+     * @return 0 if the new size is admitted and -1 if the budget is not enough.
+     */
+    int resize(std::string &error_msg, const hp::resources &current, const hp::resources &res)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        hp::resources free;
+        get_free(free);
+        add(free, current);
+        if (!fits(res, free))
+        {
+            error_msg = MAX_ALLOCATION_REACHED;
+            LOG_ERROR << "Not enough resources to resize the instance. Available CPU: " << free.cpu_us << " MicroS, RAM: " << free.mem_kbytes
+                      << " KB, Swap: " << free.swap_kbytes << " KB, Storage: " << free.storage_kbytes << " KB.";
+            return -1;
+        }
+
+        subtract(ctx.used, current);
+        add(ctx.used, res);
+        return 0;
+    }
+
+    /**
+     * Puts back the previous allocation of an instance whose resize failed after it was admitted. Unlike resize there
+     * is no fit check, since the budget released by the previous size may have been taken in the meantime and the
+     * accounting must follow the size the instance is recorded with.
+     * @param res Size admitted by the failed resize.
+     * @param previous Size the instance had before the resize.
+     */
+    void revert(const hp::resources &res, const hp::resources &previous)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        subtract(ctx.used, res);
+        add(ctx.used, previous);
+    }
+
+    /**
+     * Gives back the allocation of a destroyed or failed instance.
+     * @param res Size of the instance.
+     */
+    void release(const hp::resources &res)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        subtract(ctx.used, res);
+    }
+
+    /**
+     * Checks whether the free budget can hold the given no. of standard slots. Used to keep the warm users, which are
+     * provisioned with the standard size, within the budget.
+     * @param count No. of standard slots.
+     * @return true if the free budget can hold them otherwise false.
+     */
+    bool has_standard_slots(const size_t count)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        hp::resources free, needed;
+        get_free(free);
+        for (size_t i = 0; i < count; i++)
+            add(needed, ctx.standard);
+
+        return needed.cpu_us <= free.cpu_us && needed.mem_kbytes <= free.mem_kbytes &&
+               needed.swap_kbytes <= free.swap_kbytes && needed.storage_kbytes <= free.storage_kbytes;
+    }
+
+    /**
+     * Get the allocation of an instance. Instances created before the sizes were recorded have the standard size.
+     * @param info The instance.
+     * @return Allocation of the instance.
+     */
+    const hp::resources get_allocation(const hp::instance_info &info)
+    {
+        return info.allocation.cpu_us == 0 ? ctx.standard : info.allocation;
+    }
+
+    bool is_standard(const hp::resources &res)
+    {
+        return res.cpu_us == ctx.standard.cpu_us && res.mem_kbytes == ctx.standard.mem_kbytes &&
+               res.swap_kbytes == ctx.standard.swap_kbytes && res.storage_kbytes == ctx.standard.storage_kbytes;
+    }
+
+    /**
+     * Checks whether an instance fits in the free budget.
+     * @param res Size of the instance. Swap includes the memory.
+     * @param free Free budget. Swap is the swap only budget.
+     * @return true if it fits in every resource otherwise false.
+     */
+    bool fits(const hp::resources &res, const hp::resources &free)
+    {
+        return res.cpu_us <= free.cpu_us && res.mem_kbytes <= free.mem_kbytes &&
+               (res.swap_kbytes - std::min(res.swap_kbytes, res.mem_kbytes)) <= free.swap_kbytes &&
+               res.storage_kbytes <= free.storage_kbytes;
+    }
+
+    /**
+     * Get the budget which is not allocated. Must be called with the lock held.
+     * @param free Free budget. Swap is the swap only budget.
+     */
+    void get_free(hp::resources &free)
+    {
+        free.cpu_us = ctx.capacity.cpu_us - std::min(ctx.capacity.cpu_us, ctx.used.cpu_us);
+        free.mem_kbytes = ctx.capacity.mem_kbytes - std::min(ctx.capacity.mem_kbytes, ctx.used.mem_kbytes);
+        free.swap_kbytes = ctx.capacity.swap_kbytes - std::min(ctx.capacity.swap_kbytes, ctx.used.swap_kbytes);
+        free.storage_kbytes = ctx.capacity.storage_kbytes - std::min(ctx.capacity.storage_kbytes, ctx.used.storage_kbytes);
+    }
+
+    /**
+     * Adds an instance size to a budget total.
+     * @param total Budget total. Swap is swap only.
+     * @param res Size of the instance. Swap includes the memory.
+     */
+    void add(hp::resources &total, const hp::resources &res)
+    {
+        total.cpu_us += res.cpu_us;
+        total.mem_kbytes += res.mem_kbytes;
+        total.swap_kbytes += res.swap_kbytes - std::min(res.swap_kbytes, res.mem_kbytes);
+        total.storage_kbytes += res.storage_kbytes;
+    }
+
+    /**
+     * Takes an instance size out of a budget total. Stops at zero.
+     * @param total Budget total. Swap is swap only.
+     * @param res Size to take out.
+     */
+    void subtract(hp::resources &total, const hp::resources &res)
+    {
+        total.cpu_us -= std::min(total.cpu_us, res.cpu_us);
+        total.mem_kbytes -= std::min(total.mem_kbytes, res.mem_kbytes);
+        total.swap_kbytes -= std::min(total.swap_kbytes, res.swap_kbytes - std::min(res.swap_kbytes, res.mem_kbytes));
+        total.storage_kbytes -= std::min(total.storage_kbytes, res.storage_kbytes);
+    }
+
+} // namespace scheduler
@@ -0,0 +1,61 @@
+#ifndef _SA_SCHEDULER_
+#define _SA_SCHEDULER_
+
+#include "pchheader.hpp"
+#include "hp_manager.hpp"
+
+/**
+ * Admission of instances of different sizes against the resource budget of the host. The budget is the configured
+ * cpu, memory, swap and storage totals, and every instance holds its own allocation out of it.
+ */
+namespace scheduler
+{
+    // Named instance sizes given as a fraction of the standard slot, which is the budget split evenly across the
+    // configured instance count.
+    struct tier
+    {
+        const char *name;
+        size_t numerator;
+        size_t denominator;
+    };
+
+    constexpr tier TIERS[] = {{"micro", 1, 4}, {"small", 1, 2}, {"standard", 1, 1}, {"large", 2, 1}, {"xlarge", 4, 1}};
+    constexpr const char *DEFAULT_TIER = "standard";
+
+    struct scheduler_ctx
+    {
+        std::mutex mutex;
+        hp::resources capacity; // Budget of all the instances. Swap is the swap only budget.
+        hp::resources standard; // Size of the standard slot.
+        hp::resources used;     // Allocations of the instances and the instances being created. Swap excludes memory.
+    };
+
+    int init(const hp::resources &standard, const std::vector<hp::instance_info> &instances);
+
+    int resolve(std::string &error_msg, hp::resources &res, const msg::resource_request &request);
+
+    int reserve(std::string &error_msg, const hp::resources &res);
+
+    int resize(std::string &error_msg, const hp::resources &current, const hp::resources &res);
+
+    void revert(const hp::resources &res, const hp::resources &previous);
+
+    void release(const hp::resources &res);
+
+    bool has_standard_slots(const size_t count);
+
+    const hp::resources get_allocation(const hp::instance_info &info);
+
+    bool is_standard(const hp::resources &res);
+
+    bool fits(const hp::resources &res, const hp::resources &free);
+
+    void get_free(hp::resources &free);
+
+    void add(hp::resources &total, const hp::resources &res);
+
+    void subtract(hp::resources &total, const hp::resources &res);
+
+} // namespace scheduler
+
+#endif
@@ -2,6 +2,7 @@
 #include "salog.hpp"
 #include "util/util.hpp"
 #include "conf.hpp"
+#include "trace.hpp"
 
 namespace sqlite
 {
@@ -11,6 +12,9 @@ namespace sqlite
     constexpr const char *CREATE_INDEX = "CREATE INDEX ";
     constexpr const char *CREATE_UNIQUE_INDEX = "CREATE UNIQUE INDEX ";
     constexpr const char *JOURNAL_MODE_OFF = "PRAGMA journal_mode=OFF";
+    constexpr const char *JOURNAL_MODE_WAL = "PRAGMA journal_mode=WAL";
+    constexpr const char *SYNCHRONOUS_NORMAL = "PRAGMA synchronous=NORMAL";
+    constexpr const char *MMAP_SIZE = "PRAGMA mmap_size=67108864"; // 64MB
     constexpr const char *BEGIN_TRANSACTION = "BEGIN TRANSACTION;";
     constexpr const char *COMMIT_TRANSACTION = "COMMIT;";
     constexpr const char *ROLLBACK_TRANSACTION = "ROLLBACK;";
@@ -20,11 +24,13 @@ namespace sqlite
     constexpr const char *VALUES = "VALUES";
 
     constexpr const char *INSTANCE_TABLE = "instances";
+    constexpr const char *WARM_USER_TABLE = "warm_users";
 
     constexpr const char *INSERT_INTO_HP_INSTANCE = "INSERT INTO instances("
                                                     "owner_pubkey, time, username, status, name, ip,"
-                                                    "peer_port, user_port, init_gp_tcp_port, init_gp_udp_port, pubkey, contract_id, image_name"
-                                                    ") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?)";
+                                                    "peer_port, user_port, init_gp_tcp_port, init_gp_udp_port, pubkey, contract_id, image_name, status_changed_on,"
+                                                    "cpu_us, mem_kbytes, swap_kbytes, storage_kbytes, io_read_bps, io_write_bps"
+                                                    ") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)";
 
     constexpr const char *GET_VACANT_PORTS_FROM_HP = "SELECT DISTINCT peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM "
                                                      "instances WHERE status == ? AND user_port NOT IN"
@@ -32,22 +38,54 @@ namespace sqlite
 
     constexpr const char *GET_MAX_PORTS_FROM_HP = "SELECT peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM instances WHERE status != ? ORDER BY peer_port DESC LIMIT 1";
 
-    constexpr const char *UPDATE_STATUS_IN_HP = "UPDATE instances SET status = ? WHERE name = ?";
+    constexpr const char *UPDATE_STATUS_IN_HP = "UPDATE instances SET status = ?, status_changed_on = ? WHERE name = ?";
+
+    constexpr const char *UPDATE_ALLOCATION_IN_HP = "UPDATE instances SET cpu_us = ?, mem_kbytes = ?, swap_kbytes = ?, storage_kbytes = ?, "
+                                                    "io_read_bps = ?, io_write_bps = ? WHERE name = ?";
 
     constexpr const char *IS_CONTAINER_EXISTS = "SELECT username, status, peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM instances WHERE name = ?";
 
-    constexpr const char *GET_ALOCATED_INSTANCE_COUNT = "SELECT COUNT(name) FROM instances WHERE status != ?";
+    constexpr const char *GET_ALOCATED_INSTANCE_COUNT = "SELECT COUNT(*) FROM instances WHERE status != ?";
+
+    // Status filters are used by almost every instance query. Created separately so existing dbs get it as well.
+    // Inequality filters scan this index instead of the table when only the status is needed (eg: instance count).
+    constexpr const char *CREATE_INSTANCE_STATUS_INDEX = "CREATE INDEX IF NOT EXISTS idx_instances_status ON instances(status)";
 
     constexpr const char *GET_RUNNING_INSTANCE_NAMES = "SELECT name FROM instances WHERE status = ?";
 
-    constexpr const char *GET_INSTANCE_LIST = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name, contract_id FROM instances WHERE status != ?";
+    constexpr const char *GET_INSTANCE_LIST = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name, contract_id, status_changed_on, "
+                                              "cpu_us, mem_kbytes, swap_kbytes, storage_kbytes, io_read_bps, io_write_bps FROM instances WHERE status != ?";
 
-    constexpr const char *GET_INSTANCE = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name FROM instances WHERE name == ? AND status != ?";
+    constexpr const char *GET_INSTANCE = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name, status_changed_on, "
+                                         "cpu_us, mem_kbytes, swap_kbytes, storage_kbytes, io_read_bps, io_write_bps FROM instances WHERE name == ? AND status != ?";
 
     constexpr const char *IS_TABLE_EXISTS = "SELECT * FROM sqlite_master WHERE type='table' AND name = ?";
 
     constexpr const char *DELETE_HP_INSTANCE = "DELETE FROM instances WHERE name = ?";
 
+    constexpr const char *INSERT_INTO_WARM_USER = "INSERT INTO warm_users(username, user_id, created_on) VALUES(?,?,?)";
+
+    constexpr const char *DELETE_WARM_USER = "DELETE FROM warm_users WHERE username = ?";
+
+    constexpr const char *GET_WARM_USERS = "SELECT username, user_id FROM warm_users ORDER BY created_on";
+
+    // A prepared statement and the latency histogram of its kind.
+    struct statement_entry
+    {
+        sqlite3_stmt *stmt = NULL;
+        metrics::metric *latency = NULL;
+    };
+
+    // Statements prepared on a connection keyed by the query.
+    struct statement_cache
+    {
+        std::mutex mutex; // Serializes the use of the cached statements.
+        std::unordered_map<std::string_view, statement_entry> statements;
+    };
+
+    std::mutex statement_caches_mutex;
+    std::unordered_map<sqlite3 *, statement_cache> statement_caches;
+
     // Message boad database queries
     constexpr const char *GET_LEASES_LIST = "SELECT timestamp, tx_hash, tenant_xrp_address, life_moments, container_name, created_on_ledger, status FROM leases WHERE status = 'Acquired' OR status = 'Extended'";
 
@@ -79,6 +117,78 @@ namespace sqlite
         return 0;
     }
 
+    /**
+     * Switches the db to write-ahead logging so readers (mb-xrpl) do not block the writes of the agent. With WAL,
+     * syncing on each commit is not needed for consistency. Reads are served through a memory map.
+     * @param db Pointer to the db.
+     * @returns returns 0 on success, or -1 on error.
+     */
+    int set_wal_mode(sqlite3 *db)
+    {
+        if (exec_sql(db, JOURNAL_MODE_WAL) == -1 ||
+            exec_sql(db, SYNCHRONOUS_NORMAL) == -1 ||
+            exec_sql(db, MMAP_SIZE) == -1)
+        {
+            LOG_ERROR << "Error setting wal mode.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Borrows the cached statement of the given query. The statement is prepared if it's not in the cache.
+     * The query must outlive the connection since it's used as the cache key.
+     * @param db Pointer to the db.
+     * @param query Sql query of the statement.
+     */
+    cached_statement::cached_statement(sqlite3 *db, std::string_view query)
+    {
+        statement_cache *cache;
+        {
+            std::scoped_lock caches_lock(statement_caches_mutex);
+            cache = &statement_caches[db];
+        }
+        lock = std::unique_lock(cache->mutex);
+        started_us = trace::get_epoch_microseconds();
+
+        const auto itr = cache->statements.find(query);
+        if (itr != cache->statements.end())
+        {
+            stmt = itr->second.stmt;
+            latency = itr->second.latency;
+            return;
+        }
+
+        if (sqlite3_prepare_v2(db, query.data(), query.length(), &stmt, 0) != SQLITE_OK)
+        {
+            LOG_ERROR << "Error preparing statement. " << sqlite3_errmsg(db);
+            sqlite3_finalize(stmt);
+            stmt = NULL;
+            return;
+        }
+
+        // Statements are grouped by their leading keyword (select, insert, ...) to keep the no. of metrics small.
+        std::string kind(query.substr(0, query.find(' ')));
+        std::transform(kind.begin(), kind.end(), kind.begin(), ::tolower);
+        latency = &metrics::get(metrics::SQLITE_QUERY_DURATION, kind);
+        cache->statements.emplace(query, statement_entry{stmt, latency});
+    }
+
+    /**
+     * Records the query latency, then resets the statement and clears its bindings so it can be reused.
+     */
+    cached_statement::~cached_statement()
+    {
+        if (latency != NULL)
+            latency->observe(trace::get_epoch_microseconds() - started_us);
+
+        if (stmt != NULL)
+        {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+    }
+
     /**
      * Executes given sql query.
      * @param db Pointer to the db.
@@ -292,19 +402,14 @@ namespace sqlite
      */
     bool is_table_exists(sqlite3 *db, std::string_view table_name)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, IS_TABLE_EXISTS);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, IS_TABLE_EXISTS, -1, &stmt, 0) == SQLITE_OK &&
-            stmt != NULL && sqlite3_bind_text(stmt, 1, table_name.data(), table_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+        if (stmt != NULL && sqlite3_bind_text(stmt, 1, table_name.data(), table_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_ROW)
         {
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
             return true;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
         return false;
     }
 
@@ -340,6 +445,18 @@ namespace sqlite
         if (*db == NULL)
             return 0;
 
+        // Finalize the cached statements of the connection. Otherwise the connection can't be closed.
+        {
+            std::scoped_lock caches_lock(statement_caches_mutex);
+            const auto itr = statement_caches.find(*db);
+            if (itr != statement_caches.end())
+            {
+                for (const auto &[query, entry] : itr->second.statements)
+                    sqlite3_finalize(entry.stmt);
+                statement_caches.erase(itr);
+            }
+        }
+
         if (sqlite3_close(*db) != SQLITE_OK)
         {
             LOG_ERROR << "Can't close database: " << sqlite3_errmsg(*db);
@@ -372,7 +489,14 @@ namespace sqlite
                 table_column_info("init_gp_udp_port", COLUMN_DATA_TYPE::INT),
                 table_column_info("pubkey", COLUMN_DATA_TYPE::TEXT),
                 table_column_info("contract_id", COLUMN_DATA_TYPE::TEXT),
-                table_column_info("image_name", COLUMN_DATA_TYPE::TEXT)};
+                table_column_info("image_name", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("status_changed_on", COLUMN_DATA_TYPE::INT),
+                table_column_info("cpu_us", COLUMN_DATA_TYPE::INT),
+                table_column_info("mem_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("swap_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("storage_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("io_read_bps", COLUMN_DATA_TYPE::INT),
+                table_column_info("io_write_bps", COLUMN_DATA_TYPE::INT)};
 
             if (create_table(db, INSTANCE_TABLE, columns) == -1 ||
                 create_index(db, INSTANCE_TABLE, "name", true) == -1 ||
@@ -388,6 +512,41 @@ namespace sqlite
             if (alter_table(db, INSTANCE_TABLE, columns) == -1)
                 return -1;
         }
+
+        // Status change times are recorded since the status reconciler was introduced.
+        if (!is_column_exists(db, INSTANCE_TABLE, "status_changed_on") &&
+            alter_table(db, INSTANCE_TABLE, {table_column_info("status_changed_on", COLUMN_DATA_TYPE::INT)}) == -1)
+            return -1;
+
+        // Instance sizes are recorded since instances of different sizes were introduced. Older instances are left
+        // empty and get the standard size.
+        if (!is_column_exists(db, INSTANCE_TABLE, "cpu_us"))
+        {
+            const std::vector<table_column_info> columns{
+                table_column_info("cpu_us", COLUMN_DATA_TYPE::INT),
+                table_column_info("mem_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("swap_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("storage_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("io_read_bps", COLUMN_DATA_TYPE::INT),
+                table_column_info("io_write_bps", COLUMN_DATA_TYPE::INT)};
+
+            if (alter_table(db, INSTANCE_TABLE, columns) == -1)
+                return -1;
+        }
+
+        if (exec_sql(db, CREATE_INSTANCE_STATUS_INDEX) == -1)
+            return -1;
+
+        if (!is_table_exists(db, WARM_USER_TABLE))
+        {
+            const std::vector<table_column_info> columns{
+                table_column_info("username", COLUMN_DATA_TYPE::TEXT, true),
+                table_column_info("user_id", COLUMN_DATA_TYPE::INT),
+                table_column_info("created_on", COLUMN_DATA_TYPE::INT)};
+
+            if (create_table(db, WARM_USER_TABLE, columns) == -1)
+                return -1;
+        }
         return 0;
     }
 
@@ -399,8 +558,10 @@ namespace sqlite
      */
     int insert_hp_instance_row(sqlite3 *db, const hp::instance_info &info)
     {
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, INSERT_INTO_HP_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        cached_statement statement(db, INSERT_INTO_HP_INSTANCE);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, info.owner_pubkey.data(), info.owner_pubkey.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_int64(stmt, 2, util::get_epoch_milliseconds()) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 3, info.username.data(), info.username.length(), SQLITE_STATIC) == SQLITE_OK &&
@@ -414,9 +575,15 @@ namespace sqlite
             sqlite3_bind_text(stmt, 11, info.pubkey.data(), info.pubkey.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 12, info.contract_id.data(), info.contract_id.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 13, info.image_name.data(), info.image_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 14, info.status_changed_on) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 15, info.allocation.cpu_us) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 16, info.allocation.mem_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 17, info.allocation.swap_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 18, info.allocation.storage_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 19, info.allocation.io_read_bps) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 20, info.allocation.io_write_bps) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
             return 0;
         }
 
@@ -433,10 +600,10 @@ namespace sqlite
      */
     int is_container_exists(sqlite3 *db, std::string_view container_name, hp::instance_info &info)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, IS_CONTAINER_EXISTS);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, IS_CONTAINER_EXISTS, -1, &stmt, 0) == SQLITE_OK &&
-            stmt != NULL && sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+        if (stmt != NULL && sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_ROW)
         {
             // Populate only the necessary fields.
@@ -446,14 +613,8 @@ namespace sqlite
             info.assigned_ports.user_port = sqlite3_column_int64(stmt, 3);
             info.assigned_ports.gp_tcp_port_start = sqlite3_column_int64(stmt, 4);
             info.assigned_ports.gp_udp_port_start = sqlite3_column_int64(stmt, 5);
-
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
             return 1;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
         return 0; // Not found
     }
 
@@ -462,23 +623,54 @@ namespace sqlite
      * @param db Database connection.
      * @param container_name Name of the container whose status should be updated.
      * @param status The new status of the container.
+     * @param changed_on Epoch milliseconds of the status change.
      * @return 0 on success and -1 on error.
      */
-    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status)
+    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status, const uint64_t changed_on)
     {
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, UPDATE_STATUS_IN_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        cached_statement statement(db, UPDATE_STATUS_IN_HP);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, status.data(), status.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_bind_text(stmt, 2, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 2, changed_on) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 3, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
             return 0;
         }
         LOG_ERROR << "Error updating container status for " << container_name;
         return -1;
     }
 
+    /**
+     * Update the allocation of the given container to a new size.
+     * @param db Database connection.
+     * @param container_name Name of the container whose allocation should be updated.
+     * @param allocation The new size of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int update_allocation_in_container(sqlite3 *db, std::string_view container_name, const hp::resources &allocation)
+    {
+        cached_statement statement(db, UPDATE_ALLOCATION_IN_HP);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
+            sqlite3_bind_int64(stmt, 1, allocation.cpu_us) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 2, allocation.mem_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 3, allocation.swap_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 4, allocation.storage_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 5, allocation.io_read_bps) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 6, allocation.io_write_bps) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 7, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            return 0;
+        }
+        LOG_ERROR << "Error updating container allocation for " << container_name;
+        return -1;
+    }
+
     /**
      * Get the max peer and user ports assigned for instances excluding destroyed instances.
      * @param db Database connection.
@@ -486,10 +678,11 @@ namespace sqlite
      */
     void get_max_ports(sqlite3 *db, hp::ports &max_ports)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_MAX_PORTS_FROM_HP);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_MAX_PORTS_FROM_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, hp::CONTAINER_STATES[hp::STATES::DESTROYED], sizeof(hp::CONTAINER_STATES[hp::STATES::DESTROYED]), SQLITE_STATIC) == SQLITE_OK &&
+        if (stmt != NULL &&
+            sqlite3_bind_text(stmt, 1, hp::CONTAINER_STATES[hp::STATES::DESTROYED], -1, SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_ROW)
         {
             const uint16_t peer_port = sqlite3_column_int64(stmt, 0);
@@ -511,9 +704,6 @@ namespace sqlite
             const uint16_t gp_udp_port_start = conf::cfg.hp.init_gp_udp_port + increment;
             max_ports = {max_ports.user_port, max_ports.peer_port, gp_tcp_port_start, gp_udp_port_start};
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
     }
 
     /**
@@ -524,10 +714,11 @@ namespace sqlite
     void get_vacant_ports(sqlite3 *db, std::vector<hp::ports> &vacant_ports)
     {
 
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_VACANT_PORTS_FROM_HP);
         std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_VACANT_PORTS_FROM_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 2, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK)
         {
@@ -540,9 +731,6 @@ namespace sqlite
                 vacant_ports.push_back({peer_port, user_port, gp_tcp_port, gp_udp_port});
             }
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
     }
 
     /**
@@ -554,10 +742,11 @@ namespace sqlite
     {
         running_instance_names.clear();
 
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_RUNNING_INSTANCE_NAMES);
         std::string_view running_status(hp::CONTAINER_STATES[hp::STATES::RUNNING]);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_RUNNING_INSTANCE_NAMES, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, running_status.data(), running_status.length(), SQLITE_STATIC) == SQLITE_OK)
         {
             while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
@@ -566,9 +755,6 @@ namespace sqlite
                 running_instance_names.push_back(name);
             }
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
     }
 
     /**
@@ -578,10 +764,11 @@ namespace sqlite
      */
     void get_instance_list(sqlite3 *db, std::vector<hp::instance_info> &instances)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_INSTANCE_LIST);
         std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_INSTANCE_LIST, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK)
         {
             while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
@@ -596,12 +783,11 @@ namespace sqlite
                 info.status = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6));
                 info.image_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 7));
                 info.contract_id = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 8));
+                info.status_changed_on = sqlite3_column_int64(stmt, 9);
+                read_allocation(stmt, 10, info.allocation);
                 instances.push_back(info);
             }
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
     }
 
     /**
@@ -611,8 +797,10 @@ namespace sqlite
      */
     void get_lease_list(sqlite3 *db, std::vector<hp::lease_info> &leases)
     {
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, GET_LEASES_LIST, -1, &stmt, 0) == SQLITE_OK && stmt != NULL)
+        cached_statement statement(db, GET_LEASES_LIST);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL)
         {
             while (sqlite3_step(stmt) == SQLITE_ROW)
             {
@@ -625,9 +813,6 @@ namespace sqlite
                 leases.push_back(info);
             }
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
     }
 
     /**
@@ -639,10 +824,11 @@ namespace sqlite
      */
     int get_instance(sqlite3 *db, std::string_view container_name, hp::instance_info &instance)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_INSTANCE);
         std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 2, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK &&
             (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW))
@@ -655,17 +841,30 @@ namespace sqlite
             instance.assigned_ports.gp_udp_port_start = sqlite3_column_int64(stmt, 5);
             instance.status = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6));
             instance.image_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 7));
-
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
+            instance.status_changed_on = sqlite3_column_int64(stmt, 8);
+            read_allocation(stmt, 9, instance.allocation);
             return 0;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
         return -1;
     }
 
+    /**
+     * Reads the allocation columns of an instance row. Columns of instances created before the sizes were recorded
+     * are null and read as 0.
+     * @param stmt Statement positioned at the row.
+     * @param first_column Index of the cpu_us column. The other allocation columns follow it.
+     * @param allocation Allocation to be populated.
+     */
+    void read_allocation(sqlite3_stmt *stmt, const int first_column, hp::resources &allocation)
+    {
+        allocation.cpu_us = sqlite3_column_int64(stmt, first_column);
+        allocation.mem_kbytes = sqlite3_column_int64(stmt, first_column + 1);
+        allocation.swap_kbytes = sqlite3_column_int64(stmt, first_column + 2);
+        allocation.storage_kbytes = sqlite3_column_int64(stmt, first_column + 3);
+        allocation.io_read_bps = sqlite3_column_int64(stmt, first_column + 4);
+        allocation.io_write_bps = sqlite3_column_int64(stmt, first_column + 5);
+    }
+
     /**
      * Get count of running instances
      * @param db Database connection.
@@ -673,21 +872,17 @@ namespace sqlite
      */
     int get_allocated_instance_count(sqlite3 *db)
     {
-        sqlite3_stmt *stmt;
+        cached_statement statement(db, GET_ALOCATED_INSTANCE_COUNT);
         std::string_view destroyed_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
+        sqlite3_stmt *stmt = statement.stmt;
 
-        if (sqlite3_prepare_v2(db, GET_ALOCATED_INSTANCE_COUNT, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, destroyed_status.data(), destroyed_status.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_ROW)
         {
             const uint64_t count = sqlite3_column_int64(stmt, 0);
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
             return count;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
         return -1;
     }
 
@@ -699,15 +894,84 @@ namespace sqlite
      */
     int delete_hp_instance(sqlite3 *db, std::string_view container_name)
     {
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, DELETE_HP_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        cached_statement statement(db, DELETE_HP_INSTANCE);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
             sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
             return 0;
         }
         LOG_ERROR << "Error deleting container " << container_name;
         return -1;
     }
+
+    /**
+     * Inserts a warm pool user record.
+     * @param db Database connection.
+     * @param user Warm user to be inserted.
+     * @return 0 on success and -1 on error.
+     */
+    int insert_warm_user(sqlite3 *db, const hp::warm_user &user)
+    {
+        cached_statement statement(db, INSERT_INTO_WARM_USER);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
+            sqlite3_bind_text(stmt, 1, user.username.data(), user.username.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 2, user.user_id) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 3, util::get_epoch_milliseconds()) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            return 0;
+        }
+
+        LOG_ERROR << "Error inserting warm user " << user.username;
+        return -1;
+    }
+
+    /**
+     * Delete a warm pool user record.
+     * @param db Database connection.
+     * @param username Username of the warm user.
+     * @return 0 on success and -1 on error.
+     */
+    int delete_warm_user(sqlite3 *db, std::string_view username)
+    {
+        cached_statement statement(db, DELETE_WARM_USER);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL &&
+            sqlite3_bind_text(stmt, 1, username.data(), username.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            return 0;
+        }
+
+        LOG_ERROR << "Error deleting warm user " << username;
+        return -1;
+    }
+
+    /**
+     * Populate the given list with the warm pool users, oldest first.
+     * @param db Database connection.
+     * @param users List of warm users to be populated.
+     */
+    void get_warm_users(sqlite3 *db, std::deque<hp::warm_user> &users)
+    {
+        cached_statement statement(db, GET_WARM_USERS);
+        sqlite3_stmt *stmt = statement.stmt;
+
+        if (stmt != NULL)
+        {
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                hp::warm_user user;
+                user.username = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+                user.user_id = sqlite3_column_int64(stmt, 1);
+                users.push_back(std::move(user));
+            }
+        }
+    }
 }
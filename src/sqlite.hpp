@@ -3,6 +3,7 @@
 
 #include "pchheader.hpp"
 #include "hp_manager.hpp"
+#include "metrics.hpp"
 
 namespace sqlite
 {
@@ -39,8 +40,31 @@ namespace sqlite
         }
     };
 
+    /**
+     * A prepared statement borrowed from the statement cache of a connection. Statements are prepared on first use
+     * and reused afterwards. The connection is locked while the statement is in use since the cached statements
+     * are shared by all the threads using the connection. The time the statement is held is recorded as its
+     * query latency.
+     */
+    struct cached_statement
+    {
+        sqlite3_stmt *stmt = NULL; // NULL if the statement could not be prepared.
+
+        cached_statement(sqlite3 *db, std::string_view query);
+        ~cached_statement();
+        cached_statement(const cached_statement &) = delete;
+        cached_statement &operator=(const cached_statement &) = delete;
+
+    private:
+        std::unique_lock<std::mutex> lock;
+        metrics::metric *latency = NULL; // Latency histogram of the statement kind.
+        uint64_t started_us = 0;         // Epoch microseconds at which the statement was borrowed.
+    };
+
     int open_db(std::string_view db_name, sqlite3 **db, const bool writable = false, const bool journal = true);
 
+    int set_wal_mode(sqlite3 *db);
+
     int exec_sql(sqlite3 *db, std::string_view sql, int (*callback)(void *, int, char **, char **) = NULL, void *callback_first_arg = NULL);
 
     int begin_transaction(sqlite3 *db);
@@ -71,7 +95,9 @@ namespace sqlite
 
     int is_container_exists(sqlite3 *db, std::string_view container_name, hp::instance_info &info);
 
-    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status);
+    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status, const uint64_t changed_on);
+
+    int update_allocation_in_container(sqlite3 *db, std::string_view container_name, const hp::resources &allocation);
 
     void get_max_ports(sqlite3 *db, hp::ports &max_ports);
 
@@ -85,8 +111,16 @@ namespace sqlite
 
     int get_instance(sqlite3 *db, std::string_view container_name, hp::instance_info &instance);
 
+    void read_allocation(sqlite3_stmt *stmt, const int first_column, hp::resources &allocation);
+
     int get_allocated_instance_count(sqlite3 *db);
 
     int delete_hp_instance(sqlite3 *db, std::string_view container_name);
+
+    int insert_warm_user(sqlite3 *db, const hp::warm_user &user);
+
+    int delete_warm_user(sqlite3 *db, std::string_view username);
+
+    void get_warm_users(sqlite3 *db, std::deque<hp::warm_user> &users);
 }
 #endif
@@ -0,0 +1,372 @@
+#include "stats_collector.hpp"
+#include "hp_manager.hpp"
+#include "instance_registry.hpp"
+#include "provisioner.hpp"
+#include "cgroup_manager.hpp"
+#include "util/util.hpp"
+
+namespace stats
+{
+    constexpr const char *CGROUP_ROOT = "/sys/fs/cgroup";
+    constexpr const char *CGROUP_SUFFIX = "-cg"; // Suffix of the cgroup v1 groups created for the instance users.
+    constexpr size_t STAT_BUFFER_SIZE = 4096;
+
+    stats_ctx ctx;
+
+    /**
+     * Starts the collector thread.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        ctx.is_cgroup_v2 = cgroup::is_v2();
+
+        // Disk usage is left out if the root device is not found. Quota reads fail harmlessly if quotas are off.
+        if (provisioner::get_root_device(ctx.quota_device) == -1)
+            ctx.quota_device.clear();
+
+        try
+        {
+            ctx.collector_thread = std::thread(collector_loop);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the stats collector thread. " << e.what();
+            return -1;
+        }
+
+        LOG_INFO << "Stats collector started. Cgroup version: " << (ctx.is_cgroup_v2 ? "v2" : "v1");
+        return 0;
+    }
+
+    void deinit()
+    {
+        {
+            std::scoped_lock lock(ctx.mutex);
+            ctx.is_shutting_down = true;
+        }
+        ctx.cv.notify_all();
+
+        if (ctx.collector_thread.joinable())
+            ctx.collector_thread.join();
+
+        for (auto &[container_name, state] : ctx.instances)
+            close_instance(state);
+        ctx.instances.clear();
+        ctx.is_shutting_down = false;
+    }
+
+    void collector_loop()
+    {
+        util::mask_signal();
+
+        std::unique_lock lock(ctx.mutex);
+        while (!ctx.is_shutting_down)
+        {
+            lock.unlock();
+            collect();
+            lock.lock();
+
+            ctx.cv.wait_for(lock, std::chrono::seconds(SAMPLE_INTERVAL_SECS), []
+                            { return ctx.is_shutting_down; });
+        }
+    }
+
+    /**
+     * Takes a sample of every instance in the registry. Instances which are no longer in the registry are dropped.
+     */
+    void collect()
+    {
+        std::vector<hp::instance_info> instances;
+        registry::get_instance_list(instances);
+
+        std::scoped_lock lock(ctx.mutex);
+        for (auto &[container_name, state] : ctx.instances)
+            state.is_seen = false;
+
+        const uint64_t timestamp = util::get_epoch_milliseconds();
+        for (const hp::instance_info &info : instances)
+        {
+            instance_state &state = ctx.instances[info.container_name];
+            state.is_seen = true;
+
+            // Cgroup files are opened once. Instances whose cgroup is not there yet are retried on the next pass.
+            if (state.username != info.username || state.cpu_fd == -1)
+            {
+                close_instance(state);
+                if (open_instance(state, info.username) == -1)
+                    continue;
+            }
+
+            sample s;
+            s.timestamp = timestamp;
+            if (read_sample(state, s) == -1)
+            {
+                // The cgroup is gone, eg: the user slice was recreated when the user manager restarted. Files are
+                // opened again on the next pass instead of recording empty samples from the removed cgroup.
+                LOG_WARNING << "Error reading the cgroup of " << info.container_name << ". Reopening on the next pass.";
+                close_instance(state);
+                continue;
+            }
+
+            if (state.ring.size() < SAMPLE_COUNT)
+                state.ring.push_back(s);
+            else
+                state.ring[state.next] = s;
+            state.next = (state.next + 1) % SAMPLE_COUNT;
+        }
+
+        for (auto itr = ctx.instances.begin(); itr != ctx.instances.end();)
+        {
+            if (itr->second.is_seen)
+            {
+                itr++;
+                continue;
+            }
+            close_instance(itr->second);
+            itr = ctx.instances.erase(itr);
+        }
+    }
+
+    /**
+     * Opens the cgroup files of an instance user. On cgroup v2 the user slice is read since it's the group the
+     * limits of the user are applied to. On v1 the cpu and memory groups created for the user are read.
+     * @param state Sampling state of the instance.
+     * @param username Instance user.
+     * @return 0 on success and -1 if the cgroup of the user is not available.
+     */
+    int open_instance(instance_state &state, std::string_view username)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+
+        state.username = username;
+        state.uid = user.user_id;
+
+        if (ctx.is_cgroup_v2)
+        {
+            const std::string dir = cgroup::get_user_dir(user.user_id) + "/";
+            state.cpu_fd = open((dir + "cpu.stat").data(), O_RDONLY | O_CLOEXEC);
+            state.mem_fd = open((dir + "memory.current").data(), O_RDONLY | O_CLOEXEC);
+            state.mem_peak_fd = open((dir + "memory.peak").data(), O_RDONLY | O_CLOEXEC); // Available from kernel 5.19.
+            state.swap_fd = open((dir + "memory.swap.current").data(), O_RDONLY | O_CLOEXEC);
+            state.io_fd = open((dir + "io.stat").data(), O_RDONLY | O_CLOEXEC);
+        }
+        else
+        {
+            const std::string group = std::string(username) + CGROUP_SUFFIX;
+            const std::string cpu_dir = std::string(CGROUP_ROOT) + "/cpuacct/" + group + "/";
+            const std::string mem_dir = std::string(CGROUP_ROOT) + "/memory/" + group + "/";
+            state.cpu_fd = open((cpu_dir + "cpuacct.usage").data(), O_RDONLY | O_CLOEXEC);
+            state.mem_fd = open((mem_dir + "memory.usage_in_bytes").data(), O_RDONLY | O_CLOEXEC);
+            state.mem_peak_fd = open((mem_dir + "memory.max_usage_in_bytes").data(), O_RDONLY | O_CLOEXEC);
+            state.swap_fd = open((mem_dir + "memory.memsw.usage_in_bytes").data(), O_RDONLY | O_CLOEXEC);
+        }
+
+        return state.cpu_fd == -1 ? -1 : 0;
+    }
+
+    void close_instance(instance_state &state)
+    {
+        for (int *fd : {&state.cpu_fd, &state.mem_fd, &state.mem_peak_fd, &state.swap_fd, &state.io_fd})
+        {
+            if (*fd != -1)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    /**
+     * Reads the current usage of an instance. Usage figures which are not available are left at 0.
+     * @param state Sampling state of the instance.
+     * @param s Sample to be populated.
+     * @return 0 on success and -1 if the cpu or memory usage cannot be read, which means the cgroup has been removed.
+     */
+    int read_sample(const instance_state &state, sample &s)
+    {
+        if (ctx.is_cgroup_v2)
+        {
+            if (read_keyed_counter(state.cpu_fd, "usage_usec", s.cpu_usage_us) == -1 ||
+                (state.mem_fd != -1 && read_counter(state.mem_fd, s.mem_bytes) == -1))
+                return -1;
+            read_counter(state.mem_peak_fd, s.mem_peak_bytes);
+            read_counter(state.swap_fd, s.swap_bytes);
+            read_io_stat(state.io_fd, s);
+        }
+        else
+        {
+            uint64_t cpu_usage_ns = 0, memsw_bytes = 0;
+            if (read_counter(state.cpu_fd, cpu_usage_ns) == -1 ||
+                (state.mem_fd != -1 && read_counter(state.mem_fd, s.mem_bytes) == -1))
+                return -1;
+            read_counter(state.mem_peak_fd, s.mem_peak_bytes);
+            s.cpu_usage_us = cpu_usage_ns / 1000;
+            if (read_counter(state.swap_fd, memsw_bytes) == 0 && memsw_bytes > s.mem_bytes)
+                s.swap_bytes = memsw_bytes - s.mem_bytes;
+        }
+
+        if (!ctx.quota_device.empty())
+        {
+            struct dqblk quota = {};
+            if (quotactl(QCMD(Q_GETQUOTA, USRQUOTA), ctx.quota_device.data(), state.uid, reinterpret_cast<caddr_t>(&quota)) == 0)
+                s.disk_bytes = quota.dqb_curspace;
+        }
+        return 0;
+    }
+
+    /**
+     * Get the samples of an instance in the order they were taken.
+     * @param container_name Name of the instance.
+     * @param samples Populated samples.
+     * @return 0 on success and -1 if the instance is not being sampled.
+     */
+    int get_samples(std::string_view container_name, std::vector<sample> &samples)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+            return -1;
+
+        const instance_state &state = itr->second;
+        const size_t count = state.ring.size();
+        const size_t first = count < SAMPLE_COUNT ? 0 : state.next;
+        samples.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            samples.push_back(state.ring[(first + i) % count]);
+        return 0;
+    }
+
+    /**
+     * Get the latest sample of an instance.
+     * @param container_name Name of the instance.
+     * @param s Populated sample.
+     * @return 0 on success and -1 if the instance has not been sampled yet.
+     */
+    int get_latest(std::string_view container_name, sample &s)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end() || itr->second.ring.empty())
+            return -1;
+
+        const instance_state &state = itr->second;
+        s = state.ring[(state.next + SAMPLE_COUNT - 1) % SAMPLE_COUNT];
+        return 0;
+    }
+
+    /**
+     * Get the latest sample of every sampled instance.
+     * @param stats Populated with a single sample per instance.
+     */
+    void get_all_latest(std::vector<instance_samples> &stats)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        stats.reserve(ctx.instances.size());
+        for (const auto &[container_name, state] : ctx.instances)
+        {
+            if (state.ring.empty())
+                continue;
+            stats.push_back({container_name, {state.ring[(state.next + SAMPLE_COUNT - 1) % SAMPLE_COUNT]}});
+        }
+    }
+
+    /**
+     * Reads a single number cgroup file from the start.
+     * @param fd Cgroup file. Nothing is read if -1.
+     * @param value Read value.
+     * @return 0 on success and -1 on error.
+     */
+    int read_counter(const int fd, uint64_t &value)
+    {
+        if (fd == -1)
+            return -1;
+
+        char buf[32];
+        const ssize_t res = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (res <= 0)
+            return -1;
+
+        buf[res] = '\0';
+        value = strtoull(buf, NULL, 10);
+        return 0;
+    }
+
+    /**
+     * Reads a value of a flat keyed cgroup file such as cpu.stat.
+     * @param fd Cgroup file. Nothing is read if -1.
+     * @param key Key of the value.
+     * @param value Read value.
+     * @return 0 on success and -1 if the value is not found.
+     */
+    int read_keyed_counter(const int fd, std::string_view key, uint64_t &value)
+    {
+        if (fd == -1)
+            return -1;
+
+        char buf[STAT_BUFFER_SIZE];
+        const ssize_t res = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (res <= 0)
+            return -1;
+
+        buf[res] = '\0';
+        const std::string_view content(buf, res);
+        size_t pos = 0;
+        while (pos < content.size())
+        {
+            const size_t line_end = std::min(content.find('\n', pos), content.size());
+            const std::string_view line = content.substr(pos, line_end - pos);
+            if (line.size() > key.size() && line.substr(0, key.size()) == key && line[key.size()] == ' ')
+            {
+                value = strtoull(line.data() + key.size() + 1, NULL, 10);
+                return 0;
+            }
+            pos = line_end + 1;
+        }
+        return -1;
+    }
+
+    /**
+     * Reads the io.stat counters of a cgroup, summed over all the devices.
+     * Each line has the format: <major>:<minor> rbytes=<n> wbytes=<n> rios=<n> wios=<n> dbytes=<n> dios=<n>
+     * @param fd The io.stat file. Nothing is read if -1.
+     * @param s Sample to populate the io counters of.
+     */
+    void read_io_stat(const int fd, sample &s)
+    {
+        if (fd == -1)
+            return;
+
+        char buf[STAT_BUFFER_SIZE];
+        const ssize_t res = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (res <= 0)
+            return;
+
+        buf[res] = '\0';
+        const std::string_view content(buf, res);
+        size_t pos = 0;
+        while (pos < content.size())
+        {
+            const size_t token_end = std::min(content.find_first_of(" \n", pos), content.size());
+            const std::string_view token = content.substr(pos, token_end - pos);
+            const size_t eq = token.find('=');
+            if (eq != std::string_view::npos)
+            {
+                const std::string_view key = token.substr(0, eq);
+                const uint64_t value = strtoull(token.data() + eq + 1, NULL, 10);
+                if (key == "rbytes")
+                    s.io_read_bytes += value;
+                else if (key == "wbytes")
+                    s.io_write_bytes += value;
+                else if (key == "rios")
+                    s.io_read_ops += value;
+                else if (key == "wios")
+                    s.io_write_ops += value;
+            }
+            pos = token_end + 1;
+        }
+    }
+
+} // namespace stats
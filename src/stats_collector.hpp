@@ -0,0 +1,91 @@
+#ifndef _SA_STATS_COLLECTOR_
+#define _SA_STATS_COLLECTOR_
+
+#include "pchheader.hpp"
+
+/**
+ * Periodically samples the resource usage of the instances from their cgroups and the disk quota of their users.
+ * The latest samples of each instance are kept in a fixed size ring.
+ */
+namespace stats
+{
+    constexpr size_t SAMPLE_COUNT = 360;           // No. of latest samples kept per instance.
+    constexpr int SAMPLE_INTERVAL_SECS = 10;       // Samples of an hour are kept with the default sample count.
+
+    // Resource usage of an instance at a point in time. Cpu and io figures are cumulative counters.
+    struct sample
+    {
+        uint64_t timestamp = 0;      // Epoch milliseconds. 0 if the instance has not been sampled yet.
+        uint64_t cpu_usage_us = 0;   // Cpu time consumed by the instance.
+        uint64_t mem_bytes = 0;      // Current memory usage.
+        uint64_t mem_peak_bytes = 0; // Highest memory usage recorded by the kernel.
+        uint64_t swap_bytes = 0;     // Current swap usage.
+        uint64_t io_read_bytes = 0;
+        uint64_t io_write_bytes = 0;
+        uint64_t io_read_ops = 0;
+        uint64_t io_write_ops = 0;
+        uint64_t disk_bytes = 0;     // Disk space used by the instance user.
+    };
+
+    // Samples of an instance in the order they were taken.
+    struct instance_samples
+    {
+        std::string container_name;
+        std::vector<sample> samples;
+    };
+
+    // Sampling state of an instance. Cgroup files are kept open so a sample only costs a pread per file.
+    struct instance_state
+    {
+        std::string username;
+        uid_t uid = 0;
+        int cpu_fd = -1;
+        int mem_fd = -1;
+        int mem_peak_fd = -1;
+        int swap_fd = -1;       // Swap usage on cgroup v2 and memory + swap usage on v1.
+        int io_fd = -1;         // Only available on cgroup v2.
+        std::vector<sample> ring;
+        size_t next = 0;        // Position of the next sample in the ring.
+        bool is_seen = false;   // Whether the instance was in the registry in the current pass.
+    };
+
+    struct stats_ctx
+    {
+        std::mutex mutex;
+        std::condition_variable cv; // Wakes up the collector on shutdown.
+        std::unordered_map<std::string, instance_state> instances; // Sampling state keyed by container name.
+        std::thread collector_thread;
+        std::string quota_device; // Device of the root filesystem the user quotas are set on.
+        bool is_cgroup_v2 = false;
+        bool is_shutting_down = false;
+    };
+
+    int init();
+
+    void deinit();
+
+    void collector_loop();
+
+    void collect();
+
+    int open_instance(instance_state &state, std::string_view username);
+
+    void close_instance(instance_state &state);
+
+    int read_sample(const instance_state &state, sample &s);
+
+    int get_samples(std::string_view container_name, std::vector<sample> &samples);
+
+    int get_latest(std::string_view container_name, sample &s);
+
+    void get_all_latest(std::vector<instance_samples> &stats);
+
+    int read_counter(const int fd, uint64_t &value);
+
+    int read_keyed_counter(const int fd, std::string_view key, uint64_t &value);
+
+    void read_io_stat(const int fd, sample &s);
+
+} // namespace stats
+
+#endif
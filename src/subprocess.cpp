@@ -0,0 +1,437 @@
+#include "subprocess.hpp"
+#include "util/util.hpp"
+#include "metrics.hpp"
+
+extern char **environ;
+
+namespace subprocess
+{
+    constexpr size_t MAX_RUNNING_PROCESSES = 8;  // Further processes wait for a running one to complete.
+    constexpr uint64_t KILL_GRACE_MS = 5000;     // Time given to a timed out process to exit after SIGTERM before SIGKILL.
+    constexpr uint64_t PIPE_DRAIN_MS = 2000;     // Time given to the descendants of an exited process to release its pipes.
+    constexpr int POLL_INTERVAL_MS = 100;        // Exit check interval of processes without a pidfd.
+    constexpr int MAX_EVENTS = 32;
+
+    manager_ctx ctx;
+
+    /**
+     * Starts the event loop thread. Called on the first run, so programs can be run before the agent is fully initialized.
+     * Caller must hold the manager mutex.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        if (ctx.is_started)
+            return 0;
+
+        ctx.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ctx.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event wakeup_event = {};
+        wakeup_event.events = EPOLLIN;
+        wakeup_event.data.fd = ctx.event_fd;
+        if (ctx.epoll_fd == -1 || ctx.event_fd == -1 || epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.event_fd, &wakeup_event) == -1)
+        {
+            LOG_ERROR << errno << ": Error setting up the subprocess event loop.";
+            close_fd(ctx.epoll_fd);
+            close_fd(ctx.event_fd);
+            return -1;
+        }
+
+        try
+        {
+            ctx.loop_thread = std::thread(event_loop);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Error starting the subprocess event loop thread. " << e.what();
+            close_fd(ctx.epoll_fd);
+            close_fd(ctx.event_fd);
+            return -1;
+        }
+
+        ctx.is_started = true;
+        return 0;
+    }
+
+    /**
+     * Stops the event loop once the running and the pending processes have completed.
+     */
+    void deinit()
+    {
+        {
+            std::scoped_lock lock(ctx.mutex);
+            if (!ctx.is_started)
+                return;
+            ctx.is_shutting_down = true;
+        }
+
+        const uint64_t wakeup = 1;
+        if (write(ctx.event_fd, &wakeup, sizeof(wakeup)) == -1)
+            LOG_ERROR << errno << ": Error waking up the subprocess event loop.";
+
+        if (ctx.loop_thread.joinable())
+            ctx.loop_thread.join();
+
+        close_fd(ctx.epoll_fd);
+        close_fd(ctx.event_fd);
+        ctx.is_started = false;
+        ctx.is_shutting_down = false;
+    }
+
+    /**
+     * Runs a program without a shell and waits for it to complete. The program is stopped with SIGTERM once the
+     * deadline passes and with SIGKILL if it does not exit after that.
+     * @param args Program followed by its arguments. The program is looked up in PATH.
+     * @param res Outcome of the process.
+     * @param timeout_ms Max time the process may run.
+     * @param log_output Whether to log the output lines of the process as they arrive.
+     * @return 0 if the process ran to exit and -1 if it could not be run or timed out. Exit code is in the result.
+     */
+    int run(const std::vector<std::string> &args, result &res, const uint64_t timeout_ms, const bool log_output)
+    {
+        if (args.empty())
+            return -1;
+
+        std::shared_ptr<process> proc = std::make_shared<process>();
+        proc->args = args;
+        proc->timeout_ms = timeout_ms;
+        proc->log_output = log_output;
+        proc->program = args[0].substr(args[0].rfind('/') + 1);
+
+        std::unique_lock lock(ctx.mutex);
+        if (ctx.is_shutting_down || init() == -1)
+            return -1;
+
+        ctx.pending.push_back(proc);
+        const uint64_t wakeup = 1;
+        if (write(ctx.event_fd, &wakeup, sizeof(wakeup)) == -1)
+            LOG_ERROR << errno << ": Error waking up the subprocess event loop.";
+
+        ctx.completed_cv.wait(lock, [&]
+                              { return proc->completed; });
+        lock.unlock();
+
+        res = std::move(proc->res);
+        if (res.timed_out)
+        {
+            LOG_ERROR << args[0] << " timed out after " << timeout_ms << "ms.";
+            return -1;
+        }
+        return proc->pid == -1 ? -1 : 0;
+    }
+
+    /**
+     * Spawns the pending processes while there are free slots and drains their pipes until they complete.
+     */
+    void event_loop()
+    {
+        util::mask_signal();
+
+        struct epoll_event events[MAX_EVENTS];
+        while (true)
+        {
+            {
+                std::scoped_lock lock(ctx.mutex);
+                if (ctx.is_shutting_down && ctx.pending.empty() && ctx.running.empty())
+                    break;
+
+                while (ctx.running.size() < MAX_RUNNING_PROCESSES && !ctx.pending.empty())
+                {
+                    std::shared_ptr<process> proc = ctx.pending.front();
+                    ctx.pending.pop_front();
+                    if (spawn(*proc) == -1)
+                    {
+                        proc->completed = true;
+                        ctx.completed_cv.notify_all();
+                        continue;
+                    }
+
+                    ctx.running.push_back(proc);
+                    for (const int fd : {proc->out_fd, proc->err_fd, proc->pidfd})
+                    {
+                        if (fd != -1)
+                            ctx.fd_index.emplace(fd, proc);
+                    }
+                }
+            }
+
+            // Processes without a pidfd and the deadlines are checked at least this often.
+            int timeout = -1;
+            const uint64_t now = util::get_epoch_milliseconds();
+            for (const std::shared_ptr<process> &proc : ctx.running)
+            {
+                uint64_t next = proc->exited ? proc->exited_at + PIPE_DRAIN_MS : (proc->kill_at != 0 ? proc->kill_at : proc->deadline);
+                int wait = next > now ? (int)std::min<uint64_t>(next - now, INT_MAX) : 0;
+                if (proc->pidfd == -1 && !proc->exited)
+                    wait = std::min(wait, POLL_INTERVAL_MS);
+                timeout = timeout == -1 ? wait : std::min(timeout, wait);
+            }
+
+            const int count = epoll_wait(ctx.epoll_fd, events, MAX_EVENTS, timeout);
+            if (count == -1 && errno != EINTR)
+            {
+                LOG_ERROR << errno << ": Subprocess event loop wait failed.";
+                util::sleep(POLL_INTERVAL_MS);
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                if (events[i].data.fd == ctx.event_fd)
+                {
+                    uint64_t value;
+                    if (read(ctx.event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                        LOG_ERROR << errno << ": Error reading the subprocess wakeup event.";
+                    continue;
+                }
+                handle_event(events[i].data.fd, events[i].events);
+            }
+
+            const uint64_t checked_on = util::get_epoch_milliseconds();
+            for (size_t i = 0; i < ctx.running.size();)
+            {
+                const std::shared_ptr<process> proc = ctx.running[i];
+                check_process(*proc, checked_on);
+                if (proc->exited && proc->out_fd == -1 && proc->err_fd == -1)
+                {
+                    ctx.running.erase(ctx.running.begin() + i);
+                    complete(proc);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Spawns a process in its own process group with its stdout and stderr connected to non-blocking pipes.
+     * @param proc The process.
+     * @return 0 on success and -1 on error.
+     */
+    int spawn(process &proc)
+    {
+        int out_pipe[2], err_pipe[2];
+        if (pipe2(out_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating the output pipe for " << proc.args[0];
+            return -1;
+        }
+        if (pipe2(err_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating the error pipe for " << proc.args[0];
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+            return -1;
+        }
+
+        // The child gets blocking pipe ends. dup2 clears close-on-exec of the duplicated fds.
+        fcntl(out_pipe[1], F_SETFL, 0);
+        fcntl(err_pipe[1], F_SETFL, 0);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+        // Agent threads mask the signals, which the child would otherwise inherit. Its own process group lets the
+        // whole process tree be stopped on timeout.
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t empty_mask, default_signals;
+        sigemptyset(&empty_mask);
+        sigemptyset(&default_signals);
+        sigaddset(&default_signals, SIGPIPE);
+        sigaddset(&default_signals, SIGINT);
+        sigaddset(&default_signals, SIGTERM);
+        posix_spawnattr_setsigmask(&attr, &empty_mask);
+        posix_spawnattr_setsigdefault(&attr, &default_signals);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+        std::vector<char *> argv;
+        for (const std::string &arg : proc.args)
+            argv.push_back(const_cast<char *>(arg.data()));
+        argv.push_back(NULL);
+
+        const int ret = posix_spawnp(&proc.pid, argv[0], &actions, &attr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+
+        if (ret != 0)
+        {
+            LOG_ERROR << ret << ": Error spawning " << proc.args[0];
+            close(out_pipe[0]);
+            close(err_pipe[0]);
+            proc.pid = -1;
+            metrics::add(metrics::SUBPROCESS_SPAWN_ERRORS, proc.program);
+            return -1;
+        }
+
+        metrics::add(metrics::SUBPROCESS_SPAWNS, proc.program);
+        metrics::get(metrics::SUBPROCESSES_RUNNING).add(1);
+
+        proc.out_fd = out_pipe[0];
+        proc.err_fd = err_pipe[0];
+        proc.pidfd = syscall(SYS_pidfd_open, proc.pid, 0);
+        proc.started_at = util::get_epoch_milliseconds();
+        proc.deadline = proc.started_at + proc.timeout_ms;
+
+        for (const int fd : {proc.out_fd, proc.err_fd, proc.pidfd})
+        {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (fd != -1 && epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+                LOG_ERROR << errno << ": Error watching fd of " << proc.args[0];
+        }
+
+        return 0;
+    }
+
+    /**
+     * Handles the readiness of a pipe or a pidfd of a running process.
+     * @param fd The ready fd.
+     * @param events Ready events.
+     */
+    void handle_event(const int fd, const uint32_t events)
+    {
+        const auto itr = ctx.fd_index.find(fd);
+        if (itr == ctx.fd_index.end())
+            return;
+
+        const std::shared_ptr<process> proc = itr->second;
+        if (fd == proc->out_fd)
+            read_pipe(*proc, proc->out_fd, proc->res.output, proc->out_line);
+        else if (fd == proc->err_fd)
+            read_pipe(*proc, proc->err_fd, proc->res.error, proc->err_line);
+        else if (fd == proc->pidfd)
+            check_process(*proc, util::get_epoch_milliseconds());
+    }
+
+    /**
+     * Reads everything available on a pipe. The pipe is closed at the end of file.
+     * @param proc Process which owns the pipe.
+     * @param fd The pipe.
+     * @param buf Buffer collecting the whole output.
+     * @param line Partial line carried over for logging.
+     */
+    void read_pipe(process &proc, int &fd, std::string &buf, std::string &line)
+    {
+        char chunk[4096];
+        while (true)
+        {
+            const ssize_t res = read(fd, chunk, sizeof(chunk));
+            if (res > 0)
+            {
+                buf.append(chunk, res);
+                if (!proc.log_output)
+                    continue;
+
+                line.append(chunk, res);
+                size_t pos;
+                while ((pos = line.find('\n')) != std::string::npos)
+                {
+                    if (pos > 0)
+                        LOG_INFO << line.substr(0, pos);
+                    line.erase(0, pos + 1);
+                }
+                continue;
+            }
+
+            if (res == -1 && errno == EINTR)
+                continue;
+            if (res == -1 && errno == EAGAIN)
+                return;
+
+            // End of file or a read error.
+            if (proc.log_output && !line.empty())
+                LOG_INFO << line;
+            line.clear();
+            ctx.fd_index.erase(fd);
+            close_fd(fd);
+            return;
+        }
+    }
+
+    /**
+     * Reaps the process if it has exited and enforces its deadline otherwise.
+     * @param proc The process.
+     * @param now Current epoch milliseconds.
+     */
+    void check_process(process &proc, const uint64_t now)
+    {
+        if (!proc.exited)
+        {
+            int status;
+            const pid_t ret = waitpid(proc.pid, &status, WNOHANG);
+            if (ret == proc.pid || (ret == -1 && errno == ECHILD))
+            {
+                proc.exited = true;
+                proc.exited_at = now;
+                proc.res.exit_code = (ret == proc.pid && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+                if (proc.pidfd != -1)
+                {
+                    ctx.fd_index.erase(proc.pidfd);
+                    close_fd(proc.pidfd);
+                }
+            }
+        }
+
+        if (proc.exited)
+        {
+            // Descendants which outlived the process may keep its pipes open indefinitely.
+            if (now >= proc.exited_at + PIPE_DRAIN_MS)
+            {
+                for (int *fd : {&proc.out_fd, &proc.err_fd})
+                {
+                    ctx.fd_index.erase(*fd);
+                    close_fd(*fd);
+                }
+            }
+            return;
+        }
+
+        if (proc.kill_at == 0 && now >= proc.deadline)
+        {
+            LOG_WARNING << proc.args[0] << " (pid " << proc.pid << ") exceeded its deadline. Terminating.";
+            proc.res.timed_out = true;
+            metrics::add(metrics::SUBPROCESS_TIMEOUTS, proc.program);
+            proc.kill_at = now + KILL_GRACE_MS;
+            kill(-proc.pid, SIGTERM);
+        }
+        else if (proc.kill_at != 0 && now >= proc.kill_at)
+        {
+            LOG_WARNING << proc.args[0] << " (pid " << proc.pid << ") did not terminate. Killing.";
+            proc.kill_at = UINT64_MAX;
+            kill(-proc.pid, SIGKILL);
+        }
+    }
+
+    void close_fd(int &fd)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    /**
+     * Hands the result of a completed process over to its caller.
+     * @param proc The process.
+     */
+    void complete(const std::shared_ptr<process> &proc)
+    {
+        metrics::get(metrics::SUBPROCESSES_RUNNING).add(-1);
+        metrics::observe(metrics::SUBPROCESS_DURATION, proc->program, (proc->exited_at - proc->started_at) * 1000);
+
+        std::scoped_lock lock(ctx.mutex);
+        proc->completed = true;
+        ctx.completed_cv.notify_all();
+    }
+
+} // namespace subprocess
@@ -0,0 +1,82 @@
+#ifndef _SA_SUBPROCESS_
+#define _SA_SUBPROCESS_
+
+#include "pchheader.hpp"
+
+/**
+ * Runs external programs from a single event loop thread. Callers block only on their own process while the output
+ * of all the processes is drained through non-blocking pipes, deadlines are enforced and the no. of processes
+ * running at once is bounded.
+ */
+namespace subprocess
+{
+    constexpr uint64_t DEFAULT_TIMEOUT_MS = 300000; // Processes are stopped if they run longer than this by default.
+
+    // Outcome of a process.
+    struct result
+    {
+        int exit_code = -1;     // Exit code of the process. -1 if it could not be run or was killed by a signal.
+        bool timed_out = false; // Whether the process was stopped for running past its deadline.
+        std::string output;     // Everything the process wrote to stdout.
+        std::string error;      // Everything the process wrote to stderr.
+    };
+
+    // A process submitted to the manager. Owned by the event loop thread from submission until completion.
+    struct process
+    {
+        std::vector<std::string> args;
+        uint64_t timeout_ms = 0;
+        bool log_output = false; // Whether to log the output lines as they arrive.
+        pid_t pid = -1;
+        int pidfd = -1;          // Becomes readable when the process exits. -1 if the kernel lacks pidfd support.
+        int out_fd = -1;
+        int err_fd = -1;
+        std::string out_line;    // Partial output lines waiting for the rest to be logged.
+        std::string err_line;
+        std::string program;     // Name of the program the metrics of the process are recorded against.
+        uint64_t started_at = 0; // Epoch milliseconds.
+        uint64_t deadline = 0;   // Epoch milliseconds.
+        uint64_t kill_at = 0;    // When to escalate to SIGKILL once SIGTERM has been sent.
+        uint64_t exited_at = 0;  // When the process exited. Pipes still held open by its descendants are closed after a grace period.
+        bool exited = false;
+        bool completed = false;  // Guarded by the manager mutex.
+        result res;
+    };
+
+    struct manager_ctx
+    {
+        std::mutex mutex;
+        std::condition_variable completed_cv;
+        std::deque<std::shared_ptr<process>> pending; // Processes waiting for a free slot. Guarded by the mutex.
+        std::vector<std::shared_ptr<process>> running;
+        std::unordered_map<int, std::shared_ptr<process>> fd_index; // Pipe and pidfd of the running processes.
+        int epoll_fd = -1;
+        int event_fd = -1; // Wakes up the event loop for new submissions and shutdown.
+        std::thread loop_thread;
+        bool is_started = false;
+        bool is_shutting_down = false;
+    };
+
+    int init();
+
+    void deinit();
+
+    int run(const std::vector<std::string> &args, result &res, const uint64_t timeout_ms = DEFAULT_TIMEOUT_MS, const bool log_output = false);
+
+    void event_loop();
+
+    int spawn(process &proc);
+
+    void handle_event(const int fd, const uint32_t events);
+
+    void read_pipe(process &proc, int &fd, std::string &buf, std::string &line);
+
+    void check_process(process &proc, const uint64_t now);
+
+    void close_fd(int &fd);
+
+    void complete(const std::shared_ptr<process> &proc);
+
+} // namespace subprocess
+
+#endif
@@ -0,0 +1,119 @@
+#include "trace.hpp"
+#include "metrics.hpp"
+
+namespace trace
+{
+    trace_ctx ctx;
+    thread_local context current;
+
+    operation_scope::operation_scope(const context &ctx) : previous(current)
+    {
+        current = ctx;
+    }
+
+    operation_scope::~operation_scope()
+    {
+        current = std::move(previous);
+    }
+
+    span::span(std::string_view name) : name(name), start_us(get_epoch_microseconds())
+    {
+    }
+
+    span::~span()
+    {
+        end();
+    }
+
+    void span::end()
+    {
+        if (is_ended)
+            return;
+
+        is_ended = true;
+        record_span(name, start_us);
+    }
+
+    /**
+     * Get the operation the current thread is working on. Used to carry the operation over to helper threads.
+     * @return Operation of the current thread.
+     */
+    const context get_context()
+    {
+        return current;
+    }
+
+    /**
+     * Records a span of the current operation which lasted from the given time until now.
+     * @param name Name of the phase.
+     * @param start_us Epoch microseconds at which the phase started.
+     */
+    void record_span(std::string_view name, const uint64_t start_us)
+    {
+        span_record rec;
+        rec.operation_id = current.operation_id;
+        rec.container_name = current.container_name;
+        rec.name = name;
+        rec.start_us = start_us;
+        rec.duration_us = get_epoch_microseconds() - start_us;
+        rec.thread_id = get_thread_id();
+        metrics::observe(metrics::PHASE_DURATION, name, rec.duration_us);
+        record(std::move(rec));
+    }
+
+    /**
+     * Adds a span to the ring buffer, overwriting the oldest span once the buffer is full.
+     * @param record The completed span.
+     */
+    void record(span_record &&record)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        if (ctx.spans.size() < MAX_SPANS)
+        {
+            ctx.spans.push_back(std::move(record));
+        }
+        else
+        {
+            ctx.spans[ctx.next] = std::move(record);
+        }
+        ctx.next = (ctx.next + 1) % MAX_SPANS;
+    }
+
+    /**
+     * Get the recorded spans in the order they were completed.
+     * @param spans Populated spans.
+     * @param operation_id Only the spans of this operation are returned if not empty.
+     * @param container_name Only the spans of this instance are returned if not empty.
+     */
+    void get_spans(std::vector<span_record> &spans, std::string_view operation_id, std::string_view container_name)
+    {
+        std::scoped_lock lock(ctx.mutex);
+
+        // Oldest span is at the next position once the buffer has wrapped around.
+        const size_t count = ctx.spans.size();
+        const size_t first = count < MAX_SPANS ? 0 : ctx.next;
+        for (size_t i = 0; i < count; i++)
+        {
+            const span_record &rec = ctx.spans[(first + i) % count];
+            if ((operation_id.empty() || rec.operation_id == operation_id) &&
+                (container_name.empty() || rec.container_name == container_name))
+                spans.push_back(rec);
+        }
+    }
+
+    uint64_t get_epoch_microseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Get the kernel thread id of the current thread, which matches the thread ids shown by the system tools.
+     * @return Thread id.
+     */
+    uint64_t get_thread_id()
+    {
+        thread_local const uint64_t thread_id = syscall(SYS_gettid);
+        return thread_id;
+    }
+
+} // namespace trace
@@ -0,0 +1,87 @@
+#ifndef _SA_TRACE_
+#define _SA_TRACE_
+
+#include "pchheader.hpp"
+
+/**
+ * Latency tracing of the instance operations. Phases of an operation are recorded as spans against the operation
+ * they run in and the latest spans are kept in a fixed size ring buffer.
+ */
+namespace trace
+{
+    constexpr size_t MAX_SPANS = 8192; // No. of latest spans kept in the ring buffer.
+
+    // A completed phase of an operation.
+    struct span_record
+    {
+        std::string operation_id;   // Operation the span belongs to. Empty if recorded outside an operation.
+        std::string container_name; // Instance the operation works on. Empty if not known.
+        std::string name;           // Name of the phase.
+        uint64_t start_us = 0;      // Epoch microseconds.
+        uint64_t duration_us = 0;
+        uint64_t thread_id = 0;     // Thread which ran the phase.
+    };
+
+    // Operation the current thread is working on.
+    struct context
+    {
+        std::string operation_id;
+        std::string container_name;
+    };
+
+    struct trace_ctx
+    {
+        std::mutex mutex;
+        std::vector<span_record> spans; // Ring buffer of the recorded spans.
+        size_t next = 0;                // Position of the next span in the ring buffer.
+    };
+
+    /**
+     * Makes the spans recorded by the current thread belong to the given operation while in scope.
+     */
+    class operation_scope
+    {
+    private:
+        context previous;
+
+    public:
+        operation_scope(const context &ctx);
+        ~operation_scope();
+        operation_scope(const operation_scope &) = delete;
+        operation_scope &operator=(const operation_scope &) = delete;
+    };
+
+    /**
+     * Records the time from its construction to its end as a span of the current operation. The span ends when it
+     * goes out of scope unless ended earlier.
+     */
+    class span
+    {
+    private:
+        std::string name;
+        uint64_t start_us;
+        bool is_ended = false;
+
+    public:
+        span(std::string_view name);
+        ~span();
+        void end();
+        span(const span &) = delete;
+        span &operator=(const span &) = delete;
+    };
+
+    const context get_context();
+
+    void record_span(std::string_view name, const uint64_t start_us);
+
+    void record(span_record &&record);
+
+    void get_spans(std::vector<span_record> &spans, std::string_view operation_id, std::string_view container_name);
+
+    uint64_t get_epoch_microseconds();
+
+    uint64_t get_thread_id();
+
+} // namespace trace
+
+#endif
@@ -1,9 +1,10 @@
 #include "../pchheader.hpp"
 #include "util.hpp"
+#include "../subprocess.hpp"
+#include "../trace.hpp"
 
 namespace util
 {
-    constexpr const char *RUN_SH = "chmod +x %s && sudo bash %s %s"; // Enable execute permission before running in case bash script does not have the permission.
 
     const std::string to_hex(const std::string_view bin)
     {
@@ -195,6 +196,170 @@ namespace util
             1, FTW_DEPTH | FTW_PHYS);
     }
 
+    /**
+     * Copies the contents of a regular file. Shares the extents with a reflink where the filesystem supports it and
+     * copies within the kernel otherwise.
+     * @param src_fd Source file descriptor.
+     * @param dest_fd Destination file descriptor.
+     * @param size Size of the source file.
+     * @return 0 on success and -1 on error.
+     */
+    int copy_file_contents(const int src_fd, const int dest_fd, const off_t size)
+    {
+        if (size == 0 || ioctl(dest_fd, FICLONE, src_fd) == 0)
+            return 0;
+
+        off_t remaining = size;
+        while (remaining > 0)
+        {
+            const ssize_t copied = copy_file_range(src_fd, NULL, dest_fd, NULL, remaining, 0);
+            if (copied > 0)
+            {
+                remaining -= copied;
+                continue;
+            }
+
+            if (copied == 0)
+                break;
+
+            // Older kernels do not support copy_file_range across filesystems.
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL)
+                return -1;
+
+            char buf[65536];
+            ssize_t read_bytes;
+            while ((read_bytes = read(src_fd, buf, sizeof(buf))) > 0)
+            {
+                if (write(dest_fd, buf, read_bytes) != read_bytes)
+                    return -1;
+            }
+            return read_bytes == -1 ? -1 : 0;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Copies the directory tree under the given source directory fd into the destination directory fd.
+     * @param src_dir_fd Source directory fd. Ownership is taken over and it's closed before returning.
+     * @param dest_dir_fd Destination directory fd.
+     * @param uid Owner user id of the copied entries.
+     * @param gid Owner group id of the copied entries.
+     * @param mode Permissions of the copied files and directories.
+     * @return 0 on success and -1 on error.
+     */
+    int copy_dir_tree_at(const int src_dir_fd, const int dest_dir_fd, const uid_t uid, const gid_t gid, const mode_t mode)
+    {
+        DIR *dir = fdopendir(src_dir_fd);
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error opening directory for copying.";
+            close(src_dir_fd);
+            return -1;
+        }
+
+        int ret = 0;
+        struct dirent *entry;
+        while (ret == 0 && (entry = readdir(dir)) != NULL)
+        {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            struct stat st;
+            if (fstatat(src_dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                LOG_ERROR << errno << ": Error in stat when copying " << name;
+                ret = -1;
+            }
+            else if (S_ISDIR(st.st_mode))
+            {
+                int src_fd = -1, dest_fd = -1;
+                if (mkdirat(dest_dir_fd, name, mode) == -1 ||
+                    (dest_fd = openat(dest_dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+                    fchown(dest_fd, uid, gid) == -1 || fchmod(dest_fd, mode) == -1 ||
+                    (src_fd = openat(src_dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+                {
+                    LOG_ERROR << errno << ": Error creating directory " << name << " when copying.";
+                    ret = -1;
+                }
+                else
+                {
+                    ret = copy_dir_tree_at(src_fd, dest_fd, uid, gid, mode);
+                }
+
+                if (dest_fd != -1)
+                    close(dest_fd);
+            }
+            else if (S_ISLNK(st.st_mode))
+            {
+                char target[PATH_MAX];
+                const ssize_t len = readlinkat(src_dir_fd, name, target, sizeof(target) - 1);
+                if (len != -1)
+                    target[len] = '\0';
+
+                if (len == -1 || symlinkat(target, dest_dir_fd, name) == -1 ||
+                    fchownat(dest_dir_fd, name, uid, gid, AT_SYMLINK_NOFOLLOW) == -1)
+                {
+                    LOG_ERROR << errno << ": Error copying symlink " << name;
+                    ret = -1;
+                }
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                const int src_fd = openat(src_dir_fd, name, O_RDONLY | O_CLOEXEC);
+                const int dest_fd = openat(dest_dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+                if (src_fd == -1 || dest_fd == -1 ||
+                    fchown(dest_fd, uid, gid) == -1 || fchmod(dest_fd, mode) == -1 ||
+                    copy_file_contents(src_fd, dest_fd, st.st_size) == -1)
+                {
+                    LOG_ERROR << errno << ": Error copying file " << name;
+                    ret = -1;
+                }
+
+                if (src_fd != -1)
+                    close(src_fd);
+                if (dest_fd != -1)
+                    close(dest_fd);
+            }
+        }
+
+        closedir(dir);
+        return ret;
+    }
+
+    /**
+     * Copies the contents of a directory into an existing directory in a single walk. Owner and permissions are set
+     * as each entry is created.
+     * @param src_dir Source directory.
+     * @param dest_dir Existing destination directory.
+     * @param uid Owner user id of the copied entries.
+     * @param gid Owner group id of the copied entries.
+     * @param mode Permissions of the copied files and directories.
+     * @return 0 on success and -1 on error.
+     */
+    int copy_dir_tree(std::string_view src_dir, std::string_view dest_dir, const uid_t uid, const gid_t gid, const mode_t mode)
+    {
+        const int src_fd = open(src_dir.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (src_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening source directory " << src_dir;
+            return -1;
+        }
+
+        const int dest_fd = open(dest_dir.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dest_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening destination directory " << dest_dir;
+            close(src_fd);
+            return -1;
+        }
+
+        const int ret = copy_dir_tree_at(src_fd, dest_fd, uid, gid, mode);
+        close(dest_fd);
+        return ret;
+    }
+
     // Kill a process with a signal and if specified, wait until it stops running.
     int kill_process(const pid_t pid, const bool wait, const int signal)
     {
@@ -414,50 +579,46 @@ namespace util
     }
 
     /**
-     * Executes the given bash file and populates final comma seperated output into a vector.
-     * @param file_name Name of the bash script.
-     * @param output_params Final output of the bash script.
-     * @param input_params Input parameters to the bash script (Optional).
+     * Runs a bash script as root and takes the last line of its output as comma separated output params.
+     * @param file_name Path of the script.
+     * @param output_params Output params of the script.
+     * @param input_params Params passed to the script.
+     * @param timeout_ms Max time the script may run before it is stopped.
+     * @return 0 on success and -1 on error.
      */
-    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params)
+    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params, const uint64_t timeout_ms)
     {
-        std::string params = "";
-        for (auto itr = input_params.begin(); itr != input_params.end(); itr++)
+        // Enable execute permission before running in case bash script does not have the permission.
+        struct stat st;
+        if (stat(file_name.data(), &st) == -1 || chmod(file_name.data(), st.st_mode | S_IXUSR | S_IXGRP | S_IXOTH) == -1)
         {
-            // Empty params are appended as '-' to preserve param order.
-            params.append(itr->empty() ? "-" : *itr);
-
-            if (std::next(itr) != input_params.end())
-                params.append(" ");
+            LOG_ERROR << errno << ": Error setting execute permission of " << file_name;
+            return -1;
         }
-        const int len = 23 + (file_name.length() * 2) + params.length();
-        char command[len];
-        sprintf(command, RUN_SH, file_name.data(), file_name.data(), params.empty() ? "\0" : params.data());
 
-        FILE *fpipe = popen(command, "r");
-        if (fpipe == NULL)
+        std::vector<std::string> args = {"sudo", "bash", std::string(file_name)};
+        for (const std::string_view param : input_params)
         {
-            LOG_ERROR << "Error on popen for command " << std::string(command);
-            return -1;
+            // Empty params are passed as '-' to preserve param order.
+            args.push_back(param.empty() ? "-" : std::string(param));
         }
 
-        char buffer[200];
-        std::string output;
-
-        // Only take the last cout string It contains the output of the execution.
-        while (fgets(buffer, sizeof(buffer), fpipe) != NULL)
+        const trace::span span(std::string("script:").append(file_name.substr(file_name.rfind('/') + 1)));
+        subprocess::result res;
+        if (subprocess::run(args, res, timeout_ms, true) == -1)
         {
-            output = buffer;
-            // Replace ending new line character at the end of the log line.
-            if (!output.empty())
-            {
-                if (output.back() == '\n')
-                    output.pop_back();
-                LOG_INFO << output;
-            }
+            LOG_ERROR << "Error running " << file_name;
+            return -1;
         }
 
-        pclose(fpipe);
+        // Only take the last output line. It contains the output of the execution.
+        std::string_view output = res.output;
+        while (!output.empty() && output.back() == '\n')
+            output.remove_suffix(1);
+        const size_t pos = output.rfind('\n');
+        if (pos != std::string_view::npos)
+            output.remove_prefix(pos + 1);
+
         util::split_string(output_params, output, ",");
         return 0;
     }
@@ -465,33 +626,38 @@ namespace util
     /**
      * Execute bash command and take the output.
      * @param command Command to execute.
-     * @param output Pointer to populate output.
-     * @param output_len Length of the output.
+     * @param output Output of the command.
+     * @param timeout_ms Max time the command may run before it is stopped.
      * @return 0 on success and -1 on error.
      */
-    int execute_bash_cmd(const char *command, char *output, const int output_len)
+    int execute_bash_cmd(std::string_view command, std::string &output, const uint64_t timeout_ms)
     {
-        FILE *fpipe = popen(command, "r");
-
-        if (!fpipe)
+        subprocess::result res;
+        if (subprocess::run({"/bin/bash", "-c", std::string(command)}, res, timeout_ms) == -1)
         {
-            LOG_ERROR << "Error on popen for command " << std::string(command);
+            LOG_ERROR << "Error running command " << command;
             return -1;
         }
 
-        if (!fgets(output, output_len, fpipe))
-        {
-            LOG_ERROR << "Error on fgets for command " << std::string(command);
-            return -1;
-        }
+        output = std::move(res.output);
+        return 0;
+    }
 
-        if (pclose(fpipe) < 0)
-        {
-            LOG_ERROR << "Error on pclose for command " << std::string(command);
+    /**
+     * Executes a program without a shell and collects its stdout followed by its stderr.
+     * @param args Program followed by its arguments. The program is looked up in PATH.
+     * @param output Output of the program.
+     * @param timeout_ms Max time the program may run before it is stopped.
+     * @return Exit code of the program. -1 if the program could not be run, timed out or was killed by a signal.
+     */
+    int execute_command(const std::vector<std::string> &args, std::string &output, const uint64_t timeout_ms)
+    {
+        subprocess::result res;
+        if (subprocess::run(args, res, timeout_ms) == -1)
             return -1;
-        }
 
-        return 0;
+        output.append(res.output).append(res.error);
+        return res.exit_code;
     }
 
 } // namespace util
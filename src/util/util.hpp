@@ -41,6 +41,12 @@ namespace util
 
     int remove_directory_recursively(std::string_view dir_path);
 
+    int copy_file_contents(const int src_fd, const int dest_fd, const off_t size);
+
+    int copy_dir_tree_at(const int src_dir_fd, const int dest_dir_fd, const uid_t uid, const gid_t gid, const mode_t mode);
+
+    int copy_dir_tree(std::string_view src_dir, std::string_view dest_dir, const uid_t uid, const gid_t gid, const mode_t mode);
+
     int kill_process(const pid_t pid, const bool wait, const int signal = SIGINT);
 
     void split_string(std::vector<std::string> &collection, std::string_view str, std::string_view delimeter);
@@ -61,9 +67,11 @@ namespace util
 
     int read_json_file(const int fd, jsoncons::ojson &d);
 
-    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params = {});
+    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params = {}, const uint64_t timeout_ms = 300000);
+
+    int execute_bash_cmd(std::string_view command, std::string &output, const uint64_t timeout_ms = 300000);
 
-    int execute_bash_cmd(const char *command, char *output, const int output_len);
+    int execute_command(const std::vector<std::string> &args, std::string &output, const uint64_t timeout_ms = 300000);
 
 } // namespace util
 